@@ -20,6 +20,8 @@ HEADERS	= \
 	conf.h \
 	detail.h \
 	event.h \
+	dlist.h \
+	time.h \
 	hash.h \
 	heap.h \
 	libradius.h \
@@ -36,6 +38,7 @@ HEADERS	= \
 	stats.h \
 	sysutmp.h \
 	token.h \
+	trie.h \
 	udpfromto.h \
 	base64.h \
 	map.h \
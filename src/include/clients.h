@@ -26,6 +26,8 @@
  */
 RCSIDH(clients_h, "$Id$")
 
+#include <freeradius-devel/md5.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -41,6 +43,7 @@ typedef struct radclient {
 	char const		*shortname;		//!< Client nickname.
 
 	char const		*secret;		//!< Secret PSK.
+	fr_hmac_md5_key_t	*hmac_key;		//!< Message-Authenticator key state for the secret.
 
 	bool			message_authenticator;	//!< Require RADIUS message authenticator in requests.
 
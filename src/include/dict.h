@@ -96,6 +96,9 @@ struct dict_attr {
 	fr_dict_attr_t const	**children;			//!< Children of this attribute.
 	fr_dict_attr_t const	*next;				//!< Next child in bin.
 
+	fr_dict_attr_t const	**child_index;			//!< Children indexed directly by attribute number.
+	unsigned int		child_index_len;		//!< Attribute numbers below this are in child_index.
+
 	unsigned int		depth;				//!< Depth of nesting for this attribute.
 
 	fr_dict_attr_flags_t	flags;				//!< Flags.
@@ -186,6 +189,10 @@ int			fr_dict_read(fr_dict_t *dict, char const *dir, char const *filename);
 int			fr_dict_parse_str(fr_dict_t *dict, char *buf,
 					  fr_dict_attr_t const *parent, unsigned int vendor);
 
+int			fr_dict_snapshot_write(fr_dict_t *dict, char const *dir, char const *fn);
+
+bool			fr_dict_snapshot_loaded(fr_dict_t const *dict);
+
 fr_dict_attr_t const	*fr_dict_root(fr_dict_t const *dict);
 
 /*
@@ -219,6 +226,8 @@ fr_dict_attr_t const	*fr_dict_attr_known(fr_dict_t *dict, fr_dict_attr_t const *
  */
 void			fr_dict_print(fr_dict_attr_t const *da, int depth);
 
+void			fr_dict_enum_print(fr_dict_t *dict);
+
 fr_dict_attr_t const	*fr_dict_parent_common(fr_dict_attr_t const *a, fr_dict_attr_t const *b, bool is_ancestor);
 
 int			fr_dict_oid_component(unsigned int *out, char const **oid);
@@ -27,8 +27,29 @@
 RCSIDH(event_h, "$Id$")
 
 #include <freeradius-devel/missing.h>
+#include <freeradius-devel/time.h>
 #include <stdbool.h>
-#include <sys/event.h>
+
+/*
+ *	On Linux the event loop uses epoll and eventfd directly, and
+ *	doesn't need libkqueue.  Build with -DWITH_LIBKQUEUE_ONLY to
+ *	go through libkqueue instead, e.g. to compare wakeup latency.
+ */
+#if defined(__linux__) && !defined(WITH_LIBKQUEUE_ONLY)
+#  define FR_EVENT_EPOLL
+
+/*
+ *	FD handlers are passed kqueue's flags, whichever backend is in use.
+ */
+#  ifndef EV_EOF
+#    define EV_EOF	(0x8000)
+#  endif
+#  ifndef EV_ERROR
+#    define EV_ERROR	(0x4000)
+#  endif
+#else
+#  include <sys/event.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,7 +76,7 @@ typedef	void (*fr_event_callback_t)(fr_event_list_t *el, struct timeval *now, vo
 
 /** Called after each event loop cycle
  *
- * Called before calling kqueue to put the thread in a sleeping state.
+ * Called before waiting for events, which puts the thread in a sleeping state.
  *
  * @param[in] now	The current time.
  * @param[in] uctx	User ctx passed to #fr_event_list_alloc.
@@ -81,18 +102,18 @@ typedef void (*fr_event_fd_handler_t)(fr_event_list_t *el, int sock, int flags,
  */
 typedef void (*fr_event_fd_error_handler_t)(fr_event_list_t *el, int sock, int flags, int fd_errno, void *uctx);
 
-/** Called when a user kevent occurs
+/** Called when a user event is triggered
  *
- * @param[in] kq	that received the user kevent.
- * @param[in] kev	The kevent.
+ * @param[in] el	Event list the user event was inserted into.
  * @param[in] uctx	User ctx passed to #fr_event_user_insert.
  */
-typedef void (*fr_event_user_handler_t)(int kq, struct kevent const *kev, void *uctx);
+typedef void (*fr_event_user_handler_t)(fr_event_list_t *el, void *uctx);
 
 int		fr_event_list_num_fds(fr_event_list_t *el);
 int		fr_event_list_num_elements(fr_event_list_t *el);
 int		fr_event_list_kq(fr_event_list_t *el);
 int		fr_event_list_time(struct timeval *when, fr_event_list_t *el);
+fr_time_t	fr_event_list_now(fr_event_list_t *el) CC_HINT(nonnull);
 
 int		fr_event_fd_delete(fr_event_list_t *el, int fd);
 int		fr_event_fd_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
@@ -103,11 +124,14 @@ int		fr_event_fd_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 
 int		fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev,
 				      struct timeval *when, fr_event_callback_t callback, void const *uctx);
+int		fr_event_timer_at(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev,
+				  fr_time_t when, fr_event_callback_t callback, void const *uctx);
 int		fr_event_timer_delete(fr_event_list_t *el, fr_event_timer_t const **ev);
 int		fr_event_timer_run(fr_event_list_t *el, struct timeval *when);
 
 uintptr_t      	fr_event_user_insert(fr_event_list_t *el, fr_event_user_handler_t user, void *uctx) CC_HINT(nonnull(1,2));
 int		fr_event_user_delete(fr_event_list_t *el, fr_event_user_handler_t user, void *uctx) CC_HINT(nonnull(1,2));
+int		fr_event_user_trigger(int kq, uintptr_t ident);
 
 int		fr_event_pre_insert(fr_event_list_t *el, fr_event_status_t callback, void *uctx) CC_HINT(nonnull(1,2));
 int		fr_event_pre_delete(fr_event_list_t *el, fr_event_status_t callback, void *uctx) CC_HINT(nonnull(1,2));
@@ -116,6 +116,16 @@ typedef struct unlang_t {
 	int			actions[RLM_MODULE_NUMCODES];	//!< Priorities for the various return codes.
 } unlang_t;
 
+/** A 'case' statement with a static value
+ *
+ * Used to index the cases of a 'switch' by value.
+ */
+typedef struct {
+	fr_value_box_t const	*value;		//!< The value of the 'case'.
+	unlang_t		*instruction;	//!< The 'case' to execute.
+	int			num;		//!< Position of the 'case' in the 'switch'.
+} unlang_switch_case_t;
+
 /** Generic representation of a grouping
  *
  * Can represent IF statements, maps, update sections etc...
@@ -132,6 +142,14 @@ typedef struct {
 	vp_map_t		*map;		//!< #UNLANG_TYPE_UPDATE, #UNLANG_TYPE_MAP.
 	vp_tmpl_t		*vpt;		//!< #UNLANG_TYPE_SWITCH, #UNLANG_TYPE_MAP.
 	fr_cond_t		*cond;		//!< #UNLANG_TYPE_IF, #UNLANG_TYPE_ELSIF.
+	unlang_t		*chain_end;	//!< #UNLANG_TYPE_IF, #UNLANG_TYPE_ELSIF.  First instruction
+						//!< after the if/elsif/else chain, resolved at compile time.
+
+	fr_hash_table_t		*cases;		//!< #UNLANG_TYPE_SWITCH.  #unlang_switch_case_t indexed
+						//!< by value.  Only built when switching over an attribute.
+	unlang_t		*default_case;	//!< #UNLANG_TYPE_SWITCH.  'case' without a value.
+	bool			dynamic_cases;	//!< #UNLANG_TYPE_SWITCH.  Has cases which must be
+						//!< evaluated at runtime.
 
 	map_proc_inst_t		*proc_inst;	//!< Instantiation data for #UNLANG_TYPE_MAP.
 } unlang_group_t;
@@ -79,13 +79,33 @@ USES_APPLE_DEPRECATED_API
 #endif
 
 /* hmac.c */
+/** HMAC-MD5 key, with the padded key blocks already absorbed
+ *
+ * Lets callers which use the same key for many messages skip the
+ * key setup, which is two MD5 block transforms per HMAC.
+ */
+typedef struct {
+	FR_MD5_CTX	inner;		//!< MD5 state after (key XOR ipad).
+	FR_MD5_CTX	outer;		//!< MD5 state after (key XOR opad).
+} fr_hmac_md5_key_t;
+
 void	fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
 		    uint8_t const *key, size_t key_len)
 	CC_BOUNDED(__minbytes__, 1, MD5_DIGEST_LENGTH);
 
+void	fr_hmac_md5_key_init(fr_hmac_md5_key_t *hkey, uint8_t const *key, size_t key_len);
+
+void	fr_hmac_md5_keyed(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
+			  fr_hmac_md5_key_t const *hkey)
+	CC_BOUNDED(__minbytes__, 1, MD5_DIGEST_LENGTH);
+
 /* md5.c */
+#define FR_MD5_LANES	8			//!< Buffers hashed together by fr_md5_calc_multi().
+
 void	fr_md5_calc(uint8_t *out, uint8_t const *in, size_t inlen);
 
+void	fr_md5_calc_multi(uint8_t *out[], uint8_t const *in[], size_t const inlen[], size_t num);
+
 #ifdef __cplusplus
 }
 #endif
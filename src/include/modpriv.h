@@ -67,6 +67,10 @@ typedef struct {
 
 	void				*data;		//!< Thread specific instance data.
 
+	void				*inst_data;	//!< Instance data passed to the module's methods.
+							//!< A private copy for #RLM_TYPE_THREAD_INSTANCE
+							//!< modules, else the shared instance data.
+
 	uint64_t			total_calls;	//! total number of times we've been called
 	uint64_t			active_callers; //! number of active callers.  i.e. number of current yields
 } module_thread_instance_t;
@@ -79,6 +79,11 @@ extern const section_type_value_t section_type_value[];
 						//!< Server will protect calls
 						//!< with mutex.
 #define RLM_TYPE_RESUMABLE     	(1 << 2) 	//!< does yield / resume
+#define RLM_TYPE_THREAD_INSTANCE	(1 << 3)	//!< Module is not threadsafe, but each worker
+						//!< thread can have its own copy of the
+						//!< instance data.  Server will instantiate
+						//!< the module once per thread instead of
+						//!< protecting calls with a mutex.
 
 /** Module section callback
  *
@@ -287,7 +292,7 @@ typedef void (*fr_unlang_action_t)(REQUEST *request, void *instance, void *threa
 				   fr_state_action_t action);
 
 int		unlang_event_timeout_add(REQUEST *request, fr_unlang_timeout_callback_t callback,
-					 void const *ctx, struct timeval *timeout);
+					 void const *ctx, fr_time_t when);
 
 int 		unlang_event_fd_add(REQUEST *request,
 				    fr_unlang_fd_callback_t read,
@@ -119,6 +119,8 @@ typedef struct main_config {
 
 	bool		daemonize;			//!< Should the server daemonize on startup.
 	bool		spawn_workers;			//!< Should the server spawn threads.
+	uint32_t	num_networks;			//!< Number of network threads for the new async listeners.
+	uint32_t	num_workers;			//!< Number of worker threads for the new async listeners.
 	char const      *pid_file;			//!< Path to write out PID file.
 
 #ifdef WITH_PROXY
@@ -417,6 +419,8 @@ ssize_t		rad_filename_unescape(char *out, size_t outlen, char const *in, size_t
 void		talloc_const_free(void const *ptr);
 char		*rad_ajoin(TALLOC_CTX *ctx, char const **argv, int argc, char c);
 REQUEST		*request_alloc(TALLOC_CTX *ctx);
+REQUEST		*request_alloc_pooled(TALLOC_CTX *ctx, size_t pool_size);
+void		request_reset(REQUEST *request);
 REQUEST		*request_alloc_fake(REQUEST *oldreq);
 REQUEST		*request_alloc_proxy(REQUEST *request);
 int		request_data_add(REQUEST *request, void const *unique_ptr, int unique_int, void *opaque,
@@ -30,6 +30,11 @@ RCSIDH(state_h, "$Id$")
 extern "C" {
 #endif
 
+/*
+ *	Number of shards the state tree is split into.  Must be a power of 2.
+ */
+#define FR_STATE_SHARDS (32)
+
 typedef struct fr_state_tree_t fr_state_tree_t;
 extern fr_state_tree_t *global_state;
 
@@ -47,6 +52,10 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state);
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state);
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state);
 
+uint32_t fr_state_shard_entries_tracked(fr_state_tree_t *state, unsigned int shard);
+uint64_t fr_state_shard_entries_timeout(fr_state_tree_t *state, unsigned int shard);
+uint64_t fr_state_shard_contended(fr_state_tree_t *state, unsigned int shard);
+
 #ifdef __cplusplus
 }
 #endif
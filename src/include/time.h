@@ -0,0 +1,64 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_TIME_H
+#define _FR_TIME_H
+/**
+ * $Id$
+ *
+ * @file include/time.h
+ * @brief Platform independent monotonic clock
+ *
+ * @copyright 2016 Alan DeKok <aland@freeradius.org>
+ */
+RCSIDH(time_h, "$Id$")
+
+/*
+ *	For sys/time.h and time.h
+ */
+#include <freeradius-devel/missing.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  A typedef for "server local" time.  This is the time in
+ *  nanoseconds since the application started.
+ */
+typedef uint64_t fr_time_t;
+
+#define NANOSEC (1000000000)
+#define USEC	(1000000)
+
+int fr_time_start(void);
+fr_time_t fr_time(void);
+void fr_time_to_timeval(struct timeval *tv, fr_time_t when) CC_HINT(nonnull);
+
+/** Convert a struct timeval delay into a fr_time_t delta
+ *
+ */
+static inline fr_time_t fr_time_delta_from_timeval(struct timeval const *tv)
+{
+	return ((fr_time_t) tv->tv_sec * NANOSEC) + ((fr_time_t) tv->tv_usec * 1000);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FR_TIME_H */
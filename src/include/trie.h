@@ -0,0 +1,53 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_TRIE_H
+#define _FR_TRIE_H
+/**
+ * $Id$
+ *
+ * @file include/trie.h
+ * @brief Path-compressed binary tries, for longest prefix matching.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(trie_h, "$Id$")
+
+#include <stdint.h>
+#include <talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FR_TRIE_MAX_KEY_BITS	(128)
+
+typedef struct fr_trie_t fr_trie_t;
+
+fr_trie_t	*fr_trie_alloc(TALLOC_CTX *ctx, uint32_t max_bits);
+
+int		fr_trie_insert(fr_trie_t *ft, void const *key, uint32_t bits, void *data);
+void		*fr_trie_remove(fr_trie_t *ft, void const *key, uint32_t bits);
+
+void		*fr_trie_find(fr_trie_t *ft, void const *key, uint32_t bits);
+void		*fr_trie_lookup(fr_trie_t *ft, void const *key, uint32_t bits);
+
+uint32_t	fr_trie_num_elements(fr_trie_t *ft);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FR_TRIE_H */
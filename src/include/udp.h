@@ -39,6 +39,32 @@ extern "C" {
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+/*
+ *	recvmmsg() and sendmmsg() aren't POSIX.  The C libraries
+ *	which provide them also define MSG_WAITFORONE.
+ */
+#ifdef MSG_WAITFORONE
+#  define WITH_UDP_BATCH (1)
+#endif
+
+/** One datagram in a batched read or write
+ *
+ */
+typedef struct udp_batch_entry_t {
+	uint8_t			*data;		//!< Packet data.
+	size_t			data_len;	//!< On read, the size of the buffer, which is then
+						//!< updated to the size of the packet.
+						//!< On write, the size of the packet.
+
+	fr_ipaddr_t		src_ipaddr;	//!< Source address of the packet.
+	uint16_t		src_port;	//!< Source port of the packet.
+	fr_ipaddr_t		dst_ipaddr;	//!< Destination address of the packet.
+	uint16_t		dst_port;	//!< Destination port of the packet.
+	int			if_index;	//!< Interface the packet was received on, or sent from.
+
+	struct timeval		when;		//!< When the packet was received.
+} udp_batch_entry_t;
+
 ssize_t udp_send(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *src_ipaddr, uint16_t src_port, int if_index,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t dst_port);
@@ -52,6 +78,10 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
 		 struct timeval *when);
 
+int udp_recv_batch(int sockfd, udp_batch_entry_t *entries, int num);
+
+int udp_send_batch(int sockfd, udp_batch_entry_t *entries, int num);
+
 #ifdef __cplusplus
 }
 #endif
@@ -99,6 +99,11 @@ struct value_box {
 
 	bool				tainted;		//!< i.e. did it come from an untrusted source
 
+	bool				borrowed;		//!< datum.ptr points into a buffer owned by something
+								//!< else, usually the packet the value was decoded from.
+								//!< It's never freed via the box, and must be copied
+								//!< before it's modified, or moved to another ctx.
+
 	fr_value_box_t			*next;			//!< Next in a series of value_box.
 };
 
@@ -226,6 +231,7 @@ static inline void fr_value_box_init(fr_value_box_t *box, fr_type_t type,
 	box->type = type;
 	box->enumv = enumv;
 	box->tainted = tainted;
+	box->borrowed = false;
 	box->next = NULL;
 
 	memset(&box->datum, 0, sizeof(box->datum));
@@ -475,6 +481,9 @@ int		fr_value_box_memdup_shallow(fr_value_box_t *dst, fr_dict_attr_t const *enum
 					    uint8_t *src, size_t len, bool tainted);
 int		fr_value_box_memdup_buffer_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t const *enumv,
 						   uint8_t *src, bool tainted);
+void		fr_value_box_memborrow(fr_value_box_t *dst, fr_dict_attr_t const *enumv,
+				       uint8_t const *src, size_t len, bool tainted);
+int		fr_value_box_unborrow(TALLOC_CTX *ctx, fr_value_box_t *box);
 
 /*
  *	Parsing
@@ -49,6 +49,20 @@ typedef void (*fr_app_process_set_t)(void const *instance, REQUEST *request);
  */
 typedef void (*fr_app_event_list_set_t)(void const *instance, fr_event_list_t *el);
 
+/** Called by the application to create a copy of an I/O instance for another network thread
+ *
+ * The copy is opened separately, and MUST be able to share the same
+ * address as the original (e.g. via SO_REUSEPORT).  Only called
+ * before the original instance has been opened.
+ *
+ * @param[in] ctx	to allocate the copy in.
+ * @param[in] instance	to copy.
+ * @return
+ *	- NULL if the instance cannot be copied.
+ *	- the new instance.
+ */
+typedef void *(*fr_app_io_clone_t)(TALLOC_CTX *ctx, void *instance);
+
 /** Describes a new application (protocol)
  *
  */
@@ -100,6 +114,8 @@ typedef struct fr_app_io_t {
 
 	fr_io_open_t			open;		//!< Open a new socket for listening, or accept/connect a new
 							//!< connection.
+	fr_app_io_clone_t		clone;		//!< Copy the instance, so that each network thread
+							//!< can have its own socket.  May be NULL.
 	fr_io_get_fd_t			fd;		//!< Return the file descriptor from the instance.
 	fr_io_data_read_t		read;		//!< Read from a socket to a data buffer
 	fr_io_data_write_t		write;		//!< Write from a data buffer to a socket
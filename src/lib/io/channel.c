@@ -670,13 +670,12 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
  * the channel is taken from the kevent.
  *
  * @param[in] ch	The channel to service.
- * @param[in] c		The control plane on which we received the kev.
- * @param[in] kev	The kevent data, should get passed to the control plane.
+ * @param[in] c		The control plane on which we received the user event.
  * @return
  *	- <0 on error
  *	- 0 on success
  */
-int fr_channel_service_kevent(fr_channel_t *ch, fr_control_t *c, UNUSED struct kevent const *kev)
+int fr_channel_service_kevent(fr_channel_t *ch, fr_control_t *c)
 {
 	(void) talloc_get_type_abort(ch, fr_channel_t);
 
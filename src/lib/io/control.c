@@ -27,9 +27,9 @@ RCSID("$Id$")
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/io/ring_buffer.h>
 #include <freeradius-devel/fr_log.h>
+#include <freeradius-devel/event.h>
 
 #include <string.h>
-#include <sys/event.h>
 
 #define FR_CONTROL_MAX_TYPES	(32)
 
@@ -77,7 +77,7 @@ struct fr_control_t {
 
 	fr_atomic_queue_t	*aq;			//!< destination AQ
 
-	uintptr_t		ident;			//!< our ident for kqueue.
+	uintptr_t		ident;			//!< our ident for user events.
 
 	fr_control_ctx_t 	type[FR_CONTROL_MAX_TYPES];	//!< callbacks
 };
@@ -88,7 +88,7 @@ struct fr_control_t {
  * @param[in] ctx the talloc context
  * @param[in] kq the KQ descriptor where we will be sending signals
  * @param[in] aq the atomic queue where we will be pushing message data
- * @param[in] ident the identifier to use for EVFILT_USER signals.
+ * @param[in] ident the user event to trigger, from #fr_event_user_insert.
  * @return
  *	- NULL on error
  *	- fr_control_t on success
@@ -96,7 +96,6 @@ struct fr_control_t {
 fr_control_t *fr_control_create(TALLOC_CTX *ctx, int kq, fr_atomic_queue_t *aq, uintptr_t ident)
 {
 	fr_control_t *c;
-	struct kevent kev;
 
 	c = talloc_zero(ctx, fr_control_t);
 	if (!c) {
@@ -109,24 +108,18 @@ fr_control_t *fr_control_create(TALLOC_CTX *ctx, int kq, fr_atomic_queue_t *aq,
 	c->ident = ident;
 
 	/*
-	 *	Tell the KQ to listen on our events.
+	 *	The user event is registered by the event list of
+	 *	the receiving thread.  All we do is trigger it.
 	 *
 	 *	We COULD overload the "ident" field with our channel
 	 *	number, followed by the actual signal we're sending.
 	 *	This would work.  The downside is that it would
-	 *	require N*M EVFILT_USER kevents to be registered,
-	 *	which is bad
+	 *	require N*M user events to be registered, which is
+	 *	bad
 	 *
 	 *	The implementation here is perhaps a bit less optimal,
 	 *	but it's clean, and it works.
 	 */
-	EV_SET(&kev, ident, EVFILT_USER, EV_ADD | EV_CLEAR, NOTE_FFNOP, 0, NULL);
-	if (kevent(c->kq, &kev, 1, NULL, 0, NULL) < 0) {
-		talloc_free(c);
-		fr_strerror_printf("Failed opening KQ for control socket: %s", fr_syserror(errno));
-		return NULL;
-	}
-
 	return c;
 }
 
@@ -190,16 +183,8 @@ int fr_control_gc(UNUSED fr_control_t *c, fr_ring_buffer_t *rb)
  */
 void fr_control_free(fr_control_t *c)
 {
-	struct kevent kev;
-
 	(void) talloc_get_type_abort(c, fr_control_t);
 
-	EV_SET(&kev, c->ident, EVFILT_USER, EV_DELETE, NOTE_FFNOP, 0, NULL);
-	if (kevent(c->kq, &kev, 1, NULL, 0, NULL) < 0) {
-		talloc_free(c);
-		fr_strerror_printf("Failed opening KQ for control socket: %s", fr_syserror(errno));
-	}
-
 	talloc_free(c);
 }
 
@@ -308,19 +293,11 @@ int fr_control_message_push(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
  */
 int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id, void *data, size_t data_size)
 {
-	int rcode;
-	struct kevent kev;
-
 	(void) talloc_get_type_abort(c, fr_control_t);
 
 	if (fr_control_message_push(c, rb, id, data, data_size) < 0) return -1;
 
-	EV_SET(&kev, c->ident, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
-	rcode = kevent(c->kq, &kev, 1, NULL, 0, NULL);
-	if (rcode >= 0) return rcode;
-
-	fr_strerror_printf("Failed sending user event to kqueue (%i): %s", c->kq, fr_syserror(errno));
-	return rcode;
+	return fr_event_user_trigger(c->kq, c->ident);
 }
 
 
@@ -30,7 +30,6 @@ RCSIDH(control_h, "$Id$")
 #include <freeradius-devel/io/time.h>
 
 #include <sys/types.h>
-#include <sys/event.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,6 +33,9 @@ struct fr_listen {
 	CONF_SECTION		*server_cs;		//!< CONF_SECTION of the server
 
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
+	size_t			read_size;		//!< How much buffer to give each read, if more than
+							///< default_message_size.  Lets transports read
+							///< several packets at once, straight into the buffer.
 	size_t			num_messages;		//!< for the message ring buffer
 };
 
@@ -53,6 +56,9 @@ struct fr_async_t {
 	void			*packet_ctx;
 	fr_listen_t const	*listen;	//!< How we received this request,
 						//!< and how we'll send the reply.
+
+	size_t			pool_size;	//!< Size of the talloc pool the REQUEST was allocated with.
+	CONF_SECTION const	*pool_server_cs; //!< Virtual server whose statistics sized the pool.
 };
 
 /** Information to track src/dst ip/port
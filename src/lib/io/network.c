@@ -60,8 +60,20 @@ typedef struct fr_network_socket_t {
 	fr_message_set_t	*ms;			//!< message buffers for this socket.
 	fr_channel_data_t	*cd;			//!< cached in case of allocation & read error
 	size_t			leftover;		//!< leftover data from a previous read
+	size_t			read_size;		//!< how much buffer to reserve for each read
+
+	bool			flush_pending;		//!< we've written data, and need to call flush()
+	fr_dlist_t		flush_entry;		//!< entry in the list of sockets to flush
 } fr_network_socket_t;
 
+/*
+ *	Read at most this many packets from a socket before going back
+ *	to the event loop.  This MUST be larger than the batch size of
+ *	any transport which batches reads internally, so that the
+ *	transport can tell us (by returning 0) that its batch is empty.
+ */
+#define MAX_READS_PER_EVENT (128)
+
 /*
  *	@todo - have an array of workers, so we can index the workers in O(1) time.
  *	remove the heap of "workers ordered by CPU time"
@@ -97,6 +109,7 @@ struct fr_network_t {
 	uint64_t		num_replies;		//!< number of replies we received
 
 	rbtree_t		*sockets;		//!< list of sockets we're managing
+	fr_dlist_t		flush;			//!< sockets which need to be flushed after writing
 
 #ifdef HAVE_PTHREAD_H
 	pthread_mutex_t		mutex;			//!< for sending us control messages
@@ -284,6 +297,7 @@ static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 	 *	reply from this channel.
 	 */
 	worker->cpu_time += worker->predicted;
+	nr->num_requests++;
 
 	/*
 	 *	Insert the worker back into the heap of workers.
@@ -314,15 +328,16 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 	ssize_t data_size;
 	fr_channel_data_t *cd, *next;
 	fr_time_t *recv_time;
+	int num_reads = 0;
 
 	rad_assert(s->listen->app_io->fd(s->listen->app_io_instance) == sockfd);
 
 	fr_log(nr->log, L_DBG, "network read");
 
 	if (!s->cd) {
-		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->read_size);
 		if (!cd) {
-			fr_log(nr->log, L_ERR, "Failed allocating message size %zd! - Closing socket", s->listen->default_message_size);
+			fr_log(nr->log, L_ERR, "Failed allocating message size %zd! - Closing socket", s->read_size);
 			talloc_free(s);
 			return;
 		}
@@ -396,10 +411,16 @@ next_message:
 		 *	There are leftover bytes in the buffer, feed
 		 *	them to the next incantation of the module.
 		 */
-		next = (fr_channel_data_t *) fr_message_alloc_reserve(s->ms, &cd->m, data_size, s->listen->default_message_size);
+		next = (fr_channel_data_t *) fr_message_alloc_reserve(s->ms, &cd->m, data_size, s->read_size);
 		if (!next) {
 			fr_log(nr->log, L_ERR, "Failed reserving partial packet.");
 			// @todo - probably close the socket...
+
+			/*
+			 *	Tell the next read that the leftover
+			 *	data is gone.
+			 */
+			s->leftover = 0;
 		}
 	}
 
@@ -415,6 +436,22 @@ next_message:
 		cd = next;
 		goto next_message;
 	}
+
+	/*
+	 *	Drain more packets from the socket.  This avoids going
+	 *	back through the event loop for every packet, and lets
+	 *	transports which read many packets at once (e.g. via
+	 *	recvmmsg()) hand them all to us in one burst.
+	 */
+	if (++num_reads >= MAX_READS_PER_EVENT) return;
+
+	cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->read_size);
+	if (!cd) {
+		fr_log(nr->log, L_ERR, "Failed allocating message size %zd! - Closing socket", s->read_size);
+		talloc_free(s);
+		return;
+	}
+	goto next_message;
 }
 
 #if 0
@@ -461,6 +498,8 @@ static int _network_socket_free(fr_network_socket_t *s)
 
 	rbtree_deletebydata(nr->sockets, s);
 
+	if (s->flush_pending) fr_dlist_remove(&s->flush_entry);
+
 	if (s->listen->app_io->close) {
 		s->listen->app_io->close(s->listen->app_io_instance);
 	} else {
@@ -482,6 +521,7 @@ static void fr_network_socket_callback(void *ctx, void const *data, size_t data_
 	int			fd;
 	fr_network_t		*nr = ctx;
 	fr_network_socket_t	*s;
+	size_t			ring_size;
 	fr_app_io_t const	*app_io;
 
 	rad_assert(data_size == sizeof(*s));
@@ -492,14 +532,20 @@ static void fr_network_socket_callback(void *ctx, void const *data, size_t data_
 	rad_assert(s != NULL);
 	memcpy(s, data, sizeof(*s));
 
+	s->flush_pending = false;
+	s->read_size = s->listen->default_message_size;
+	if (s->listen->read_size > s->read_size) s->read_size = s->listen->read_size;
 	talloc_set_destructor(s, _network_socket_free);
 
 	/*
 	 *	Allocate the ring buffer for messages and packets.
+	 *	Each read has to fit in half of it.
 	 */
+	ring_size = s->listen->default_message_size * s->listen->num_messages;
+	if (ring_size < (s->read_size * 4)) ring_size = s->read_size * 4;
+
 	s->ms = fr_message_set_create(s, s->listen->num_messages,
-				      sizeof(fr_channel_data_t),
-				      s->listen->default_message_size * s->listen->num_messages);
+				      sizeof(fr_channel_data_t), ring_size);
 	if (!s->ms) {
 		fr_log(nr->log, L_ERR, "Failed creating message buffers for network IO.  Closing socket.");
 		talloc_free(s);
@@ -562,11 +608,10 @@ static void fr_network_worker_callback(void *ctx, void const *data, size_t data_
 
 /** Service a control-plane event.
  *
- * @param[in] kq the kq to service
- * @param[in] kev the kevent to service
- * @param[in] ctx the fr_worker_t
+ * @param[in] el the event list
+ * @param[in] ctx the fr_network_t
  */
-static void fr_network_evfilt_user(UNUSED int kq, UNUSED struct kevent const *kev, void *ctx)
+static void fr_network_evfilt_user(UNUSED fr_event_list_t *el, void *ctx)
 {
 	fr_time_t now;
 	fr_network_t *nr = talloc_get_type_abort(ctx, fr_network_t);
@@ -660,6 +705,7 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 		fr_strerror_printf("Failed creating tree for sockets: %s", fr_strerror());
 		goto fail2;
 	}
+	FR_DLIST_INIT(nr->flush);
 
 	nr->replies = fr_heap_create(reply_cmp, offsetof(fr_channel_data_t, channel.heap_id));
 	if (!nr->replies) {
@@ -755,10 +801,12 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 {
 	fr_channel_data_t *cd;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
+	fr_dlist_t *entry;
 
 	while ((cd = fr_heap_pop(nr->replies)) != NULL) {
 		ssize_t rcode;
 		fr_listen_t const *listen;
+		fr_network_socket_t my_socket, *s;
 
 		listen = cd->listen;
 
@@ -777,8 +825,6 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 		rcode = listen->app_io->write(listen->app_io_instance, cd->packet_ctx,
 					      cd->reply.request_time, cd->m.data, cd->m.data_size);
 		if (rcode < 0) {
-			fr_network_socket_t my_socket, *s;
-
 			/*
 			 *	Tell the socket that there was an error.
 			 *
@@ -797,12 +843,41 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 			// call write function again at some later date.
 		}
 
+		/*
+		 *	The transport may have queued the data, e.g. to
+		 *	send many replies with one system call.  Remember
+		 *	to flush it once we've written all of the replies.
+		 */
+		if (listen->app_io->flush) {
+			my_socket.listen = listen;
+			s = rbtree_finddata(nr->sockets, &my_socket);
+			if (s && !s->flush_pending) {
+				s->flush_pending = true;
+				fr_dlist_insert_tail(&nr->flush, &s->flush_entry);
+			}
+		}
+
 		fr_log(nr->log, L_DBG, "Sending reply to socket %d",
 		       cd->listen->app_io->fd(cd->listen->app_io_instance));
 		fr_message_done(&cd->m);
 	}
-}
 
+	/*
+	 *	Flush the sockets which have queued data.
+	 */
+	while ((entry = FR_DLIST_FIRST(nr->flush)) != NULL) {
+		fr_network_socket_t *s;
+
+		s = fr_ptr_to_type(fr_network_socket_t, flush_entry, entry);
+		fr_dlist_remove(&s->flush_entry);
+		s->flush_pending = false;
+
+		if (s->listen->app_io->flush(s->listen->app_io_instance) < 0) {
+			if (s->listen->app_io->error) s->listen->app_io->error(s->listen->app_io_instance);
+			talloc_free(s);
+		}
+	}
+}
 
 /** The main network worker function.
  *
@@ -888,3 +963,23 @@ int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker)
 
 	return rcode;
 }
+
+/** Print debug information about the network structure
+ *
+ *  This function may be called from another thread, so the numbers
+ *  it prints are approximate.
+ *
+ * @param[in] nr the network
+ * @param[in] fp the file where the debug output is printed.
+ */
+void fr_network_debug(fr_network_t *nr, FILE *fp)
+{
+	(void) talloc_get_type_abort(nr, fr_network_t);
+
+	fprintf(fp, "\tkq = %d\n", nr->kq);
+	fprintf(fp, "\tnum_sockets = %u\n", rbtree_num_elements(nr->sockets));
+	fprintf(fp, "\tnum_workers = %zd\n", fr_heap_num_elements(nr->workers));
+	fprintf(fp, "\tnum_requests = %" PRIu64 "\n", nr->num_requests);
+	fprintf(fp, "\tnum_replies = %" PRIu64 "\n", nr->num_replies);
+	fprintf(fp, "\tpending replies = %zd\n", fr_heap_num_elements(nr->replies));
+}
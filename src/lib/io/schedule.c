@@ -97,6 +97,7 @@ typedef struct fr_schedule_network_t {
 	pthread_t	pthread_id;		//!< the thread of this network
 
 	int		id;			//!< a unique ID
+	int		num_sockets;		//!< how many sockets we've given to this network
 	fr_schedule_t	*sc;			//!< the scheduler we are running under
 
 	fr_schedule_child_status_t status;	//!< status of the worker
@@ -117,6 +118,7 @@ struct fr_schedule_t {
 	int		max_networks;		//!< number of network threads
 	int		max_workers;		//!< max number of worker threads
 
+	int		num_networks;		//!< number of network threads
 	int		num_workers;		//!< number of worker threads
 	int		num_workers_exited;	//!< number of exited workers
 
@@ -130,11 +132,12 @@ struct fr_schedule_t {
 	uint32_t	worker_flags;		//!< for debugging the worker
 
 	fr_dlist_t	workers;		//!< list of workers
+	fr_worker_peers_t *peers;		//!< array of workers, so that they can steal from each other
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
 
-	fr_schedule_network_t *sn;		//!< pointer to the (one) network thread
+	fr_schedule_network_t **sn;		//!< array of network threads
 };
 
 
@@ -149,6 +152,7 @@ static void *fr_schedule_worker_thread(void *arg)
 	fr_schedule_t *sc = sw->sc;
 	fr_schedule_child_status_t status = FR_CHILD_FAIL;
 	fr_event_list_t *el;
+	int i;
 	char buffer[32];
 
 	fr_log(sc->log, L_INFO, "Worker %d starting\n", sw->id);
@@ -178,9 +182,23 @@ static void *fr_schedule_worker_thread(void *arg)
 		goto fail;
 	}
 
+	/*
+	 *	Let this worker steal from the others, and let the
+	 *	others steal from this one.
+	 */
+	fr_worker_peers_add(sc->peers, sw->id, sw->worker);
+
 	sw->status = FR_CHILD_RUNNING;
 
-	(void) fr_network_worker_add(sc->sn->rc, sw->worker);
+	/*
+	 *	Every network thread gets its own channel to every
+	 *	worker.  That way each network can distribute its
+	 *	packets across all of the workers, without the
+	 *	networks having to coordinate with each other.
+	 */
+	for (i = 0; i < sc->num_networks; i++) {
+		(void) fr_network_worker_add(sc->sn[i]->rc, sw->worker);
+	}
 
 	fr_log(sc->log, L_INFO, "Spawned async worker %d", sw->id);
 
@@ -264,7 +282,7 @@ static void *fr_schedule_network_thread(void *arg)
 	 */
 	sem_post(&sc->semaphore);
 
-	fr_log(sc->log, L_INFO, "Spawned asycn network 0");
+	fr_log(sc->log, L_INFO, "Spawned async network %d", sn->id);
 
 	/*
 	 *	Do all of the work.
@@ -286,7 +304,7 @@ fail:
 
 	sn->status = status;
 
-	fr_log(sc->log, L_INFO, "Network exiting");
+	fr_log(sc->log, L_INFO, "Network %d exiting", sn->id);
 
 	/*
 	 *	Tell the scheduler we're done.
@@ -317,7 +335,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t
 {
 #ifdef HAVE_PTHREAD_H
 	int i;
-	int rcode;
+	int rcode = 0;
 	pthread_attr_t attr;
 	fr_dlist_t *entry, *next;
 #endif
@@ -398,24 +416,87 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t
 	}
 
 	/*
-	 *	Create the network thread first.
-	 *	@todo - create multiple network threads
+	 *	Create the network threads first.
 	 */
-	sc->sn = talloc_zero(sc, fr_schedule_network_t);
-	sc->sn->sc = sc;
-	sc->sn->id = 0;
+	sc->sn = talloc_zero_array(sc, fr_schedule_network_t *, sc->max_networks);
+	if (!sc->sn) {
+		fr_strerror_printf("Failed allocating memory");
+		sem_destroy(&sc->semaphore);
+		talloc_free(sc);
+		return NULL;
+	}
 
-	rcode = pthread_create(&sc->sn->pthread_id, &attr, fr_schedule_network_thread, sc->sn);
-	if (rcode != 0) {
-		fr_strerror_printf("Failed creating network thread: %s", fr_syserror(errno));
-		goto fail;
+	for (i = 0; i < sc->max_networks; i++) {
+		fr_schedule_network_t *sn;
+
+		fr_log(sc->log, L_DBG, "Creating %d/%d networks\n", i, sc->max_networks);
+
+		sn = talloc_zero(sc, fr_schedule_network_t);
+		if (!sn) {
+			fr_log(sc->log, L_ERR, "Network %d - Failed allocating memory", i);
+			break;
+		}
+
+		sn->sc = sc;
+		sn->id = i;
+		sn->status = FR_CHILD_INITIALIZING;
+
+		rcode = pthread_create(&sn->pthread_id, &attr, fr_schedule_network_thread, sn);
+		if (rcode != 0) {
+			fr_log(sc->log, L_ERR, "Failed creating network %d: %s\n", i, fr_syserror(errno));
+			talloc_free(sn);
+			break;
+		}
+
+		sc->sn[sc->num_networks++] = sn;
 	}
 
-	SEM_WAIT_INTR(&sc->semaphore);
-	if (sc->sn->status != FR_CHILD_RUNNING) {
-	fail:
-		TALLOC_FREE(sc->sn);
-		fr_schedule_destroy(sc);
+	/*
+	 *	Wait for all of the networks to signal us that either
+	 *	they've started, OR there's been a problem and they
+	 *	can't start.
+	 */
+	for (i = 0; i < sc->num_networks; i++) {
+		fr_log(sc->log, L_DBG, "Waiting for semaphore from network %d/%d\n", i, sc->num_networks);
+		SEM_WAIT_INTR(&sc->semaphore);
+	}
+
+	/*
+	 *	Failed to start some networks, refuse to do anything!
+	 *
+	 *	The workers haven't been created yet, so we only have
+	 *	to clean up the networks.
+	 */
+	for (i = 0; i < sc->num_networks; i++) {
+		if (sc->sn[i]->status == FR_CHILD_RUNNING) continue;
+
+		fr_log(sc->log, L_ERR, "Network %d failed to start", sc->sn[i]->id);
+		rcode = -1;
+	}
+
+	if ((rcode < 0) || (sc->num_networks < sc->max_networks)) {
+		for (i = 0; i < sc->num_networks; i++) {
+			if (sc->sn[i]->status != FR_CHILD_RUNNING) continue;
+
+			fr_network_exit(sc->sn[i]->rc);
+			SEM_WAIT_INTR(&sc->semaphore);
+		}
+
+		sem_destroy(&sc->semaphore);
+		talloc_free(sc);
+		return NULL;
+	}
+
+	sc->peers = fr_worker_peers_create(sc, sc->max_workers);
+	if (!sc->peers) {
+		fr_log(sc->log, L_ERR, "Failed allocating memory");
+		for (i = 0; i < sc->num_networks; i++) {
+			fr_network_exit(sc->sn[i]->rc);
+			SEM_WAIT_INTR(&sc->semaphore);
+		}
+
+		sem_destroy(&sc->semaphore);
+		talloc_free(sc);
 		return NULL;
 	}
 
@@ -524,7 +605,12 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 		goto done;
 	}
 
-	rad_assert(sc->num_workers > 0);
+	/*
+	 *	Stop the workers from stealing from each other.  Each
+	 *	worker waits for the requests which were stolen from
+	 *	it before it exits.
+	 */
+	fr_worker_peers_clear(sc->peers);
 
 	/*
 	 *	Signal all of the workers to exit.
@@ -563,10 +649,12 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 	}
 
 	/*
-	 *	If the network thread is running, tell it to exit.
+	 *	If the network threads are running, tell them to exit.
 	 */
-	if (sc->sn->status == FR_CHILD_RUNNING) {
-		fr_network_exit(sc->sn->rc);
+	for (i = 0; i < sc->num_networks; i++) {
+		if (sc->sn[i]->status != FR_CHILD_RUNNING) continue;
+
+		fr_network_exit(sc->sn[i]->rc);
 		SEM_WAIT_INTR(&sc->semaphore);
 	}
 
@@ -587,6 +675,11 @@ done:
 }
 
 /** Add a socket to a scheduler.
+ *
+ *  The socket is given to the network thread which is managing the
+ *  fewest sockets.  Listeners which have been cloned (e.g. via
+ *  SO_REUSEPORT) are therefore spread across all of the network
+ *  threads, so long as each clone is added in turn.
  *
  * @param[in] sc the scheduler
  * @param[in] io the ctx and callbacks for the transport.
@@ -596,17 +689,70 @@ done:
  */
 fr_network_t *fr_schedule_socket_add(fr_schedule_t *sc, fr_listen_t const *io)
 {
+	int i;
 	fr_network_t *nr;
+	fr_schedule_network_t *sn = NULL;
 
 	(void) talloc_get_type_abort(sc, fr_schedule_t);
 
 	if (sc->el) {
 		nr = sc->single_network;
 	} else {
-		nr = sc->sn->rc;
+		for (i = 0; i < sc->num_networks; i++) {
+			if (!sn || (sc->sn[i]->num_sockets < sn->num_sockets)) sn = sc->sn[i];
+		}
+		rad_assert(sn != NULL);
+
+		nr = sn->rc;
 	}
 
 	if (fr_network_socket_add(nr, io) < 0) return NULL;
 
+	if (sn) sn->num_sockets++;
+
 	return nr;
 }
+
+/** Get the number of network threads
+ *
+ *  Applications use this to decide how many copies of a listener to
+ *  open, so that each network thread can read from its own socket.
+ *
+ * @param[in] sc the scheduler
+ * @return the number of network threads (1 for single-threaded mode)
+ */
+int fr_schedule_num_networks(fr_schedule_t const *sc)
+{
+	if (sc->el) return 1;
+
+	return sc->num_networks;
+}
+
+/** Print debug information about the scheduler
+ *
+ *  Prints the load on each network thread, so that the administrator
+ *  can see whether the listeners are balanced across the networks.
+ *
+ * @param[in] sc the scheduler
+ * @param[in] fp the file where the debug output is printed.
+ */
+void fr_schedule_debug(fr_schedule_t *sc, FILE *fp)
+{
+	int i;
+
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
+
+	if (sc->el) {
+		fprintf(fp, "network 0 (single-threaded)\n");
+		fr_network_debug(sc->single_network, fp);
+		return;
+	}
+
+	for (i = 0; i < sc->num_networks; i++) {
+		if (sc->sn[i]->status != FR_CHILD_RUNNING) continue;
+
+		fprintf(fp, "network %d\n", sc->sn[i]->id);
+		fprintf(fp, "\tassigned sockets = %d\n", sc->sn[i]->num_sockets);
+		fr_network_debug(sc->sn[i]->rc, fp);
+	}
+}
@@ -43,6 +43,8 @@ fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_
 int			fr_schedule_destroy(fr_schedule_t *sc);
 
 fr_network_t		*fr_schedule_socket_add(fr_schedule_t *sc, fr_listen_t const *io) CC_HINT(nonnull);
+int			fr_schedule_num_networks(fr_schedule_t const *sc) CC_HINT(nonnull);
+void			fr_schedule_debug(fr_schedule_t *sc, FILE *fp) CC_HINT(nonnull);
 
 #ifdef __cplusplus
 }
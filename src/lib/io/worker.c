@@ -57,6 +57,20 @@
  *  yeilded, it is placed onto the yielded list in the worker
  *  "tracking" data structure.
  *
+ *  When a worker has nothing to do, it steals messages from the
+ *  "to_decode" heap of other workers.  That way one slow request
+ *  (e.g. a blocking database call) doesn't hold up all of the other
+ *  requests which were queued behind it.  The stolen request is
+ *  processed by the thief, and the reply is sent back over the
+ *  channel the request came in on.  The "to_decode" heap and the
+ *  worker end of the channels are therefore protected by a mutex.
+ *  The mutex is almost always uncontended.
+ *
+ *  A worker which is exiting waits until no other worker is looking
+ *  at it, and until all of the requests which were stolen from it
+ *  have been replied to.  Otherwise the thief would reply through a
+ *  channel which no longer exists.
+ *
  * @copyright 2016 Alan DeKok <aland@freeradius.org>
  */
 RCSID("$Id$")
@@ -66,6 +80,22 @@ RCSID("$Id$")
 #include <freeradius-devel/io/message.h>
 #include <freeradius-devel/io/listen.h>
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#define PTHREAD_MUTEX_LOCK   pthread_mutex_lock
+#define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+
+#else
+#define PTHREAD_MUTEX_LOCK
+#define PTHREAD_MUTEX_UNLOCK
+#endif
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 /**
  *  Track things by priority and time.
  */
@@ -74,6 +104,56 @@ typedef struct fr_worker_heap_t {
 	fr_heap_t	*heap;			//!< heap, ordered by priority
 } fr_worker_heap_t;
 
+/**
+ *  The worker end of a channel.
+ *
+ *  A request may be processed by a different worker than the one
+ *  which received it.  So we need to know which worker owns the
+ *  channel, in order to lock it.
+ */
+typedef struct fr_worker_channel_t {
+	fr_worker_t		*worker;	//!< the worker which owns the channel
+	fr_message_set_t	*ms;		//!< message set for replies
+} fr_worker_channel_t;
+
+typedef _Atomic(fr_worker_t *) fr_worker_ptr_t;
+
+/**
+ *  The workers which can steal messages from each other.
+ *
+ *  Thieves count themselves in "num_stealing" while they look at
+ *  the array, so that a worker which is exiting knows when it's
+ *  safe to free itself.
+ */
+struct fr_worker_peers_t {
+	int			num_workers;	//!< size of the "worker" array
+	atomic_uint_fast32_t	num_stealing;	//!< number of workers looking at the array
+	fr_worker_ptr_t		*worker;	//!< the workers, which may be NULL
+};
+
+#define FR_WORKER_POOL_MIN	(1 << 10)	//!< smallest bucket in the request footprint histogram
+#define FR_WORKER_POOL_MAX	(1 << 20)	//!< largest pool we'll allocate for a REQUEST
+#define FR_WORKER_POOL_BUCKETS	11		//!< FR_WORKER_POOL_MIN .. FR_WORKER_POOL_MAX in powers of 2
+#define FR_WORKER_POOL_SAMPLE	16		//!< measure the footprint of one request in this many
+#define FR_WORKER_POOL_RESIZE	256		//!< re-calculate pool sizes after this many measured
+						//!< requests, and halve the weight of the older ones
+#define FR_WORKER_CHUNK_OVERHEAD 64		//!< approximate size of a talloc chunk header
+
+/**
+ *  Memory used by requests for one virtual server.
+ *
+ *  Used to size the talloc pool of new requests so that most of
+ *  them never need to call malloc() once the pool is allocated.
+ */
+typedef struct fr_worker_pool_stats_t {
+	CONF_SECTION const	*server_cs;	//!< the virtual server
+	size_t			pool_size;	//!< size of the pool for new requests
+	uint64_t		num_requests;	//!< number of requests measured
+	uint64_t		num_overflows;	//!< number of measured requests which didn't fit into their pool
+	uint64_t		histogram[FR_WORKER_POOL_BUCKETS]; //!< request footprints, in powers of 2,
+								   //!< decayed every FR_WORKER_POOL_RESIZE requests
+} fr_worker_pool_stats_t;
+
 #ifndef NDEBUG
 static void fr_worker_verify(fr_worker_t *worker);
 #define WORKER_VERIFY fr_worker_verify(worker)
@@ -111,6 +191,10 @@ struct fr_worker_t {
 
 	size_t			talloc_pool_size; //!< for each REQUEST
 
+	REQUEST			**free_requests; //!< requests which can be re-used
+	int			num_free_requests; //!< number of entries in free_requests
+	int			max_free_requests; //!< maximum number of requests to keep for re-use
+
 	fr_time_t		checked_timeout; //!< when we last checked the tails of the queues
 
 	fr_worker_heap_t	to_decode;	//!< messages from the master, to be decoded or localized
@@ -125,12 +209,32 @@ struct fr_worker_t {
 	int			num_decoded;	//!< number of messages which have been decoded
 	int			num_replies;	//!< number of messages which were replied to
 	int			num_timeouts;	//!< number of messages which timed out
+	int			num_stolen;	//!< number of messages we stole from other workers
+	int			num_pool_hits;	//!< number of requests which were re-used
+	int			num_pool_misses; //!< number of requests which had to be allocated
+
+	uint64_t		num_released;	//!< number of requests released
+	uint64_t		num_measured;	//!< number of released requests whose footprint was measured
+	uint64_t		num_pool_overflows; //!< number of measured requests which didn't fit into their pool
+	uint64_t		request_mem_total; //!< bytes used by all measured requests
+	size_t			request_mem_max; //!< most bytes used by a single measured request
+
+	fr_worker_pool_stats_t	*pool_stats;	//!< per virtual server request footprints
+	int			num_pool_stats;	//!< number of entries in pool_stats
 
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
 
-	bool			exiting;	//!< are we exiting?
+	atomic_bool		exiting;	//!< are we exiting?
 
 	fr_channel_t		**channel;	//!< list of channels
+
+	fr_worker_peers_t	*peers;		//!< other workers we can steal messages from
+	atomic_uint_fast32_t	num_to_decode;	//!< size of "to_decode", for thieves which don't hold the mutex
+	atomic_uint_fast32_t	num_loaned;	//!< number of our messages which other workers are processing
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;		//!< for "to_decode", and the worker end of the channels
+#endif
 };
 
 static void fr_worker_post_event(fr_event_list_t *el, struct timeval *now, void *uctx);
@@ -164,10 +268,233 @@ static void fr_worker_post_event(fr_event_list_t *el, struct timeval *now, void
                fr_dlist_remove(&_var->_member);			 \
        } while (0)
 
+/*
+ *	Publish the size of the "to_decode" heap.  MUST be called
+ *	with the worker mutex held.
+ */
+#define WORKER_TO_DECODE_COUNT(_worker) \
+	atomic_store_explicit(&(_worker)->num_to_decode, \
+			      fr_heap_num_elements((_worker)->to_decode.heap), memory_order_relaxed)
 
-/** Drain the input channel
+
+/** Attach the data structures which every REQUEST needs
+ *
+ * @param[in] request to initialise.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int fr_worker_request_attach(REQUEST *request)
+{
+	request->packet = fr_radius_alloc(request, false);
+	if (!request->packet) return -1;
+
+	request->reply = fr_radius_alloc(request, false);
+	if (!request->reply) return -1;
+
+	request->async = talloc_zero(request, fr_async_t);
+	if (!request->async) return -1;
+
+	return 0;
+}
+
+/** Find the memory statistics for a virtual server, creating them if necessary
+ *
+ *  There are only a handful of virtual servers, so a linear search
+ *  is fine.
+ *
+ * @param[in] worker the worker
+ * @param[in] server_cs the virtual server
+ * @return
+ *	- NULL on error
+ *	- fr_worker_pool_stats_t for the virtual server
+ */
+static fr_worker_pool_stats_t *fr_worker_pool_stats(fr_worker_t *worker, CONF_SECTION const *server_cs)
+{
+	int i;
+	fr_worker_pool_stats_t *stats;
+
+	for (i = 0; i < worker->num_pool_stats; i++) {
+		if (worker->pool_stats[i].server_cs == server_cs) return &worker->pool_stats[i];
+	}
+
+	stats = talloc_realloc(worker, worker->pool_stats, fr_worker_pool_stats_t, worker->num_pool_stats + 1);
+	if (!stats) return NULL;
+	worker->pool_stats = stats;
+
+	stats = &worker->pool_stats[worker->num_pool_stats++];
+	memset(stats, 0, sizeof(*stats));
+	stats->server_cs = server_cs;
+	stats->pool_size = worker->talloc_pool_size;
+
+	return stats;
+}
+
+/** Record the memory used by a request, and re-size the pool if necessary
+ *
+ *  The new pool size is the smallest power of 2 which covers 99% of
+ *  the requests in the histogram.  The histogram is then halved, so
+ *  that the pool size follows changes in traffic, instead of being
+ *  fixed by whatever the server saw when it started.
+ *
+ * @param[in] stats for the virtual server
+ * @param[in] pool_size the size of the pool the request was allocated with.
+ * @param[in] used approximate number of bytes used by the request
+ */
+static void fr_worker_pool_stats_update(fr_worker_pool_stats_t *stats, size_t pool_size, size_t used)
+{
+	int i;
+	uint64_t total, p99;
+
+	for (i = 0; i < (FR_WORKER_POOL_BUCKETS - 1); i++) {
+		if (used <= ((size_t) FR_WORKER_POOL_MIN << i)) break;
+	}
+	stats->histogram[i]++;
+
+	if (used > pool_size) stats->num_overflows++;
+
+	if ((++stats->num_requests % FR_WORKER_POOL_RESIZE) != 0) return;
+
+	total = 0;
+	for (i = 0; i < FR_WORKER_POOL_BUCKETS; i++) total += stats->histogram[i];
+
+	p99 = total - (total / 100);
+	total = 0;
+	for (i = 0; i < (FR_WORKER_POOL_BUCKETS - 1); i++) {
+		total += stats->histogram[i];
+		if (total >= p99) break;
+	}
+
+	stats->pool_size = (size_t) FR_WORKER_POOL_MIN << i;
+
+	for (i = 0; i < FR_WORKER_POOL_BUCKETS; i++) stats->histogram[i] /= 2;
+}
+
+/** Get a REQUEST, either from the free list, or by allocating a new one
+ *
+ *  Requests on the free list which have a pool smaller than the one
+ *  the virtual server needs are discarded, so that the worker
+ *  converges on pools which fit the observed traffic.
+ *
+ * @param[in] worker the worker
+ * @param[in] server_cs the virtual server which will process the request.
+ * @return
+ *	- NULL on error
+ *	- REQUEST the request
+ */
+static REQUEST *fr_worker_request_alloc(fr_worker_t *worker, CONF_SECTION const *server_cs)
+{
+	REQUEST *request;
+	fr_worker_pool_stats_t *stats;
+	size_t pool_size = worker->talloc_pool_size;
+
+	stats = fr_worker_pool_stats(worker, server_cs);
+	if (stats) pool_size = stats->pool_size;
+
+	while (worker->num_free_requests > 0) {
+		request = worker->free_requests[--worker->num_free_requests];
+		if (request->async->pool_size >= pool_size) {
+			worker->num_pool_hits++;
+			request->async->pool_server_cs = server_cs;
+			return request;
+		}
+
+		talloc_free(request);
+	}
+
+	worker->num_pool_misses++;
+
+	/*
+	 *	Requests are not parented by the worker, as they may
+	 *	be moved to another context by the protocol handlers.
+	 */
+	request = request_alloc_pooled(NULL, pool_size);
+	if (!request) return NULL;
+
+	if (fr_worker_request_attach(request) < 0) {
+		talloc_free(request);
+		return NULL;
+	}
+	request->async->pool_size = pool_size;
+	request->async->pool_server_cs = server_cs;
+
+	return request;
+}
+
+/** Release a REQUEST, putting it back onto the free list if there's room
+ *
+ *  The request is reset, which frees all of its children.  Because
+ *  the request is a talloc pool, the memory for the next request
+ *  comes from the pool, and not from malloc().
+ *
+ *  Measured requests which overflowed their pool are freed, so that
+ *  the next allocation gets a pool of the current size.
  *
  * @param[in] worker the worker
+ * @param[in] request to release
+ */
+static void fr_worker_request_release(fr_worker_t *worker, REQUEST *request)
+{
+	size_t pool_size;
+
+	pool_size = request->async->pool_size;
+
+	/*
+	 *	Track how much memory requests actually use, so that
+	 *	the pool size follows real traffic.  talloc doesn't
+	 *	tell us how much of the pool was used, so estimate
+	 *	the chunk headers.
+	 *
+	 *	Walking the request's talloc tree costs about as
+	 *	much as freeing it, so only one request in
+	 *	FR_WORKER_POOL_SAMPLE is measured.  A request which
+	 *	overflowed its pool but wasn't measured is re-used,
+	 *	which is safe.  Its pool is just smaller than it
+	 *	could be.
+	 */
+	if ((worker->num_released++ % FR_WORKER_POOL_SAMPLE) == 0) {
+		size_t used;
+		fr_worker_pool_stats_t *stats;
+
+		used = talloc_total_size(request) + (talloc_total_blocks(request) * FR_WORKER_CHUNK_OVERHEAD);
+		worker->num_measured++;
+		worker->request_mem_total += used;
+		if (used > worker->request_mem_max) worker->request_mem_max = used;
+
+		/*
+		 *	Record the usage against the virtual server the
+		 *	pool was sized for, which isn't necessarily the
+		 *	one which finished processing the request.
+		 */
+		stats = fr_worker_pool_stats(worker, request->async->pool_server_cs);
+		if (stats) {
+			uint64_t num_overflows = stats->num_overflows;
+
+			fr_worker_pool_stats_update(stats, pool_size, used);
+			worker->num_pool_overflows += stats->num_overflows - num_overflows;
+		}
+
+		if (used > pool_size) goto free;
+	}
+
+	if (worker->num_free_requests >= worker->max_free_requests) {
+	free:
+		talloc_free(request);
+		return;
+	}
+
+	request_reset(request);
+	if (fr_worker_request_attach(request) < 0) goto free;
+	request->async->pool_size = pool_size;
+
+	worker->free_requests[worker->num_free_requests++] = request;
+}
+
+/** Drain the input channel
+ *
+ *  The caller MUST hold the mutex of the worker which owns the channel.
+ *
+ * @param[in] worker the worker which owns the channel
  * @param[in] ch the channel to drain
  * @param[in] cd the message (if any) to start with
  */
@@ -187,6 +514,8 @@ static void fr_worker_drain_input(fr_worker_t *worker, fr_channel_t *ch, fr_chan
 		cd->channel.ch = ch;
 		WORKER_HEAP_INSERT(to_decode, cd, request.list);
 	} while ((cd = fr_channel_recv_request(ch)) != NULL);
+
+	WORKER_TO_DECODE_COUNT(worker);
 }
 
 
@@ -202,7 +531,7 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 	int i;
 	bool ok;
 	fr_channel_t *ch;
-	fr_message_set_t *ms;
+	fr_worker_channel_t *wc;
 	fr_channel_event_t ce;
 	fr_worker_t *worker = ctx;
 
@@ -228,7 +557,9 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 	case FR_CHANNEL_DATA_READY_WORKER:
 		rad_assert(ch != NULL);
 		fr_log(worker->log, L_DBG, "\t%saq data ready", worker->name);
+		PTHREAD_MUTEX_LOCK(&worker->mutex);
 		fr_worker_drain_input(worker, ch, NULL);
+		PTHREAD_MUTEX_UNLOCK(&worker->mutex);
 		break;
 
 	case FR_CHANNEL_OPEN:
@@ -245,11 +576,15 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 			worker->channel[i] = ch;
 			fr_log(worker->log, L_DBG, "\t%sreceived channel %p into array entry %d", worker->name, ch, i);
 
-			ms = fr_message_set_create(worker, worker->message_set_size,
-						   sizeof(fr_channel_data_t),
-						   worker->ring_buffer_size);
-			rad_assert(ms != NULL);
-			fr_channel_worker_ctx_add(ch, ms);
+			wc = talloc_zero(worker, fr_worker_channel_t);
+			rad_assert(wc != NULL);
+
+			wc->worker = worker;
+			wc->ms = fr_message_set_create(wc, worker->message_set_size,
+						       sizeof(fr_channel_data_t),
+						       worker->ring_buffer_size);
+			rad_assert(wc->ms != NULL);
+			fr_channel_worker_ctx_add(ch, wc);
 
 			worker->num_channels++;
 			ok = true;
@@ -278,12 +613,14 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 			 *	wake up after a time and try
 			 *	to close it again.
 			 */
+			PTHREAD_MUTEX_LOCK(&worker->mutex);
 			(void) fr_channel_worker_ack_close(ch);
 
-			ms = fr_channel_worker_ctx_get(ch);
-			rad_assert(ms != NULL);
-			fr_message_set_gc(ms);
-			talloc_free(ms);
+			wc = fr_channel_worker_ctx_get(ch);
+			rad_assert(wc != NULL);
+			fr_message_set_gc(wc->ms);
+			PTHREAD_MUTEX_UNLOCK(&worker->mutex);
+			talloc_free(wc);
 
 			worker->channel[i] = NULL;
 			rad_assert(worker->num_channels > 0);
@@ -300,11 +637,10 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 
 /** Service a control-plane event.
  *
- * @param[in] kq the kq to service
- * @param[in] kev the kevent to service
+ * @param[in] el the event list
  * @param[in] ctx the fr_worker_t
  */
-static void fr_worker_evfilt_user(UNUSED int kq, UNUSED struct kevent const *kev, void *ctx)
+static void fr_worker_evfilt_user(UNUSED fr_event_list_t *el, void *ctx)
 {
 	fr_time_t now;
 	fr_worker_t *worker = ctx;
@@ -325,6 +661,9 @@ static void fr_worker_evfilt_user(UNUSED int kq, UNUSED struct kevent const *kev
  *
  *  The network thread believes that a worker is running a request until that request has been NAK'd.
  *
+ *  The message may have been stolen from another worker, so we lock
+ *  the worker which owns the channel.
+ *
  * @param[in] worker the worker
  * @param[in] cd the message to NAK
  * @param[in] now when the message is NAKd
@@ -334,7 +673,8 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 	size_t			size;
 	fr_channel_data_t	*reply;
 	fr_channel_t		*ch;
-	fr_message_set_t	*ms;
+	fr_worker_channel_t	*wc;
+	fr_worker_t		*owner;
 	fr_listen_t const	*listen;
 
 	worker->num_timeouts++;
@@ -345,13 +685,16 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 	ch = cd->channel.ch;
 	listen = cd->listen;
 
-	ms = fr_channel_worker_ctx_get(ch);
-	rad_assert(ms != NULL);
+	wc = fr_channel_worker_ctx_get(ch);
+	rad_assert(wc != NULL);
+	owner = wc->worker;
+
+	PTHREAD_MUTEX_LOCK(&owner->mutex);
 
 	/*
 	 *	Allocate a default message size.
 	 */
-	reply = (fr_channel_data_t *) fr_message_reserve(ms, listen->app_io->default_message_size);
+	reply = (fr_channel_data_t *) fr_message_reserve(wc->ms, listen->app_io->default_message_size);
 	rad_assert(reply != NULL);
 
 	/*
@@ -360,13 +703,15 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 	size = listen->app_io->nak(listen->app_io_instance, cd->m.data,
 				   cd->m.data_size, reply->m.data, reply->m.rb_size);
 
-	(void) fr_message_alloc(ms, &reply->m, size);
+	(void) fr_message_alloc(wc->ms, &reply->m, size);
 
 	/*
-	 *	Fill in the NAK.
+	 *	Fill in the NAK.  The network tracks CPU time per
+	 *	channel, so we report the time for the worker which
+	 *	owns the channel.
 	 */
 	reply->m.when = now;
-	reply->reply.cpu_time = worker->tracking.running;
+	reply->reply.cpu_time = wc->worker->tracking.running;
 	reply->reply.processing_time = 10; /* @todo - set to something better? */
 	reply->reply.request_time = cd->m.when;
 
@@ -388,7 +733,15 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 
 	worker->num_replies++;
 
-	if (cd) fr_worker_drain_input(worker, ch, cd);
+	if (cd) fr_worker_drain_input(owner, ch, cd);
+
+	PTHREAD_MUTEX_UNLOCK(&owner->mutex);
+
+	/*
+	 *	The owner may free itself as soon as this hits zero,
+	 *	so it MUST be the last time we touch it.
+	 */
+	if (owner != worker) atomic_fetch_sub_explicit(&owner->num_loaned, 1, memory_order_release);
 }
 
 
@@ -396,6 +749,9 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
  *
  *  And clean it up.
  *
+ *  The request may have been stolen from another worker, so we lock
+ *  the worker which owns the channel.
+ *
  * @param[in] worker the worker
  * @param[in] request the request to process
  * @param[in] size maximum size of the reply data
@@ -404,7 +760,8 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 {
 	fr_channel_data_t *reply, *cd;
 	fr_channel_t *ch;
-	fr_message_set_t *ms;
+	fr_worker_channel_t *wc;
+	fr_worker_t *owner;
 
 	/*
 	 *	Allocate and send the reply.
@@ -412,10 +769,13 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	ch = request->async->channel;
 	rad_assert(ch != NULL);
 
-	ms = fr_channel_worker_ctx_get(ch);
-	rad_assert(ms != NULL);
+	wc = fr_channel_worker_ctx_get(ch);
+	rad_assert(wc != NULL);
+	owner = wc->worker;
+
+	PTHREAD_MUTEX_LOCK(&owner->mutex);
 
-	reply = (fr_channel_data_t *) fr_message_reserve(ms, size);
+	reply = (fr_channel_data_t *) fr_message_reserve(wc->ms, size);
 	rad_assert(reply != NULL);
 
 	/*
@@ -440,7 +800,7 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 		/*
 		 *	Resize the buffer to the actual packet size.
 		 */
-		cd = (fr_channel_data_t *) fr_message_alloc(ms, &reply->m, slen);
+		cd = (fr_channel_data_t *) fr_message_alloc(wc->ms, &reply->m, slen);
 		rad_assert(cd == reply);
 	}
 
@@ -455,7 +815,7 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	 *	sequence / ack will be filled in by fr_channel_send_reply()
 	 */
 	reply->m.when = request->async->tracking.when;
-	reply->reply.cpu_time = worker->tracking.running;
+	reply->reply.cpu_time = wc->worker->tracking.running;
 	reply->reply.processing_time = request->async->tracking.running;
 	reply->reply.request_time = request->async->recv_time;
 
@@ -478,14 +838,14 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	 *	Drain the incoming TO_WORKER queue.  We do this every
 	 *	time we're done processing a request.
 	 */
-	if (cd) fr_worker_drain_input(worker, ch, cd);
+	if (cd) fr_worker_drain_input(owner, ch, cd);
+
+	PTHREAD_MUTEX_UNLOCK(&owner->mutex);
+
+	if (owner != worker) atomic_fetch_sub_explicit(&owner->num_loaned, 1, memory_order_release);
 
-	/*
-	 *	@todo Use a talloc pool for the request.  Clean it up,
-	 *	and insert it back into a slab allocator.
-	 */
 	fr_dlist_remove(&request->async->time_order);
-	talloc_free(request);
+	fr_worker_request_release(worker, request);
 }
 
 /** Check timeouts on the various queues
@@ -526,21 +886,37 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 
 	/*
 	 *	Check the "to_decode" queue for old packets.
+	 *
+	 *	Other workers may steal from this queue, so we hold
+	 *	the lock only while we remove the message.
 	 */
-	while ((entry = FR_DLIST_TAIL(worker->to_decode.list)) != NULL) {
+	while (true) {
 		fr_message_t *lm;
 		fr_channel_data_t *cd;
 
+		PTHREAD_MUTEX_LOCK(&worker->mutex);
+		entry = FR_DLIST_TAIL(worker->to_decode.list);
+		if (!entry) {
+			PTHREAD_MUTEX_UNLOCK(&worker->mutex);
+			break;
+		}
+
 		cd = fr_ptr_to_type(fr_channel_data_t, request.list, entry);
 		waiting = now - cd->m.when;
 
-		if (waiting < (NANOSEC / 100)) break;
+		if (waiting < (NANOSEC / 100)) {
+			PTHREAD_MUTEX_UNLOCK(&worker->mutex);
+			break;
+		}
+
+		WORKER_HEAP_EXTRACT(to_decode, cd, request.list);
+		WORKER_TO_DECODE_COUNT(worker);
+		PTHREAD_MUTEX_UNLOCK(&worker->mutex);
 
 		/*
 		 *	Waiting too long, delete it.
 		 */
 		if (waiting > NANOSEC) {
-			WORKER_HEAP_EXTRACT(to_decode, cd, request.list);
 		nak:
 			fr_worker_nak(worker, cd, now);
 			continue;
@@ -549,7 +925,6 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 		/*
 		 *	0.01 to 1s.  Localize it.
 		 */
-		WORKER_HEAP_EXTRACT(to_decode, cd, request.list);
 		lm = fr_message_localize(worker, &cd->m, sizeof(cd->m));
 		if (!lm) goto nak;
 
@@ -620,6 +995,128 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 }
 
 
+/** Steal a message from another worker
+ *
+ *  We pick the worker with the most messages waiting to be decoded,
+ *  and take the highest priority one.  The victim can't exit until
+ *  we've replied to the stolen message.
+ *
+ * @param[in] worker the worker which is looking for work
+ * @return
+ *	- NULL on nothing to steal
+ *	- fr_channel_data_t the stolen message
+ */
+static fr_channel_data_t *fr_worker_steal(fr_worker_t *worker)
+{
+	int			i;
+	uint_fast32_t		num, max = 0;
+	fr_worker_t		*victim = NULL;
+	fr_channel_data_t	*cd = NULL;
+	fr_worker_peers_t	*peers = worker->peers;
+
+	atomic_fetch_add_explicit(&peers->num_stealing, 1, memory_order_seq_cst);
+
+	/*
+	 *	Find the busiest worker.  We don't lock the other
+	 *	workers for this check, as it's only a hint.
+	 */
+	for (i = 0; i < peers->num_workers; i++) {
+		fr_worker_t *peer = atomic_load_explicit(&peers->worker[i], memory_order_acquire);
+
+		if (!peer || (peer == worker) || atomic_load_explicit(&peer->exiting, memory_order_relaxed)) continue;
+
+		num = atomic_load_explicit(&peer->num_to_decode, memory_order_relaxed);
+		if (num > max) {
+			max = num;
+			victim = peer;
+		}
+	}
+
+	if (!victim) goto done;
+
+	/*
+	 *	The victim checks "num_loaned" only after it sees
+	 *	"num_stealing" drop to zero, so we have to take the
+	 *	loan before we stop stealing.
+	 */
+	PTHREAD_MUTEX_LOCK(&victim->mutex);
+	if (!atomic_load_explicit(&victim->exiting, memory_order_relaxed)) {
+		cd = fr_heap_pop(victim->to_decode.heap);
+		if (cd) {
+			fr_dlist_remove(&cd->request.list);
+			WORKER_TO_DECODE_COUNT(victim);
+			atomic_fetch_add_explicit(&victim->num_loaned, 1, memory_order_relaxed);
+		}
+	}
+	PTHREAD_MUTEX_UNLOCK(&victim->mutex);
+
+done:
+	atomic_fetch_sub_explicit(&peers->num_stealing, 1, memory_order_seq_cst);
+
+	if (!cd) return NULL;
+
+	worker->num_stolen++;
+	fr_log(worker->log, L_DBG, "\t%sstole request from %s", worker->name, victim->name);
+
+	return cd;
+}
+
+/** Check if other workers have messages which we can steal
+ *
+ * @param[in] worker the worker which is looking for work
+ * @return true if there is work to steal
+ */
+static bool fr_worker_can_steal(fr_worker_t *worker)
+{
+	int			i;
+	bool			found = false;
+	fr_worker_peers_t	*peers = worker->peers;
+
+	atomic_fetch_add_explicit(&peers->num_stealing, 1, memory_order_seq_cst);
+
+	for (i = 0; i < peers->num_workers; i++) {
+		fr_worker_t *peer = atomic_load_explicit(&peers->worker[i], memory_order_acquire);
+
+		if (!peer || (peer == worker) || atomic_load_explicit(&peer->exiting, memory_order_relaxed)) continue;
+
+		if (atomic_load_explicit(&peer->num_to_decode, memory_order_relaxed) > 0) {
+			found = true;
+			break;
+		}
+	}
+
+	atomic_fetch_sub_explicit(&peers->num_stealing, 1, memory_order_seq_cst);
+
+	return found;
+}
+
+/** Give back the messages we stole from other workers
+ *
+ *  We're exiting, and won't reply to the requests we're still
+ *  processing.  Tell the workers which own their channels that
+ *  we're done with them.
+ *
+ * @param[in] worker the worker which is exiting
+ * @param[in] head the list of requests to check
+ */
+static void fr_worker_loans_return(fr_worker_t *worker, fr_dlist_t *head)
+{
+	fr_dlist_t *entry;
+
+	for (entry = FR_DLIST_FIRST((*head));
+	     entry != NULL;
+	     entry = FR_DLIST_NEXT((*head), entry)) {
+		fr_async_t *async;
+		fr_worker_channel_t *wc;
+
+		async = fr_ptr_to_type(fr_async_t, time_order, entry);
+		wc = fr_channel_worker_ctx_get(async->channel);
+		if (!wc || (wc->worker == worker)) continue;
+
+		atomic_fetch_sub_explicit(&wc->worker->num_loaned, 1, memory_order_release);
+	}
+}
+
 /** Get a runnable request
  *
  * @param[in] worker the worker
@@ -635,9 +1132,6 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	REQUEST			*request;
 	fr_dlist_t		*entry;
 	fr_listen_t const	*listen;
-#ifndef HAVE_TALLOC_POOLED_OBJECT
-	TALLOC_CTX		*ctx;
-#endif
 
 	/*
 	 *	Grab a runnable request, and resume it.
@@ -651,13 +1145,18 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 
 	/*
 	 *	Find either a localized message, or one which is in
-	 *	the "to_decode" queue.
+	 *	the "to_decode" queue.  If we have nothing to do, try
+	 *	to steal a message from another worker.
 	 */
 	do {
 		WORKER_HEAP_POP(localized, cd, request.list);
 		if (!cd) {
+			PTHREAD_MUTEX_LOCK(&worker->mutex);
 			WORKER_HEAP_POP(to_decode, cd, request.list);
+			if (cd) WORKER_TO_DECODE_COUNT(worker);
+			PTHREAD_MUTEX_UNLOCK(&worker->mutex);
 		}
+		if (!cd && worker->peers) cd = fr_worker_steal(worker);
 		if (!cd) return NULL;
 
 		worker->num_decoded++;
@@ -674,17 +1173,11 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 		}
 	} while (!cd);
 
-	ctx = request = request_alloc(NULL);
+	request = fr_worker_request_alloc(worker, cd->listen->server_cs);
 	if (!request) goto nak;
 
 	request->el = worker->el;
 	request->backlog = worker->runnable;
-	request->packet = fr_radius_alloc(request, false);
-	rad_assert(request->packet != NULL);
-	request->reply = fr_radius_alloc(request, false);
-	rad_assert(request->reply != NULL);
-
-	request->async = talloc_zero(request, fr_async_t);
 	request->server_cs = cd->listen->server_cs;
 
 	/*
@@ -725,7 +1218,7 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 
 	if (ret < 0) {
 		fr_log(worker->log, L_DBG, "\t%sFAILED decode of request %"PRIu64, worker->name, request->number);
-		talloc_free(ctx);
+		fr_worker_request_release(worker, request);
 nak:
 		fr_worker_nak(worker, cd, fr_time());
 		return NULL;
@@ -901,16 +1394,21 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 	 *	more to do, we need to tell the other end of the
 	 *	channels that we're sleeping.
 	 */
+	PTHREAD_MUTEX_LOCK(&worker->mutex);
 	sleeping = (fr_heap_num_elements(worker->runnable) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->localized.heap) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->to_decode.heap) == 0);
+	if (sleeping && worker->peers) sleeping = !fr_worker_can_steal(worker);
 
 	/*
 	 *	Tell the event loop that there is new work to do.  We
 	 *	don't want to wait for events, but instead check them,
 	 *	and start processing packets immediately.
 	 */
-	if (!sleeping) return 1;
+	if (!sleeping) {
+		PTHREAD_MUTEX_UNLOCK(&worker->mutex);
+		return 1;
+	}
 
 	fr_log(worker->log, L_DBG, "\t%ssleeping running %zd, localized %zd, to_decode %zd",
 	       worker->name,
@@ -932,6 +1430,7 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 
 		(void) fr_channel_worker_sleeping(worker->channel[i]);
 	}
+	PTHREAD_MUTEX_UNLOCK(&worker->mutex);
 
 	return 0;
 }
@@ -977,15 +1476,40 @@ void fr_worker_destroy(fr_worker_t *worker)
 
 	WORKER_VERIFY;
 
+	if (worker->peers) {
+		/*
+		 *	Return our loans before waiting for other
+		 *	workers to return theirs.  Otherwise two
+		 *	exiting workers could wait for each other.
+		 */
+		fr_worker_loans_return(worker, &worker->time_order);
+		fr_worker_loans_return(worker, &worker->waiting_to_die);
+
+		/*
+		 *	Wait until no thief can still be holding a
+		 *	pointer to us, and until the requests which
+		 *	were stolen from us are done with our
+		 *	channels.  The order of the checks matters,
+		 *	see fr_worker_steal().
+		 */
+		while ((atomic_load_explicit(&worker->peers->num_stealing, memory_order_seq_cst) > 0) ||
+		       (atomic_load_explicit(&worker->num_loaned, memory_order_acquire) > 0)) {
+			usleep(1000);
+		}
+	}
+
 	/*
 	 *	These messages aren't in the channel, so we have to
 	 *	mark them as unused.
 	 */
+	PTHREAD_MUTEX_LOCK(&worker->mutex);
 	while (true) {
 		WORKER_HEAP_POP(to_decode, cd, request.list);
 		if (!cd) break;
 		fr_message_done(&cd->m);
 	}
+	WORKER_TO_DECODE_COUNT(worker);
+	PTHREAD_MUTEX_UNLOCK(&worker->mutex);
 
 	while (true) {
 		WORKER_HEAP_POP(localized, cd, request.list);
@@ -1008,6 +1532,13 @@ void fr_worker_destroy(fr_worker_t *worker)
 		fr_channel_worker_ack_close(worker->channel[i]);
 	}
 
+	/*
+	 *	The cached requests aren't parented by the worker.
+	 */
+	for (i = 0; i < worker->num_free_requests; i++) {
+		talloc_free(worker->free_requests[i]);
+	}
+
 	(void) fr_event_pre_delete(worker->el, fr_worker_pre_event, worker);
 	(void) fr_event_post_delete(worker->el, fr_worker_post_event, worker);
 
@@ -1040,6 +1571,10 @@ nomem:
 	worker->name = "";
 	worker->flags = flags;
 
+	atomic_init(&worker->exiting, false);
+	atomic_init(&worker->num_to_decode, 0);
+	atomic_init(&worker->num_loaned, 0);
+
 	worker->channel = talloc_zero_array(worker, fr_channel_t *, max_channels);
 	if (!worker->channel) {
 		talloc_free(worker);
@@ -1053,10 +1588,17 @@ nomem:
 	 *	@todo make these configurable
 	 */
 	worker->max_channels = max_channels;
-	worker->talloc_pool_size = 4096; /* at least enough for a REQUEST */
+	worker->talloc_pool_size = 16384; /* a REQUEST, and its attributes */
+	worker->max_free_requests = 128;
 	worker->message_set_size = 1024;
 	worker->ring_buffer_size = (1 << 16);
 
+	worker->free_requests = talloc_zero_array(worker, REQUEST *, worker->max_free_requests);
+	if (!worker->free_requests) {
+		talloc_free(worker);
+		goto nomem;
+	}
+
 	if (fr_event_pre_insert(worker->el, fr_worker_pre_event, worker) < 0) {
 		fr_strerror_printf("Failed adding pre-check to event list");
 		talloc_free(worker);
@@ -1101,6 +1643,13 @@ nomem:
 		goto fail2;
 	}
 
+#ifdef HAVE_PTHREAD_H
+	if (pthread_mutex_init(&worker->mutex, NULL) != 0) {
+		fr_strerror_printf("Failed initializing mutex");
+		goto fail2;
+	}
+#endif
+
 	WORKER_HEAP_INIT(to_decode, worker_message_cmp, fr_channel_data_t, channel.heap_id);
 	WORKER_HEAP_INIT(localized, worker_message_cmp, fr_channel_data_t, channel.heap_id);
 
@@ -1154,7 +1703,7 @@ fr_event_list_t *fr_worker_el(fr_worker_t *worker)
  */
 void fr_worker_exit(fr_worker_t *worker)
 {
-	worker->exiting = true;
+	atomic_store_explicit(&worker->exiting, true, memory_order_seq_cst);
 
 	fr_event_loop_exit(worker->el, 1);
 }
@@ -1230,7 +1779,7 @@ void fr_worker(fr_worker_t *worker)
 		num_events = fr_event_corral(worker->el, wait_for_event);
 		fr_log(worker->log, L_DBG, "\t%sGot num_events %d", worker->name, num_events);
 		if (num_events < 0) {
-			if (worker->exiting) break; /* don't complain if we're exiting */
+			if (atomic_load_explicit(&worker->exiting, memory_order_relaxed)) break; /* don't complain if we're exiting */
 
 			fr_log(worker->log, L_ERR, "Failed corraling events: %s", fr_strerror());
 			break;
@@ -1254,11 +1803,31 @@ void fr_worker(fr_worker_t *worker)
  */
 void fr_worker_debug(fr_worker_t *worker, FILE *fp)
 {
+	int i;
+
 	WORKER_VERIFY;
 
 	fprintf(fp, "\tkq = %d\n", worker->kq);
 	fprintf(fp, "\tnum_channels = %d\n", worker->num_channels);
 	fprintf(fp, "\tnum_requests = %d\n", worker->num_requests);
+	fprintf(fp, "\tnum_stolen = %d\n", worker->num_stolen);
+	fprintf(fp, "\tnum_pool_hits = %d\n", worker->num_pool_hits);
+	fprintf(fp, "\tnum_pool_misses = %d\n", worker->num_pool_misses);
+	fprintf(fp, "\tnum_released = %" PRIu64 "\n", worker->num_released);
+	fprintf(fp, "\tnum_measured = %" PRIu64 "\n", worker->num_measured);
+	fprintf(fp, "\tnum_pool_overflows = %" PRIu64 "\n", worker->num_pool_overflows);
+	fprintf(fp, "\trequest_mem_total = %" PRIu64 "\n", worker->request_mem_total);
+	fprintf(fp, "\trequest_mem_max = %zu\n", worker->request_mem_max);
+
+	for (i = 0; i < worker->num_pool_stats; i++) {
+		fr_worker_pool_stats_t *stats = &worker->pool_stats[i];
+
+		fprintf(fp, "\tserver %s pool_size = %zu measured = %" PRIu64 " overflows = %" PRIu64
+			" (%" PRIu64 "%%)\n",
+			stats->server_cs ? cf_section_name2(stats->server_cs) : "-", stats->pool_size,
+			stats->num_requests, stats->num_overflows,
+			stats->num_requests ? (stats->num_overflows * 100) / stats->num_requests : 0);
+	}
 
 	fprintf(fp, "\tcalculated (predicted) total CPU time = %zd\n", worker->tracking.predicted * worker->num_requests);
 	fprintf(fp, "\tcalculated (counted) per request time = %zd\n", worker->tracking.running / worker->num_requests);
@@ -1314,6 +1883,73 @@ void fr_worker_name(fr_worker_t *worker, char const *name)
 }
 
 
+/** Create the array of workers which can steal messages from each other.
+ *
+ *  The array is shared by all of the workers, and MUST outlive them.
+ *
+ * @param[in] ctx the talloc context
+ * @param[in] num_workers the maximum number of workers
+ * @return
+ *	- NULL on error
+ *	- fr_worker_peers_t on success
+ */
+fr_worker_peers_t *fr_worker_peers_create(TALLOC_CTX *ctx, int num_workers)
+{
+	int i;
+	fr_worker_peers_t *peers;
+
+	peers = talloc_zero(ctx, fr_worker_peers_t);
+	if (!peers) return NULL;
+
+	peers->worker = talloc_zero_array(peers, fr_worker_ptr_t, num_workers);
+	if (!peers->worker) {
+		talloc_free(peers);
+		return NULL;
+	}
+	peers->num_workers = num_workers;
+
+	atomic_init(&peers->num_stealing, 0);
+	for (i = 0; i < num_workers; i++) atomic_init(&peers->worker[i], NULL);
+
+	return peers;
+}
+
+/** Let a worker steal messages from its peers, and let them steal from it.
+ *
+ *  MUST be called before fr_worker() starts running.
+ *
+ * @param[in] peers the array of workers
+ * @param[in] id the index of this worker in the array
+ * @param[in] worker the worker
+ */
+void fr_worker_peers_add(fr_worker_peers_t *peers, int id, fr_worker_t *worker)
+{
+	WORKER_VERIFY;
+
+	rad_assert((id >= 0) && (id < peers->num_workers));
+
+	worker->peers = peers;
+	atomic_store_explicit(&peers->worker[id], worker, memory_order_release);
+}
+
+/** Stop the workers from stealing from each other.
+ *
+ *  Workers which are already looking at the array will finish
+ *  stealing, and the workers they steal from will wait for them in
+ *  fr_worker_destroy().
+ *
+ * @param[in] peers the array of workers
+ */
+void fr_worker_peers_clear(fr_worker_peers_t *peers)
+{
+	int i;
+
+	for (i = 0; i < peers->num_workers; i++) {
+		atomic_store_explicit(&peers->worker[i], NULL, memory_order_seq_cst);
+	}
+}
+
+
 #ifndef NDEBUG
 /** Verify the worker data structures.
  *
@@ -44,6 +44,11 @@ extern "C" {
  */
 typedef struct fr_worker_t fr_worker_t;
 
+/**
+ *  The workers which can steal messages from each other.
+ */
+typedef struct fr_worker_peers_t fr_worker_peers_t;
+
 fr_worker_t *fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t const *logger, uint32_t flags) CC_HINT(nonnull(2,3));
 void fr_worker_destroy(fr_worker_t *worker) CC_HINT(nonnull);
 int fr_worker_kq(fr_worker_t *worker) CC_HINT(nonnull);
@@ -52,6 +57,9 @@ void fr_worker(fr_worker_t *worker) CC_HINT(nonnull);
 void fr_worker_exit(fr_worker_t *worker) CC_HINT(nonnull);
 void fr_worker_debug(fr_worker_t *worker, FILE *fp) CC_HINT(nonnull);
 void fr_worker_name(fr_worker_t *worker, char const *name) CC_HINT(nonnull);
+fr_worker_peers_t *fr_worker_peers_create(TALLOC_CTX *ctx, int num_workers);
+void fr_worker_peers_add(fr_worker_peers_t *peers, int id, fr_worker_t *worker) CC_HINT(nonnull);
+void fr_worker_peers_clear(fr_worker_peers_t *peers) CC_HINT(nonnull);
 fr_channel_t *fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_control_t *master) CC_HINT(nonnull);
 
 #ifdef __cplusplus
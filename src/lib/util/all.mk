@@ -43,7 +43,9 @@ SOURCES		:= base64.c \
 		   syserror.c \
 		   socket.c \
 		   talloc.c \
+		   time.c \
 		   token.c \
+		   trie.c \
 		   udpfromto.c \
 		   udp.c \
 		   value.c \
@@ -29,13 +29,23 @@ RCSID("$Id$")
 #endif
 
 #include <ctype.h>
+#include <fcntl.h>
 
 #ifdef HAVE_SYS_STAT_H
 #  include <sys/stat.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
+
 #define MAX_ARGV (16)
 
+/*
+ *	Largest direct index of child attributes, as a number of bits.
+ */
+#define DICT_CHILD_INDEX_BITS (16)
+
 /** Magic internal dictionary
  *
  * Internal dictionary is checked in addition to the protocol dictionary
@@ -52,6 +62,7 @@ fr_dict_t	*fr_dict_internal = NULL;	//!< Internal server dictionary.
  */
 typedef struct dict_stat_t {
 	struct dict_stat_t *next;
+	char *path;			//!< of the file, used when writing snapshots.
 	struct stat stat_buf;
 } dict_stat_t;
 
@@ -93,6 +104,11 @@ struct fr_dict {
 
 	fr_dict_attr_t		*root;			//!< Root attribute of this dictionary.
 	TALLOC_CTX		*pool;			//!< Talloc memory pool to reduce allocs.
+
+	bool			read_extra;		//!< Definitions were added after fr_dict_from_file(),
+							//!< so the dictionary no longer matches its files.
+	bool			has_cast_types;		//!< The Tmp-Cast-* attributes were added to this dictionary.
+	bool			from_snapshot;		//!< Loaded from the precompiled snapshot.
 };
 
 /** Map data types to names representing those types
@@ -240,6 +256,12 @@ bool const fr_dict_non_data_types[FR_TYPE_MAX + 1] = {
 #define FNV_MAGIC_INIT (0x811c9dc5)
 #define FNV_MAGIC_PRIME (0x01000193)
 
+/*
+ *	Highest attribute number seen in the root of any dictionary.
+ *	Attributes added with a number of -1 are numbered from here.
+ */
+static unsigned int root_max_attr = UINT8_MAX + 1;
+
 #ifdef __clang_analyzer__
 #  define INTERNAL_IF_NULL(_dict) do {\
 	if (!_dict) _dict = fr_dict_internal; \
@@ -426,13 +448,14 @@ static int dict_enum_value_cmp(void const *one, void const *two)
 
 /** Add an entry to the list of stat buffers.
  */
-static void dict_stat_add(fr_dict_t *dict, struct stat const *stat_buf)
+static void dict_stat_add(fr_dict_t *dict, char const *path, struct stat const *stat_buf)
 {
 	dict_stat_t *this;
 
 	this = talloc_zero(dict, dict_stat_t);
 	if (!this) return;
 
+	this->path = talloc_typed_strdup(this, path);
 	memcpy(&(this->stat_buf), stat_buf, sizeof(this->stat_buf));
 
 	if (!dict->stat_head) {
@@ -667,6 +690,106 @@ static inline int fr_dict_attr_child_add(fr_dict_attr_t *parent, fr_dict_attr_t
 	child->next = *this;
 	*this = child;
 
+	/*
+	 *	Keep the direct index in sync with the bins, for
+	 *	attributes added after the dictionary was loaded.
+	 */
+	if (child->attr < parent->child_index_len) {
+		fr_dict_attr_t const *p;
+
+		for (p = parent->children[child->attr & 0xff]; p; p = p->next) if (p->attr == child->attr) break;
+		parent->child_index[child->attr] = p;
+	}
+
+	return 0;
+}
+
+/** Build direct indexes of the children of an attribute, and its descendents
+ *
+ * The bins in the children array are keyed by (attr & 0xff), so
+ * attribute spaces with 16-bit numbers (WiMAX, 3GPP2, DHCPv6...) end
+ * up in long chains, which are walked for every attribute decoded.
+ *
+ * The index maps attribute numbers directly to children.  It covers
+ * attribute numbers from zero, up to the point where it would be
+ * mostly empty.  Attributes with higher numbers are found via the bins.
+ *
+ * @param[in] da	to index the children of.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure (memory allocation error).
+ */
+static int dict_attr_child_index_build(fr_dict_attr_t *da)
+{
+	unsigned int		below[DICT_CHILD_INDEX_BITS + 1];
+	unsigned int		i, bits, len = 0;
+	size_t			num_bins;
+	fr_dict_attr_t const	*p;
+
+	talloc_free(da->child_index);
+	da->child_index = NULL;
+	da->child_index_len = 0;
+
+	if (!da->children) return 0;
+
+	num_bins = talloc_array_length(da->children);
+
+	/*
+	 *	Count the children which would be covered by
+	 *	indexes of each (power of 2) size.
+	 */
+	memset(below, 0, sizeof(below));
+	for (i = 0; i < num_bins; i++) {
+		for (p = da->children[i]; p; p = p->next) {
+			for (bits = 8; bits <= DICT_CHILD_INDEX_BITS; bits++) {
+				if (p->attr < (1U << bits)) below[bits]++;
+			}
+		}
+	}
+
+	/*
+	 *	Pick the largest index which is at least a quarter
+	 *	full.  The first 256 attribute numbers are always
+	 *	indexed, as there are usually more bins than that.
+	 */
+	for (bits = DICT_CHILD_INDEX_BITS; bits > 8; bits--) {
+		if ((below[bits] * 4) >= (1U << bits)) break;
+	}
+	if (below[bits] == 0) goto recurse;
+
+	/*
+	 *	Trim the index to the highest attribute it covers.
+	 */
+	for (i = 0; i < num_bins; i++) {
+		for (p = da->children[i]; p; p = p->next) {
+			if ((p->attr < (1U << bits)) && (p->attr >= len)) len = p->attr + 1;
+		}
+	}
+
+	da->child_index = talloc_zero_array(da, fr_dict_attr_t const *, len);
+	if (!da->child_index) return -1;
+	da->child_index_len = len;
+
+	/*
+	 *	The first child in a bin with a given number is
+	 *	the one which is returned when searching the bins.
+	 */
+	for (i = 0; i < num_bins; i++) {
+		for (p = da->children[i]; p; p = p->next) {
+			if ((p->attr < len) && !da->child_index[p->attr]) da->child_index[p->attr] = p;
+		}
+	}
+
+recurse:
+	for (i = 0; i < num_bins; i++) {
+		for (p = da->children[i]; p; p = p->next) {
+			fr_dict_attr_t *child;
+
+			memcpy(&child, &p, sizeof(child));
+			if (dict_attr_child_index_build(child) < 0) return -1;
+		}
+	}
+
 	return 0;
 }
 
@@ -817,6 +940,49 @@ static fr_dict_attr_t *fr_dict_attr_alloc(TALLOC_CTX *ctx,
 	return da;
 }
 
+/** Add the IPv4 and IPv6 variants of a combo-ip attribute
+ *
+ * @param[in] dict	the attribute belongs to.
+ * @param[in] n		combo-ip attribute.
+ * @param[in] namelen	length of the attribute's name.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int dict_attr_combo_add(fr_dict_t *dict, fr_dict_attr_t const *n, size_t namelen)
+{
+	fr_dict_attr_t *v4, *v6;
+
+	v4 = (fr_dict_attr_t *)talloc_zero_array(dict->pool, uint8_t, sizeof(*v4) + namelen);
+	if (!v4) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+	talloc_set_type(v4, fr_dict_attr_t);
+
+	v6 = (fr_dict_attr_t *)talloc_zero_array(dict->pool, uint8_t, sizeof(*v6) + namelen);
+	if (!v6) goto oom;
+	talloc_set_type(v6, fr_dict_attr_t);
+
+	memcpy(v4, n, sizeof(*v4) + namelen);
+	v4->type = FR_TYPE_IPV4_ADDR;
+
+	memcpy(v6, n, sizeof(*v6) + namelen);
+	v6->type = FR_TYPE_IPV6_ADDR;
+	if (!fr_hash_table_replace(dict->attributes_combo, v4)) {
+		fr_strerror_printf("Failed inserting IPv4 version of combo attribute");
+		return -1;
+	}
+
+	if (!fr_hash_table_replace(dict->attributes_combo, v6)) {
+		fr_strerror_printf("Failed inserting IPv6 version of combo attribute");
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Add an attribute to the name table for the dictionary.
  *
  * @todo we need to check length of none vendor attributes.
@@ -874,19 +1040,17 @@ static fr_dict_attr_t *fr_dict_attr_add_by_name(fr_dict_t *dict, fr_dict_attr_t
 	/******************** sanity check attribute number ********************/
 
 	if (parent->flags.is_root) {
-		static unsigned int max_attr = UINT8_MAX + 1;
-
 		if (attr == -1) {
 			if (fr_dict_attr_by_name(dict, name)) return 0; /* exists, don't add it again */
-			attr = ++max_attr;
+			attr = ++root_max_attr;
 			flags.internal = 1;
 
 		} else if (attr <= 0) {
 			fr_strerror_printf("ATTRIBUTE number %i is invalid, must be greater than zero", attr);
 			goto error;
 
-		} else if ((unsigned int) attr > max_attr) {
-			max_attr = attr;
+		} else if ((unsigned int) attr > root_max_attr) {
+			root_max_attr = attr;
 		}
 
 		/*
@@ -1412,7 +1576,6 @@ static fr_dict_attr_t *fr_dict_attr_add_by_name(fr_dict_t *dict, fr_dict_attr_t
 
 	n = fr_dict_attr_alloc(dict->pool, parent, name, vendor, attr, type, &flags);
 	if (!n) {
-	oom:
 		fr_strerror_printf("Out of memory");
 		goto error;
 	}
@@ -1455,32 +1618,7 @@ static fr_dict_attr_t *fr_dict_attr_add_by_name(fr_dict_t *dict, fr_dict_attr_t
 	/*
 	 *	Hacks for combo-IP
 	 */
-	if (n->type == FR_TYPE_COMBO_IP_ADDR) {
-		fr_dict_attr_t *v4, *v6;
-
-		v4 = (fr_dict_attr_t *)talloc_zero_array(dict->pool, uint8_t, sizeof(*v4) + namelen);
-		if (!v4) goto oom;
-		talloc_set_type(v4, fr_dict_attr_t);
-
-		v6 = (fr_dict_attr_t *)talloc_zero_array(dict->pool, uint8_t, sizeof(*v6) + namelen);
-		if (!v6) goto oom;
-		talloc_set_type(v6, fr_dict_attr_t);
-
-		memcpy(v4, n, sizeof(*v4) + namelen);
-		v4->type = FR_TYPE_IPV4_ADDR;
-
-		memcpy(v6, n, sizeof(*v6) + namelen);
-		v6->type = FR_TYPE_IPV6_ADDR;
-		if (!fr_hash_table_replace(dict->attributes_combo, v4)) {
-			fr_strerror_printf("Failed inserting IPv4 version of combo attribute");
-			goto error;
-		}
-
-		if (!fr_hash_table_replace(dict->attributes_combo, v6)) {
-			fr_strerror_printf("Failed inserting IPv6 version of combo attribute");
-			goto error;
-		}
-	}
+	if ((n->type == FR_TYPE_COMBO_IP_ADDR) && (dict_attr_combo_add(dict, n, namelen) < 0)) goto error;
 
 	return n;
 }
@@ -2349,7 +2487,7 @@ static int _dict_from_file(dict_from_file_ctx_t *ctx,
 	}
 #endif
 
-	dict_stat_add(ctx->dict, &statbuf);
+	dict_stat_add(ctx->dict, fn, &statbuf);
 
 	/*
 	 *	Seed the random pool with data.
@@ -2672,45 +2810,753 @@ static int dict_from_file(fr_dict_t *dict,
 
 static bool defined_cast_types = false;
 
-/** (re)initialize a protocol dictionary
+/*
+ *	Precompiled dictionary snapshots.
  *
- * Initialize the directory, then fix the attr member of all attributes.
+ *	Parsing the text dictionaries is a large part of startup
+ *	time.  A snapshot is a flat, pointer-free copy of the vendors,
+ *	attributes and enums of a dictionary, written by raddict when
+ *	the dictionaries are installed.  On startup we map it, check
+ *	it against the source files, and decode it directly into the
+ *	dictionary, skipping the parser and all of its sanity checks.
  *
- * First dictionary initialised will be set as the default internal dictionary.
+ *	Integers are in host byte order.  The header records enough
+ *	about the build that snapshots from other architectures or
+ *	other versions of the server are ignored, and the text files
+ *	are read instead.
+ */
+#define DICT_SNAPSHOT_MAGIC	(0x46524443)		/* "FRDC" */
+#define DICT_SNAPSHOT_VERSION	(1)
+#define DICT_SNAPSHOT_ENDIAN	(0x01020304)
+#define DICT_SNAPSHOT_EXT	".snapshot"
+
+typedef struct dict_snapshot_hdr_t {
+	uint32_t		magic;
+	uint32_t		version;
+	uint32_t		endian;			//!< Detects snapshots from other architectures.
+	uint32_t		flags_size;		//!< sizeof(fr_dict_attr_flags_t).
+	uint64_t		build;			//!< RADIUSD_MAGIC_NUMBER of the writer.
+	uint32_t		attr_size;		//!< sizeof(fr_dict_attr_t).
+	uint32_t		type_max;		//!< FR_TYPE_MAX.
+	uint32_t		has_cast_types;		//!< Snapshot contains the Tmp-Cast-* attributes.
+	uint32_t		root_max_attr;		//!< After the writer loaded the dictionary.
+	uint32_t		num_files;
+	uint32_t		num_vendors;
+	uint32_t		num_attrs;
+	uint32_t		num_enums;
+	uint32_t		body_len;		//!< Length of the records following the header.
+	uint32_t		checksum;		//!< fr_hash() of the records.
+} dict_snapshot_hdr_t;
+
+/*
+ *	Each record is followed by its variable length data.  Strings
+ *	are written with their trailing '\0', which isn't included in
+ *	the length.
+ */
+typedef struct dict_snapshot_file_t {
+	int64_t			mtime;
+	uint64_t		size;
+	uint32_t		in_dir;			//!< Path is relative to the dictionary directory.
+	uint32_t		path_len;
+} dict_snapshot_file_t;
+
+typedef struct dict_snapshot_vendor_t {
+	uint32_t		vendorpec;
+	uint32_t		type;
+	uint32_t		length;
+	uint32_t		flags;
+	uint32_t		by_num;			//!< Vendor is in vendors_by_num.
+	uint32_t		name_len;
+} dict_snapshot_vendor_t;
+
+typedef struct dict_snapshot_attr_t {
+	uint32_t		parent;			//!< Record number of the parent, 0 for the root.
+	uint32_t		attr;
+	uint32_t		vendor;
+	uint32_t		type;
+	uint32_t		by_name;		//!< Attribute is in attributes_by_name.
+	uint32_t		name_len;		//!< Name follows the fr_dict_attr_flags_t.
+} dict_snapshot_attr_t;
+
+typedef struct dict_snapshot_enum_t {
+	uint32_t		da;			//!< Record number of the attribute.
+	uint32_t		by_value;		//!< Enum is in values_by_da.
+	uint32_t		type;
+	uint32_t		alias_len;
+	uint32_t		value_len;		//!< Value, in network format, follows the alias.
+} dict_snapshot_enum_t;
+
+/** State for writing a snapshot
  *
- * @param[in] ctx to allocate the dictionary from.
- * @param[out] out Where to write a pointer to the new dictionary.  Will free existing
- *	dictionary if files have changed and *out is not NULL.
- * @param[in] dir to read dictionary files from.
- * @param[in] fn file name to read.
- * @param[in] name to use for the root attributes.
+ */
+typedef struct dict_snapshot_ctx_t {
+	fr_dict_t		*dict;
+	uint8_t			*buf;			//!< Records, grown as needed.
+	size_t			used;			//!< How much of buf is used.
+	fr_hash_table_t		*index;			//!< Maps attributes to their record numbers.
+	uint32_t		num_vendors;
+	uint32_t		num_attrs;
+	uint32_t		num_enums;
+} dict_snapshot_ctx_t;
+
+typedef struct dict_snapshot_index_t {
+	fr_dict_attr_t const	*da;
+	uint32_t		num;
+} dict_snapshot_index_t;
+
+static uint32_t dict_snapshot_index_hash(void const *data)
+{
+	dict_snapshot_index_t const *idx = data;
+
+	return fr_hash(&idx->da, sizeof(idx->da));
+}
+
+static int dict_snapshot_index_cmp(void const *one, void const *two)
+{
+	dict_snapshot_index_t const *a = one, *b = two;
+
+	return (a->da > b->da) - (a->da < b->da);
+}
+
+/** Append data to the snapshot records
+ *
+ */
+static int dict_snapshot_append(dict_snapshot_ctx_t *sc, void const *data, size_t len)
+{
+	size_t size = talloc_array_length(sc->buf);
+
+	if ((sc->used + len) > size) {
+		uint8_t *buf;
+
+		while (size < (sc->used + len)) size *= 2;
+
+		buf = talloc_realloc(sc, sc->buf, uint8_t, size);
+		if (!buf) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+		sc->buf = buf;
+	}
+
+	if (len) memcpy(sc->buf + sc->used, data, len);
+	sc->used += len;
+
+	return 0;
+}
+
+/** Append a string, and its trailing '\0' to the snapshot records
+ *
+ */
+static inline int dict_snapshot_append_str(dict_snapshot_ctx_t *sc, char const *str, size_t len)
+{
+	return dict_snapshot_append(sc, str, len + 1);
+}
+
+static int _dict_snapshot_write_vendor(void *ctx, void *data)
+{
+	dict_snapshot_ctx_t	*sc = ctx;
+	fr_dict_vendor_t const	*dv = data;
+	dict_snapshot_vendor_t	rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.vendorpec = dv->vendorpec;
+	rec.type = dv->type;
+	rec.length = dv->length;
+	rec.flags = dv->flags;
+	rec.by_num = (fr_hash_table_finddata(sc->dict->vendors_by_num, dv) == dv);
+	rec.name_len = strlen(dv->name);
+
+	if ((dict_snapshot_append(sc, &rec, sizeof(rec)) < 0) ||
+	    (dict_snapshot_append_str(sc, dv->name, rec.name_len) < 0)) return -1;
+
+	sc->num_vendors++;
+
+	return 0;
+}
+
+/** Write an attribute and its children, depth first
+ *
+ * Children are written in bin order, so appending them to the bins
+ * of their parent when loading reproduces the original tree.
+ */
+static int dict_snapshot_write_attr(dict_snapshot_ctx_t *sc, fr_dict_attr_t const *da, uint32_t parent)
+{
+	dict_snapshot_attr_t	rec;
+	dict_snapshot_index_t	*idx;
+	fr_dict_attr_t const	*p;
+	size_t			i, len;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.parent = parent;
+	rec.attr = da->attr;
+	rec.vendor = da->vendor;
+	rec.type = da->type;
+	rec.by_name = (fr_hash_table_finddata(sc->dict->attributes_by_name, da) == da);
+	rec.name_len = strlen(da->name);
+
+	if ((dict_snapshot_append(sc, &rec, sizeof(rec)) < 0) ||
+	    (dict_snapshot_append(sc, &da->flags, sizeof(da->flags)) < 0) ||
+	    (dict_snapshot_append_str(sc, da->name, rec.name_len) < 0)) return -1;
+
+	idx = talloc_zero(sc, dict_snapshot_index_t);
+	if (!idx) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+	idx->da = da;
+	idx->num = ++sc->num_attrs;
+
+	if (!fr_hash_table_insert(sc->index, idx)) {
+		fr_strerror_printf("Attribute \"%s\" appears twice in the dictionary tree", da->name);
+		return -1;
+	}
+
+	len = talloc_array_length(da->children);
+	for (i = 0; i < len; i++) {
+		for (p = da->children[i]; p; p = p->next) {
+			if (dict_snapshot_write_attr(sc, p, idx->num) < 0) return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int _dict_snapshot_write_enum(void *ctx, void *data)
+{
+	dict_snapshot_ctx_t	*sc = ctx;
+	fr_dict_enum_t const	*enumv = data;
+	dict_snapshot_enum_t	rec;
+	dict_snapshot_index_t	find, *idx;
+	uint8_t			buffer[256], *value = buffer;
+	size_t			need = 0;
+	ssize_t			slen;
+
+	find.da = enumv->da;
+	idx = fr_hash_table_finddata(sc->index, &find);
+	if (!idx) {
+		fr_strerror_printf("VALUE \"%s\" references an attribute which isn't in the dictionary",
+				   enumv->alias);
+		return -1;
+	}
+
+	slen = fr_value_box_to_network(&need, buffer, sizeof(buffer), enumv->value);
+	if (slen < 0) return -1;
+	if (need) {
+		value = talloc_array(sc, uint8_t, need);
+		if (!value) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+		slen = fr_value_box_to_network(NULL, value, need, enumv->value);
+		if (slen < 0) return -1;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.da = idx->num;
+	rec.by_value = (fr_hash_table_finddata(sc->dict->values_by_da, enumv) == enumv);
+	rec.type = enumv->value->type;
+	rec.alias_len = strlen(enumv->alias);
+	rec.value_len = slen;
+
+	if ((dict_snapshot_append(sc, &rec, sizeof(rec)) < 0) ||
+	    (dict_snapshot_append_str(sc, enumv->alias, rec.alias_len) < 0) ||
+	    (dict_snapshot_append(sc, value, slen) < 0)) return -1;
+
+	if (value != buffer) talloc_free(value);
+
+	sc->num_enums++;
+
+	return 0;
+}
+
+/** Write all of a buffer to a file descriptor
+ *
+ */
+static int dict_snapshot_write_fd(int fd, void const *data, size_t len)
+{
+	uint8_t const	*p = data;
+	ssize_t		slen;
+
+	while (len > 0) {
+		slen = write(fd, p, len);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += slen;
+		len -= slen;
+	}
+
+	return 0;
+}
+
+/** Write a precompiled snapshot of a dictionary
+ *
+ * The snapshot is written to "<dir>/<fn>.snapshot", and is used by
+ * #fr_dict_from_file when loading the same dictionary, so long as
+ * none of the files it was built from have changed.
+ *
+ * If the dictionary was loaded from its snapshot, the snapshot is
+ * already up to date, and isn't written again.
+ *
+ * @param[in] dict	to write.  Must have been loaded with #fr_dict_from_file,
+ *			and not extended since.
+ * @param[in] dir	the dictionary was loaded from.
+ * @param[in] fn	the dictionary was loaded from.
  * @return
+ *	- 1 if the snapshot was already up to date.
  *	- 0 on success.
  *	- -1 on failure.
  */
-int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char const *fn, char const *name)
+int fr_dict_snapshot_write(fr_dict_t *dict, char const *dir, char const *fn)
 {
-	fr_dict_t *dict;
+	dict_snapshot_ctx_t	*sc;
+	dict_snapshot_hdr_t	hdr;
+	dict_stat_t		*ds;
+	size_t			dir_len;
+	char			path[2048], tmp[sizeof(path) + 8];
+	int			fd;
+	int			ret = -1;
 
-	if (!*out) {
-		/* Pre-Allocate 5MB of pool memory for rapid startup */
-		dict = talloc_zero(ctx, fr_dict_t);
-		dict->pool = talloc_pool(dict, (1024 * 1024 * 5));
-	} else {
-		dict = *out;
-		if (dict_stat_check(dict, dir, fn)) return 0;
+	INTERNAL_IF_NULL(dict);
+
+	if (dict->read_extra) {
+		fr_strerror_printf("%s: Dictionary has been extended since it was loaded, "
+				   "and no longer matches its files", __FUNCTION__);
+		return -1;
 	}
 
 	/*
-	 *	Free the old dictionaries
+	 *	Loading it checked the build, the checksum, and
+	 *	every file it was built from.
 	 */
-	if (*out == fr_dict_internal) fr_dict_internal = dict;
-	TALLOC_FREE(*out);
+	if (dict->from_snapshot) return 1;
+
+	snprintf(path, sizeof(path), "%s/%s" DICT_SNAPSHOT_EXT, dir, fn);
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+	sc = talloc_zero(NULL, dict_snapshot_ctx_t);
+	if (!sc) {
+	oom:
+		fr_strerror_printf("%s: Out of memory", __FUNCTION__);
+		goto done;
+	}
+	sc->dict = dict;
+	sc->buf = talloc_array(sc, uint8_t, 64 * 1024);
+	if (!sc->buf) goto oom;
+	sc->index = fr_hash_table_create(sc, dict_snapshot_index_hash, dict_snapshot_index_cmp, NULL);
+	if (!sc->index) goto oom;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = DICT_SNAPSHOT_MAGIC;
+	hdr.version = DICT_SNAPSHOT_VERSION;
+	hdr.endian = DICT_SNAPSHOT_ENDIAN;
+	hdr.flags_size = sizeof(fr_dict_attr_flags_t);
+	hdr.build = RADIUSD_MAGIC_NUMBER;
+	hdr.attr_size = sizeof(fr_dict_attr_t);
+	hdr.type_max = FR_TYPE_MAX;
+	hdr.has_cast_types = dict->has_cast_types;
+	hdr.root_max_attr = root_max_attr;
 
 	/*
-	 *	Remove this at some point...
+	 *	Files, with paths relative to the dictionary
+	 *	directory where possible, so that the snapshot
+	 *	can be moved along with the dictionaries.
 	 */
-	if (!fr_dict_internal) fr_dict_internal = dict;
+	dir_len = strlen(dir);
+	while ((dir_len > 1) && (dir[dir_len - 1] == FR_DIR_SEP)) dir_len--;
+
+	for (ds = dict->stat_head; ds; ds = ds->next) {
+		dict_snapshot_file_t	rec;
+		char const		*p = ds->path;
+
+		memset(&rec, 0, sizeof(rec));
+		rec.mtime = ds->stat_buf.st_mtime;
+		rec.size = ds->stat_buf.st_size;
+
+		if ((strncmp(p, dir, dir_len) == 0) && (p[dir_len] == FR_DIR_SEP)) {
+			p += dir_len + 1;
+			rec.in_dir = 1;
+		}
+		rec.path_len = strlen(p);
+
+		if ((dict_snapshot_append(sc, &rec, sizeof(rec)) < 0) ||
+		    (dict_snapshot_append_str(sc, p, rec.path_len) < 0)) goto done;
+
+		hdr.num_files++;
+	}
+
+	if (fr_hash_table_walk(dict->vendors_by_name, _dict_snapshot_write_vendor, sc) < 0) goto done;
+
+	/*
+	 *	The root is always record 0, and isn't written.
+	 */
+	{
+		fr_dict_attr_t const	*p;
+		size_t			i, len;
+
+		len = talloc_array_length(dict->root->children);
+		for (i = 0; i < len; i++) {
+			for (p = dict->root->children[i]; p; p = p->next) {
+				if (dict_snapshot_write_attr(sc, p, 0) < 0) goto done;
+			}
+		}
+	}
+
+	if (fr_hash_table_walk(dict->values_by_alias, _dict_snapshot_write_enum, sc) < 0) goto done;
+
+	hdr.num_vendors = sc->num_vendors;
+	hdr.num_attrs = sc->num_attrs;
+	hdr.num_enums = sc->num_enums;
+	hdr.body_len = sc->used;
+	hdr.checksum = fr_hash(sc->buf, sc->used);
+
+	/*
+	 *	Write to a uniquely named temporary file, and rename
+	 *	it into place, so a server starting up never sees
+	 *	half a snapshot, and two writers don't write to the
+	 *	same file.
+	 */
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		fr_strerror_printf("%s: Failed opening %s: %s", __FUNCTION__, tmp, fr_syserror(errno));
+		goto done;
+	}
+
+	if ((fchmod(fd, 0644) < 0) ||
+	    (dict_snapshot_write_fd(fd, &hdr, sizeof(hdr)) < 0) ||
+	    (dict_snapshot_write_fd(fd, sc->buf, sc->used) < 0) ||
+	    (fsync(fd) < 0)) {
+		fr_strerror_printf("%s: Failed writing %s: %s", __FUNCTION__, tmp, fr_syserror(errno));
+		close(fd);
+		unlink(tmp);
+		goto done;
+	}
+
+	if (close(fd) < 0) {
+		fr_strerror_printf("%s: Failed writing %s: %s", __FUNCTION__, tmp, fr_syserror(errno));
+		unlink(tmp);
+		goto done;
+	}
+
+	if (rename(tmp, path) < 0) {
+		fr_strerror_printf("%s: Failed renaming %s to %s: %s", __FUNCTION__, tmp, path, fr_syserror(errno));
+		unlink(tmp);
+		goto done;
+	}
+
+	ret = 0;
+
+done:
+	talloc_free(sc);
+
+	return ret;
+}
+
+/** Copy a fixed size record out of the snapshot
+ *
+ * @return
+ *	- The data following the record.
+ *	- NULL if the record is truncated.
+ */
+static uint8_t const *dict_snapshot_get(void *out, size_t outlen, uint8_t const *p, uint8_t const *end)
+{
+	if ((size_t)(end - p) < outlen) return NULL;
+
+	memcpy(out, p, outlen);
+
+	return p + outlen;
+}
+
+/** Point to a string in the snapshot
+ *
+ * @return
+ *	- The data following the string.
+ *	- NULL if the string is truncated or isn't terminated.
+ */
+static uint8_t const *dict_snapshot_get_str(char const **out, size_t len, uint8_t const *p, uint8_t const *end)
+{
+	if (((size_t)(end - p) <= len) || (p[len] != '\0')) return NULL;
+
+	*out = (char const *)p;
+
+	return p + len + 1;
+}
+
+/** Append a child to the end of its bin in the parent
+ *
+ * Unlike #fr_dict_attr_child_add, this doesn't sort the bin, as
+ * the snapshot already contains the children in bin order.
+ */
+static int dict_snapshot_child_append(fr_dict_attr_t *parent, fr_dict_attr_t *child)
+{
+	fr_dict_attr_t const **bin;
+
+	if (!parent->children) parent->children = talloc_zero_array(parent, fr_dict_attr_t const *, UINT8_MAX + 1);
+	if (!parent->children) return -1;
+
+	bin = &parent->children[child->attr & 0xff];
+	while (*bin) {
+		fr_dict_attr_t *p;
+
+		memcpy(&p, bin, sizeof(p));
+		bin = &p->next;
+	}
+	*bin = child;
+
+	return 0;
+}
+
+/** Load a dictionary from its precompiled snapshot
+ *
+ * The snapshot is only used if it was written by this build of the
+ * server, and none of the files it was built from have changed since.
+ *
+ * @param[in] dict	to populate.  Must be empty, apart from the root.
+ * @param[in] dir	to read the dictionary from.
+ * @param[in] fn	of the dictionary.
+ * @return
+ *	- 1 if the dictionary was loaded from the snapshot.
+ *	- 0 if there's no usable snapshot, and the text files should be read.
+ *	- -1 on error.  The dictionary may be partially populated.
+ */
+static int dict_snapshot_load(fr_dict_t *dict, char const *dir, char const *fn)
+{
+	char			path[2048];
+	int			fd;
+	struct stat		snap_stat;
+	dict_snapshot_hdr_t	hdr;
+	uint8_t const		*start, *p, *end;
+	TALLOC_CTX		*tmp_ctx = NULL;
+	char const		**file_paths = NULL;
+	struct stat		*file_stats = NULL;
+	fr_dict_attr_t		**attrs = NULL;
+	uint32_t		i;
+	int			ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s" DICT_SNAPSHOT_EXT, dir, fn);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return 0;
+
+	/*
+	 *	The snapshot is loaded without any checks, so it
+	 *	mustn't be easier to modify than the dictionaries.
+	 */
+	if ((fstat(fd, &snap_stat) < 0) || !S_ISREG(snap_stat.st_mode) || (snap_stat.st_mode & S_IWOTH) ||
+	    ((size_t)snap_stat.st_size < sizeof(hdr))) {
+		close(fd);
+		return 0;
+	}
+
+#ifdef HAVE_SYS_MMAN_H
+	start = mmap(NULL, snap_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (start == MAP_FAILED) return 0;
+#else
+	{
+		uint8_t *buf;
+
+		tmp_ctx = talloc_new(NULL);
+		buf = talloc_array(tmp_ctx, uint8_t, snap_stat.st_size);
+		if (!buf || (read(fd, buf, snap_stat.st_size) != snap_stat.st_size)) {
+			close(fd);
+			talloc_free(tmp_ctx);
+			return 0;
+		}
+		close(fd);
+		start = buf;
+	}
+#endif
+	end = start + snap_stat.st_size;
+
+	p = dict_snapshot_get(&hdr, sizeof(hdr), start, end);
+	if ((hdr.magic != DICT_SNAPSHOT_MAGIC) ||
+	    (hdr.version != DICT_SNAPSHOT_VERSION) ||
+	    (hdr.endian != DICT_SNAPSHOT_ENDIAN) ||
+	    (hdr.flags_size != sizeof(fr_dict_attr_flags_t)) ||
+	    (hdr.build != RADIUSD_MAGIC_NUMBER) ||
+	    (hdr.attr_size != sizeof(fr_dict_attr_t)) ||
+	    (hdr.type_max != FR_TYPE_MAX) ||
+	    (hdr.body_len != (size_t)(end - p)) ||
+	    (hdr.checksum != fr_hash(p, hdr.body_len))) goto done;
+
+	/*
+	 *	The cast attributes only go into the first
+	 *	dictionary loaded, so the snapshot has to agree.
+	 */
+	if (hdr.has_cast_types == defined_cast_types) goto done;
+
+	if (!tmp_ctx) tmp_ctx = talloc_new(NULL);
+	file_paths = talloc_zero_array(tmp_ctx, char const *, hdr.num_files);
+	file_stats = talloc_zero_array(tmp_ctx, struct stat, hdr.num_files);
+	attrs = talloc_zero_array(tmp_ctx, fr_dict_attr_t *, hdr.num_attrs + 1);
+	if (!file_paths || !file_stats || !attrs) goto done;
+
+	/*
+	 *	If any of the files have changed, ignore the snapshot.
+	 *	We don't touch the dictionary until we know we're
+	 *	using it.
+	 */
+	for (i = 0; i < hdr.num_files; i++) {
+		dict_snapshot_file_t	rec;
+		char const		*name;
+
+		if (!(p = dict_snapshot_get(&rec, sizeof(rec), p, end)) ||
+		    !(p = dict_snapshot_get_str(&name, rec.path_len, p, end))) goto done;
+
+		if (rec.in_dir) {
+			file_paths[i] = talloc_asprintf(file_paths, "%s/%s", dir, name);
+			if (!file_paths[i]) goto done;
+		} else {
+			file_paths[i] = name;
+		}
+
+		if ((stat(file_paths[i], &file_stats[i]) < 0) ||
+		    (file_stats[i].st_mtime != rec.mtime) ||
+		    ((uint64_t)file_stats[i].st_size != rec.size)) goto done;
+	}
+
+	/*
+	 *	From here on, any problem is an error, as we've
+	 *	started populating the dictionary.
+	 */
+	ret = -1;
+
+	for (i = 0; i < hdr.num_files; i++) dict_stat_add(dict, file_paths[i], &file_stats[i]);
+
+	for (i = 0; i < hdr.num_vendors; i++) {
+		dict_snapshot_vendor_t	rec;
+		char const		*name;
+		fr_dict_vendor_t	*dv;
+
+		if (!(p = dict_snapshot_get(&rec, sizeof(rec), p, end)) ||
+		    !(p = dict_snapshot_get_str(&name, rec.name_len, p, end))) goto truncated;
+
+		dv = (fr_dict_vendor_t *)talloc_zero_array(dict->pool, uint8_t, sizeof(*dv) + rec.name_len);
+		if (!dv) goto oom;
+		talloc_set_type(dv, fr_dict_vendor_t);
+
+		memcpy(dv->name, name, rec.name_len + 1);
+		dv->vendorpec = rec.vendorpec;
+		dv->type = rec.type;
+		dv->length = rec.length;
+		dv->flags = rec.flags;
+
+		if (!fr_hash_table_insert(dict->vendors_by_name, dv) ||
+		    (rec.by_num && !fr_hash_table_replace(dict->vendors_by_num, dv))) {
+			fr_strerror_printf("%s: Failed inserting vendor %s", __FUNCTION__, dv->name);
+			goto done;
+		}
+	}
+
+	attrs[0] = dict->root;
+	for (i = 1; i <= hdr.num_attrs; i++) {
+		dict_snapshot_attr_t	rec;
+		fr_dict_attr_flags_t	flags;
+		char const		*name;
+		fr_dict_attr_t		*n;
+
+		if (!(p = dict_snapshot_get(&rec, sizeof(rec), p, end)) ||
+		    !(p = dict_snapshot_get(&flags, sizeof(flags), p, end)) ||
+		    !(p = dict_snapshot_get_str(&name, rec.name_len, p, end)) ||
+		    (rec.parent >= i)) goto truncated;
+
+		n = fr_dict_attr_alloc(dict->pool, attrs[rec.parent], name, rec.vendor, rec.attr, rec.type, &flags);
+		if (!n) goto done;
+
+		if (dict_snapshot_child_append(attrs[rec.parent], n) < 0) goto oom;
+
+		if (rec.by_name && !fr_hash_table_insert(dict->attributes_by_name, n)) {
+			fr_strerror_printf("%s: Failed inserting attribute %s", __FUNCTION__, n->name);
+			goto done;
+		}
+
+		if (rec.by_name && (n->type == FR_TYPE_COMBO_IP_ADDR) &&
+		    (dict_attr_combo_add(dict, n, rec.name_len) < 0)) goto done;
+
+		attrs[i] = n;
+	}
+
+	for (i = 0; i < hdr.num_enums; i++) {
+		dict_snapshot_enum_t	rec;
+		char const		*alias;
+		fr_dict_enum_t		*enumv;
+		fr_value_box_t		*value;
+
+		if (!(p = dict_snapshot_get(&rec, sizeof(rec), p, end)) ||
+		    !(p = dict_snapshot_get_str(&alias, rec.alias_len, p, end)) ||
+		    ((size_t)(end - p) < rec.value_len) ||
+		    (rec.da == 0) || (rec.da > hdr.num_attrs) || (rec.type >= FR_TYPE_MAX)) goto truncated;
+
+		enumv = talloc_zero(dict->pool, fr_dict_enum_t);
+		if (!enumv) goto oom;
+
+		enumv->alias = talloc_typed_strdup(enumv, alias);
+		value = fr_value_box_alloc(enumv, rec.type, NULL, false);
+		if (!enumv->alias || !value) goto oom;
+
+		if (fr_value_box_from_network(enumv, value, rec.type, NULL, p, rec.value_len, false) < 0) goto done;
+		p += rec.value_len;
+
+		enumv->value = value;
+		enumv->da = attrs[rec.da];
+
+		if (!fr_hash_table_insert(dict->values_by_alias, enumv) ||
+		    (rec.by_value && !fr_hash_table_replace(dict->values_by_da, enumv))) {
+			fr_strerror_printf("%s: Failed inserting value %s", __FUNCTION__, alias);
+			goto done;
+		}
+	}
+
+	if (p != end) {
+	truncated:
+		fr_strerror_printf("%s: Snapshot %s is malformed", __FUNCTION__, path);
+		goto done;
+	}
+
+	if (hdr.root_max_attr > root_max_attr) root_max_attr = hdr.root_max_attr;
+	if (hdr.has_cast_types) {
+		defined_cast_types = true;
+		dict->has_cast_types = true;
+	}
+
+	ret = 1;
+
+done:
+#ifdef HAVE_SYS_MMAN_H
+	munmap((void *)start, snap_stat.st_size);
+#endif
+	talloc_free(tmp_ctx);
+
+	return ret;
+
+oom:
+	fr_strerror_printf("%s: Out of memory", __FUNCTION__);
+	goto done;
+}
+
+/** Allocate an empty protocol dictionary
+ *
+ * @param[in] ctx to allocate the dictionary from.
+ * @param[in] name to use for the root attributes.
+ * @return
+ *	- A new dictionary, containing only the root attribute.
+ *	- NULL on error.
+ */
+static fr_dict_t *dict_alloc(TALLOC_CTX *ctx, char const *name)
+{
+	fr_dict_t *dict;
+
+	dict = talloc_zero(ctx, fr_dict_t);
+	if (!dict) {
+	oom:
+		fr_strerror_printf("%s: Out of memory", __FUNCTION__);
+		return NULL;
+	}
+
+	/* Pre-Allocate 5MB of pool memory for rapid startup */
+	dict->pool = talloc_pool(dict, (1024 * 1024 * 5));
 
 	/*
 	 *	Create the table of vendor by name.   There MAY NOT
@@ -2720,7 +3566,7 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 	if (!dict->vendors_by_name) {
 	error:
 		talloc_free(dict);
-		return -1;
+		goto oom;
 	}
 
 	/*
@@ -2754,6 +3600,7 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 	 *	Magic dictionary root attribute
 	 */
 	dict->root = (fr_dict_attr_t *)talloc_zero_array(dict, uint8_t, sizeof(fr_dict_attr_t) + strlen(name));
+	if (!dict->root) goto error;
 	strcpy(dict->root->name, name);
 	talloc_set_type(dict->root, fr_dict_attr_t);
 	dict->root->flags.is_root = 1;
@@ -2763,6 +3610,89 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 
 	dict->enum_fixup = NULL;        /* just to be safe. */
 
+	return dict;
+}
+
+/** Whether the dictionary was loaded from its precompiled snapshot
+ *
+ * @param[in] dict	to check.
+ * @return
+ *	- true if the snapshot was used.
+ *	- false if the dictionary files were parsed.
+ */
+bool fr_dict_snapshot_loaded(fr_dict_t const *dict)
+{
+	return dict->from_snapshot;
+}
+
+/** (re)initialize a protocol dictionary
+ *
+ * Initialize the directory, then fix the attr member of all attributes.
+ *
+ * First dictionary initialised will be set as the default internal dictionary.
+ *
+ * @param[in] ctx to allocate the dictionary from.
+ * @param[out] out Where to write a pointer to the new dictionary.  Will free existing
+ *	dictionary if files have changed and *out is not NULL.
+ * @param[in] dir to read dictionary files from.
+ * @param[in] fn file name to read.
+ * @param[in] name to use for the root attributes.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char const *fn, char const *name)
+{
+	fr_dict_t *dict;
+
+	if (*out && dict_stat_check(*out, dir, fn)) return 0;
+
+	dict = dict_alloc(ctx, name);
+	if (!dict) return -1;
+
+	/*
+	 *	Free the old dictionaries
+	 */
+	if (*out == fr_dict_internal) fr_dict_internal = dict;
+	TALLOC_FREE(*out);
+
+	/*
+	 *	Remove this at some point...
+	 */
+	if (!fr_dict_internal) fr_dict_internal = dict;
+
+	/*
+	 *	Use the precompiled snapshot, if there's one
+	 *	which matches the dictionary files.
+	 */
+	switch (dict_snapshot_load(dict, dir, fn)) {
+	case 0:
+		break;
+
+	case 1:
+		dict->from_snapshot = true;
+		goto finalise;
+
+	/*
+	 *	A snapshot which passed the checks, but which we
+	 *	couldn't load, is no different from a missing one.
+	 *	Throw away whatever was loaded from it, and parse
+	 *	the dictionary files instead.
+	 */
+	default:
+	{
+		fr_dict_t *fresh;
+
+		fresh = dict_alloc(ctx, name);
+		if (!fresh) goto error;
+
+		if (fr_dict_internal == dict) fr_dict_internal = fresh;
+		talloc_free(dict);
+		dict = fresh;
+	}
+		break;
+	}
+
 	/*
 	 *	Add cast attributes.  We do it this way,
 	 *	so cast attributes get added automatically for new types.
@@ -2799,9 +3729,14 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 			talloc_free(type_name);
 		}
 		defined_cast_types = true;
+		dict->has_cast_types = true;
 	}
 
-	if (dict_from_file(dict, dir, fn, NULL, 0) < 0) goto error;
+	if (dict_from_file(dict, dir, fn, NULL, 0) < 0) {
+	error:
+		talloc_free(dict);
+		return -1;
+	}
 
 	/*
 	 *	Resolve any VALUE aliases (enums) that were defined
@@ -2839,6 +3774,9 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 		}
 	}
 
+finalise:
+	if (dict_attr_child_index_build(dict->root) < 0) goto error;
+
 	/*
 	 *	Walk over all of the hash tables to ensure they're
 	 *	initialized.  We do this because the threads may perform
@@ -2858,6 +3796,8 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 
 int fr_dict_read(fr_dict_t *dict, char const *dir, char const *filename)
 {
+	int ret;
+
 	INTERNAL_IF_NULL(dict);
 
 	if (!dict->attributes_by_name) {
@@ -2865,7 +3805,12 @@ int fr_dict_read(fr_dict_t *dict, char const *dir, char const *filename)
 		return -1;
 	}
 
-	return dict_from_file(dict, dir, filename, NULL, 0);
+	dict->read_extra = true;
+
+	ret = dict_from_file(dict, dir, filename, NULL, 0);
+	if (ret < 0) return ret;
+
+	return dict_attr_child_index_build(dict->root);
 }
 
 /*
@@ -2879,6 +3824,8 @@ int fr_dict_parse_str(fr_dict_t *dict, char *buf, fr_dict_attr_t const *parent,
 
 	INTERNAL_IF_NULL(dict);
 
+	dict->read_extra = true;
+
 	argc = fr_dict_str_to_argv(buf, argv, MAX_ARGV);
 	if (argc == 0) return 0;
 
@@ -3611,6 +4558,29 @@ void fr_dict_print(fr_dict_attr_t const *da, int depth)
 	}
 }
 
+static int _dict_enum_print(UNUSED void *ctx, void *data)
+{
+	fr_dict_enum_t const	*enumv = data;
+	char			buff[256];
+
+	fr_value_box_snprint(buff, sizeof(buff), enumv->value, '\0');
+
+	printf("VALUE \"%s\" \"%s\" %s\n", enumv->da->name, enumv->alias, buff);
+
+	return 0;
+}
+
+/** Print all of the enumerated values in a dictionary
+ *
+ * The values are printed in hash table order.
+ *
+ * @param[in] dict	to print values from.
+ */
+void fr_dict_enum_print(fr_dict_t *dict)
+{
+	fr_hash_table_walk(dict->values_by_alias, _dict_enum_print, NULL);
+}
+
 /** Find a common ancestor that two TLV type attributes share
  *
  * @param a first TLV attribute.
@@ -4170,6 +5140,11 @@ inline fr_dict_attr_t const *fr_dict_attr_child_by_num(fr_dict_attr_t const *par
 {
 	fr_dict_attr_t const *bin;
 
+	/*
+	 *	Most lookups are satisfied by the direct index.
+	 */
+	if (attr < parent->child_index_len) return parent->child_index[attr];
+
 	if (!parent->children) return NULL;
 
 	/*
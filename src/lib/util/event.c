@@ -30,28 +30,63 @@ RCSID("$Id$")
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/heap.h>
 #include <freeradius-devel/event.h>
-#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/time.h>
+#include <freeradius-devel/dlist.h>
 
 #define FR_EV_BATCH_FDS (256)
 
+/*
+ *	On Linux (see FR_EVENT_EPOLL), there's no kqueue.  File
+ *	descriptors are watched with epoll, user events are eventfds
+ *	in the same epoll set, and timers use the epoll_wait()
+ *	timeout.  epoll refuses regular files.  Those are always
+ *	readable and writable, so like kqueue, we service them on
+ *	every pass through the loop.
+ */
+#ifdef FR_EVENT_EPOLL
+#  define USE_EPOLL
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#endif
+
 #undef USEC
 #define USEC (1000000)
 
-#if !defined(SO_GET_FILTER) && defined(SO_ATTACH_FILTER)
-#  define SO_GET_FILTER SO_ATTACH_FILTER
+/*
+ *	Timers which are far enough in the future go into a hashed
+ *	timer wheel, where insert and delete are O(1).  As a slot
+ *	comes within FR_EVENT_WHEEL_NEAR ticks of the current time,
+ *	its timers are moved to the heap, which orders them precisely.
+ */
+#define FR_EVENT_WHEEL_RES	(100000000)	//!< Width of a wheel slot, in nanoseconds.
+#define FR_EVENT_WHEEL_SLOTS	(1024)		//!< Number of slots.  Must be a power of 2.
+#define FR_EVENT_WHEEL_NEAR	(2)		//!< Timers due within this many ticks go into the heap.
+
+/*
+ *	libkqueue reports EOF for raw sockets with a packet filter
+ *	attached, so it needs to know which sockets have one.
+ */
+#if !defined(USE_EPOLL) && defined(__linux__) && defined(SO_ATTACH_FILTER)
+#  ifndef SO_GET_FILTER
+#    define SO_GET_FILTER SO_ATTACH_FILTER
+#  endif
+#  define CHECK_PF_ATTACHED
 #endif
 
 /** A timer event
  *
  */
 struct fr_event_timer_t {
-	struct timeval		when;			//!< When this timer should fire.
+	fr_time_t		when;			//!< When this timer should fire.
 	fr_event_callback_t	callback;		//!< Callback to execute when the timer fires.
 	void const		*uctx;			//!< Context pointer to pass to the callback.
 	TALLOC_CTX		*linked_ctx;		//!< talloc ctx this event was bound to.
 
 	fr_event_timer_t const	**parent;		//!< Previous timer.
 	int			heap;			//!< Where to store opaque heap data.
+
+	fr_dlist_t		entry;			//!< Entry in a timer wheel slot.
+	bool			in_wheel;		//!< Whether the timer is in the wheel, or the heap.
 };
 
 /** A file descriptor event
@@ -63,7 +98,7 @@ typedef struct fr_event_fd_t {
 	int                     sock_type;              //!< The type of socket SOCK_STREAM, SOCK_RAW etc...
 	bool                    is_file;                //!< Is a file, not a socket.
 
-#ifdef SO_GET_FILTER
+#ifdef CHECK_PF_ATTACHED
 	bool                    pf_attached;            //!< Has an attached packet filter (PF) program.
 #endif
 
@@ -80,6 +115,11 @@ typedef struct fr_event_fd_t {
 	bool			deferred_delete;	//!< Deferred deletion flag.  Delete this event *after*
 							///< the handlers complete.
 
+#ifdef USE_EPOLL
+	bool			use_file;		//!< epoll refused the FD, so it's serviced on every loop.
+	fr_dlist_t		entry;			//!< Entry in the list of file FDs.
+#endif
+
 	void			*uctx;			//!< Context pointer to pass to each file descriptor callback.
 	TALLOC_CTX		*linked_ctx;		//!< talloc ctx this event was bound to.
 } fr_event_fd_t;
@@ -102,12 +142,12 @@ typedef struct fr_event_post_t {
 	void			*uctx;			//!< Context for the callback.
 } fr_event_post_t;
 
-/** Callbacks for kevent() user events
+/** Callbacks for user events
  *
  */
 typedef struct fr_event_user_t {
 	fr_dlist_t		entry;			//!< Linked list of callback.
-	uintptr_t		ident;			//!< The identifier of this event.
+	uintptr_t		ident;			//!< The identifier of this event.  For epoll, an eventfd.
 	fr_event_user_handler_t callback;		//!< The callback to call.
 	void			*uctx;			//!< Context for the callback.
 } fr_event_user_t;
@@ -117,24 +157,42 @@ typedef struct fr_event_user_t {
  */
 struct fr_event_list_t {
 	fr_heap_t		*times;			//!< of timer events to be executed.
+
+	uint64_t		wheel_tick;		//!< The last tick the wheel was advanced to.
+	uint64_t		wheel_next;		//!< Tick of the earliest non-empty slot, or 0 if
+							///< it needs to be found again.
+	int			num_wheel;		//!< Number of timers in the wheel.
+	fr_dlist_t		wheel[FR_EVENT_WHEEL_SLOTS]; //!< Timers due more than FR_EVENT_WHEEL_NEAR
+							///< ticks after wheel_tick.
 	rbtree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
 
 	int			exit;			//!< If non-zero, the event loop will exit after its current
 							///< iteration, returning this value.
 
 	struct timeval  	now;			//!< The last time the event list was serviced.
+	fr_time_t		now_mono;		//!< Monotonic time matching "now".  Timers use this clock.
 	bool			dispatch;		//!< Whether the event list is currently dispatching events.
 
 	int			num_fds;		//!< Number of FDs listened to by this event list.
 	int			num_fd_events;		//!< Number of events in this event list.
 
-	int			kq;			//!< instance associated with this event list.
-
 	fr_dlist_t		pre_callbacks;		//!< callbacks when we may be idle...
 	fr_dlist_t		user_callbacks;		//!< EVFILT_USER callbacks
 	fr_dlist_t		post_callbacks;		//!< post-processing callbacks
 
+#ifdef USE_EPOLL
+	int			epfd;			//!< epoll instance.
+	int			exit_fd;		//!< eventfd which wakes the loop up to exit.
+
+	fr_dlist_t		file_fds;		//!< FDs epoll can't watch, which are always ready.
+	int			num_file_fds;		//!< Number of entries in file_fds.
+
+	struct epoll_event	events[FR_EV_BATCH_FDS]; /* so it doesn't go on the stack every time */
+#else
+	int			kq;			//!< instance associated with this event list.
+
 	struct kevent		events[FR_EV_BATCH_FDS]; /* so it doesn't go on the stack every time */
+#endif
 };
 
 /** Compare two timer events to see which one should occur first
@@ -148,13 +206,9 @@ struct fr_event_list_t {
  */
 static int fr_event_timer_cmp(void const *a, void const *b)
 {
-	int			ret;
 	fr_event_timer_t const	*ev_a = a, *ev_b = b;
 
-	ret = (ev_a->when.tv_sec < ev_b->when.tv_sec) - (ev_a->when.tv_sec > ev_b->when.tv_sec);
-	if (ret != 0) return ret;
-
-	return (ev_a->when.tv_usec < ev_b->when.tv_usec) - (ev_a->when.tv_usec > ev_b->when.tv_usec);
+	return (ev_a->when < ev_b->when) - (ev_a->when > ev_b->when);
 }
 
 /** Compare two file descriptor handles
@@ -192,10 +246,13 @@ int fr_event_list_num_elements(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return fr_heap_num_elements(el->times);
+	return fr_heap_num_elements(el->times) + el->num_wheel;
 }
 
 /** Return the kq associated with an event list.
+ *
+ * For epoll, this is the epoll instance.  It's only used to
+ * identify the event list, #fr_event_user_trigger doesn't need it.
  *
  * @param[in] el to return timer events for.
  * @return kq
@@ -204,7 +261,11 @@ int fr_event_list_kq(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
+#ifdef USE_EPOLL
+	return el->epfd;
+#else
 	return el->kq;
+#endif
 }
 
 /** Get the current time according to the event list
@@ -234,6 +295,80 @@ int fr_event_list_time(struct timeval *when, fr_event_list_t *el)
 	return 1;
 }
 
+/** Get the monotonic time of the current iteration of the event loop
+ *
+ * The time is updated once per call to #fr_event_service, so the I/O
+ * and timer handlers don't have to read the clock themselves.
+ *
+ * @param[in] el to get time from.
+ * @return the time, on the same clock as #fr_time.
+ */
+fr_time_t fr_event_list_now(fr_event_list_t *el)
+{
+	return el->now_mono;
+}
+
+/** Update the cached wall clock and monotonic times
+ *
+ */
+static inline void fr_event_list_update_time(fr_event_list_t *el)
+{
+	gettimeofday(&el->now, NULL);
+	el->now_mono = fr_time();
+}
+
+/** Convert a wall clock time to the monotonic clock used by timers
+ *
+ * The offset between the two clocks is taken from the cached times,
+ * so the conversion doesn't need to read either clock.
+ *
+ * @param[in] el	to take the clock offset from.
+ * @param[in] tv	wall clock time to convert.
+ * @return the matching monotonic time, or 0 if it's before the monotonic epoch.
+ */
+static fr_time_t fr_event_time_from_timeval(fr_event_list_t *el, struct timeval const *tv)
+{
+	int64_t delta;
+
+	delta = ((int64_t) (tv->tv_sec - el->now.tv_sec) * USEC) + (tv->tv_usec - el->now.tv_usec);
+	delta *= 1000;
+
+	if ((delta < 0) && ((fr_time_t) -delta > el->now_mono)) return 0;
+
+	return el->now_mono + delta;
+}
+
+/** Convert a monotonic time to wall clock time
+ *
+ * Rounds up to the next microsecond, so that a caller which waits
+ * until the returned time doesn't wake up just before the timer is due.
+ *
+ * @param[in] el	to take the clock offset from.
+ * @param[out] tv	where to write the wall clock time.
+ * @param[in] when	monotonic time to convert.
+ */
+static void fr_event_time_to_timeval(fr_event_list_t *el, struct timeval *tv, fr_time_t when)
+{
+	int64_t delta = (int64_t) (when - el->now_mono);
+
+	if (delta > 0) {
+		delta = (delta + 999) / 1000;
+	} else {
+		delta /= 1000;
+	}
+
+	tv->tv_sec = el->now.tv_sec + (delta / USEC);
+	tv->tv_usec = el->now.tv_usec + (delta % USEC);
+
+	if (tv->tv_usec < 0) {
+		tv->tv_sec--;
+		tv->tv_usec += USEC;
+	} else if (tv->tv_usec >= USEC) {
+		tv->tv_sec++;
+		tv->tv_usec -= USEC;
+	}
+}
+
 /** Remove a file descriptor from the event loop
  *
  * @param[in] el	to remove file descriptor from.
@@ -274,6 +409,97 @@ int fr_event_fd_delete(fr_event_list_t *el, int fd)
 	return 0;
 }
 
+/** Update the filters registered for a file descriptor
+ *
+ * Registers the filters for read_fn and write_fn, and removes any
+ * filters for callbacks which are no longer set.  Only the difference
+ * between the current and the new callbacks is sent to the kernel.
+ *
+ * @param[in] el	the file descriptor is registered with.
+ * @param[in] ef	to update.  ef->read and ef->write are the current callbacks.
+ * @param[in] read_fn	the new read callback.
+ * @param[in] write_fn	the new write callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int fr_event_fd_filters(fr_event_list_t *el, fr_event_fd_t *ef,
+			       fr_event_fd_handler_t read_fn, fr_event_fd_handler_t write_fn)
+{
+#ifdef USE_EPOLL
+	struct epoll_event	epev;
+	int			op;
+
+	if (((ef->read != NULL) == (read_fn != NULL)) &&
+	    ((ef->write != NULL) == (write_fn != NULL))) return 0;
+
+	/*
+	 *	Files are always ready, all we track is whether
+	 *	they're serviced.
+	 */
+	if (ef->use_file) {
+		if (!read_fn && !write_fn) {
+			fr_dlist_remove(&ef->entry);
+			el->num_file_fds--;
+		}
+		return 0;
+	}
+
+	/*
+	 *	EPOLLRDHUP is the closest match for EV_EOF on
+	 *	EVFILT_READ, i.e. the other end has gone away.
+	 */
+	memset(&epev, 0, sizeof(epev));
+	if (read_fn) epev.events |= EPOLLIN | EPOLLRDHUP;
+	if (write_fn) epev.events |= EPOLLOUT;
+	epev.data.ptr = ef;
+
+	if (!ef->read && !ef->write) {
+		op = EPOLL_CTL_ADD;
+	} else if (!read_fn && !write_fn) {
+		op = EPOLL_CTL_DEL;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	if (epoll_ctl(el->epfd, op, ef->fd, &epev) == 0) return 0;
+
+	/*
+	 *	Closing the FD removes it from the epoll set.
+	 */
+	if ((op == EPOLL_CTL_DEL) && ((errno == EBADF) || (errno == ENOENT))) return 0;
+
+	/*
+	 *	epoll doesn't do regular files.
+	 */
+	if ((op != EPOLL_CTL_ADD) || (errno != EPERM)) return -1;
+
+	ef->use_file = true;
+	fr_dlist_insert_tail(&el->file_fds, &ef->entry);
+	el->num_file_fds++;
+
+	return 0;
+#else
+	int		count = 0;
+	struct kevent	evset[2];
+
+	if (ef->read) {
+		if (!read_fn) EV_SET(&evset[count++], ef->fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
+	} else {
+		if (read_fn) EV_SET(&evset[count++], ef->fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, ef);
+	}
+	if (ef->write) {
+		if (!write_fn) EV_SET(&evset[count++], ef->fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
+	} else {
+		if (write_fn) EV_SET(&evset[count++], ef->fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, ef);
+	}
+
+	if (!count) return 0;
+
+	return kevent(el->kq, evset, count, NULL, 0, NULL) < 0 ? -1 : 0;
+#endif
+}
+
 /** Remove a file descriptor from the event loop
  *
  * @param[in] ef	to remove.
@@ -281,17 +507,10 @@ int fr_event_fd_delete(fr_event_list_t *el, int fd)
  */
 static int _fr_event_fd_free(fr_event_fd_t *ef)
 {
-	struct kevent	evset[2];
-
 	fr_event_list_t	*el = talloc_parent(ef);
 
 	if (likely(ef->is_registered)) {
-		int count = 0;
-
-		if (ef->read) EV_SET(&evset[count++], ef->fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
-		if (ef->write) EV_SET(&evset[count++], ef->fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
-
-		if (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
+		if (unlikely(fr_event_fd_filters(el, ef, NULL, NULL) < 0)) {
 			fr_strerror_printf("Failed removing filters for FD %i: %s", ef->fd, fr_syserror(errno));
 			return -1;
 		}
@@ -323,8 +542,6 @@ int fr_event_fd_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 		       fr_event_fd_error_handler_t error,
 		       void *uctx)
 {
-	int		count = 0;
-	struct kevent	evset[2];
 	fr_event_fd_t	*ef, find;
 
 	if (unlikely(!el)) {
@@ -388,7 +605,7 @@ int fr_event_fd_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
                         }
                         ef->is_file = true;
                 }
-#ifdef SO_GET_FILTER
+#ifdef CHECK_PF_ATTACHED
                 else {
                         opt_len = 0;
                         if (unlikely(getsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, NULL, &opt_len) < 0)) {
@@ -402,10 +619,7 @@ int fr_event_fd_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 
 		rbtree_insert(el->fds, ef);
 
-		if (read_fn) EV_SET(&evset[count++], fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, ef);
-		if (write_fn) EV_SET(&evset[count++], fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, ef);
-
-		if (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
+		if (unlikely(fr_event_fd_filters(el, ef, read_fn, write_fn) < 0)) {
 			fr_strerror_printf("Failed adding filter for FD %i: %s", fd, fr_syserror(errno));
 			talloc_free(ef);
 			return -1;
@@ -422,25 +636,12 @@ int fr_event_fd_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 	}
 
 	/*
-	 *	Calculate the diff between the filters that
-	 *	should be registered and the filters we need.
+	 *	Register the diff between the filters that
+	 *	are registered and the filters we need.
 	 */
-	if (ef->read) {
-		if (!read_fn) EV_SET(&evset[count++], ef->fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
-	} else {
-		if (read_fn) EV_SET(&evset[count++], ef->fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, ef);
-	}
-	if (ef->write) {
-		if (!write_fn) EV_SET(&evset[count++], ef->fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
-	} else {
-		if (write_fn) EV_SET(&evset[count++], ef->fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, ef);
-	}
-
-	if (count) {
-		if (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
-			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
-			return -1;
-		}
+	if (unlikely(fr_event_fd_filters(el, ef, read_fn, write_fn) < 0)) {
+		fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
+		return -1;
 	}
 
 	/*
@@ -458,6 +659,169 @@ int fr_event_fd_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 }
 
 
+/** Convert a time to a timer wheel tick
+ *
+ */
+static inline uint64_t fr_event_wheel_tick(fr_time_t when)
+{
+	return when / FR_EVENT_WHEEL_RES;
+}
+
+/** Add a timer to the wheel, or to the heap if it's due soon
+ *
+ * @param[in] el	to insert the timer into.
+ * @param[in] ev	to insert.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_event_timer_link(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	uint64_t tick = fr_event_wheel_tick(ev->when);
+
+	if (tick > (el->wheel_tick + FR_EVENT_WHEEL_NEAR)) {
+		fr_dlist_insert_tail(&el->wheel[tick & (FR_EVENT_WHEEL_SLOTS - 1)], &ev->entry);
+		ev->in_wheel = true;
+		el->num_wheel++;
+		if (el->wheel_next && (tick < el->wheel_next)) el->wheel_next = tick;
+		return 0;
+	}
+
+	ev->in_wheel = false;
+	if (unlikely(!fr_heap_insert(el->times, ev))) return -1;
+
+	return 0;
+}
+
+/** Remove a timer from the wheel or the heap
+ *
+ * @param[in] el	the timer was inserted into.
+ * @param[in] ev	to remove.
+ * @return
+ *	- 1 if the timer was removed.
+ *	- 0 if the timer wasn't in the event list.
+ */
+static int fr_event_timer_unlink(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	if (ev->in_wheel) {
+		fr_dlist_remove(&ev->entry);
+		ev->in_wheel = false;
+		el->num_wheel--;
+		return 1;
+	}
+
+	return fr_heap_extract(el->times, ev);
+}
+
+/** Move timers which are now due soon from the wheel to the heap
+ *
+ * Each tick moves the slot which is now FR_EVENT_WHEEL_NEAR ticks
+ * ahead.  Timers in that slot which are for a later rotation of the
+ * wheel are left alone.
+ *
+ * @param[in] el	to advance.
+ * @param[in] now	the current time.
+ */
+static void fr_event_wheel_advance(fr_event_list_t *el, fr_time_t now)
+{
+	uint64_t target = fr_event_wheel_tick(now);
+
+	if (target <= el->wheel_tick) return;
+
+	/*
+	 *	Nothing in the wheel, or we've been away for more
+	 *	than a full rotation.  Either way, visiting each slot
+	 *	at most once is enough.
+	 */
+	if ((el->num_wheel == 0) || ((target - el->wheel_tick) > FR_EVENT_WHEEL_SLOTS)) {
+		if (el->num_wheel == 0) {
+			el->wheel_tick = target;
+			return;
+		}
+		el->wheel_tick = target - FR_EVENT_WHEEL_SLOTS;
+	}
+
+	while (el->wheel_tick < target) {
+		fr_dlist_t	*head, *entry, *next;
+		uint64_t	limit;
+
+		el->wheel_tick++;
+		limit = el->wheel_tick + FR_EVENT_WHEEL_NEAR;
+		head = &el->wheel[limit & (FR_EVENT_WHEEL_SLOTS - 1)];
+
+		for (entry = head->next; entry != head; entry = next) {
+			fr_event_timer_t *ev = fr_ptr_to_type(fr_event_timer_t, entry, entry);
+
+			next = entry->next;
+
+			if (fr_event_wheel_tick(ev->when) > limit) continue;
+
+			(void) fr_event_timer_unlink(el, ev);
+			(void) fr_event_timer_link(el, ev);
+		}
+	}
+}
+
+/** Find when the wheel next needs to move timers into the heap
+ *
+ * That's when the earliest non-empty slot comes within
+ * FR_EVENT_WHEEL_NEAR ticks.  Timers removed from the wheel may
+ * leave the cached slot empty, and timers for a later rotation share
+ * slots with earlier ones.  Either way we wake up early, find
+ * nothing to move, and look for the next slot.
+ *
+ * @param[in] el	to check.  Must have timers in the wheel.
+ * @return the time the next slot is moved into the heap.
+ */
+static fr_time_t fr_event_wheel_next(fr_event_list_t *el)
+{
+	uint64_t tick;
+
+	if (el->wheel_next <= (el->wheel_tick + FR_EVENT_WHEEL_NEAR)) {
+		el->wheel_next = 0;
+
+		for (tick = el->wheel_tick + FR_EVENT_WHEEL_NEAR + 1;
+		     tick <= (el->wheel_tick + FR_EVENT_WHEEL_NEAR + FR_EVENT_WHEEL_SLOTS);
+		     tick++) {
+			if (FR_DLIST_FIRST(el->wheel[tick & (FR_EVENT_WHEEL_SLOTS - 1)])) {
+				el->wheel_next = tick;
+				break;
+			}
+		}
+
+		if (!fr_cond_assert(el->wheel_next != 0)) return (el->wheel_tick + 1) * FR_EVENT_WHEEL_RES;
+	}
+
+	return (el->wheel_next - FR_EVENT_WHEEL_NEAR) * FR_EVENT_WHEEL_RES;
+}
+
+/** Find when the event list next needs to run its timers
+ *
+ * That's either the first timer in the heap, or the next time the
+ * wheel needs to move timers into the heap.
+ *
+ * @param[in] el	to check.
+ * @param[out] when	the time of the next timer event.
+ * @return
+ *	- true if there are timers.
+ *	- false if there are no timers.
+ */
+static bool fr_event_timer_next(fr_event_list_t *el, fr_time_t *when)
+{
+	fr_event_timer_t	*ev;
+	fr_time_t		promote;
+
+	ev = fr_heap_peek(el->times);
+	if (ev) *when = ev->when;
+
+	if (el->num_wheel == 0) return (ev != NULL);
+
+	promote = fr_event_wheel_next(el);
+	if (!ev || (promote < *when)) *when = promote;
+
+	return true;
+}
+
 /** Delete a timer event from the event list
  *
  * @param[in] el	to delete event from.
@@ -493,10 +857,10 @@ static int _event_timer_free(fr_event_timer_t *ev)
 	fr_event_list_t	*el = talloc_parent(ev);
 	int		ret;
 
-	ret = fr_heap_extract(el->times, ev);
+	ret = fr_event_timer_unlink(el, ev);
 
 	/*
-	 *	Events MUST be in the heap
+	 *	Events MUST be in the heap or the wheel
 	 */
 	if (!fr_cond_assert(ret == 1)) {
 		fr_strerror_printf("Event not found in heap");
@@ -517,7 +881,7 @@ static int _event_timer_free(fr_event_timer_t *ev)
  * @param[in] el		to insert event into.
  * @param[in,out] ev_p		If not NULL modify this event instead of creating a new one.  This is a parent
  *				in a temporal sense, not in a memory structure or dependency sense.
- * @param[in] when		we should run the event.
+ * @param[in] when		we should run the event (wall clock time).
  * @param[in] callback		function to execute if the event fires.
  * @param[in] uctx		user data to pass to the event.
  * @return
@@ -526,6 +890,41 @@ static int _event_timer_free(fr_event_timer_t *ev)
  */
 int fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
 			  struct timeval *when, fr_event_callback_t callback, void const *uctx)
+{
+	if (unlikely(!el)) {
+		fr_strerror_printf("Invalid arguments: NULL event list");
+		return -1;
+	}
+
+	if (unlikely(!when || (when->tv_usec >= USEC))) {
+		fr_strerror_printf("Invalid arguments: time");
+		return -1;
+	}
+
+	return fr_event_timer_at(ctx, el, ev_p, fr_event_time_from_timeval(el, when), callback, uctx);
+}
+
+/** Insert a timer event into an event list, using the monotonic clock
+ *
+ * @note The talloc parent of the memory returned in ev_p must not be changed.
+ *	 If the lifetime of the event needs to be bound to another context
+ *	 this function should be called with the existing event pointed to by
+ *	 ev_p.
+ *
+ * @param[in] ctx		to bind lifetime of the event to.
+ * @param[in] el		to insert event into.
+ * @param[in,out] ev_p		If not NULL modify this event instead of creating a new one.  This is a parent
+ *				in a temporal sense, not in a memory structure or dependency sense.
+ * @param[in] when		we should run the event, on the same clock as #fr_time
+ *				and #fr_event_list_now.
+ * @param[in] callback		function to execute if the event fires.
+ * @param[in] uctx		user data to pass to the event.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_event_timer_at(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
+		      fr_time_t when, fr_event_callback_t callback, void const *uctx)
 {
 	fr_event_timer_t *ev;
 
@@ -539,11 +938,6 @@ int fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t
 		return -1;
 	}
 
-	if (unlikely(!when || (when->tv_usec >= USEC))) {
-		fr_strerror_printf("Invalid arguments: time");
-		return -1;
-	}
-
 	if (unlikely(!ev_p)) {
 		fr_strerror_printf("Invalid arguments: NULL ev_p");
 		return -1;
@@ -592,16 +986,16 @@ int fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t
 		 *	Event may have fired, in which case the
 		 *	event will no longer be in the event loop.
 		 */
-		(void) fr_heap_extract(el->times, ev);
+		(void) fr_event_timer_unlink(el, ev);
 	}
 
-	ev->when = *when;
+	ev->when = when;
 	ev->callback = callback;
 	ev->uctx = uctx;
 	ev->linked_ctx = ctx;
 	ev->parent = ev_p;
 
-	if (unlikely(!fr_heap_insert(el->times, ev))) {
+	if (unlikely(fr_event_timer_link(el, ev) < 0)) {
 		fr_strerror_printf("Failed inserting event into heap");
 		talloc_free(ev);
 		return -1;
@@ -613,7 +1007,33 @@ int fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t
 }
 
 
+/** Stop listening for a user event
+ *
+ * @param[in] user	to remove.
+ * @return 0.
+ */
+static int _fr_event_user_free(fr_event_user_t *user)
+{
+#ifdef USE_EPOLL
+	/*
+	 *	Closing the eventfd removes it from the epoll set.
+	 */
+	close((int) user->ident);
+#else
+	fr_event_list_t	*el = talloc_parent(user);
+	struct kevent	kev;
+
+	EV_SET(&kev, user->ident, EVFILT_USER, EV_DELETE, NOTE_FFNOP, 0, NULL);
+	(void) kevent(el->kq, &kev, 1, NULL, 0, NULL);
+#endif
+
+	return 0;
+}
+
 /** Add a user callback to the event list.
+ *
+ * The callback is run by the thread servicing the event list, when
+ * another thread calls #fr_event_user_trigger with the returned ident.
  *
  * @param[in] el	Containing the timer events.
  * @param[in] callback	for EVFILT_USER.
@@ -625,16 +1045,97 @@ int fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t
 uintptr_t fr_event_user_insert(fr_event_list_t *el, fr_event_user_handler_t callback, void *uctx)
 {
 	fr_event_user_t *user;
+#ifdef USE_EPOLL
+	struct epoll_event epev;
+	int fd;
+#else
+	struct kevent kev;
+#endif
 
 	user = talloc(el, fr_event_user_t);
+	if (!user) {
+		fr_strerror_printf("Out of memory");
+		return 0;
+	}
 	user->callback = callback;
 	user->uctx = uctx;
+
+#ifdef USE_EPOLL
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0) {
+		fr_strerror_printf("Failed creating eventfd: %s", fr_syserror(errno));
+		talloc_free(user);
+		return 0;
+	}
+	user->ident = (uintptr_t) fd;
+	talloc_set_destructor(user, _fr_event_user_free);
+
+	memset(&epev, 0, sizeof(epev));
+	epev.events = EPOLLIN;
+	epev.data.ptr = user;
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, fd, &epev) < 0) {
+		fr_strerror_printf("Failed adding eventfd to epoll: %s", fr_syserror(errno));
+		talloc_free(user);
+		return 0;
+	}
+#else
 	user->ident = (uintptr_t) user;
 
+	EV_SET(&kev, user->ident, EVFILT_USER, EV_ADD | EV_CLEAR, NOTE_FFNOP, 0, NULL);
+	if (kevent(el->kq, &kev, 1, NULL, 0, NULL) < 0) {
+		fr_strerror_printf("Failed adding user event to kqueue: %s", fr_syserror(errno));
+		talloc_free(user);
+		return 0;
+	}
+	talloc_set_destructor(user, _fr_event_user_free);
+#endif
+
 	fr_dlist_insert_tail(&el->user_callbacks, &user->entry);
 
-	return user->ident;;
+	return user->ident;
+}
+
+/** Trigger a user event
+ *
+ * May be called from any thread.
+ *
+ * @param[in] kq	of the event list the user event was inserted into.
+ *			Not used by epoll, where the ident is an eventfd.
+ * @param[in] ident	returned by #fr_event_user_insert.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+#ifdef USE_EPOLL
+int fr_event_user_trigger(UNUSED int kq, uintptr_t ident)
+{
+	uint64_t value = 1;
+
+	/*
+	 *	EAGAIN means the counter is full, so the event
+	 *	list already has a wakeup pending.
+	 */
+	if ((write((int) ident, &value, sizeof(value)) < 0) && (errno != EAGAIN)) {
+		fr_strerror_printf("Failed writing to eventfd %i: %s", (int) ident, fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#else
+int fr_event_user_trigger(int kq, uintptr_t ident)
+{
+	struct kevent kev;
+
+	EV_SET(&kev, ident, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
+	if (kevent(kq, &kev, 1, NULL, 0, NULL) < 0) {
+		fr_strerror_printf("Failed sending user event to kqueue (%i): %s", kq, fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
 }
+#endif
 
 
 /** Delete a user callback to the event list.
@@ -786,39 +1287,29 @@ int fr_event_post_delete(fr_event_list_t *el, fr_event_callback_t callback, void
 /** Run a single scheduled timer event
  *
  * @param[in] el	containing the timer events.
- * @param[in] when	Process events scheduled to run before or at this time.
+ * @param[in] now	monotonic time to run events for.
+ * @param[out] next	when the next event is due, if none fired.
+ * @param[in] when	wall clock time to pass to the callback.
  * @return
  *	- 0 no timer events fired.
  *	- 1 a timer event fired.
  */
-int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
+static int fr_event_timer_run_mono(fr_event_list_t *el, fr_time_t now, fr_time_t *next, struct timeval *when)
 {
 	fr_event_callback_t	callback;
 	void			*uctx;
 	fr_event_timer_t	*ev;
 
-	if (unlikely(!el)) return 0;
-
-	if (fr_heap_num_elements(el->times) == 0) {
-		when->tv_sec = 0;
-		when->tv_usec = 0;
-		return 0;
-	}
-
-	ev = fr_heap_peek(el->times);
-	if (!ev) {
-		when->tv_sec = 0;
-		when->tv_usec = 0;
-		return 0;
-	}
+	fr_event_wheel_advance(el, now);
 
 	/*
-	 *	See if it's time to do this one.
+	 *	See if it's time to do the first one.  If not, tell
+	 *	the caller when to come back, which may be when the
+	 *	wheel next has timers to move into the heap.
 	 */
-	if ((ev->when.tv_sec > when->tv_sec) ||
-	    ((ev->when.tv_sec == when->tv_sec) &&
-	     (ev->when.tv_usec > when->tv_usec))) {
-		*when = ev->when;
+	ev = fr_heap_peek(el->times);
+	if (!ev || (ev->when > now)) {
+		if (!fr_event_timer_next(el, next)) *next = 0;
 		return 0;
 	}
 
@@ -835,10 +1326,36 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 	return 1;
 }
 
+/** Run a single scheduled timer event
+ *
+ * @param[in] el	containing the timer events.
+ * @param[in] when	Process events scheduled to run before or at this time.
+ * @return
+ *	- 0 no timer events fired.
+ *	- 1 a timer event fired.
+ */
+int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
+{
+	fr_time_t next;
+
+	if (unlikely(!el)) return 0;
+
+	if (fr_event_timer_run_mono(el, fr_event_time_from_timeval(el, when), &next, when) == 1) return 1;
+
+	if (!next) {
+		when->tv_sec = 0;
+		when->tv_usec = 0;
+		return 0;
+	}
+
+	fr_event_time_to_timeval(el, when, next);
+	return 0;
+}
+
 /** Gather outstanding timer and file descriptor events
  *
  * @param[in] el	to process events for.
- * @param[in] wait	if true, block on the kevent() call until a timer or file descriptor event occurs.
+ * @param[in] wait	if true, block until a timer or file descriptor event occurs.
  * @return
  *	- <0 error, or the event loop is exiting
  *	- the number of outstanding events.
@@ -846,7 +1363,9 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 int fr_event_corral(fr_event_list_t *el, bool wait)
 {
 	struct timeval		when, *wake;
+#ifndef USE_EPOLL
 	struct timespec		ts_when, *ts_wake;
+#endif
 	fr_dlist_t		*entry;
 	int			num_fd_events;
 
@@ -866,22 +1385,20 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 	wake = &when;
 
 	if (wait) {
-		if (fr_heap_num_elements(el->times) > 0) {
-			fr_event_timer_t *ev;
-
-			ev = fr_heap_peek(el->times);
-			if (!fr_cond_assert(ev)) {
-				fr_strerror_printf("Timer heap says it is non-empty, but there are no entries in it");
-				return -1;
-			}
+		fr_time_t next;
 
-			gettimeofday(&el->now, NULL);
+		if (fr_event_timer_next(el, &next)) {
+			fr_time_t now = fr_time();
 
 			/*
 			 *	Next event is in the future, get the time
 			 *	between now and that event.
 			 */
-			if (fr_timeval_cmp(&ev->when, &el->now) > 0) fr_timeval_subtract(&when, &ev->when, &el->now);
+			if (next > now) {
+				next -= now;
+				when.tv_sec = next / NANOSEC;
+				when.tv_usec = (next % NANOSEC) / 1000;
+			}
 
 			wake = &when;
 		} else {
@@ -907,6 +1424,31 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 		}
 	}
 
+#ifdef USE_EPOLL
+	{
+		int timeout;
+
+		/*
+		 *	Files are always ready, so don't sleep if
+		 *	there are any.  Otherwise round up, as
+		 *	epoll_wait() works in milliseconds, to avoid
+		 *	waking before the timer is due.
+		 */
+		if (el->num_file_fds > 0) {
+			timeout = 0;
+		} else if (wake) {
+			if (when.tv_sec >= ((INT_MAX / 1000) - 1)) {
+				timeout = INT_MAX;
+			} else {
+				timeout = (when.tv_sec * 1000) + ((when.tv_usec + 999) / 1000);
+			}
+		} else {
+			timeout = -1;
+		}
+
+		num_fd_events = epoll_wait(el->epfd, el->events, FR_EV_BATCH_FDS, timeout);
+	}
+#else
 	if (wake) {
 		ts_wake = &ts_when;
 		ts_when.tv_sec = when.tv_sec;
@@ -921,6 +1463,7 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 	 *	or wait for the next timer event.
 	 */
 	num_fd_events = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, ts_wake);
+#endif
 
 	/*
 	 *	Interrupt is different from timeout / FD events.
@@ -929,29 +1472,151 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 		if (errno == EINTR) {
 			return 0;
 		} else {
-			fr_strerror_printf("Failed calling kevent: %s", fr_syserror(errno));
+			fr_strerror_printf("Failed waiting for events: %s", fr_syserror(errno));
 			return -1;
 		}
 	}
 
-	return el->num_fd_events = num_fd_events;
+	el->num_fd_events = num_fd_events;
+
+#ifdef USE_EPOLL
+	return num_fd_events + el->num_file_fds;
+#else
+	return num_fd_events;
+#endif
 }
 
+#ifdef USE_EPOLL
+/** Service FD and user events returned by epoll_wait(), and any files
+ *
+ * @param[in] el containing events to service.
+ */
+static void fr_event_service_epoll(fr_event_list_t *el)
+{
+	int		i;
+	fr_dlist_t	*entry, *next;
+
+	for (i = 0; i < el->num_fd_events; i++) {
+		fr_event_fd_t	*ev;
+		fr_event_user_t	*user;
+		uint32_t	events = el->events[i].events;
+		int		flags = 0;
+		int		fd_errno = 0;
+		socklen_t	len = sizeof(fd_errno);
+
+		/*
+		 *	This is just a "wakeup" event from
+		 *	fr_event_loop_exit(), which is always ignored.
+		 */
+		if (!el->events[i].data.ptr) continue;
+
+		/*
+		 *	Process any user events.  Reading the eventfd
+		 *	resets it, so it doesn't fire again until
+		 *	it's next triggered.
+		 */
+		user = talloc_get_type(el->events[i].data.ptr, fr_event_user_t);
+		if (user) {
+			uint64_t value;
+
+			(void) read((int) user->ident, &value, sizeof(value));
+
+			user->callback(el, user->uctx);
+			continue;
+		}
+
+		ev = talloc_get_type_abort(el->events[i].data.ptr, fr_event_fd_t);
+
+		if (!fr_cond_assert(ev->is_registered)) continue;
+
+		/*
+		 *	Map the epoll events onto the kqueue flags,
+		 *	so that handlers see the same thing whichever
+		 *	backend is in use.
+		 */
+		if (unlikely(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+			flags = EV_EOF;
+
+			/*
+			 *	Same as the EV_EOF handling for kqueue.
+			 *	This is fine, the callback will get
+			 *	notified via the flags field.
+			 */
+			if (ev->is_file) goto service;
+
+			/*
+			 *	The reason is in the socket error, if any.
+			 */
+			if (events & EPOLLERR) flags = EV_ERROR;
+			(void) getsockopt(ev->fd, SOL_SOCKET, SO_ERROR, &fd_errno, &len);
+
+			if (ev->error) ev->error(el, ev->fd, flags, fd_errno, ev->uctx);
+			fr_event_fd_delete(el, ev->fd);
+			continue;
+		}
+
+	service:
+		ev->in_handler = true;
+		if (ev->read && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+			ev->read(el, ev->fd, flags, ev->uctx);
+		}
+		if (ev->write && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && !ev->deferred_delete) {
+			ev->write(el, ev->fd, flags, ev->uctx);
+		}
+		ev->in_handler = false;
+
+		/*
+		 *	Process any deferred deletes performed
+		 *	by the I/O handler.
+		 */
+		if (ev->deferred_delete) fr_event_fd_delete(el, ev->fd);
+	}
+
+	/*
+	 *	Files epoll can't watch are always readable and
+	 *	writable.
+	 */
+	for (entry = FR_DLIST_FIRST(el->file_fds);
+	     entry != NULL;
+	     entry = next) {
+		fr_event_fd_t *ev;
+
+		next = FR_DLIST_NEXT(el->file_fds, entry);
+
+		ev = fr_ptr_to_type(fr_event_fd_t, entry, entry);
+
+		ev->in_handler = true;
+		if (ev->read) ev->read(el, ev->fd, 0, ev->uctx);
+		if (ev->write && !ev->deferred_delete) ev->write(el, ev->fd, 0, ev->uctx);
+		ev->in_handler = false;
+
+		if (ev->deferred_delete) fr_event_fd_delete(el, ev->fd);
+	}
+}
+#endif
+
 /** Service any outstanding timer or file descriptor events
  *
  * @param[in] el containing events to service.
  */
 void fr_event_service(fr_event_list_t *el)
 {
+#ifndef USE_EPOLL
 	int		i;
+#endif
 	fr_dlist_t	*entry;
 	struct timeval	when;
 
 	if (unlikely(el->exit)) return;
 
+	fr_event_list_update_time(el);
+
 	/*
 	 *	Run all of the file descriptor events.
 	 */
+#ifdef USE_EPOLL
+	fr_event_service_epoll(el);
+#else
 	for (i = 0; i < el->num_fd_events; i++) {
 		fr_event_fd_t	*ev;
 		int		fd_errno = 0;
@@ -974,7 +1639,7 @@ void fr_event_service(fr_event_list_t *el)
 			(void) talloc_get_type_abort(user, fr_event_user_t);
 			rad_assert(user->ident == el->events[i].ident);
 
-			user->callback(el->kq, &el->events[i], user->uctx);
+			user->callback(el, user->uctx);
 			continue;
 		}
 
@@ -1042,16 +1707,17 @@ service:
 		 */
 		if (ev->deferred_delete) fr_event_fd_delete(el, ev->fd);
 	}
-
-	gettimeofday(&el->now, NULL);
+#endif
 
 	/*
 	 *	Run all of the timer events.
 	 */
-	if (fr_heap_num_elements(el->times) > 0) {
+	if ((fr_heap_num_elements(el->times) > 0) || (el->num_wheel > 0)) {
+		fr_time_t next;
+
 		do {
 			when = el->now;
-		} while (fr_event_timer_run(el, &when) == 1);
+		} while (fr_event_timer_run_mono(el, el->now_mono, &next, &when) == 1);
 	}
 
 	/*
@@ -1078,7 +1744,11 @@ service:
  */
 void fr_event_loop_exit(fr_event_list_t *el, int code)
 {
+#ifdef USE_EPOLL
+	uint64_t value = 1;
+#else
 	struct kevent kev;
+#endif
 
 	if (unlikely(!el)) return;
 
@@ -1087,8 +1757,12 @@ void fr_event_loop_exit(fr_event_list_t *el, int code)
 	/*
 	 *	Signal the control plane to exit.
 	 */
+#ifdef USE_EPOLL
+	(void) write(el->exit_fd, &value, sizeof(value));
+#else
 	EV_SET(&kev, 0, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
 	(void) kevent(el->kq, &kev, 1, NULL, 0, NULL);
+#endif
 }
 
 /** Check to see whether the event loop is in the process of exiting
@@ -1129,12 +1803,27 @@ int fr_event_loop(fr_event_list_t *el)
 static int _event_list_free(fr_event_list_t *el)
 {
 	fr_event_timer_t const *ev;
+	int i;
 
 	while ((ev = fr_heap_peek(el->times)) != NULL) fr_event_timer_delete(el, &ev);
 
+	for (i = 0; i < FR_EVENT_WHEEL_SLOTS; i++) {
+		fr_dlist_t *entry;
+
+		while ((entry = FR_DLIST_FIRST(el->wheel[i])) != NULL) {
+			ev = fr_ptr_to_type(fr_event_timer_t, entry, entry);
+			fr_event_timer_delete(el, &ev);
+		}
+	}
+
 	talloc_free(el->times);
 
-	close(el->kq);
+#ifdef USE_EPOLL
+	if (el->exit_fd >= 0) close(el->exit_fd);
+	if (el->epfd >= 0) close(el->epfd);
+#else
+	if (el->kq >= 0) close(el->kq);
+#endif
 
 	return 0;
 }
@@ -1151,12 +1840,24 @@ static int _event_list_free(fr_event_list_t *el)
 fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_t status, void *status_uctx)
 {
 	fr_event_list_t *el;
+#ifdef USE_EPOLL
+	struct epoll_event epev;
+#else
 	struct kevent kev;
+#endif
+	int i;
 
 	el = talloc_zero(ctx, fr_event_list_t);
 	if (!fr_cond_assert(el)) {
 		return NULL;
 	}
+#ifdef USE_EPOLL
+	el->epfd = -1;
+	el->exit_fd = -1;
+	FR_DLIST_INIT(el->file_fds);
+#else
+	el->kq = -1;
+#endif
 	talloc_set_destructor(el, _event_list_free);
 
 	el->times = fr_heap_create(fr_event_timer_cmp, offsetof(fr_event_timer_t, heap));
@@ -1166,11 +1867,24 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_t status,
 	}
 	el->fds = rbtree_create(el, fr_event_fd_cmp, NULL, 0);
 
+	for (i = 0; i < FR_EVENT_WHEEL_SLOTS; i++) FR_DLIST_INIT(el->wheel[i]);
+	fr_event_list_update_time(el);
+	el->wheel_tick = fr_event_wheel_tick(el->now_mono);
+
+#ifdef USE_EPOLL
+	el->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->epfd < 0) {
+		fr_strerror_printf("Failed creating epoll instance: %s", fr_syserror(errno));
+		talloc_free(el);
+		return NULL;
+	}
+#else
 	el->kq = kqueue();
 	if (el->kq < 0) {
 		talloc_free(el);
 		return NULL;
 	}
+#endif
 
 	FR_DLIST_INIT(el->pre_callbacks);
 	FR_DLIST_INIT(el->post_callbacks);
@@ -1178,6 +1892,28 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_t status,
 
 	if (status) (void) fr_event_pre_insert(el, status, status_uctx);
 
+#ifdef USE_EPOLL
+	/*
+	 *	Our "exit" wakeup is the only entry with a NULL data
+	 *	pointer.  It's edge triggered, so it never needs to
+	 *	be read.
+	 */
+	el->exit_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (el->exit_fd < 0) {
+		fr_strerror_printf("Failed creating eventfd: %s", fr_syserror(errno));
+		talloc_free(el);
+		return NULL;
+	}
+
+	memset(&epev, 0, sizeof(epev));
+	epev.events = EPOLLIN | EPOLLET;
+	epev.data.ptr = NULL;
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->exit_fd, &epev) < 0) {
+		fr_strerror_printf("Failed adding eventfd to epoll: %s", fr_syserror(errno));
+		talloc_free(el);
+		return NULL;
+	}
+#else
 	/*
 	 *	Set our "exit" callback as ident 0.
 	 */
@@ -1186,6 +1922,7 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_t status,
 		talloc_free(el);
 		return NULL;
 	}
+#endif
 
 	return el;
 }
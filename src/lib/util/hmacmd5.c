@@ -33,19 +33,14 @@ RCSID("$Id$")
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/md5.h>
 
-/** Calculate HMAC using MD5
+/** Absorb an HMAC-MD5 key into a pair of MD5 contexts
  *
- * @param digest Caller digest to be filled in.
- * @param text Pointer to data stream.
- * @param text_len length of data stream.
+ * @param hkey Where to write the key state.
  * @param key Pointer to authentication key.
  * @param key_len Length of authentication key.
- *
  */
-void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
-		 uint8_t const *key, size_t key_len)
+void fr_hmac_md5_key_init(fr_hmac_md5_key_t *hkey, uint8_t const *key, size_t key_len)
 {
-	FR_MD5_CTX context;
 	uint8_t k_ipad[65];    /* inner padding - key XORd with ipad */
 	uint8_t k_opad[65];    /* outer padding - key XORd with opad */
 	uint8_t tk[16];
@@ -86,25 +81,63 @@ void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t
 		k_ipad[i] ^= 0x36;
 		k_opad[i] ^= 0x5c;
 	}
+
+	/*
+	 * The pads are exactly one block, so the contexts hold
+	 * nothing but the MD5 state after them.
+	 */
+	fr_md5_init(&hkey->inner);
+	fr_md5_update(&hkey->inner, k_ipad, 64);
+
+	fr_md5_init(&hkey->outer);
+	fr_md5_update(&hkey->outer, k_opad, 64);
+}
+
+/** Calculate HMAC using MD5, and a key from #fr_hmac_md5_key_init
+ *
+ * @param digest Caller digest to be filled in.
+ * @param text Pointer to data stream.
+ * @param text_len length of data stream.
+ * @param hkey Key state.
+ */
+void fr_hmac_md5_keyed(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
+		       fr_hmac_md5_key_t const *hkey)
+{
+	FR_MD5_CTX context;
+
 	/*
 	 * perform inner MD5
 	 */
-	fr_md5_init(&context);		   /* init context for 1st
-					      * pass */
-	fr_md5_update(&context, k_ipad, 64);      /* start with inner pad */
+	fr_md5_copy(&context, &hkey->inner);
 	fr_md5_update(&context, text, text_len); /* then text of datagram */
 	fr_md5_final(digest, &context);	  /* finish up 1st pass */
 	/*
 	 * perform outer MD5
 	 */
-	fr_md5_init(&context);		   /* init context for 2nd
-					      * pass */
-	fr_md5_update(&context, k_opad, 64);     /* start with outer pad */
+	fr_md5_copy(&context, &hkey->outer);
 	fr_md5_update(&context, digest, 16);     /* then results of 1st
 					      * hash */
 	fr_md5_final(digest, &context);	  /* finish up 2nd pass */
 }
 
+/** Calculate HMAC using MD5
+ *
+ * @param digest Caller digest to be filled in.
+ * @param text Pointer to data stream.
+ * @param text_len length of data stream.
+ * @param key Pointer to authentication key.
+ * @param key_len Length of authentication key.
+ *
+ */
+void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
+		 uint8_t const *key, size_t key_len)
+{
+	fr_hmac_md5_key_t hkey;
+
+	fr_hmac_md5_key_init(&hkey, key, key_len);
+	fr_hmac_md5_keyed(digest, text, text_len, &hkey);
+}
+
 /*
 Test Vectors (Trailing '\0' of a character string not included in test):
 
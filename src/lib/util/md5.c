@@ -34,6 +34,91 @@ void fr_md5_calc(uint8_t *out, uint8_t const *in, size_t inlen)
 	fr_md5_final(out, &ctx);
 }
 
+/* The four core functions - F1 is optimized somewhat */
+#define F1(x, y, z) (z ^ (x & (y ^ z)))
+#define F2(x, y, z) F1(z, x, y)
+#define F3(x, y, z) (x ^ y ^ z)
+#define F4(x, y, z) (y ^ (x | ~z))
+
+/* This is the central step in the MD5 algorithm. */
+#define MD5STEP(f, w, x, y, z, data, s) (w += f(x, y, z) + data, w = w << s | w >> (32 - s),  w += x)
+
+/** All 64 steps of an MD5 block transform
+ *
+ * Shared by the scalar and multi-buffer transforms.  The step macros only
+ * use operators which GCC vector types support, so the same text works on
+ * uint32_t and on a vector of uint32_t lanes.
+ */
+#define MD5_ROUNDS(_a, _b, _c, _d, _in) do { \
+	MD5STEP(F1, _a, _b, _c, _d, _in[ 0] + 0xd76aa478,  7); \
+	MD5STEP(F1, _d, _a, _b, _c, _in[ 1] + 0xe8c7b756, 12); \
+	MD5STEP(F1, _c, _d, _a, _b, _in[ 2] + 0x242070db, 17); \
+	MD5STEP(F1, _b, _c, _d, _a, _in[ 3] + 0xc1bdceee, 22); \
+	MD5STEP(F1, _a, _b, _c, _d, _in[ 4] + 0xf57c0faf,  7); \
+	MD5STEP(F1, _d, _a, _b, _c, _in[ 5] + 0x4787c62a, 12); \
+	MD5STEP(F1, _c, _d, _a, _b, _in[ 6] + 0xa8304613, 17); \
+	MD5STEP(F1, _b, _c, _d, _a, _in[ 7] + 0xfd469501, 22); \
+	MD5STEP(F1, _a, _b, _c, _d, _in[ 8] + 0x698098d8,  7); \
+	MD5STEP(F1, _d, _a, _b, _c, _in[ 9] + 0x8b44f7af, 12); \
+	MD5STEP(F1, _c, _d, _a, _b, _in[10] + 0xffff5bb1, 17); \
+	MD5STEP(F1, _b, _c, _d, _a, _in[11] + 0x895cd7be, 22); \
+	MD5STEP(F1, _a, _b, _c, _d, _in[12] + 0x6b901122,  7); \
+	MD5STEP(F1, _d, _a, _b, _c, _in[13] + 0xfd987193, 12); \
+	MD5STEP(F1, _c, _d, _a, _b, _in[14] + 0xa679438e, 17); \
+	MD5STEP(F1, _b, _c, _d, _a, _in[15] + 0x49b40821, 22); \
+\
+	MD5STEP(F2, _a, _b, _c, _d, _in[ 1] + 0xf61e2562,  5); \
+	MD5STEP(F2, _d, _a, _b, _c, _in[ 6] + 0xc040b340,  9); \
+	MD5STEP(F2, _c, _d, _a, _b, _in[11] + 0x265e5a51, 14); \
+	MD5STEP(F2, _b, _c, _d, _a, _in[ 0] + 0xe9b6c7aa, 20); \
+	MD5STEP(F2, _a, _b, _c, _d, _in[ 5] + 0xd62f105d,  5); \
+	MD5STEP(F2, _d, _a, _b, _c, _in[10] + 0x02441453,  9); \
+	MD5STEP(F2, _c, _d, _a, _b, _in[15] + 0xd8a1e681, 14); \
+	MD5STEP(F2, _b, _c, _d, _a, _in[ 4] + 0xe7d3fbc8, 20); \
+	MD5STEP(F2, _a, _b, _c, _d, _in[ 9] + 0x21e1cde6,  5); \
+	MD5STEP(F2, _d, _a, _b, _c, _in[14] + 0xc33707d6,  9); \
+	MD5STEP(F2, _c, _d, _a, _b, _in[ 3] + 0xf4d50d87, 14); \
+	MD5STEP(F2, _b, _c, _d, _a, _in[ 8] + 0x455a14ed, 20); \
+	MD5STEP(F2, _a, _b, _c, _d, _in[13] + 0xa9e3e905,  5); \
+	MD5STEP(F2, _d, _a, _b, _c, _in[ 2] + 0xfcefa3f8,  9); \
+	MD5STEP(F2, _c, _d, _a, _b, _in[ 7] + 0x676f02d9, 14); \
+	MD5STEP(F2, _b, _c, _d, _a, _in[12] + 0x8d2a4c8a, 20); \
+\
+	MD5STEP(F3, _a, _b, _c, _d, _in[ 5] + 0xfffa3942,  4); \
+	MD5STEP(F3, _d, _a, _b, _c, _in[ 8] + 0x8771f681, 11); \
+	MD5STEP(F3, _c, _d, _a, _b, _in[11] + 0x6d9d6122, 16); \
+	MD5STEP(F3, _b, _c, _d, _a, _in[14] + 0xfde5380c, 23); \
+	MD5STEP(F3, _a, _b, _c, _d, _in[ 1] + 0xa4beea44,  4); \
+	MD5STEP(F3, _d, _a, _b, _c, _in[ 4] + 0x4bdecfa9, 11); \
+	MD5STEP(F3, _c, _d, _a, _b, _in[ 7] + 0xf6bb4b60, 16); \
+	MD5STEP(F3, _b, _c, _d, _a, _in[10] + 0xbebfbc70, 23); \
+	MD5STEP(F3, _a, _b, _c, _d, _in[13] + 0x289b7ec6,  4); \
+	MD5STEP(F3, _d, _a, _b, _c, _in[ 0] + 0xeaa127fa, 11); \
+	MD5STEP(F3, _c, _d, _a, _b, _in[ 3] + 0xd4ef3085, 16); \
+	MD5STEP(F3, _b, _c, _d, _a, _in[ 6] + 0x04881d05, 23); \
+	MD5STEP(F3, _a, _b, _c, _d, _in[ 9] + 0xd9d4d039,  4); \
+	MD5STEP(F3, _d, _a, _b, _c, _in[12] + 0xe6db99e5, 11); \
+	MD5STEP(F3, _c, _d, _a, _b, _in[15] + 0x1fa27cf8, 16); \
+	MD5STEP(F3, _b, _c, _d, _a, _in[2 ] + 0xc4ac5665, 23); \
+\
+	MD5STEP(F4, _a, _b, _c, _d, _in[ 0] + 0xf4292244,  6); \
+	MD5STEP(F4, _d, _a, _b, _c, _in[7 ] + 0x432aff97, 10); \
+	MD5STEP(F4, _c, _d, _a, _b, _in[14] + 0xab9423a7, 15); \
+	MD5STEP(F4, _b, _c, _d, _a, _in[5 ] + 0xfc93a039, 21); \
+	MD5STEP(F4, _a, _b, _c, _d, _in[12] + 0x655b59c3,  6); \
+	MD5STEP(F4, _d, _a, _b, _c, _in[3 ] + 0x8f0ccc92, 10); \
+	MD5STEP(F4, _c, _d, _a, _b, _in[10] + 0xffeff47d, 15); \
+	MD5STEP(F4, _b, _c, _d, _a, _in[1 ] + 0x85845dd1, 21); \
+	MD5STEP(F4, _a, _b, _c, _d, _in[8 ] + 0x6fa87e4f,  6); \
+	MD5STEP(F4, _d, _a, _b, _c, _in[15] + 0xfe2ce6e0, 10); \
+	MD5STEP(F4, _c, _d, _a, _b, _in[6 ] + 0xa3014314, 15); \
+	MD5STEP(F4, _b, _c, _d, _a, _in[13] + 0x4e0811a1, 21); \
+	MD5STEP(F4, _a, _b, _c, _d, _in[4 ] + 0xf7537e82,  6); \
+	MD5STEP(F4, _d, _a, _b, _c, _in[11] + 0xbd3af235, 10); \
+	MD5STEP(F4, _c, _d, _a, _b, _in[2 ] + 0x2ad7d2bb, 15); \
+	MD5STEP(F4, _b, _c, _d, _a, _in[9 ] + 0xeb86d391, 21); \
+} while (0)
+
 #ifndef HAVE_OPENSSL_EVP_H
 /*
  * This code implements the MD5 message-digest algorithm.
@@ -166,15 +251,6 @@ void fr_md5_final(uint8_t out[MD5_DIGEST_LENGTH], FR_MD5_CTX *ctx)
 	memset(ctx, 0, sizeof(*ctx));	/* in case it's sensitive */
 }
 
-/* The four core functions - F1 is optimized somewhat */
-#define F1(x, y, z) (z ^ (x & (y ^ z)))
-#define F2(x, y, z) F1(z, x, y)
-#define F3(x, y, z) (x ^ y ^ z)
-#define F4(x, y, z) (y ^ (x | ~z))
-
-/* This is the central step in the MD5 algorithm. */
-#define MD5STEP(f, w, x, y, z, data, s) (w += f(x, y, z) + data, w = w << s | w >> (32 - s),  w += x)
-
 /** The core of the MD5 algorithm
  *
  * This alters an existing MD5 hash to reflect the addition of 16
@@ -201,77 +277,199 @@ void fr_md5_transform(uint32_t state[4], uint8_t const block[MD5_BLOCK_LENGTH])
 	c = state[2];
 	d = state[3];
 
-	MD5STEP(F1, a, b, c, d, in[ 0] + 0xd76aa478,  7);
-	MD5STEP(F1, d, a, b, c, in[ 1] + 0xe8c7b756, 12);
-	MD5STEP(F1, c, d, a, b, in[ 2] + 0x242070db, 17);
-	MD5STEP(F1, b, c, d, a, in[ 3] + 0xc1bdceee, 22);
-	MD5STEP(F1, a, b, c, d, in[ 4] + 0xf57c0faf,  7);
-	MD5STEP(F1, d, a, b, c, in[ 5] + 0x4787c62a, 12);
-	MD5STEP(F1, c, d, a, b, in[ 6] + 0xa8304613, 17);
-	MD5STEP(F1, b, c, d, a, in[ 7] + 0xfd469501, 22);
-	MD5STEP(F1, a, b, c, d, in[ 8] + 0x698098d8,  7);
-	MD5STEP(F1, d, a, b, c, in[ 9] + 0x8b44f7af, 12);
-	MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17);
-	MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22);
-	MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122,  7);
-	MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12);
-	MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17);
-	MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22);
-
-	MD5STEP(F2, a, b, c, d, in[ 1] + 0xf61e2562,  5);
-	MD5STEP(F2, d, a, b, c, in[ 6] + 0xc040b340,  9);
-	MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14);
-	MD5STEP(F2, b, c, d, a, in[ 0] + 0xe9b6c7aa, 20);
-	MD5STEP(F2, a, b, c, d, in[ 5] + 0xd62f105d,  5);
-	MD5STEP(F2, d, a, b, c, in[10] + 0x02441453,  9);
-	MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14);
-	MD5STEP(F2, b, c, d, a, in[ 4] + 0xe7d3fbc8, 20);
-	MD5STEP(F2, a, b, c, d, in[ 9] + 0x21e1cde6,  5);
-	MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6,  9);
-	MD5STEP(F2, c, d, a, b, in[ 3] + 0xf4d50d87, 14);
-	MD5STEP(F2, b, c, d, a, in[ 8] + 0x455a14ed, 20);
-	MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905,  5);
-	MD5STEP(F2, d, a, b, c, in[ 2] + 0xfcefa3f8,  9);
-	MD5STEP(F2, c, d, a, b, in[ 7] + 0x676f02d9, 14);
-	MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);
-
-	MD5STEP(F3, a, b, c, d, in[ 5] + 0xfffa3942,  4);
-	MD5STEP(F3, d, a, b, c, in[ 8] + 0x8771f681, 11);
-	MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16);
-	MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23);
-	MD5STEP(F3, a, b, c, d, in[ 1] + 0xa4beea44,  4);
-	MD5STEP(F3, d, a, b, c, in[ 4] + 0x4bdecfa9, 11);
-	MD5STEP(F3, c, d, a, b, in[ 7] + 0xf6bb4b60, 16);
-	MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23);
-	MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6,  4);
-	MD5STEP(F3, d, a, b, c, in[ 0] + 0xeaa127fa, 11);
-	MD5STEP(F3, c, d, a, b, in[ 3] + 0xd4ef3085, 16);
-	MD5STEP(F3, b, c, d, a, in[ 6] + 0x04881d05, 23);
-	MD5STEP(F3, a, b, c, d, in[ 9] + 0xd9d4d039,  4);
-	MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11);
-	MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);
-	MD5STEP(F3, b, c, d, a, in[2 ] + 0xc4ac5665, 23);
-
-	MD5STEP(F4, a, b, c, d, in[ 0] + 0xf4292244,  6);
-	MD5STEP(F4, d, a, b, c, in[7 ] + 0x432aff97, 10);
-	MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15);
-	MD5STEP(F4, b, c, d, a, in[5 ] + 0xfc93a039, 21);
-	MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3,  6);
-	MD5STEP(F4, d, a, b, c, in[3 ] + 0x8f0ccc92, 10);
-	MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15);
-	MD5STEP(F4, b, c, d, a, in[1 ] + 0x85845dd1, 21);
-	MD5STEP(F4, a, b, c, d, in[8 ] + 0x6fa87e4f,  6);
-	MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);
-	MD5STEP(F4, c, d, a, b, in[6 ] + 0xa3014314, 15);
-	MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21);
-	MD5STEP(F4, a, b, c, d, in[4 ] + 0xf7537e82,  6);
-	MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10);
-	MD5STEP(F4, c, d, a, b, in[2 ] + 0x2ad7d2bb, 15);
-	MD5STEP(F4, b, c, d, a, in[9 ] + 0xeb86d391, 21);
+	MD5_ROUNDS(a, b, c, d, in);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+#endif
+
+#ifndef MD5_BLOCK_LENGTH
+#  define MD5_BLOCK_LENGTH 64
+#endif
+
+#define GET_32BIT_LE(cp) (\
+	(uint32_t)((cp)[0]) |\
+	(uint32_t)((cp)[1]) << 8 |\
+	(uint32_t)((cp)[2]) << 16 |\
+	(uint32_t)((cp)[3]) << 24)
+
+#ifdef __GNUC__
+/*
+ *	One uint32_t per lane.  With AVX2 the compiler maps this directly
+ *	onto a ymm register.  Without it, each operation is split into
+ *	two SSE2 halves.
+ */
+typedef uint32_t fr_md5_vec_t __attribute__((vector_size(FR_MD5_LANES * sizeof(uint32_t))));
+
+/*
+ *	Distributions build for baseline x86-64, which has no AVX2.  So
+ *	on x86-64 ELF systems, compile fr_md5_calc_multi() once for each
+ *	instruction set, and have the dynamic linker pick the best one
+ *	the CPU supports when the library is loaded.
+ */
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GLIBC__) && defined(__has_attribute)
+#  if __has_attribute(target_clones)
+#    define MD5_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#  endif
+#endif
+#ifndef MD5_TARGET_CLONES
+#  define MD5_TARGET_CLONES
+#endif
+
+/** Run one MD5 block transform on every lane
+ *
+ * Always inlined, so that each clone of fr_md5_calc_multi() gets a copy
+ * built for its own instruction set.
+ *
+ * @param[in,out] state	of each lane, one vector per MD5 state word.
+ * @param[in] block	64 bytes of input for each lane.
+ */
+static inline CC_HINT(always_inline) void fr_md5_transform_multi(fr_md5_vec_t state[4],
+								 uint8_t const *block[FR_MD5_LANES])
+{
+	fr_md5_vec_t	a, b, c, d, in[MD5_BLOCK_LENGTH / 4];
+	int		i, j;
+
+	for (j = 0; j < FR_MD5_LANES; j++) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+		uint32_t words[MD5_BLOCK_LENGTH / 4];
+
+		memcpy(words, block[j], sizeof(words));
+		for (i = 0; i < MD5_BLOCK_LENGTH / 4; i++) in[i][j] = words[i];
+#else
+		for (i = 0; i < MD5_BLOCK_LENGTH / 4; i++) in[i][j] = GET_32BIT_LE(block[j] + (i * 4));
+#endif
+	}
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+
+	MD5_ROUNDS(a, b, c, d, in);
 
 	state[0] += a;
 	state[1] += b;
 	state[2] += c;
 	state[3] += d;
 }
+
+/** Calculate the MD5 hashes of multiple buffers
+ *
+ * Buffers are hashed #FR_MD5_LANES at a time, with one lane per buffer.
+ * Lanes run in lock step, so the cost of each group is set by its longest
+ * buffer.  This works best when the buffers are of similar length, as
+ * RADIUS packets from the same batch usually are.
+ *
+ * @param[out] out	Where to write the MD5 digest of each buffer.  Each must be a
+ *			minimum of MD5_DIGEST_LENGTH.
+ * @param[in] in	Data to hash.
+ * @param[in] inlen	Length of each buffer in in.
+ * @param[in] num	Number of buffers.
+ */
+MD5_TARGET_CLONES void fr_md5_calc_multi(uint8_t *out[], uint8_t const *in[], size_t const inlen[], size_t num)
+{
+	static uint8_t const	zero[MD5_BLOCK_LENGTH];
+	size_t			i, j, k;
+
+	for (i = 0; i < num; i += FR_MD5_LANES) {
+		fr_md5_vec_t	state[4];
+		uint8_t const	*block[FR_MD5_LANES];
+		uint8_t		tail[FR_MD5_LANES][2 * MD5_BLOCK_LENGTH];
+		size_t		full[FR_MD5_LANES], blocks[FR_MD5_LANES];
+		size_t		lanes, max = 0;
+
+		lanes = num - i;
+		if (lanes > FR_MD5_LANES) lanes = FR_MD5_LANES;
+
+		/*
+		 *	Full blocks are read directly from the input.
+		 *	The partial block, the padding and the length
+		 *	go into the lane's tail, which is one or two
+		 *	blocks long.
+		 */
+		for (j = 0; j < lanes; j++) {
+			size_t		len = inlen[i + j];
+			size_t		rem = len & (MD5_BLOCK_LENGTH - 1);
+			uint64_t	bits = (uint64_t)len << 3;
+			uint8_t		*p;
+
+			full[j] = len / MD5_BLOCK_LENGTH;
+			blocks[j] = full[j] + ((rem < (MD5_BLOCK_LENGTH - 8)) ? 1 : 2);
+			if (blocks[j] > max) max = blocks[j];
+
+			memset(tail[j], 0, sizeof(tail[j]));
+			memcpy(tail[j], in[i + j] + (full[j] * MD5_BLOCK_LENGTH), rem);
+			tail[j][rem] = 0x80;
+
+			p = tail[j] + ((blocks[j] - full[j]) * MD5_BLOCK_LENGTH) - 8;
+			for (k = 0; k < 8; k++) p[k] = bits >> (k * 8);
+		}
+
+		for (k = 0; k < 4; k++) state[k] = (fr_md5_vec_t){ 0 };
+		state[0] += 0x67452301;
+		state[1] += 0xefcdab89;
+		state[2] += 0x98badcfe;
+		state[3] += 0x10325476;
+
+		for (k = 0; k < max; k++) {
+			for (j = 0; j < FR_MD5_LANES; j++) {
+				if ((j >= lanes) || (k >= blocks[j])) {
+					block[j] = zero;	/* unused, or already finished */
+
+				} else if (k < full[j]) {
+					block[j] = in[i + j] + (k * MD5_BLOCK_LENGTH);
+
+				} else {
+					block[j] = tail[j] + ((k - full[j]) * MD5_BLOCK_LENGTH);
+				}
+			}
+
+			fr_md5_transform_multi(state, block);
+
+			/*
+			 *	Copy out the digests of the lanes which
+			 *	have just processed their last block.
+			 */
+			for (j = 0; j < lanes; j++) {
+				int w;
+
+				if ((k + 1) != blocks[j]) continue;
+
+				for (w = 0; w < 4; w++) {
+					uint8_t		*p = out[i + j] + (w * 4);
+					uint32_t	v = state[w][j];
+
+					p[0] = v;
+					p[1] = v >> 8;
+					p[2] = v >> 16;
+					p[3] = v >> 24;
+				}
+			}
+		}
+
+		memset(tail, 0, sizeof(tail));	/* in case it's sensitive */
+	}
+}
+#else
+/** Calculate the MD5 hashes of multiple buffers
+ *
+ * The compiler doesn't support vector types, so the buffers are hashed
+ * one at a time.
+ *
+ * @param[out] out	Where to write the MD5 digest of each buffer.  Each must be a
+ *			minimum of MD5_DIGEST_LENGTH.
+ * @param[in] in	Data to hash.
+ * @param[in] inlen	Length of each buffer in in.
+ * @param[in] num	Number of buffers.
+ */
+void fr_md5_calc_multi(uint8_t *out[], uint8_t const *in[], size_t const inlen[], size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++) fr_md5_calc(out[i], in[i], inlen[i]);
+}
 #endif
@@ -276,6 +276,13 @@ void fr_pair_steal(TALLOC_CTX *ctx, VALUE_PAIR *vp)
 {
 	(void) talloc_steal(ctx, vp);
 
+	/*
+	 *	The value may point into the packet the VP was
+	 *	decoded from, which may be freed before the new
+	 *	context is.  Give the VP its own copy.
+	 */
+	if (vp->data.borrowed) fr_value_box_unborrow(vp, &vp->data);
+
 	/*
 	 *	The DA may be unknown.  If we're stealing the VPs to a
 	 *	different context, copy the unknown DA.  We use the VP
@@ -614,15 +621,22 @@ int fr_pair_mark_xlat(VALUE_PAIR *vp, char const *value)
 
 /** Find the pair with the matching DAs
  *
+ * Walks the list directly, as this is the most common lookup, and
+ * doesn't need the state a #vp_cursor_t carries.
  */
 VALUE_PAIR *fr_pair_find_by_da(VALUE_PAIR *head, fr_dict_attr_t const *da, int8_t tag)
 {
-	vp_cursor_t 	cursor;
+	VALUE_PAIR	*i;
 
 	if(!fr_cond_assert(da)) return NULL;
 
-	(void) fr_pair_cursor_init(&cursor, &head);
-	return fr_pair_cursor_next_by_da(&cursor, da, tag);
+	for (i = head; i; i = i->next) {
+		VERIFY_VP(i);
+		if (i->da != da) continue;
+		if (!da->flags.has_tag || TAG_EQ(tag, i->tag)) return i;
+	}
+
+	return NULL;
 }
 
 
@@ -1699,6 +1713,7 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 				break;
 
 			case FR_TYPE_OCTETS:
+				if (i->data.borrowed) fr_value_box_unborrow(i, &i->data);
 				fr_pair_value_memsteal(found, i->vp_octets);
 				i->vp_octets = NULL;
 				break;
@@ -2664,6 +2679,12 @@ inline void fr_pair_verify(char const *file, int line, VALUE_PAIR const *vp)
 		size_t len;
 		TALLOC_CTX *parent;
 
+		/*
+		 *	Borrowed buffers belong to something else,
+		 *	usually the packet the VP was decoded from.
+		 */
+		if (vp->data.borrowed) break;
+
 		if (!talloc_get_type(vp->vp_ptr, uint8_t)) {
 			FR_FAULT_LOG("CONSISTENCY CHECK FAILED %s[%u]: VALUE_PAIR \"%s\" data buffer type should be "
 				     "uint8_t but is %s\n", file, line, vp->da->name, talloc_get_name(vp->vp_ptr));
@@ -0,0 +1,527 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/util/trie.c
+ * @brief Path-compressed binary tries, for longest prefix matching.
+ *
+ *  The trie maps (key, bits) prefixes to data.  Nodes only exist where
+ *  there is data, or where two prefixes diverge, so a lookup visits at
+ *  most one node per distinct prefix length on the path to the key.
+ *
+ *  Lookups are lock-free.  Updates never modify a node which readers
+ *  can see.  Instead, the nodes on the path to the change are copied,
+ *  and the new root is published atomically.  Readers see either the
+ *  old version of the trie, or the new one.
+ *
+ *  The nodes which are no longer part of the trie are "retired", and
+ *  freed by a later update once FR_TRIE_RETIRE_DELAY seconds have
+ *  passed.  Readers don't register with the trie, so we rely on a
+ *  lookup taking much less time than that.
+ *
+ *  Updates are NOT thread-safe with respect to each other.  The caller
+ *  has to serialise them.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/trie.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#define FR_TRIE_MAX_KEY_BYTES	(FR_TRIE_MAX_KEY_BITS / 8)
+
+/*
+ *	How long (in seconds) retired nodes are kept before they are
+ *	freed.
+ */
+#define FR_TRIE_RETIRE_DELAY	(60)
+
+typedef struct fr_trie_node_t fr_trie_node_t;
+
+struct fr_trie_node_t {
+	uint8_t			key[FR_TRIE_MAX_KEY_BYTES];	//!< key, masked to "bits"
+	uint32_t		bits;				//!< number of significant bits in the key
+	void			*data;				//!< user data, or NULL for a branch node
+	fr_trie_node_t		*child[2];			//!< children, by the value of the next bit
+
+	fr_trie_node_t		*next_retired;			//!< next node in the retired list
+	time_t			retired;			//!< when the node was removed from the trie
+};
+
+struct fr_trie_t {
+	_Atomic(fr_trie_node_t *) root;		//!< current version of the trie
+
+	uint32_t		max_bits;	//!< maximum key length
+	uint32_t		num_elements;	//!< number of prefixes with data
+
+	fr_trie_node_t		*retired_head;	//!< oldest retired node
+	fr_trie_node_t		*retired_tail;	//!< newest retired node
+};
+
+/*
+ *	State for one update.
+ */
+typedef struct fr_trie_op_t {
+	fr_trie_t		*ft;
+	bool			failed;		//!< ran out of memory
+
+	fr_trie_node_t		*created[FR_TRIE_MAX_KEY_BITS + 3];	//!< new nodes, freed on failure
+	int			num_created;
+
+	fr_trie_node_t		*replaced;	//!< nodes which aren't in the new version of the trie
+
+	void			*data;		//!< data which was removed
+} fr_trie_op_t;
+
+/** Get one bit of a key
+ *
+ */
+static inline int trie_bit(uint8_t const *key, uint32_t bit)
+{
+	return (key[bit >> 3] >> (7 - (bit & 0x07))) & 0x01;
+}
+
+/** Return the number of leading bits which are the same in both keys
+ *
+ * @param[in] a first key
+ * @param[in] b second key
+ * @param[in] max maximum number of bits to check
+ * @return the number of common bits, no more than "max".
+ */
+static uint32_t trie_common(uint8_t const *a, uint8_t const *b, uint32_t max)
+{
+	uint32_t	i, bits;
+	uint8_t		diff;
+
+	for (i = 0; (i * 8) < max; i++) {
+		diff = a[i] ^ b[i];
+		if (!diff) continue;
+
+		bits = i * 8;
+		while (!(diff & 0x80)) {
+			diff <<= 1;
+			bits++;
+		}
+
+		return (bits < max) ? bits : max;
+	}
+
+	return max;
+}
+
+static fr_trie_node_t *trie_node_alloc(fr_trie_op_t *op, uint8_t const *key, uint32_t bits, void *data)
+{
+	fr_trie_node_t	*node;
+	uint32_t	bytes;
+
+	node = talloc_zero(op->ft, fr_trie_node_t);
+	if (!node) {
+		op->failed = true;
+		return NULL;
+	}
+	op->created[op->num_created++] = node;
+
+	bytes = bits >> 3;
+	memcpy(node->key, key, bytes);
+	if (bits & 0x07) node->key[bytes] = key[bytes] & (0xff << (8 - (bits & 0x07)));
+
+	node->bits = bits;
+	node->data = data;
+
+	return node;
+}
+
+/** Remember that a node is no longer part of the new trie
+ *
+ */
+static inline void trie_node_replaced(fr_trie_op_t *op, fr_trie_node_t *node)
+{
+	node->next_retired = op->replaced;
+	op->replaced = node;
+}
+
+/** Copy a node, and replace the old one
+ *
+ */
+static fr_trie_node_t *trie_node_copy(fr_trie_op_t *op, fr_trie_node_t *old)
+{
+	fr_trie_node_t *node;
+
+	node = trie_node_alloc(op, old->key, old->bits, old->data);
+	if (!node) return NULL;
+
+	node->child[0] = old->child[0];
+	node->child[1] = old->child[1];
+
+	trie_node_replaced(op, old);
+
+	return node;
+}
+
+/** Publish the new version of the trie, and free old nodes
+ *
+ */
+static void trie_commit(fr_trie_op_t *op, fr_trie_node_t *root)
+{
+	fr_trie_t	*ft = op->ft;
+	fr_trie_node_t	*node, *next;
+	time_t		now;
+
+	atomic_store_explicit(&ft->root, root, memory_order_release);
+
+	now = time(NULL);
+
+	/*
+	 *	Readers may still be using the replaced nodes.
+	 */
+	for (node = op->replaced; node != NULL; node = next) {
+		next = node->next_retired;
+
+		node->next_retired = NULL;
+		node->retired = now;
+
+		if (!ft->retired_head) {
+			ft->retired_head = ft->retired_tail = node;
+		} else {
+			ft->retired_tail->next_retired = node;
+			ft->retired_tail = node;
+		}
+	}
+
+	/*
+	 *	Nothing can be using the oldest nodes.
+	 */
+	while ((node = ft->retired_head) != NULL) {
+		if ((node->retired + FR_TRIE_RETIRE_DELAY) > now) break;
+
+		ft->retired_head = node->next_retired;
+		if (!ft->retired_head) ft->retired_tail = NULL;
+
+		talloc_free(node);
+	}
+}
+
+/** Undo a failed update
+ *
+ *  Nothing has been published, so the new nodes can be freed
+ *  immediately.
+ */
+static void trie_abort(fr_trie_op_t *op)
+{
+	int i;
+
+	for (i = 0; i < op->num_created; i++) {
+		talloc_free(op->created[i]);
+	}
+}
+
+static fr_trie_node_t *trie_insert(fr_trie_op_t *op, fr_trie_node_t *node, uint8_t const *key, uint32_t bits, void *data)
+{
+	fr_trie_node_t	*new, *child;
+	uint32_t	common;
+	int		bit;
+
+	if (!node) return trie_node_alloc(op, key, bits, data);
+
+	common = trie_common(node->key, key, (node->bits < bits) ? node->bits : bits);
+
+	/*
+	 *	The node is a prefix of the key.
+	 */
+	if (common == node->bits) {
+		if (node->bits == bits) {
+			if (node->data) {
+				fr_strerror_printf("Prefix already exists");
+				return NULL;
+			}
+
+			new = trie_node_copy(op, node);
+			if (!new) return NULL;
+
+			new->data = data;
+			return new;
+		}
+
+		bit = trie_bit(key, node->bits);
+		child = trie_insert(op, node->child[bit], key, bits, data);
+		if (!child) return NULL;
+
+		new = trie_node_copy(op, node);
+		if (!new) return NULL;
+
+		new->child[bit] = child;
+		return new;
+	}
+
+	/*
+	 *	The key is a prefix of the node.  The node becomes a
+	 *	child of the new one.
+	 */
+	if (common == bits) {
+		new = trie_node_alloc(op, key, bits, data);
+		if (!new) return NULL;
+
+		new->child[trie_bit(node->key, bits)] = node;
+		return new;
+	}
+
+	/*
+	 *	The key and the node diverge.  Add a branch node.
+	 */
+	new = trie_node_alloc(op, key, common, NULL);
+	if (!new) return NULL;
+
+	child = trie_node_alloc(op, key, bits, data);
+	if (!child) return NULL;
+
+	new->child[trie_bit(key, common)] = child;
+	new->child[trie_bit(node->key, common)] = node;
+
+	return new;
+}
+
+static fr_trie_node_t *trie_remove(fr_trie_op_t *op, fr_trie_node_t *node, uint8_t const *key, uint32_t bits)
+{
+	fr_trie_node_t	*new, *child;
+	int		bit;
+
+	if (!node) return NULL;
+
+	if ((node->bits > bits) || (trie_common(node->key, key, node->bits) < node->bits)) return node;
+
+	if (node->bits == bits) {
+		if (!node->data) return node;
+
+		op->data = node->data;
+
+		/*
+		 *	It's still needed as a branch node.
+		 */
+		if (node->child[0] && node->child[1]) {
+			new = trie_node_copy(op, node);
+			if (!new) return NULL;
+
+			new->data = NULL;
+			return new;
+		}
+
+		trie_node_replaced(op, node);
+		return node->child[0] ? node->child[0] : node->child[1];
+	}
+
+	bit = trie_bit(key, node->bits);
+	child = trie_remove(op, node->child[bit], key, bits);
+	if (op->failed) return NULL;
+	if (child == node->child[bit]) return node;
+
+	/*
+	 *	A branch node with only one child isn't needed.
+	 */
+	if (!node->data && !child) {
+		trie_node_replaced(op, node);
+		return node->child[bit ^ 0x01];
+	}
+
+	new = trie_node_copy(op, node);
+	if (!new) return NULL;
+
+	new->child[bit] = child;
+	return new;
+}
+
+/** Allocate a trie
+ *
+ * @param[in] ctx to allocate the trie in.
+ * @param[in] max_bits the maximum length of a key, in bits.
+ * @return
+ *	- NULL on error.
+ *	- fr_trie_t on success.
+ */
+fr_trie_t *fr_trie_alloc(TALLOC_CTX *ctx, uint32_t max_bits)
+{
+	fr_trie_t *ft;
+
+	if (max_bits > FR_TRIE_MAX_KEY_BITS) {
+		fr_strerror_printf("Keys cannot be more than %d bits", FR_TRIE_MAX_KEY_BITS);
+		return NULL;
+	}
+
+	ft = talloc_zero(ctx, fr_trie_t);
+	if (!ft) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+
+	ft->max_bits = max_bits;
+	atomic_init(&ft->root, NULL);
+
+	return ft;
+}
+
+/** Insert a prefix into the trie
+ *
+ * @param[in] ft the trie.
+ * @param[in] key the key, in network byte order.
+ * @param[in] bits the number of significant bits in the key.
+ * @param[in] data to associate with the prefix.  Must not be NULL.
+ * @return
+ *	- <0 on error, including the prefix already existing.
+ *	- 0 on success.
+ */
+int fr_trie_insert(fr_trie_t *ft, void const *key, uint32_t bits, void *data)
+{
+	fr_trie_op_t	op;
+	fr_trie_node_t	*root;
+
+	if (!data) {
+		fr_strerror_printf("Data cannot be NULL");
+		return -1;
+	}
+
+	if (bits > ft->max_bits) {
+		fr_strerror_printf("Key is too long");
+		return -1;
+	}
+
+	memset(&op, 0, sizeof(op));
+	op.ft = ft;
+
+	root = atomic_load_explicit(&ft->root, memory_order_relaxed);
+	root = trie_insert(&op, root, key, bits, data);
+	if (!root) {
+		if (op.failed) fr_strerror_printf("Out of memory");
+		trie_abort(&op);
+		return -1;
+	}
+
+	trie_commit(&op, root);
+	ft->num_elements++;
+
+	return 0;
+}
+
+/** Remove a prefix from the trie
+ *
+ * @param[in] ft the trie.
+ * @param[in] key the key, in network byte order.
+ * @param[in] bits the number of significant bits in the key.
+ * @return
+ *	- NULL if the prefix wasn't found, or on error.
+ *	- the data which was associated with the prefix.
+ */
+void *fr_trie_remove(fr_trie_t *ft, void const *key, uint32_t bits)
+{
+	fr_trie_op_t	op;
+	fr_trie_node_t	*root;
+
+	if (bits > ft->max_bits) return NULL;
+
+	memset(&op, 0, sizeof(op));
+	op.ft = ft;
+
+	root = atomic_load_explicit(&ft->root, memory_order_relaxed);
+	root = trie_remove(&op, root, key, bits);
+	if (op.failed) {
+		fr_strerror_printf("Out of memory");
+		trie_abort(&op);
+		return NULL;
+	}
+
+	if (!op.data) return NULL;
+
+	trie_commit(&op, root);
+	ft->num_elements--;
+
+	return op.data;
+}
+
+/** Find an exact prefix in the trie
+ *
+ *  May be called at the same time as an update.
+ *
+ * @param[in] ft the trie.
+ * @param[in] key the key, in network byte order.
+ * @param[in] bits the number of significant bits in the key.
+ * @return
+ *	- NULL if the prefix wasn't found.
+ *	- the data associated with the prefix.
+ */
+void *fr_trie_find(fr_trie_t *ft, void const *key, uint32_t bits)
+{
+	fr_trie_node_t *node;
+
+	if (bits > ft->max_bits) return NULL;
+
+	node = atomic_load_explicit(&ft->root, memory_order_acquire);
+	while (node) {
+		if ((node->bits > bits) || (trie_common(node->key, key, node->bits) < node->bits)) return NULL;
+
+		if (node->bits == bits) return node->data;
+
+		node = node->child[trie_bit(key, node->bits)];
+	}
+
+	return NULL;
+}
+
+/** Find the longest prefix in the trie which matches a key
+ *
+ *  May be called at the same time as an update.
+ *
+ * @param[in] ft the trie.
+ * @param[in] key the key, in network byte order.
+ * @param[in] bits the length of the key.
+ * @return
+ *	- NULL if no prefix matches.
+ *	- the data associated with the longest matching prefix.
+ */
+void *fr_trie_lookup(fr_trie_t *ft, void const *key, uint32_t bits)
+{
+	fr_trie_node_t	*node;
+	void		*found = NULL;
+
+	if (bits > ft->max_bits) return NULL;
+
+	node = atomic_load_explicit(&ft->root, memory_order_acquire);
+	while (node) {
+		if ((node->bits > bits) || (trie_common(node->key, key, node->bits) < node->bits)) break;
+
+		if (node->data) found = node->data;
+
+		if (node->bits == bits) break;
+
+		node = node->child[trie_bit(key, node->bits)];
+	}
+
+	return found;
+}
+
+/** Return the number of prefixes in the trie
+ *
+ */
+uint32_t fr_trie_num_elements(fr_trie_t *ft)
+{
+	return ft->num_elements;
+}
@@ -237,3 +237,321 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 
 	return received;
 }
+
+#ifdef WITH_UDP_BATCH
+/*
+ *	Mac OSX Lion doesn't define SOL_IP.  But IPPROTO_IP works.
+ */
+#ifndef SOL_IP
+#  define SOL_IP IPPROTO_IP
+#endif
+
+#define UDP_BATCH_MAX	(64)
+#define UDP_CMSG_SIZE	(256)
+
+/** Get the destination address, interface, and timestamp from a received message
+ *
+ * @param[in] msgh	as filled in by recvmmsg().
+ * @param[in,out] entry	where the dst address is written.
+ */
+static void udp_batch_cmsg(struct msghdr *msgh, udp_batch_entry_t *entry)
+{
+#ifdef WITH_UDPFROMTO
+	struct cmsghdr	*cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msgh);
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+#ifdef IP_PKTINFO
+		if ((cmsg->cmsg_level == SOL_IP) &&
+		    (cmsg->cmsg_type == IP_PKTINFO)) {
+			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+
+			entry->dst_ipaddr.af = AF_INET;
+			entry->dst_ipaddr.prefix = 32;
+			entry->dst_ipaddr.addr.v4 = i->ipi_addr;
+			entry->if_index = i->ipi_ifindex;
+			continue;
+		}
+#endif
+
+#ifdef IP_RECVDSTADDR
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
+			entry->dst_ipaddr.af = AF_INET;
+			entry->dst_ipaddr.prefix = 32;
+			memcpy(&entry->dst_ipaddr.addr.v4, CMSG_DATA(cmsg), sizeof(entry->dst_ipaddr.addr.v4));
+			continue;
+		}
+#endif
+
+#ifdef IPV6_PKTINFO
+		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
+		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
+			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+
+			entry->dst_ipaddr.af = AF_INET6;
+			entry->dst_ipaddr.prefix = 128;
+			entry->dst_ipaddr.addr.v6 = i->ipi6_addr;
+			entry->if_index = i->ipi6_ifindex;
+			continue;
+		}
+#endif
+
+#ifdef SO_TIMESTAMP
+		if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
+			memcpy(&entry->when, CMSG_DATA(cmsg), sizeof(entry->when));
+		}
+#endif
+	}
+#endif	/* WITH_UDPFROMTO */
+}
+
+/** Read multiple UDP packets with one system call
+ *
+ *  This function is like calling udp_recv() multiple times.  The
+ *  socket MUST be non-blocking.
+ *
+ *  The caller fills in entries[i].data and entries[i].data_len with
+ *  the buffers to read into.  On return, the entries contain the
+ *  packet lengths and the src/dst ip/port of each packet.
+ *
+ * @param[in] sockfd we're reading from.
+ * @param[in,out] entries the buffers to read into, and the packet information.
+ * @param[in] num the number of entries.
+ * @return
+ *	- >0 the number of packets read.
+ *	- 0 no packets were available.
+ *	- <0 on failure.
+ */
+int udp_recv_batch(int sockfd, udp_batch_entry_t *entries, int num)
+{
+	int			i, received;
+	struct mmsghdr		msgs[UDP_BATCH_MAX];
+	struct iovec		iov[UDP_BATCH_MAX];
+	struct sockaddr_storage	src[UDP_BATCH_MAX];
+	uint8_t			cbuf[UDP_BATCH_MAX][UDP_CMSG_SIZE];
+	struct sockaddr_storage	dst;
+	socklen_t		sizeof_dst = sizeof(dst);
+	fr_ipaddr_t		dst_ipaddr;
+	uint16_t		dst_port;
+	struct timeval		now = { 0, 0 };
+
+	if (num > UDP_BATCH_MAX) num = UDP_BATCH_MAX;
+
+	memset(msgs, 0, sizeof(msgs[0]) * num);
+
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = entries[i].data;
+		iov[i].iov_len = entries[i].data_len;
+
+		msgs[i].msg_hdr.msg_name = &src[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(src[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = cbuf[i];
+		msgs[i].msg_hdr.msg_controllen = sizeof(cbuf[i]);
+	}
+
+	received = recvmmsg(sockfd, msgs, num, MSG_DONTWAIT, NULL);
+	if (received < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return 0;
+
+		fr_strerror_printf("udp_recv_batch failed: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	recvmsg doesn't provide the dst port, or the dst
+	 *	address if the socket isn't bound to INADDR_ANY.
+	 */
+	if (getsockname(sockfd, (struct sockaddr *)&dst, &sizeof_dst) < 0) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+		return -1;
+	}
+	if (fr_ipaddr_from_sockaddr(&dst, sizeof_dst, &dst_ipaddr, &dst_port) < 0) return -1;
+
+	for (i = 0; i < received; i++) {
+		udp_batch_entry_t *entry = &entries[i];
+
+		entry->data_len = msgs[i].msg_len;
+
+		if (fr_ipaddr_from_sockaddr(&src[i], msgs[i].msg_hdr.msg_namelen,
+					    &entry->src_ipaddr, &entry->src_port) < 0) {
+			/*
+			 *	Mark the packet as empty, so the
+			 *	caller will ignore it.
+			 */
+			entry->data_len = 0;
+			continue;
+		}
+
+		entry->dst_ipaddr = dst_ipaddr;
+		entry->dst_port = dst_port;
+		entry->if_index = 0;
+		entry->when.tv_sec = 0;
+		entry->when.tv_usec = 0;
+
+		udp_batch_cmsg(&msgs[i].msg_hdr, entry);
+
+		if (!entry->when.tv_sec) {
+			if (!now.tv_sec) gettimeofday(&now, NULL);
+			entry->when = now;
+		}
+	}
+
+	return received;
+}
+
+/** Write multiple UDP packets with one system call
+ *
+ *  This function is like calling udp_send() multiple times.
+ *
+ * @param[in] sockfd we're writing to.
+ * @param[in] entries the packets to write, and their src/dst ip/port.
+ * @param[in] num the number of entries.
+ * @return
+ *	- >=0 the number of packets written.
+ *	- <0 on failure.
+ */
+int udp_send_batch(int sockfd, udp_batch_entry_t *entries, int num)
+{
+	int			i, sent, total = 0;
+	struct mmsghdr		msgs[UDP_BATCH_MAX];
+	struct iovec		iov[UDP_BATCH_MAX];
+	struct sockaddr_storage	dst[UDP_BATCH_MAX];
+#if defined(WITH_UDPFROMTO) && (defined(IP_PKTINFO) || defined(IPV6_PKTINFO))
+	uint8_t			cbuf[UDP_BATCH_MAX][UDP_CMSG_SIZE];
+#endif
+
+	if (num > UDP_BATCH_MAX) num = UDP_BATCH_MAX;
+
+	memset(msgs, 0, sizeof(msgs[0]) * num);
+
+	for (i = 0; i < num; i++) {
+		udp_batch_entry_t	*entry = &entries[i];
+		socklen_t		sizeof_dst;
+
+		if (fr_ipaddr_to_sockaddr(&entry->dst_ipaddr, entry->dst_port, &dst[i], &sizeof_dst) < 0) return -1;
+
+		iov[i].iov_base = entry->data;
+		iov[i].iov_len = entry->data_len;
+
+		msgs[i].msg_hdr.msg_name = &dst[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof_dst;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+
+#ifdef WITH_UDPFROMTO
+		/*
+		 *	Set the source address, as with sendfromto().
+		 *	If we don't know it, let the kernel pick.
+		 */
+		if ((entry->src_ipaddr.af == AF_UNSPEC) || fr_ipaddr_is_inaddr_any(&entry->src_ipaddr)) continue;
+
+#  ifdef IP_PKTINFO
+		if (entry->src_ipaddr.af == AF_INET) {
+			struct cmsghdr *cmsg;
+			struct in_pktinfo *pkt;
+
+			memset(cbuf[i], 0, CMSG_SPACE(sizeof(*pkt)));
+			msgs[i].msg_hdr.msg_control = cbuf[i];
+			msgs[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(*pkt));
+
+			cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+			cmsg->cmsg_level = SOL_IP;
+			cmsg->cmsg_type = IP_PKTINFO;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
+
+			pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+			pkt->ipi_spec_dst = entry->src_ipaddr.addr.v4;
+			pkt->ipi_ifindex = entry->if_index;
+		}
+#  endif
+
+#  ifdef IPV6_PKTINFO
+		if (entry->src_ipaddr.af == AF_INET6) {
+			struct cmsghdr *cmsg;
+			struct in6_pktinfo *pkt;
+
+			memset(cbuf[i], 0, CMSG_SPACE(sizeof(*pkt)));
+			msgs[i].msg_hdr.msg_control = cbuf[i];
+			msgs[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(*pkt));
+
+			cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+			cmsg->cmsg_level = IPPROTO_IPV6;
+			cmsg->cmsg_type = IPV6_PKTINFO;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
+
+			pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+			pkt->ipi6_addr = entry->src_ipaddr.addr.v6;
+			pkt->ipi6_ifindex = entry->if_index;
+		}
+#  endif
+#endif	/* WITH_UDPFROMTO */
+	}
+
+	/*
+	 *	sendmmsg() may send fewer packets than we asked for.
+	 *	Keep going until they're all sent, or there's an error.
+	 */
+	while (total < num) {
+		sent = sendmmsg(sockfd, msgs + total, num - total, 0);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+
+			fr_strerror_printf("udp_send_batch failed: %s", fr_syserror(errno));
+			return total ? total : -1;
+		}
+
+		if (sent == 0) break;
+
+		total += sent;
+	}
+
+	return total;
+}
+#else
+/** Read multiple UDP packets
+ *
+ *  The system doesn't support recvmmsg(), so we read one packet.
+ */
+int udp_recv_batch(int sockfd, udp_batch_entry_t *entries, int num)
+{
+	ssize_t received;
+
+	if (num < 1) return 0;
+
+	received = udp_recv(sockfd, entries[0].data, entries[0].data_len, 0,
+			    &entries[0].src_ipaddr, &entries[0].src_port,
+			    &entries[0].dst_ipaddr, &entries[0].dst_port,
+			    &entries[0].if_index, &entries[0].when);
+	if (received < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return 0;
+		return -1;
+	}
+
+	entries[0].data_len = received;
+
+	return 1;
+}
+
+/** Write multiple UDP packets
+ *
+ *  The system doesn't support sendmmsg(), so we write them one at a time.
+ */
+int udp_send_batch(int sockfd, udp_batch_entry_t *entries, int num)
+{
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (udp_send(sockfd, entries[i].data, entries[i].data_len, 0,
+			     &entries[i].src_ipaddr, entries[i].src_port, entries[i].if_index,
+			     &entries[i].dst_ipaddr, entries[i].dst_port) < 0) {
+			return i ? i : -1;
+		}
+	}
+
+	return num;
+}
+#endif	/* WITH_UDP_BATCH */
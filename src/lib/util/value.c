@@ -226,7 +226,11 @@ inline void fr_value_box_clear(fr_value_box_t *data)
 	switch (data->type) {
 	case FR_TYPE_OCTETS:
 	case FR_TYPE_STRING:
-		TALLOC_FREE(data->datum.ptr);
+		if (data->borrowed) {
+			data->datum.ptr = NULL;
+		} else {
+			TALLOC_FREE(data->datum.ptr);
+		}
 		data->datum.length = 0;
 		break;
 
@@ -242,6 +246,7 @@ inline void fr_value_box_clear(fr_value_box_t *data)
 	}
 
 	data->tainted = false;
+	data->borrowed = false;
 	data->type = FR_TYPE_INVALID;
 }
 
@@ -264,6 +269,7 @@ static inline void fr_value_box_copy_meta(fr_value_box_t *dst, fr_value_box_t co
 	dst->enumv = src->enumv;
 	dst->type = src->type;
 	dst->tainted = src->tainted;
+	dst->borrowed = false;
 }
 
 /** Compare two values
@@ -2285,6 +2291,17 @@ void fr_value_box_copy_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_bo
 
 	case FR_TYPE_STRING:
 	case FR_TYPE_OCTETS:
+		/*
+		 *	Borrowed buffers aren't talloc chunks, so
+		 *	the copy borrows them too.
+		 */
+		if (src->borrowed) {
+			dst->datum.ptr = src->datum.ptr;
+			fr_value_box_copy_meta(dst, src);
+			dst->borrowed = true;
+			break;
+		}
+
 		dst->datum.ptr = ctx ? talloc_reference(ctx, src->datum.ptr) : src->datum.ptr;
 		fr_value_box_copy_meta(dst, src);
 		break;
@@ -2304,6 +2321,11 @@ int fr_value_box_steal(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_box_t cons
 {
 	if (!fr_cond_assert(src->type != FR_TYPE_INVALID)) return -1;
 
+	/*
+	 *	We don't own the buffer, so we can't give it away.
+	 */
+	if (src->borrowed) return fr_value_box_copy(ctx, dst, src);
+
 	switch (src->type) {
 	default:
 		return fr_value_box_copy(ctx, dst, src);
@@ -2695,6 +2717,52 @@ int fr_value_box_memdup_buffer_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_
 	return 0;
 }
 
+/** Point a box at part of a buffer owned by something else
+ *
+ * Used to avoid copying values out of packets.  The buffer must outlive
+ * the box, or the box must be unborrowed with #fr_value_box_unborrow first.
+ * The buffer isn't freed when the box is cleared.
+ *
+ * @param[in] dst 	to assign buffer to.
+ * @param[in] enumv	Aliases for values.
+ * @param[in] src	start of the value.  Needn't be a talloc chunk.
+ * @param[in] len	of the value.
+ * @param[in] tainted	Whether the value came from a trusted source.
+ */
+void fr_value_box_memborrow(fr_value_box_t *dst, fr_dict_attr_t const *enumv,
+			    uint8_t const *src, size_t len, bool tainted)
+{
+	dst->type = FR_TYPE_OCTETS;
+	dst->tainted = tainted;
+	dst->borrowed = true;
+	dst->vb_octets = src;
+	dst->datum.length = len;
+	dst->enumv = enumv;
+	dst->next = NULL;
+}
+
+/** Give a box its own copy of a borrowed buffer
+ *
+ * @param[in] ctx 	to allocate the copy in.
+ * @param[in] box	to unborrow.  Does nothing if the box's buffer isn't borrowed.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_value_box_unborrow(TALLOC_CTX *ctx, fr_value_box_t *box)
+{
+	fr_value_box_t tmp;
+
+	if (!box->borrowed) return 0;
+
+	if (fr_value_box_copy(ctx, &tmp, box) < 0) return -1;
+
+	tmp.next = box->next;
+	memcpy(box, &tmp, sizeof(*box));
+
+	return 0;
+}
+
 /** Convert integer encoded as string to a fr_value_box_t type
  *
  * @param[out] dst		where to write parsed value.
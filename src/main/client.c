@@ -30,8 +30,16 @@ RCSID("$Id$")
 #include <freeradius-devel/cf_parse.h>
 #include <freeradius-devel/rad_assert.h>
 #include <freeradius-devel/modules.h>
+#include <freeradius-devel/trie.h>
 
 #include <sys/stat.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
 
 #include <ctype.h>
 #include <fcntl.h>
@@ -42,13 +50,30 @@ RCSID("$Id$")
 #endif
 #endif
 
+/*
+ *	Clients are looked up in a trie per address family, and per
+ *	protocol.  IPPROTO_IP is a wildcard, and matches any protocol.
+ */
+#define CLIENT_TRIE_PROTO_MAX	(3)
+#define CLIENT_TRIE_MAX		(2 * CLIENT_TRIE_PROTO_MAX)
+
 /** Group of clients
  *
+ *  The "trees" are used when adding and deleting clients, to find
+ *  duplicates.  The "tries" are used by client_find(), which does one
+ *  longest prefix match per trie, instead of one lookup per prefix
+ *  length.
+ *
+ *  client_find() doesn't lock the list.  Updates to the tries are
+ *  copy-on-write, and are serialised by the mutex.  The tries are
+ *  allocated when the first client is added, so they're published
+ *  atomically, too.
  */
 struct radclient_list {
 	char const	*name;			//!< Name of the client list.
 	rbtree_t	*trees[129];		//!< For 0..128, inclusive.
-	uint32_t       	min_prefix;
+	_Atomic(fr_trie_t *) tries[CLIENT_TRIE_MAX];	//!< For longest prefix matching.
+	pthread_mutex_t	mutex;			//!< Serialises updates.
 };
 
 #ifdef WITH_STATS
@@ -147,6 +172,64 @@ static int client_num_cmp(void const *one, void const *two)
 }
 #endif
 
+/** Return the index of the trie for an address family and protocol
+ *
+ * @return
+ *	- <0 for unknown address families.
+ *	- the index into the "tries" array.
+ */
+static int client_trie_index(int af, int proto)
+{
+	int i;
+
+	switch (af) {
+	case AF_INET:
+		i = 0;
+		break;
+
+	case AF_INET6:
+		i = CLIENT_TRIE_PROTO_MAX;
+		break;
+
+	default:
+		return -1;
+	}
+
+#ifdef WITH_TCP
+	switch (proto) {
+	case IPPROTO_UDP:
+		i += 1;
+		break;
+
+	case IPPROTO_TCP:
+		i += 2;
+		break;
+
+	default:
+		break;
+	}
+#endif
+
+	return i;
+}
+
+/** Get the key for an IP address
+ *
+ */
+static inline uint8_t const *client_trie_key(fr_ipaddr_t const *ipaddr)
+{
+	if (ipaddr->af == AF_INET) return (uint8_t const *) &ipaddr->addr.v4.s_addr;
+
+	return (uint8_t const *) &ipaddr->addr.v6.s6_addr;
+}
+
+static int _client_list_free(RADCLIENT_LIST *clients)
+{
+	pthread_mutex_destroy(&clients->mutex);
+
+	return 0;
+}
+
 /** Return a new client list
  *
  * @note The container won't contain any clients.
@@ -157,12 +240,20 @@ static int client_num_cmp(void const *one, void const *two)
  */
 RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
 {
-	RADCLIENT_LIST *clients = talloc_zero(cs, RADCLIENT_LIST);
+	RADCLIENT_LIST	*clients = talloc_zero(cs, RADCLIENT_LIST);
+	int		i;
 
 	if (!clients) return NULL;
 
+	for (i = 0; i < CLIENT_TRIE_MAX; i++) atomic_init(&clients->tries[i], NULL);
+
 	clients->name = talloc_strdup(clients, cs ? cf_section_name1(cs) : "root");
-	clients->min_prefix = 128;
+
+	if (pthread_mutex_init(&clients->mutex, NULL) != 0) {
+		talloc_free(clients);
+		return NULL;
+	}
+	talloc_set_destructor(clients, _client_list_free);
 
 	return clients;
 }
@@ -177,7 +268,9 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
  */
 bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
+	int i;
 	RADCLIENT *old;
+	fr_trie_t *trie;
 	char buffer[FR_IPADDR_PREFIX_STRLEN];
 
 	if (!client) return false;
@@ -203,6 +296,20 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 		rad_assert(0);
 	}
 
+	/*
+	 *	Every Message-Authenticator to or from the client
+	 *	uses the same key, so do the HMAC key setup once.
+	 */
+	if (client->secret && !client->hmac_key) {
+		client->hmac_key = talloc(client, fr_hmac_md5_key_t);
+		if (!client->hmac_key) {
+			ERROR("Out of memory");
+			return false;
+		}
+		fr_hmac_md5_key_init(client->hmac_key, (uint8_t const *) client->secret,
+				     talloc_array_length(client->secret) - 1);
+	}
+
 	fr_inet_ntop_prefix(buffer, sizeof(buffer), &client->ipaddr);
 	DEBUG3("Adding client %s (%s) to prefix tree %i", buffer, client->longname, client->ipaddr.prefix);
 
@@ -260,16 +367,35 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 		}
 	}
 
+	i = client_trie_index(client->ipaddr.af, client->proto);
+	if (i < 0) return false;
+
+	pthread_mutex_lock(&clients->mutex);
+
 	/*
 	 *	Create a tree for it.
 	 */
 	if (!clients->trees[client->ipaddr.prefix]) {
 		clients->trees[client->ipaddr.prefix] = rbtree_create(clients, client_ipaddr_cmp, NULL, 0);
 		if (!clients->trees[client->ipaddr.prefix]) {
+		fail:
+			pthread_mutex_unlock(&clients->mutex);
 			return false;
 		}
 	}
 
+	/*
+	 *	client_find() reads the tries without the lock, so
+	 *	the trie has to be initialised before it's visible.
+	 */
+	trie = atomic_load_explicit(&clients->tries[i], memory_order_relaxed);
+	if (!trie) {
+		trie = fr_trie_alloc(clients, (client->ipaddr.af == AF_INET) ? 32 : 128);
+		if (!trie) goto fail;
+
+		atomic_store_explicit(&clients->tries[i], trie, memory_order_release);
+	}
+
 #define namecmp(a) ((!old->a && !client->a) || (old->a && client->a && (strcmp(old->a, client->a) == 0)))
 
 	/*
@@ -291,21 +417,26 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 		    namecmp(client_server) &&
 #endif
 		    (old->message_authenticator == client->message_authenticator)) {
+			pthread_mutex_unlock(&clients->mutex);
 			WARN("Ignoring duplicate client %s", client->longname);
 			client_free(client);
 			return true;
 		}
 
 		ERROR("Failed to add duplicate client %s", client->shortname);
-		return false;
+		goto fail;
 	}
 #undef namecmp
 
 	/*
 	 *	Other error adding client: likely is fatal.
 	 */
-	if (!rbtree_insert(clients->trees[client->ipaddr.prefix], client)) {
-		return false;
+	if (!rbtree_insert(clients->trees[client->ipaddr.prefix], client)) goto fail;
+
+	if (fr_trie_insert(trie, client_trie_key(&client->ipaddr), client->ipaddr.prefix, client) < 0) {
+		ERROR("Failed to add client %s: %s", client->shortname, fr_strerror());
+		rbtree_deletebydata(clients->trees[client->ipaddr.prefix], client);
+		goto fail;
 	}
 
 #ifdef WITH_STATS
@@ -340,12 +471,10 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	if (tree_num) rbtree_insert(tree_num, client);
 #endif
 
-	if (client->ipaddr.prefix < clients->min_prefix) {
-		clients->min_prefix = client->ipaddr.prefix;
-	}
-
 	(void) talloc_steal(clients, client); /* reparent it */
 
+	pthread_mutex_unlock(&clients->mutex);
+
 	return true;
 }
 
@@ -353,6 +482,8 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 #ifdef WITH_DYNAMIC_CLIENTS
 void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
+	int i;
+
 	if (!client) return;
 
 	if (!clients) clients = root_clients;
@@ -363,10 +494,23 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 
 	client->dynamic = 2;	/* signal to client_free */
 
+	pthread_mutex_lock(&clients->mutex);
 #ifdef WITH_STATS
 	rbtree_deletebydata(tree_num, client);
 #endif
 	rbtree_deletebydata(clients->trees[client->ipaddr.prefix], client);
+
+	/*
+	 *	Readers may still be using the client, but
+	 *	client_free() delays freeing it.
+	 */
+	i = client_trie_index(client->ipaddr.af, client->proto);
+	if (i >= 0) {
+		fr_trie_t *trie = atomic_load_explicit(&clients->tries[i], memory_order_relaxed);
+
+		if (trie) (void) fr_trie_remove(trie, client_trie_key(&client->ipaddr), client->ipaddr.prefix);
+	}
+	pthread_mutex_unlock(&clients->mutex);
 }
 #endif
 
@@ -406,8 +550,10 @@ RADCLIENT *client_findbynumber(UNUSED const RADCLIENT_LIST *clients, UNUSED int
  */
 RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, int proto)
 {
-	int32_t i, max_prefix;
-	RADCLIENT myclient;
+	int		i, start;
+	uint32_t	max_prefix;
+	uint8_t const	*key;
+	RADCLIENT	*client, *found = NULL;
 
 	if (!clients) clients = root_clients;
 
@@ -426,20 +572,30 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 		return NULL;
 	}
 
-	for (i = max_prefix; i >= (int32_t) clients->min_prefix; i--) {
-		void *data;
+	key = client_trie_key(ipaddr);
+	start = client_trie_index(ipaddr->af, IPPROTO_IP);
 
-		if (!clients->trees[i]) continue;
+	/*
+	 *	Check the wildcard trie, and the trie for the protocol.
+	 *	If the protocol is a wildcard, check all of them.  The
+	 *	longest prefix wins.
+	 */
+	for (i = start; i < (start + CLIENT_TRIE_PROTO_MAX); i++) {
+		fr_trie_t *trie;
+
+		if ((i != start) && (proto != IPPROTO_IP) &&
+		    (i != client_trie_index(ipaddr->af, proto))) continue;
 
-		myclient.ipaddr = *ipaddr;
-		myclient.proto = proto;
-		fr_ipaddr_mask(&myclient.ipaddr, i);
+		trie = atomic_load_explicit(&clients->tries[i], memory_order_acquire);
+		if (!trie) continue;
 
-		data = rbtree_finddata(clients->trees[i], &myclient);
-		if (data) return data;
+		client = fr_trie_lookup(trie, key, max_prefix);
+		if (!client) continue;
+
+		if (!found || (client->ipaddr.prefix > found->ipaddr.prefix)) found = client;
 	}
 
-	return NULL;
+	return found;
 }
 
 /*
@@ -1082,6 +1082,7 @@ static int command_show_module_flags(rad_listen_t *listener, int argc, char *arg
 	}
 
 	if ((instance->module->type & RLM_TYPE_THREAD_UNSAFE) != 0) cprintf(listener, "thread-unsafe\n");
+	if ((instance->module->type & RLM_TYPE_THREAD_INSTANCE) != 0) cprintf(listener, "thread-instance\n");
 
 	return CMD_OK;
 }
@@ -2443,10 +2444,19 @@ static int command_print_stats(rad_listen_t *listener, fr_stats_t *stats,
 
 static int command_stats_state(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
 {
+	unsigned int i;
+
 	cprintf(listener, "states_created\t\t%" PRIu64 "\n", fr_state_entries_created(global_state));
 	cprintf(listener, "states_timeout\t\t%" PRIu64 "\n", fr_state_entries_timeout(global_state));
 	cprintf(listener, "states_tracked\t\t%" PRIu32 "\n", fr_state_entries_tracked(global_state));
 
+	for (i = 0; i < FR_STATE_SHARDS; i++) {
+		cprintf(listener, "shard.%u\ttracked %" PRIu32 "\ttimeout %" PRIu64 "\tcontended %" PRIu64 "\n", i,
+			fr_state_shard_entries_tracked(global_state, i),
+			fr_state_shard_entries_timeout(global_state, i),
+			fr_state_shard_contended(global_state, i));
+	}
+
 	return CMD_OK;
 }
 
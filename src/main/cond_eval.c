@@ -760,6 +760,117 @@ int cond_eval(REQUEST *request, int modreturn, int depth, fr_cond_t const *c)
 #endif
 
 
+/** Lists with this many attributes or fewer are searched without an index
+ *
+ * Allocating and filling the index costs more than walking a short list.
+ */
+#define PAIRMOVE_INDEX_MIN	8
+
+/** Index of the "to" list used by radius_pairmove()
+ *
+ * Maps each #fr_dict_attr_t to the first slot in the "to" array holding
+ * an attribute of that type.  Further slots with the same #fr_dict_attr_t
+ * are chained through next[], in list order.
+ *
+ * Short lists aren't indexed (mask is 0), and are searched slot by slot.
+ */
+typedef struct {
+	VALUE_PAIR		**list;		//!< "to" array being searched.
+	int			count;		//!< Number of elements in list.
+
+	fr_dict_attr_t const	**da;		//!< Open-addressed table of attribute types.
+	int			*first;		//!< First "to" slot for the matching da[] entry.
+	int			*next;		//!< Next "to" slot with the same attribute, or -1.
+	uint32_t		mask;		//!< Size of the table - 1.
+} pairmove_index_t;
+
+/** Find the first slot in the "to" array matching da, or -1
+ *
+ */
+static int pairmove_index_find(pairmove_index_t const *idx, fr_dict_attr_t const *da)
+{
+	uint32_t	h;
+	int		j;
+
+	if (!idx->mask) {
+		for (j = 0; j < idx->count; j++) {
+			if (idx->list[j] && (idx->list[j]->da == da)) return j;
+		}
+		return -1;
+	}
+
+	h = fr_hash(&da, sizeof(da)) & idx->mask;
+	while (idx->da[h]) {
+		if (idx->da[h] == da) return idx->first[h];
+		h = (h + 1) & idx->mask;
+	}
+
+	return -1;
+}
+
+/** Find the slot after j in the "to" array matching da, or -1
+ *
+ */
+static int pairmove_index_next(pairmove_index_t const *idx, fr_dict_attr_t const *da, int j)
+{
+	if (idx->mask) return idx->next[j];
+
+	for (j++; j < idx->count; j++) {
+		if (idx->list[j] && (idx->list[j]->da == da)) return j;
+	}
+
+	return -1;
+}
+
+/** Build an attribute index over the "to" array
+ *
+ * The table is kept at most half full, so probe sequences stay short.
+ *
+ * @param[in] ctx	to allocate the index in.
+ * @param[out] idx	to initialise.
+ * @param[in] list	array of attributes to index.
+ * @param[in] count	number of elements in list.
+ */
+static void pairmove_index_init(TALLOC_CTX *ctx, pairmove_index_t *idx, VALUE_PAIR **list, int count)
+{
+	uint32_t	size = 8, h;
+	int		j;
+
+	idx->list = list;
+	idx->count = count;
+	idx->da = NULL;
+	idx->first = idx->next = NULL;
+	idx->mask = 0;
+
+	if (count <= PAIRMOVE_INDEX_MIN) return;
+
+	while (size < ((uint32_t)count * 2)) size <<= 1;
+
+	idx->mask = size - 1;
+	idx->da = talloc_zero_array(ctx, fr_dict_attr_t const *, size);
+	idx->first = talloc_array(ctx, int, size);
+	idx->next = talloc_array(ctx, int, count);
+
+	/*
+	 *	Walk backwards, so that prepending to each chain
+	 *	leaves it in list order.
+	 */
+	for (j = count - 1; j >= 0; j--) {
+		fr_dict_attr_t const *da = list[j]->da;
+
+		h = fr_hash(&da, sizeof(da)) & idx->mask;
+		while (idx->da[h] && (idx->da[h] != da)) h = (h + 1) & idx->mask;
+
+		if (!idx->da[h]) {
+			idx->da[h] = da;
+			idx->next[j] = -1;
+		} else {
+			idx->next[j] = idx->first[h];
+		}
+		idx->first[h] = j;
+	}
+}
+
 /*
  *	The fr_pair_list_move() function in src/lib/valuepair.c does all sorts of
  *	extra magic that we don't want here.
@@ -776,6 +887,7 @@ void radius_pairmove(REQUEST *request, VALUE_PAIR **to, VALUE_PAIR *from, bool d
 	VALUE_PAIR **from_list, **to_list;
 	VALUE_PAIR *append, **append_tail;
 	VALUE_PAIR *to_copy;
+	pairmove_index_t to_index;
 	bool *edited = NULL;
 	REQUEST *fixup = NULL;
 	TALLOC_CTX *ctx;
@@ -833,6 +945,16 @@ void radius_pairmove(REQUEST *request, VALUE_PAIR **to, VALUE_PAIR *from, bool d
 	tailto = to_count;
 	edited = talloc_zero_array(request, bool, to_count);
 
+	/*
+	 *	Index the "to" list by attribute, so that each
+	 *	attribute in the "from" list only visits the
+	 *	attributes it can match, instead of the whole list.
+	 *	Replacements below don't change the da of a slot,
+	 *	so the index stays valid while we edit.  Short
+	 *	lists are cheaper to walk than to index.
+	 */
+	pairmove_index_init(to_list, &to_index, to_list, to_count);
+
 	RDEBUG4("::: FROM %d TO %d MAX %d", from_count, to_count, count);
 
 	/*
@@ -854,15 +976,11 @@ void radius_pairmove(REQUEST *request, VALUE_PAIR **to, VALUE_PAIR *from, bool d
 		if (from_list[i]->op == T_OP_ADD) goto do_append;
 
 		found = false;
-		for (j = 0; j < to_count; j++) {
+		for (j = pairmove_index_find(&to_index, from_list[i]->da); j >= 0;
+		     j = pairmove_index_next(&to_index, from_list[i]->da, j)) {
 			if (edited[j] || !to_list[j] || !from_list[i]) continue;
 
-			/*
-			 *	Attributes aren't the same, skip them.
-			 */
-			if (from_list[i]->da != to_list[j]->da) {
-				continue;
-			}
+			rad_assert(from_list[i]->da == to_list[j]->da);
 
 			/*
 			 *	We don't use a "switch" statement here
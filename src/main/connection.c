@@ -82,8 +82,8 @@ do { \
 	conn->state = _new; \
 } while (0)
 
-static void connection_state_init(fr_connection_t *conn, struct timeval *now);
-static void connection_state_failed(fr_connection_t *conn, struct timeval *now);
+static void connection_state_init(fr_connection_t *conn, fr_time_t now);
+static void connection_state_failed(fr_connection_t *conn, fr_time_t now);
 
 /** The requisite period of time has passed, try and re-open the connection
  *
@@ -91,11 +91,11 @@ static void connection_state_failed(fr_connection_t *conn, struct timeval *now);
  * @param[in] now	the current time.
  * @param[in] uctx	The #fr_connection_t the fd is associated with.
  */
-static void _reconnect_delay_done(UNUSED fr_event_list_t *el, struct timeval *now, void *uctx)
+static void _reconnect_delay_done(fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
 {
 	fr_connection_t *conn = talloc_get_type_abort(uctx, fr_connection_t);
 
-	connection_state_init(conn, now);
+	connection_state_init(conn, fr_event_list_now(el));
 }
 
 /** Connection failed
@@ -108,9 +108,9 @@ static void _reconnect_delay_done(UNUSED fr_event_list_t *el, struct timeval *no
  * back to init.
  *
  * @param[in] conn	that failed.
- * @param[in] now	The current time.
+ * @param[in] now	The current time, from #fr_time.
  */
-static void connection_state_failed(fr_connection_t *conn, struct timeval *now)
+static void connection_state_failed(fr_connection_t *conn, fr_time_t now)
 {
 	fr_connection_state_t prev;
 	rad_assert(conn->state != FR_CONNECTION_STATE_FAILED);
@@ -159,13 +159,9 @@ static void connection_state_failed(fr_connection_t *conn, struct timeval *now)
 	case FR_CONNECTION_STATE_INIT:				/* Failed during initialisation */
 	case FR_CONNECTION_STATE_CONNECTED:			/* Failed after connecting */
 	case FR_CONNECTION_STATE_CONNECTING:			/* Failed during connecting */
-	{
-		struct timeval when;
-
-		fr_timeval_add(&when, now, &conn->reconnection_delay);
-		fr_event_timer_insert(conn, conn->el, &conn->reconnection_timer,
-				      &when, _reconnect_delay_done, conn);
-	}
+		fr_event_timer_at(conn, conn->el, &conn->reconnection_timer,
+				  now + fr_time_delta_from_timeval(&conn->reconnection_delay),
+				  _reconnect_delay_done, conn);
 		break;
 
 	case FR_CONNECTION_STATE_TIMEOUT:			/* Failed during connecting */
@@ -185,13 +181,13 @@ static void connection_state_failed(fr_connection_t *conn, struct timeval *now)
  * @param[in] now	the current time.
  * @param[in] uctx	The #fr_connection_t the fd is associated with.
  */
-static void _connection_timeout(UNUSED fr_event_list_t *el, struct timeval *now, void *uctx)
+static void _connection_timeout(fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
 {
 	fr_connection_t *conn = talloc_get_type_abort(uctx, fr_connection_t);
 
 	ERROR("Connection failed - timed out after %pVs", fr_box_timeval(conn->connection_timeout));
 	STATE_TRANSITION(FR_CONNECTION_STATE_TIMEOUT);
-	connection_state_failed(conn, now);
+	connection_state_failed(conn, fr_event_list_now(el));
 }
 
 /** Receive an error notification when we're connecting a socket
@@ -202,10 +198,9 @@ static void _connection_timeout(UNUSED fr_event_list_t *el, struct timeval *now,
  * @param[in] fd_errno	from kevent.
  * @param[in] uctx	The #fr_connection_t this fd is associated with.
  */
-static void _connection_error(UNUSED fr_event_list_t *el, UNUSED int sock, UNUSED int flags, int fd_errno, void *uctx)
+static void _connection_error(fr_event_list_t *el, UNUSED int sock, UNUSED int flags, int fd_errno, void *uctx)
 {
 	fr_connection_t *conn = talloc_get_type_abort(uctx, fr_connection_t);
-	struct timeval	now;
 
 	/*
 	 *	Explicit error occurred, delete the connection timer
@@ -213,8 +208,7 @@ static void _connection_error(UNUSED fr_event_list_t *el, UNUSED int sock, UNUSE
 	fr_event_timer_delete(conn->el, &conn->connection_timer);
 
 	ERROR("Connection failed: %s", fr_syserror(fd_errno));
-	gettimeofday(&now, NULL);
-	connection_state_failed(conn, &now);
+	connection_state_failed(conn, fr_event_list_now(el));
 }
 
 /** Receive a write notification after connecting a socket
@@ -224,7 +218,7 @@ static void _connection_error(UNUSED fr_event_list_t *el, UNUSED int sock, UNUSE
  * @param[in] flags	from kevent.
  * @param[in] uctx	The #fr_connection_t this fd is associated with.
  */
-static void _connection_writable(UNUSED fr_event_list_t *el, UNUSED int sock, UNUSED int flags, void *uctx)
+static void _connection_writable(fr_event_list_t *el, UNUSED int sock, UNUSED int flags, void *uctx)
 {
 	fr_connection_t *conn = talloc_get_type_abort(uctx, fr_connection_t);
 	fr_connection_state_t ret;
@@ -246,14 +240,9 @@ static void _connection_writable(UNUSED fr_event_list_t *el, UNUSED int sock, UN
 	 *	Open callback failed
 	 */
 	case FR_CONNECTION_STATE_FAILED:
-	{
-		struct timeval now;
-
 		PERROR("Connection failed");
-		gettimeofday(&now, NULL);
-		connection_state_failed(conn, &now);
+		connection_state_failed(conn, fr_event_list_now(el));
 		return;
-	}
 
 	default:
 		rad_assert(0);
@@ -263,9 +252,9 @@ static void _connection_writable(UNUSED fr_event_list_t *el, UNUSED int sock, UN
 /** Enter the initialising state
  *
  * @param[in] conn	being initialised.
- * @param[in] now	the current ime.
+ * @param[in] now	the current time, from #fr_time.
  */
-static void connection_state_init(fr_connection_t *conn, struct timeval *now)
+static void connection_state_init(fr_connection_t *conn, fr_time_t now)
 {
 	fr_connection_state_t ret;
 	int fd = -1;
@@ -278,12 +267,8 @@ static void connection_state_init(fr_connection_t *conn, struct timeval *now)
 	ret = conn->init(&fd, conn->uctx);
 	switch (ret) {
 	case FR_CONNECTION_STATE_CONNECTING:
-	{
-		struct timeval when = { 0, 0 };
-
 		DEBUG2("Connection initialised");
 		STATE_TRANSITION(ret);
-		fr_timeval_add(&when, now, &conn->connection_timeout);
 
 		/*
 		 *	If connection becomes writable we
@@ -294,10 +279,10 @@ static void connection_state_init(fr_connection_t *conn, struct timeval *now)
 			connection_state_failed(conn, now);
 			return;
 		}
-		fr_event_timer_insert(conn, conn->el, &conn->connection_timer,
-				      &when, _connection_timeout, conn);
+		fr_event_timer_at(conn, conn->el, &conn->connection_timer,
+				  now + fr_time_delta_from_timeval(&conn->connection_timeout),
+				  _connection_timeout, conn);
 		conn->fd = fd;
-	}
 		break;
 
 	/*
@@ -414,13 +399,9 @@ void fr_connection_failed_func(fr_connection_t *conn, fr_connection_failed_t fun
  */
 void fr_connection_start(fr_connection_t *conn)
 {
-	struct timeval now;
-
-	gettimeofday(&now, NULL);
-
 	switch (conn->state) {
 	case FR_CONNECTION_STATE_HALTED:
-		connection_state_init(conn, &now);
+		connection_state_init(conn, fr_time());
 		break;
 
 	default:
@@ -449,15 +430,9 @@ void fr_connection_reconnect(fr_connection_t *conn)
 	case FR_CONNECTION_STATE_CONNECTING:
 	case FR_CONNECTION_STATE_CONNECTED:
 	case FR_CONNECTION_STATE_TIMEOUT:
-	{
-		struct timeval now;
-
-		gettimeofday(&now, NULL);
-
 		DEBUG2("Reconnecting...");
 
-		connection_state_failed(conn, &now);
-	}
+		connection_state_failed(conn, fr_time());
 		return;
 	}
 }
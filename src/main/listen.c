@@ -2339,7 +2339,8 @@ static int client_socket_encode(UNUSED rad_listen_t *listener, REQUEST *request)
 			request->reply->data_len, MAX_PACKET_LEN);
 	}
 
-	if (fr_radius_packet_sign(request->reply, request->packet, request->client->secret) < 0) {
+	if (fr_radius_packet_sign(request->reply, request->packet, request->client->secret,
+				  request->client->hmac_key) < 0) {
 		RPERROR("Failed signing packet");
 
 		return -1;
@@ -2356,7 +2357,7 @@ static int client_socket_decode(UNUSED rad_listen_t *listener, REQUEST *request)
 #endif
 
 	if (fr_radius_packet_verify(request->packet, NULL,
-			     request->client->secret) < 0) {
+			     request->client->secret, request->client->hmac_key) < 0) {
 		if (request->reply) request->reply->id = -1;
 		return -1;
 	}
@@ -2399,7 +2400,7 @@ static int proxy_socket_encode(UNUSED rad_listen_t *listener, REQUEST *request)
 			request->proxy->packet->data_len, MAX_PACKET_LEN);
 	}
 
-	if (fr_radius_packet_sign(request->proxy->packet, NULL, request->proxy->home_server->secret) < 0) {
+	if (fr_radius_packet_sign(request->proxy->packet, NULL, request->proxy->home_server->secret, NULL) < 0) {
 		RPERROR("Failed signing proxied packet");
 
 		return -1;
@@ -37,6 +37,13 @@ fr_thread_local_setup(rbtree_t *, module_thread_inst_tree)
 
 static TALLOC_CTX *instance_ctx = NULL;
 
+/*
+ *	Serialises instantiation of per-thread copies of module
+ *	instance data, as the libraries these modules wrap often
+ *	can't be initialised from multiple threads at once.
+ */
+static pthread_mutex_t thread_inst_data_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  *	Ordered by component
  */
@@ -512,6 +519,14 @@ static void _module_thread_instance_free(void *to_free)
 		(void) thread_inst->inst->module->thread_detach(thread_inst->data);
 	}
 
+	/*
+	 *	Private copy of the instance data, needs
+	 *	detaching before it's freed with thread_inst.
+	 */
+	if ((thread_inst->inst_data != thread_inst->inst->dl_inst->data) && thread_inst->inst->module->detach) {
+		(void) thread_inst->inst->module->detach(thread_inst->inst_data);
+	}
+
 	talloc_free(thread_inst);
 }
 
@@ -542,6 +557,46 @@ static int _module_thread_inst_tree_cmp(void const *a, void const *b)
 	return (my_a->inst > my_b->inst) - (my_a->inst < my_b->inst);
 }
 
+/** Create a thread private copy of a module's instance data
+ *
+ * The copy starts out identical to the shared instance data, so
+ * anything set during bootstrap or configuration parsing is retained.
+ * The module's instantiate function is then called again on the copy,
+ * and must replace any handles it creates, without freeing the
+ * originals.
+ *
+ * @param[in] thread_inst	to create the instance data copy for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int module_thread_inst_data_alloc(module_thread_instance_t *thread_inst)
+{
+	module_instance_t	*mod_inst = thread_inst->inst;
+	void			*data;
+	int			ret = 0;
+
+	if (!mod_inst->dl_inst->data) return 0;
+
+	MEM(data = talloc_memdup(thread_inst, mod_inst->dl_inst->data,
+				 talloc_get_size(mod_inst->dl_inst->data)));
+	talloc_set_name_const(data, talloc_get_name(mod_inst->dl_inst->data));
+
+	if (mod_inst->module->instantiate) {
+		pthread_mutex_lock(&thread_inst_data_mutex);
+		ret = mod_inst->module->instantiate(data, mod_inst->dl_inst->conf);
+		pthread_mutex_unlock(&thread_inst_data_mutex);
+	}
+	if (ret < 0) {
+		talloc_free(data);
+		return -1;
+	}
+
+	thread_inst->inst_data = data;
+
+	return 0;
+}
+
 typedef struct {
 	rbtree_t	*tree;		//!< Containing the thread instances.
 	fr_event_list_t *el;		//!< Event list for this thread.
@@ -564,6 +619,14 @@ static int _module_thread_instantiate(void *instance, void *ctx)
 
 	MEM(thread_inst = talloc_zero(NULL, module_thread_instance_t));
 	thread_inst->inst = mod_inst;
+	thread_inst->inst_data = mod_inst->dl_inst->data;
+
+	if ((mod_inst->module->type & RLM_TYPE_THREAD_INSTANCE) &&
+	    (module_thread_inst_data_alloc(thread_inst) < 0)) {
+		ERROR("Thread instantiation failed for module \"%s\"", mod_inst->name);
+		talloc_free(thread_inst);
+		return -1;
+	}
 
 	if (mod_inst->module->thread_inst_size) {
 		char *type_name;
@@ -581,7 +644,7 @@ static int _module_thread_instantiate(void *instance, void *ctx)
 	}
 
 	if (mod_inst->module->thread_instantiate) {
-		ret = mod_inst->module->thread_instantiate(mod_inst->dl_inst->conf, mod_inst->dl_inst->data,
+		ret = mod_inst->module->thread_instantiate(mod_inst->dl_inst->conf, thread_inst->inst_data,
 							   thread_inst_ctx->el, thread_inst->data);
 		if (ret < 0) {
 			ERROR("Thread instantiation failed for module \"%s\"",
@@ -675,9 +738,11 @@ static int _module_instantiate(void *instance, UNUSED void *ctx)
 	/*
 	 *	If we're threaded, check if the module is thread-safe.
 	 *
-	 *	If it isn't, we create a mutex.
+	 *	If it isn't, we create a mutex, unless each
+	 *	thread gets its own copy of the instance.
 	 */
-	if ((mod_inst->module->type & RLM_TYPE_THREAD_UNSAFE) != 0) {
+	if (((mod_inst->module->type & RLM_TYPE_THREAD_UNSAFE) != 0) &&
+	    ((mod_inst->module->type & RLM_TYPE_THREAD_INSTANCE) == 0)) {
 		mod_inst->mutex = talloc_zero(mod_inst, pthread_mutex_t);
 
 		/*
@@ -0,0 +1,116 @@
+/*
+ * raddict.c	Write a precompiled snapshot of the dictionaries.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "Usage: raddict [options]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -h                     Print usage help information.\n");
+	fprintf(stderr, "  -p                     Print the attributes and values in the dictionary.\n");
+	fprintf(stderr, "  -s                     Fail if the dictionary wasn't loaded from its snapshot.\n");
+	fprintf(stderr, "  -x                     Increase debug level.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	bool		print = false;
+	bool		need_snapshot = false;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	fr_log_fp = stderr;
+
+	while ((c = getopt(argc, argv, "D:hpsx")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'p':
+			print = true;
+			break;
+
+		case 's':
+			need_snapshot = true;
+			break;
+
+		case 'x':
+			fr_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("raddict");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("raddict");
+		exit(EXIT_FAILURE);
+	}
+
+	if (need_snapshot && !fr_dict_snapshot_loaded(dict)) {
+		fprintf(stderr, "raddict: %s/%s.snapshot is missing or out of date\n", dict_dir, FR_DICTIONARY_FILE);
+		exit(EXIT_FAILURE);
+	}
+
+	if (print) {
+		fr_dict_print(fr_dict_root(dict), 0);
+		fr_dict_enum_print(dict);
+	}
+
+	switch (fr_dict_snapshot_write(dict, dict_dir, FR_DICTIONARY_FILE)) {
+	case 1:
+		if (fr_debug_lvl) fprintf(stderr, "%s/%s.snapshot is up to date\n", dict_dir, FR_DICTIONARY_FILE);
+		break;
+
+	case 0:
+		if (fr_debug_lvl) fprintf(stderr, "Wrote %s/%s.snapshot\n", dict_dir, FR_DICTIONARY_FILE);
+		break;
+
+	default:
+		fr_perror("raddict");
+		exit(EXIT_FAILURE);
+	}
+
+	talloc_free(autofree);
+
+	return EXIT_SUCCESS;
+}
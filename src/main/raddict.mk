@@ -0,0 +1,5 @@
+TARGET		:= raddict
+SOURCES		:= raddict.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -587,8 +587,8 @@ int main(int argc, char *argv[])
 	 *	async listeners, then we open the sockets.
 	 */
 	if (!check_config && main_config.namespace) {
-		int networks = 1;
-		int workers = 4;
+		int networks = main_config.num_networks ? main_config.num_networks : 1;
+		int workers = main_config.num_workers ? main_config.num_workers : 4;
 		fr_event_list_t *el = NULL;
 
 		if (!main_config.spawn_workers) {
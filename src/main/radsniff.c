@@ -157,7 +157,9 @@ static void rs_daemonize(char const *pidfile)
 	}
 }
 
+#ifndef USEC
 #define USEC 1000000
+#endif
 static void rs_tv_add_ms(struct timeval const *start, unsigned long interval, struct timeval *result) {
     result->tv_sec = start->tv_sec + (interval / 1000);
     result->tv_usec = start->tv_usec + ((interval % 1000) * 1000);
@@ -1377,7 +1379,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			FILE *log_fp = fr_log_fp;
 
 			fr_log_fp = NULL;
-			ret = fr_radius_packet_verify(current, original->expect, conf->radius_secret);
+			ret = fr_radius_packet_verify(current, original->expect, conf->radius_secret, NULL);
 			fr_log_fp = log_fp;
 			if (ret != 0) {
 				REDEBUG("Failed verifying packet ID %d", current->id);
@@ -43,10 +43,10 @@ struct request_data_t {
 						//!< after we're done processing this request.
 };
 
-/** Callback for freeing a request struct
+/** Release the resources held by a request
  *
  */
-static int _request_free(REQUEST *request)
+static void request_cleanup(REQUEST *request)
 {
 	rad_assert(!request->in_request_hash);
 #ifdef WITH_PROXY
@@ -54,9 +54,6 @@ static int _request_free(REQUEST *request)
 #endif
 	rad_assert(!request->ev);
 
-#ifndef NDEBUG
-	request->magic = 0x01020304;	/* set the request to be nonsense */
-#endif
 	request->client = NULL;
 #ifdef WITH_PROXY
 	request->proxy = NULL;
@@ -71,20 +68,28 @@ static int _request_free(REQUEST *request)
 	 *	request being set to NULL, before the request is freed.
 	 */
 	if (request->state_ctx) talloc_free(request->state_ctx);
+	request->state_ctx = NULL;
+}
+
+/** Callback for freeing a request struct
+ *
+ */
+static int _request_free(REQUEST *request)
+{
+	request_cleanup(request);
+
+#ifndef NDEBUG
+	request->magic = 0x01020304;	/* set the request to be nonsense */
+#endif
 
 	return 0;
 }
 
-/** Create a new REQUEST data structure
+/** Initialise the fields of a zeroed REQUEST
  *
  */
-REQUEST *request_alloc(TALLOC_CTX *ctx)
+static void request_init(REQUEST *request)
 {
-	REQUEST *request;
-
-	request = talloc_zero(ctx, REQUEST);
-	if (!request) return NULL;
-	talloc_set_destructor(request, _request_free);
 #ifndef NDEBUG
 	request->magic = REQUEST_MAGIC;
 #endif
@@ -129,10 +134,74 @@ REQUEST *request_alloc(TALLOC_CTX *ctx)
 	request->heap_id = -1;
 
 	request->state_ctx = talloc_init("session-state");
+}
+
+/** Create a new REQUEST data structure
+ *
+ */
+REQUEST *request_alloc(TALLOC_CTX *ctx)
+{
+	REQUEST *request;
+
+	request = talloc_zero(ctx, REQUEST);
+	if (!request) return NULL;
+	talloc_set_destructor(request, _request_free);
+
+	request_init(request);
 
 	return request;
 }
 
+/** Create a new REQUEST data structure, which is also a talloc pool
+ *
+ *  Attributes and other data allocated in the context of the request
+ *  come from the pool, until it is exhausted.  Once all of the
+ *  children of the request have been freed, the pool is empty again.
+ *  So a request which is re-used via request_reset() doesn't need to
+ *  call malloc() for most of its data.
+ *
+ * @param[in] ctx to allocate the request in.
+ * @param[in] pool_size the size of the pool, in bytes.
+ * @return
+ *	- NULL on error
+ *	- REQUEST the new request
+ */
+REQUEST *request_alloc_pooled(TALLOC_CTX *ctx, size_t pool_size)
+{
+	REQUEST *request;
+
+#ifdef HAVE_TALLOC_POOLED_OBJECT
+	request = talloc_pooled_object(ctx, REQUEST, 64, pool_size);
+	if (!request) return NULL;
+	memset(request, 0, sizeof(*request));
+#else
+	request = talloc_zero(ctx, REQUEST);
+	if (!request) return NULL;
+#endif
+	talloc_set_destructor(request, _request_free);
+
+	request_init(request);
+
+	return request;
+}
+
+/** Reset a REQUEST so that it can be re-used
+ *
+ *  All of the children of the request are freed, and the request is
+ *  re-initialised as if it had just been allocated by request_alloc().
+ *
+ * @param[in] request to reset.
+ */
+void request_reset(REQUEST *request)
+{
+	request_cleanup(request);
+
+	talloc_free_children(request);
+	memset(request, 0, sizeof(*request));
+
+	request_init(request);
+}
+
 
 /*
  *	Create a new REQUEST, based on an old one.
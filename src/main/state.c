@@ -50,6 +50,12 @@ RCSID("$Id$")
 #include <freeradius-devel/state.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 /** Holds a state value, and associated VALUE_PAIRs and data
  *
  */
@@ -106,24 +112,35 @@ typedef struct state_entry {
 	request_data_t		*data;				//!< Persistable request data, also parented ctx.
 } fr_state_entry_t;
 
-struct fr_state_tree_t {
-	uint64_t		id;				//!< Next ID to assign.
-	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
-								//!< timeout.
-	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
+/** One shard of the state tree
+ *
+ * Entries are distributed across shards by a hash of their state value,
+ * so that concurrent EAP conversations rarely contend on the same mutex.
+ */
+typedef struct state_shard {
 	rbtree_t		*tree;				//!< rbtree used to lookup state value.
 
 	fr_state_entry_t	*head, *tail;			//!< Entries to expire.
-	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
+
+	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
+								//!< timeout.
+	uint64_t		contended;			//!< Number of times the mutex was already held
+								//!< when we tried to acquire it.
 	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+} fr_state_shard_t;
+
+struct fr_state_tree_t {
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
+	atomic_uint_fast32_t	num_entries;			//!< Number of entries across all shards.
+	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
+	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
+
+	fr_state_shard_t	shard[FR_STATE_SHARDS];		//!< Shards, selected by hashing the state value.
 };
 
 fr_state_tree_t *global_state = NULL;
 
-#define PTHREAD_MUTEX_LOCK if (main_config.spawn_workers) pthread_mutex_lock
-#define PTHREAD_MUTEX_UNLOCK if (main_config.spawn_workers) pthread_mutex_unlock
-
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_tree_t *state, fr_state_shard_t *shard, fr_state_entry_t *entry);
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -135,34 +152,70 @@ static int state_entry_cmp(void const *one, void const *two)
 	return memcmp(a->state, b->state, sizeof(a->state));
 }
 
+/** Return the shard an entry lives in
+ *
+ * State values are usually random, but some modules set their own, so
+ * we hash the whole value rather than picking out a few bytes.
+ */
+static inline fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	return &state->shard[fr_hash(entry->state, sizeof(entry->state)) & (FR_STATE_SHARDS - 1)];
+}
+
+/** Lock a shard, recording whether we had to wait for it
+ *
+ */
+static inline void state_shard_lock(fr_state_shard_t *shard)
+{
+	if (!main_config.spawn_workers) return;
+
+	if (pthread_mutex_trylock(&shard->mutex) == 0) return;
+
+	pthread_mutex_lock(&shard->mutex);
+	shard->contended++;
+}
+
+static inline void state_shard_unlock(fr_state_shard_t *shard)
+{
+	if (!main_config.spawn_workers) return;
+
+	pthread_mutex_unlock(&shard->mutex);
+}
+
 /** Free the state tree
  *
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *this;
-
-	if (main_config.spawn_workers) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*this;
+	fr_state_shard_t	*shard;
+	int			i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while (state->head) {
-		this = state->head;
-		state_entry_unlink(state, this);
-		talloc_free(this);
-	}
+	for (i = 0; i < FR_STATE_SHARDS; i++) {
+		shard = &state->shard[i];
 
-	for (this = state->head; this; this = this->next) DEBUG4("State %" PRIu64 " needs freeing prev was %" PRIu64 "", this->id, this->prev ? this->prev->id : 100000);
+		if (!shard->tree) continue;
 
-	/*
-	 *	Ensure we got *all* the entries
-	 */
-	rad_assert(!state->head);
+		while (shard->head) {
+			this = shard->head;
+			state_entry_unlink(state, shard, this);
+			talloc_free(this);
+		}
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		/*
+		 *	Ensure we got *all* the entries
+		 */
+		rad_assert(!shard->head);
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+
+		if (main_config.spawn_workers) pthread_mutex_destroy(&shard->mutex);
+	}
 
 	if (state == global_state) global_state = NULL;
 
@@ -179,12 +232,15 @@ static int _state_tree_free(fr_state_tree_t *state)
 fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, uint32_t max_sessions, uint32_t timeout)
 {
 	fr_state_tree_t *state;
+	int		i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	atomic_init(&state->id, 0);
+	atomic_init(&state->num_entries, 0);
 
 	/*
 	 *	Create a break in the contexts.
@@ -195,31 +251,39 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, uint32_t max_sessions, uint
 	 */
 	fr_talloc_link_ctx(ctx, state);
 
-	if (main_config.spawn_workers && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
-		talloc_free(state);
-		return NULL;
-	}
+	talloc_set_destructor(state, _state_tree_free);
 
-	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
-	 */
-	state->tree = rbtree_create(NULL, state_entry_cmp, NULL, 0);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+	for (i = 0; i < FR_STATE_SHARDS; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = rbtree_create(NULL, state_entry_cmp, NULL, 0);
+		if (!shard->tree) {
+		error:
+			talloc_free(state);
+			return NULL;
+		}
+
+		if (main_config.spawn_workers && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(shard->tree);
+			shard->tree = NULL;
+			goto error;
+		}
 	}
-	talloc_set_destructor(state, _state_tree_free);
 
 	return state;
 }
 
 /** Unlink an entry and remove if from the tree
  *
+ * @note Called with the shard mutex held.
  */
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+static void state_entry_unlink(fr_state_tree_t *state, fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	fr_state_entry_t *prev, *next;
 
@@ -227,28 +291,105 @@ static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
 	next = entry->next;
 
 	if (prev) {
-		rad_assert(state->head != entry);
+		rad_assert(shard->head != entry);
 		prev->next = next;
-	} else if (state->head) {
-		rad_assert(state->head == entry);
-		state->head = next;
+	} else if (shard->head) {
+		rad_assert(shard->head == entry);
+		shard->head = next;
 	}
 
 	if (next) {
-		rad_assert(state->tail != entry);
+		rad_assert(shard->tail != entry);
 		next->prev = prev;
-	} else if (state->tail) {
-		rad_assert(state->tail == entry);
-		state->tail = prev;
+	} else if (shard->tail) {
+		rad_assert(shard->tail == entry);
+		shard->tail = prev;
 	}
 	entry->next = NULL;
 	entry->prev = NULL;
 
-	rbtree_deletebydata(state->tree, entry);
+	if (rbtree_deletebydata(shard->tree, entry)) atomic_fetch_sub_explicit(&state->num_entries, 1,
+									      memory_order_relaxed);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
 
+/** Unlink entries which have expired
+ *
+ * Each shard's cleanup list is ordered by expiry time, so we only
+ * ever look at the entries which are due.
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @param[in] state	tree the shard belongs to.
+ * @param[in] shard	to expire entries from.
+ * @param[in] now	the current time.
+ * @param[in] free_next	where to append the expired entries.  They must be
+ *			freed by the caller, after releasing the mutex.
+ * @return where to append further entries to be freed.
+ */
+static fr_state_entry_t **state_shard_expire(fr_state_tree_t *state, fr_state_shard_t *shard,
+					     time_t now, fr_state_entry_t **free_next)
+{
+	fr_state_entry_t *entry;
+
+	while ((entry = shard->head) && (entry->cleanup < now)) {
+		state_entry_unlink(state, shard, entry);
+		*free_next = entry;
+		free_next = &(entry->next);
+		shard->timed_out++;
+	}
+
+	return free_next;
+}
+
+/** Free a list of entries which have been unlinked
+ *
+ * Freeing may involve significantly more work than just freeing the
+ * data.  If there's request data that was persisted it will now be
+ * freed also, and it may have complex destructors associated with it.
+ * So this is always done outside of the mutex.
+ */
+static void state_entry_list_free(fr_state_entry_t *head)
+{
+	fr_state_entry_t *entry, *next;
+
+	for (next = head; next;) {
+		entry = next;
+		next = entry->next;
+		talloc_free(entry);
+	}
+}
+
+/** Unlink and free expired entries from every shard
+ *
+ * Inserts only clean up the shard they're inserting into.  When the
+ * tree is full, the stale entries may all be in other shards, so we
+ * have to look at every shard before giving up.
+ *
+ * @note Called with no mutexes held.
+ *
+ * @param[in] state	tree to expire entries from.
+ * @param[in] now	the current time.
+ */
+static void state_tree_expire(fr_state_tree_t *state, time_t now)
+{
+	int			i;
+	fr_state_entry_t	*free_head;
+
+	for (i = 0; i < FR_STATE_SHARDS; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		free_head = NULL;
+
+		state_shard_lock(shard);
+		(void) state_shard_expire(state, shard, now, &free_head);
+		state_shard_unlock(shard);
+
+		state_entry_list_free(free_head);
+	}
+}
+
 /** Frees any data associated with a state
  *
  */
@@ -287,99 +428,53 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	return 0;
 }
 
-/** Create a new state entry
+/** Create a new state entry, and insert it into the shard its state value hashes to
+ *
+ * The entry takes ownership of the request's session-state, and any
+ * persistable request data.
  *
- * @note Called with the mutex held.
+ * @note Called with no mutexes held.
+ *
+ * @param[in] state	tree to insert the entry into.
+ * @param[in] request	the entry is being created for.
+ * @param[in] packet	the State attribute will be added to.
+ * @param[in] old_state	value of the previous state entry in this sequence, or NULL.
+ * @param[in] old_tries	of the previous state entry.
+ * @param[in] data	persistable request data.
+ * @return
+ *	- The new entry.
+ *	- NULL if we're tracking too many sessions, or the state value is a duplicate.
  */
-static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request,
-					    RADIUS_PACKET *packet, fr_state_entry_t *old)
+static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet,
+					    uint8_t const *old_state, int old_tries, request_data_t *data)
 {
 	size_t			i;
 	uint32_t		x;
 	time_t			now = time(NULL);
 	VALUE_PAIR		*vp;
-	fr_state_entry_t	*entry, *next;
-	fr_state_entry_t	*free_head = NULL, **free_next = &free_head;
-
-	uint8_t			old_state[sizeof(old->state)];
-	int			old_tries = 0;
-
-	/*
-	 *	Clean up old entries.
-	 */
-	for (entry = state->head; entry != NULL; entry = next) {
-		next = entry->next;
-
-		if (entry == old) continue;
-
-		/*
-		 *	Too old, we can delete it.
-		 */
-		if (entry->cleanup < now) {
-			state_entry_unlink(state, entry);
-			*free_next = entry;
-			free_next = &(entry->next);
-			state->timed_out++;
-			continue;
-		}
-
-		break;
-	}
-
-	if (rbtree_num_elements(state->tree) >= (uint32_t) state->max_sessions) return NULL;
+	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
+	fr_state_entry_t	*free_head = NULL;
 
 	/*
-	 *	Record the information from the old state, we may base the
-	 *	new state off the old one.
-	 *
-	 *	Once we release the mutex, the state of old becomes indeterminate
-	 *	so we have to grab the values now.
+	 *	Cheap check before we do any work.  If we're full,
+	 *	expire old entries before deciding that there's no
+	 *	room.  It's re-checked when we insert the entry.
 	 */
-	if (old) {
-		old_tries = old->tries;
+	if (atomic_load_explicit(&state->num_entries, memory_order_relaxed) >= state->max_sessions) {
+		state_tree_expire(state, now);
 
-		memcpy(old_state, old->state, sizeof(old_state));
-
-		/*
-		 *	The old one isn't used any more, so we can free it.
-		 */
-		if (!old->data) {
-			state_entry_unlink(state, old);
-			*free_next = old;
-		}
-	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
-	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
-	 */
-	for (next = free_head; next;) {
-		entry = next;
-		next = entry->next;
-		talloc_free(entry);
+		if (atomic_load_explicit(&state->num_entries, memory_order_relaxed) >= state->max_sessions) return NULL;
 	}
 
 	/*
 	 *	Allocation doesn't need to occur inside the critical region
 	 *	and would add significantly to contention.
-	 *
-	 *	We reparent the talloc chunk later (when we hold the mutex again)
-	 *	we can't do it now due to thread safety issues with talloc.
 	 */
 	entry = talloc_zero(NULL, fr_state_entry_t);
-	if (!entry) {
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
+	if (!entry) return NULL;
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -407,7 +502,7 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		 *	16 octets of randomness should be enough to
 		 *	have a globally unique state.
 		 */
-		if (!old) {
+		if (!old_state) {
 			for (i = 0; i < sizeof(entry->state) / sizeof(x); i++) {
 				x = fr_rand();
 				memcpy(entry->state + (i * 4), &x, sizeof(x));
@@ -451,12 +546,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		       entry->id, hex, (uint64_t)entry->cleanup - now);
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (rbtree_num_elements(state->tree) >= (uint32_t)state->max_sessions) {
-		talloc_free(entry);
-		return NULL;
-	}
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -465,52 +554,105 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 */
 	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	if (!rbtree_insert(state->tree, entry)) {
+	/*
+	 *	The shard can only be determined once the
+	 *	state value is final.
+	 */
+	shard = state_shard(state, entry);
+
+	entry->seq_start = request->seq_start;
+	entry->ctx = request->state_ctx;
+	entry->vps = request->state;
+	entry->data = data;
+
+	state_shard_lock(shard);
+
+	/*
+	 *	Clean up old entries in this shard.  Other shards
+	 *	are cleaned up as entries are added to them.
+	 */
+	(void) state_shard_expire(state, shard, now, &free_head);
+
+	if ((atomic_load_explicit(&state->num_entries, memory_order_relaxed) >= state->max_sessions) ||
+	    !rbtree_insert(shard->tree, entry)) {
+		state_shard_unlock(shard);
+
+		/*
+		 *	The caller still owns these.
+		 */
+		entry->ctx = NULL;
+		entry->vps = NULL;
+		entry->data = NULL;
 		talloc_free(entry);
+
+		state_entry_list_free(free_head);
 		return NULL;
 	}
+	atomic_fetch_add_explicit(&state->num_entries, 1, memory_order_relaxed);
 
 	/*
 	 *	Link it to the end of the list, which is implicitely
 	 *	ordered by cleanup time.
 	 */
-	if (!state->head) {
+	if (!shard->head) {
 		entry->prev = entry->next = NULL;
-		state->head = state->tail = entry;
+		shard->head = shard->tail = entry;
 	} else {
-		rad_assert(state->tail != NULL);
+		rad_assert(shard->tail != NULL);
 
-		entry->prev = state->tail;
-		state->tail->next = entry;
+		entry->prev = shard->tail;
+		shard->tail->next = entry;
 
 		entry->next = NULL;
-		state->tail = entry;
+		shard->tail = entry;
 	}
 
+	state_shard_unlock(shard);
+
+	state_entry_list_free(free_head);
+
 	return entry;
 }
 
-/** Find the entry, based on the State attribute
+/** Build the key for looking up an entry, based on the State attribute
  *
+ * @param[in] state	tree to search.
+ * @param[out] key	entry to populate with the state value.
+ * @param[in] request	the packet belongs to.
+ * @param[in] packet	containing the State attribute.
+ * @return
+ *	- The shard the entry would be in.
+ *	- NULL if the packet has no valid State attribute.
  */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet)
+static fr_state_shard_t *state_entry_key(fr_state_tree_t *state, fr_state_entry_t *key,
+					 REQUEST *request, RADIUS_PACKET *packet)
 {
 	VALUE_PAIR *vp;
-	fr_state_entry_t *entry, my_entry;
 
 	vp = fr_pair_find_by_num(packet->vps, 0, FR_STATE, TAG_ANY);
 	if (!vp) return NULL;
 
-	if (vp->vp_length != sizeof(my_entry.state)) return NULL;
+	if (vp->vp_length != sizeof(key->state)) return NULL;
 
-	memcpy(my_entry.state, vp->vp_octets, sizeof(my_entry.state));
+	memcpy(key->state, vp->vp_octets, sizeof(key->state));
 
 	/*
 	 *	Make it unique for different virtual servers handling the same request
 	 */
-	my_entry.state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
+	key->state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
+
+	return state_shard(state, key);
+}
+
+/** Find the entry, based on the State attribute
+ *
+ * @note Called with the shard mutex held.
+ */
+static fr_state_entry_t *state_entry_find(fr_state_shard_t *shard, fr_state_entry_t *key)
+{
+	fr_state_entry_t *entry;
 
-	entry = rbtree_finddata(state->tree, &my_entry);
+	entry = rbtree_finddata(shard->tree, key);
 
 	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
 
@@ -522,16 +664,20 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *reque
  */
 void fr_state_discard(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *original)
 {
-	fr_state_entry_t *entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
+
+	shard = state_entry_key(state, &my_entry, request, original);
+	if (!shard) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, original);
+	state_shard_lock(shard);
+	entry = state_entry_find(shard, &my_entry);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		state_shard_unlock(shard);
 		return;
 	}
-	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_entry_unlink(state, shard, entry);
+	state_shard_unlock(shard);
 
 	/*
 	 *	The state and request must be in the same state
@@ -560,8 +706,9 @@ void fr_state_discard(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *o
  */
 void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet)
 {
-	fr_state_entry_t *entry;
-	TALLOC_CTX *old_ctx = NULL;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
+	TALLOC_CTX		*old_ctx = NULL;
 
 	rad_assert(request->state == NULL);
 
@@ -574,23 +721,26 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
+	shard = state_entry_key(state, &my_entry, request, packet);
+	if (shard) {
+		state_shard_lock(shard);
 
-	entry = state_entry_find(state, request, packet);
-	if (entry) {
-		if (request->state_ctx) old_ctx = request->state_ctx;
+		entry = state_entry_find(shard, &my_entry);
+		if (entry) {
+			if (request->state_ctx) old_ctx = request->state_ctx;
 
-		request->seq_start = entry->seq_start;
-		request->state_ctx = entry->ctx;
-		request->state = entry->vps;
-		request_data_restore(request, entry->data);
+			request->seq_start = entry->seq_start;
+			request->state_ctx = entry->ctx;
+			request->state = entry->vps;
+			request_data_restore(request, entry->data);
 
-		entry->ctx = NULL;
-		entry->vps = NULL;
-		entry->data = NULL;
-	}
+			entry->ctx = NULL;
+			entry->vps = NULL;
+			entry->data = NULL;
+		}
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		state_shard_unlock(shard);
+	}
 
 	if (request->state) {
 		RDEBUG2("Restored &session-state");
@@ -618,8 +768,12 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
  */
 bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *original, RADIUS_PACKET *packet)
 {
-	fr_state_entry_t *entry, *old;
-	request_data_t *data;
+	fr_state_entry_t	*entry, *old = NULL, *unused = NULL, my_entry;
+	fr_state_shard_t	*shard;
+	request_data_t		*data;
+
+	uint8_t			old_state[sizeof(my_entry.state)];
+	int			old_tries = 0;
 
 	request_data_by_persistance(&data, request, true);
 
@@ -630,30 +784,47 @@ bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 		rdebug_pair_list(L_DBG_LVL_2, request, request->state, "&session-state:");
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
-	old = original ? state_entry_find(state, request, original) :
-			 NULL;
+	/*
+	 *	Record the information from the old state, we may base the
+	 *	new state off the old one.
+	 *
+	 *	The new entry will usually be in a different shard, so
+	 *	we grab the values now, and release the old shard
+	 *	before creating it.
+	 */
+	shard = original ? state_entry_key(state, &my_entry, request, original) : NULL;
+	if (shard) {
+		state_shard_lock(shard);
+
+		old = state_entry_find(shard, &my_entry);
+		if (old) {
+			old_tries = old->tries;
+
+			memcpy(old_state, old->state, sizeof(old_state));
+
+			/*
+			 *	The old one isn't used any more, so we can free it.
+			 */
+			if (!old->data) {
+				state_entry_unlink(state, shard, old);
+				unused = old;
+			}
+		}
 
-	entry = state_entry_create(state, request, packet, old);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
-		return false;
+		state_shard_unlock(shard);
 	}
 
-	rad_assert(entry->ctx == NULL);
-	rad_assert(request->state_ctx);
+	/*
+	 *	Free this outside of the mutex for less contention.
+	 */
+	if (unused) talloc_free(unused);
 
-	entry->seq_start = request->seq_start;
-	entry->ctx = request->state_ctx;
-	entry->vps = request->state;
-	entry->data = data;
+	entry = state_entry_create(state, request, packet, old ? old_state : NULL, old_tries, data);
+	if (!entry) return false;
 
 	request->state_ctx = NULL;
 	request->state = NULL;
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
 	RDEBUG3("RADIUS State - saved");
 	VERIFY_REQUEST(request);
 
@@ -665,7 +836,7 @@ bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -673,7 +844,12 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint64_t	timed_out = 0;
+	int		i;
+
+	for (i = 0; i < FR_STATE_SHARDS; i++) timed_out += state->shard[i].timed_out;
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -681,5 +857,35 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return (uint32_t)rbtree_num_elements(state->tree);
+	return atomic_load_explicit(&state->num_entries, memory_order_relaxed);
+}
+
+/** Return the number of entries tracked by a shard
+ *
+ */
+uint32_t fr_state_shard_entries_tracked(fr_state_tree_t *state, unsigned int shard)
+{
+	if (shard >= FR_STATE_SHARDS) return 0;
+
+	return rbtree_num_elements(state->shard[shard].tree);
+}
+
+/** Return the number of entries in a shard that timed out
+ *
+ */
+uint64_t fr_state_shard_entries_timeout(fr_state_tree_t *state, unsigned int shard)
+{
+	if (shard >= FR_STATE_SHARDS) return 0;
+
+	return state->shard[shard].timed_out;
+}
+
+/** Return the number of times a shard's mutex was contended
+ *
+ */
+uint64_t fr_state_shard_contended(fr_state_tree_t *state, unsigned int shard)
+{
+	if (shard >= FR_STATE_SHARDS) return 0;
+
+	return state->shard[shard].contended;
 }
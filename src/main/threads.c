@@ -179,6 +179,8 @@ static const CONF_PARSER thread_config[] = {
 	{ FR_CONF_POINTER("cleanup_delay", FR_TYPE_UINT32, &thread_pool.cleanup_delay), .dflt = "5" },
 	{ FR_CONF_POINTER("max_queue_size", FR_TYPE_UINT32, &thread_pool.max_queue_size), .dflt = "65536" },
 	{ FR_CONF_POINTER("queue_priority", FR_TYPE_STRING, &thread_pool.queue_priority), .dflt = NULL },
+	{ FR_CONF_POINTER("num_networks", FR_TYPE_UINT32, &main_config.num_networks), .dflt = "1" },
+	{ FR_CONF_POINTER("num_workers", FR_TYPE_UINT32, &main_config.num_workers), .dflt = "4" },
 #ifdef WITH_STATS
 #ifdef WITH_ACCOUNTING
 	{ FR_CONF_POINTER("auto_limit_acct", FR_TYPE_BOOL, &thread_pool.auto_limit_acct) },
@@ -495,10 +497,9 @@ static void *thread_handler(void *arg)
 		 *	max_request_time handler to the request.
 		 */
 		if (fr_heap_num_elements(thread->backlog) > 0) {
-			struct timeval when;
+			fr_time_t when;
 
-			gettimeofday(&when, NULL);
-			when.tv_sec += main_config.max_request_time;
+			when = fr_time() + ((fr_time_t) main_config.max_request_time * NANOSEC);
 
 			pthread_mutex_lock(&thread->backlog_mutex);
 			for (;;) {
@@ -528,8 +529,8 @@ static void *thread_handler(void *arg)
 				request->thread_ctx = NULL;
 
 				request->el = el;
-				if (fr_event_timer_insert(request, request->el, &request->ev,
-							  &when, max_request_time_hook, request) < 0) {
+				if (fr_event_timer_at(request, request->el, &request->ev,
+						      when, max_request_time_hook, request) < 0) {
 					REDEBUG("Failed inserting max_request_time");
 				}
 			}
@@ -801,6 +802,10 @@ int thread_pool_bootstrap(CONF_SECTION *cs, bool *spawn_workers)
 	FR_INTEGER_BOUND_CHECK("max_servers", thread_pool.max_threads, >=, 1);
 	FR_INTEGER_BOUND_CHECK("start_servers", thread_pool.start_threads, <=, thread_pool.max_threads);
 
+	FR_INTEGER_BOUND_CHECK("num_networks", main_config.num_networks, >=, 1);
+	FR_INTEGER_BOUND_CHECK("num_networks", main_config.num_networks, <=, 64);
+	FR_INTEGER_BOUND_CHECK("num_workers", main_config.num_workers, >=, 1);
+
 #ifdef WITH_TLS
 	/*
 	 *	So TLS knows what to do.
@@ -42,6 +42,7 @@ typedef struct REQUEST REQUEST;
 #endif
 
 #include <ctype.h>
+#include <sys/time.h>
 
 #ifdef HAVE_GETOPT_H
 #	include <getopt.h>
@@ -83,6 +84,14 @@ static RADIUS_PACKET my_packet = {
 
 static char *my_secret = NULL;
 
+/*
+ *	Decode benchmark, enabled with -b <iterations>
+ */
+static unsigned int	bench_iterations = 0;
+static uint64_t		bench_decodes = 0;
+static uint64_t		bench_pairs = 0;
+static uint64_t		bench_usec = 0;
+
 static char proto_name_prev[128];
 static void *dl_handle, *dl_symbol;
 
@@ -575,6 +584,41 @@ static void parse_xlat(char const *input, char *output, size_t outlen)
 	talloc_free(fmt);
 }
 
+/** Decode the same data repeatedly, and record how long it took
+ *
+ */
+static void decode_benchmark(uint8_t const *data, size_t data_len, fr_radius_ctx_t *decoder_ctx)
+{
+	unsigned int	i;
+	struct timeval	start, end;
+	VALUE_PAIR	*head = NULL, *vp;
+	vp_cursor_t	cursor;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < bench_iterations; i++) {
+		uint8_t const	*attr = data;
+		size_t		len = data_len;
+		ssize_t		my_len;
+
+		fr_pair_cursor_init(&cursor, &head);
+		while (len > 0) {
+			my_len = fr_radius_decode_pair(NULL, &cursor, fr_dict_root(fr_dict_internal), attr, len,
+						       decoder_ctx);
+			if ((my_len <= 0) || ((size_t) my_len > len)) break;
+
+			attr += my_len;
+			len -= my_len;
+		}
+
+		for (vp = head; vp; vp = vp->next) bench_pairs++;
+		fr_pair_list_free(&head);
+	}
+	gettimeofday(&end, NULL);
+
+	bench_usec += ((end.tv_sec - start.tv_sec) * 1000000) + (end.tv_usec - start.tv_usec);
+	bench_decodes += bench_iterations;
+}
+
 static int load_proto_library(void **handle, void **symbol, char *proto_name)
 {
 	char dl_name[128];
@@ -799,6 +843,16 @@ static void process_file(fr_dict_t *dict, const char *root_dir, char const *file
 				}
 			}
 
+			/*
+			 *	Decode octets by reference, as the server
+			 *	does.  The VPs are freed before "data" is
+			 *	overwritten.
+			 */
+			decoder_ctx.borrow_start = attr;
+			decoder_ctx.borrow_end = attr + len;
+
+			if (bench_iterations) decode_benchmark(attr, len, &decoder_ctx);
+
 			fr_pair_cursor_init(&cursor, &head);
 			my_len = 0;
 			while (len > 0) {
@@ -1104,6 +1158,13 @@ static void process_file(fr_dict_t *dict, const char *root_dir, char const *file
 
 	if (fp != stdin) fclose(fp);
 
+	if (bench_decodes) {
+		printf("%s: %"PRIu64" decodes, %"PRIu64" pairs in %"PRIu64"us (%"PRIu64"ns per pair)\n",
+		       filename, bench_decodes, bench_pairs, bench_usec,
+		       bench_pairs ? (bench_usec * 1000) / bench_pairs : 0);
+		bench_decodes = bench_pairs = bench_usec = 0;
+	}
+
 	unload_proto_library();	/* Cleanup */
 }
 
@@ -1111,6 +1172,7 @@ static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: unit_test_attribute [OPTS] filename\n");
 	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -b <iterations>        Benchmark \"decode\" tests, by repeating each one.\n");
 	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 	fprintf(stderr, "  -M                     Show talloc memory report.\n");
@@ -1136,7 +1198,10 @@ int main(int argc, char *argv[])
 	}
 #endif
 
-	while ((c = getopt(argc, argv, "d:D:xMh")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "b:d:D:xMh")) != EOF) switch (c) {
+		case 'b':
+			bench_iterations = atoi(optarg);
+			break;
 		case 'd':
 			radius_dir = optarg;
 			break;
@@ -44,6 +44,11 @@ bool log_stripped_names = false;
 
 static bool filedone = false;
 
+/*
+ *	Interpreter benchmark, enabled with -b <iterations>
+ */
+static unsigned int	bench_iterations = 0;
+
 char const *radiusd_version = RADIUSD_VERSION_STRING_BUILD("unittest");
 
 /*
@@ -365,6 +370,53 @@ static REQUEST *request_from_file(FILE *fp, fr_event_list_t *el, RADCLIENT *clie
 }
 
 
+/** Run copies of a request through the virtual server repeatedly, and print how long it took
+ *
+ * Debugging output is turned off while the copies run, so that the time
+ * measured is spent interpreting the policy, and not logging it.
+ */
+static void request_benchmark(char const *filename, REQUEST *request)
+{
+	unsigned int	i;
+	int		debug_lvl = rad_debug_lvl;
+	uint64_t	usec;
+	struct timeval	start, end;
+
+	rad_debug_lvl = fr_debug_lvl = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < bench_iterations; i++) {
+		REQUEST	*copy;
+
+		copy = request_alloc(NULL);
+		copy->packet = fr_radius_copy(copy, request->packet);
+		copy->reply = fr_radius_alloc(copy, false);
+		if (!copy->packet || !copy->reply) {
+			ERROR("No memory");
+			talloc_free(copy);
+			break;
+		}
+
+		copy->client = request->client;
+		copy->number = request->number;
+		copy->master_state = REQUEST_ACTIVE;
+		copy->child_state = REQUEST_RUNNING;
+		copy->server_cs = request->server_cs;
+		copy->root = request->root;
+
+		rad_virtual_server(copy);
+
+		talloc_free(copy);
+	}
+	gettimeofday(&end, NULL);
+
+	rad_debug_lvl = fr_debug_lvl = debug_lvl;
+
+	usec = ((end.tv_sec - start.tv_sec) * 1000000) + (end.tv_usec - start.tv_usec);
+	printf("%s: %u requests in %" PRIu64 " us, %" PRIu64 " ns/request\n",
+	       filename, i, usec, i ? (usec * 1000) / i : 0);
+}
+
 static void print_packet(FILE *fp, RADIUS_PACKET *packet)
 {
 	VALUE_PAIR *vp;
@@ -523,6 +575,45 @@ static ssize_t xlat_poke(TALLOC_CTX *ctx, char **out, size_t outlen,
 /*
  *	Read a file compose of xlat's and expected results
  */
+/** Expand the same format string repeatedly, and record how long it took
+ *
+ * Each string is expanded both at runtime, as modules do, and from
+ * a tree which is tokenized on every call, for comparison.
+ */
+static void xlat_benchmark(REQUEST *request, char const *fmt,
+			   uint64_t *runtime_usec, uint64_t *tokenize_usec)
+{
+	unsigned int	i;
+	int		debug_lvl = request->log.lvl;
+	char		output[8192];
+	struct timeval	start, end;
+
+	request->log.lvl = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < bench_iterations; i++) {
+		(void) xlat_eval(output, sizeof(output), request, fmt, NULL, NULL);
+	}
+	gettimeofday(&end, NULL);
+	*runtime_usec += ((end.tv_sec - start.tv_sec) * 1000000) + (end.tv_usec - start.tv_usec);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < bench_iterations; i++) {
+		xlat_exp_t	*head;
+		char const	*error;
+		char		*copy = talloc_typed_strdup(NULL, fmt);
+
+		if (xlat_tokenize(copy, copy, &head, &error) > 0) {
+			(void) xlat_eval_compiled(output, sizeof(output), request, head, NULL, NULL);
+		}
+		talloc_free(copy);
+	}
+	gettimeofday(&end, NULL);
+	*tokenize_usec += ((end.tv_sec - start.tv_sec) * 1000000) + (end.tv_usec - start.tv_usec);
+
+	request->log.lvl = debug_lvl;
+}
+
 static bool do_xlats(char const *filename, FILE *fp)
 {
 	int		lineno = 0;
@@ -532,6 +623,7 @@ static bool do_xlats(char const *filename, FILE *fp)
 	char		output[8192];
 	REQUEST		*request;
 	struct timeval	now;
+	uint64_t	bench_xlats = 0, runtime_usec = 0, tokenize_usec = 0;
 
 	/*
 	 *	Create and initialize the new request.
@@ -598,6 +690,11 @@ static bool do_xlats(char const *filename, FILE *fp)
 				continue;
 			}
 
+			if (bench_iterations) {
+				xlat_benchmark(request, input + 5, &runtime_usec, &tokenize_usec);
+				bench_xlats += bench_iterations;
+			}
+
 			TALLOC_FREE(fmt); /* also frees 'head' */
 			continue;
 		}
@@ -620,6 +717,11 @@ static bool do_xlats(char const *filename, FILE *fp)
 		return false;
 	}
 
+	if (bench_xlats) {
+		printf("%s: %" PRIu64 " expansions, runtime %" PRIu64 " ns/xlat, tokenized each time %" PRIu64 " ns/xlat\n",
+		       filename, bench_xlats, (runtime_usec * 1000) / bench_xlats, (tokenize_usec * 1000) / bench_xlats);
+	}
+
 	TALLOC_FREE(request);
 	return true;
 }
@@ -700,9 +802,13 @@ int main(int argc, char *argv[])
 	default_log.fd = STDOUT_FILENO;
 
 	/*  Process the options.  */
-	while ((argval = getopt(argc, argv, "d:D:f:hi:mMn:o:O:xX")) != EOF) {
+	while ((argval = getopt(argc, argv, "b:d:D:f:hi:mMn:o:O:xX")) != EOF) {
 
 		switch (argval) {
+			case 'b':
+				bench_iterations = atoi(optarg);
+				break;
+
 			case 'd':
 				set_radius_dir(NULL, optarg);
 				break;
@@ -952,6 +1058,12 @@ int main(int argc, char *argv[])
 		fclose(fp);
 	}
 
+	/*
+	 *	Benchmark copies of the request first, so that the
+	 *	original is untouched for the filter.
+	 */
+	if (bench_iterations) request_benchmark(input_file ? input_file : "-", request);
+
 	/*
 	 *	FIXME: create scheduler and inject packets into that!!!
 	 */
@@ -1042,6 +1154,8 @@ static void NEVER_RETURNS usage(int status)
 
 	fprintf(output, "Usage: %s [options]\n", main_config.name);
 	fprintf(output, "Options:\n");
+	fprintf(output, "  -b iterations Time running copies of the request through the server,\n");
+	fprintf(output, "                or expanding each xlat with \"-O xlat_only\".\n");
 	fprintf(output, "  -d raddb_dir  Configuration files are in \"raddb_dir/*\".\n");
 	fprintf(output, "  -D dict_dir   Dictionary files are in \"dict_dir/*\".\n");
 	fprintf(output, "  -f file       Filter reply against attributes in 'file'.\n");
@@ -1668,6 +1668,56 @@ static void add_child(unlang_group_t *g, unlang_t *c)
 	c->parent = unlang_group_to_generic(g);
 }
 
+/** Flatten if/elsif/else chains in a group
+ *
+ * The bodies of 'if' and 'elsif' blocks with conditions which are
+ * always false are freed, as they can never be run.  The blocks
+ * themselves are kept.  Evaluating a condition which doesn't match
+ * still updates the priority of the current result with the block's
+ * actions, and a following 'elsif' or 'else' stays in its chain.
+ *
+ * Where each 'if' and 'elsif' jumps to when its condition matches is
+ * then resolved, which saves the interpreter from walking over the
+ * rest of the chain every time a condition is taken.
+ */
+static void compile_if_chains(unlang_group_t *g)
+{
+	unlang_t	*c, *head, *end, *child, *next;
+
+	for (c = g->children; c; c = c->next) {
+		unlang_group_t *f;
+
+		if ((c->type != UNLANG_TYPE_IF) && (c->type != UNLANG_TYPE_ELSIF)) continue;
+
+		f = unlang_generic_to_group(c);
+		if (f->cond->type != COND_TYPE_FALSE) continue;
+
+		for (child = f->children; child; child = next) {
+			next = child->next;
+			talloc_free(child);
+		}
+		f->children = f->tail = NULL;
+		f->num_children = 0;
+	}
+
+	c = g->children;
+	while (c) {
+		if ((c->type != UNLANG_TYPE_IF) && (c->type != UNLANG_TYPE_ELSIF)) {
+			c = c->next;
+			continue;
+		}
+
+		head = c;
+		for (end = c->next;
+		     end && ((end->type == UNLANG_TYPE_ELSIF) || (end->type == UNLANG_TYPE_ELSE));
+		     end = end->next);
+
+		for (c = head; c != end; c = c->next) {
+			if (c->type != UNLANG_TYPE_ELSE) unlang_generic_to_group(c)->chain_end = end;
+		}
+	}
+}
+
 /*
  *	compile 'actions { ... }' inside of another group.
  */
@@ -1802,6 +1852,8 @@ static unlang_t *compile_children(unlang_group_t *g, UNUSED unlang_t *parent, un
 		}
 	}
 
+	compile_if_chains(g);
+
 	return compile_action_defaults(c, unlang_ctx, parentgroup_type);
 }
 
@@ -1832,6 +1884,140 @@ static unlang_t *compile_group(unlang_t *parent, unlang_compile_t *unlang_ctx, C
 	return compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
 }
 
+static uint32_t _switch_case_hash(void const *data)
+{
+	fr_value_box_t const *value = ((unlang_switch_case_t const *)data)->value;
+
+	switch (value->type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		return fr_hash(value->vb_octets, value->datum.length);
+
+	default:
+		return fr_hash(((uint8_t const *)value) + fr_value_box_offsets[value->type],
+			       fr_value_box_field_sizes[value->type]);
+	}
+}
+
+static int _switch_case_cmp(void const *one, void const *two)
+{
+	unlang_switch_case_t const *a = one, *b = two;
+
+	return fr_value_box_cmp(a->value, b->value);
+}
+
+/** Whether 'case' values of a given type can be matched by hashing
+ *
+ * The hash must agree with the comparisons done by #cond_eval_map, so
+ * types with fuzzy equality (floats, prefixes) are excluded.
+ */
+static bool switch_case_hashable(fr_type_t type)
+{
+	switch (type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+	case FR_TYPE_IPV4_ADDR:
+	case FR_TYPE_IPV6_ADDR:
+	case FR_TYPE_IFID:
+	case FR_TYPE_ETHERNET:
+	case FR_TYPE_BOOL:
+	case FR_TYPE_UINT8:
+	case FR_TYPE_UINT16:
+	case FR_TYPE_UINT32:
+	case FR_TYPE_UINT64:
+	case FR_TYPE_INT8:
+	case FR_TYPE_INT16:
+	case FR_TYPE_INT32:
+	case FR_TYPE_INT64:
+	case FR_TYPE_DATE:
+	case FR_TYPE_SIZE:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/** Index the static 'case' values of a 'switch'
+ *
+ * Cases whose values are known at compile time are inserted into a hash
+ * table, so the matching case can be found without evaluating each one
+ * in turn.  Cases which need expanding at runtime are still evaluated
+ * in order, but only those appearing before the matching static case.
+ *
+ * @param[in] g		The 'switch' to index.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int compile_switch_cases(unlang_group_t *g)
+{
+	unlang_t		*this;
+	unlang_group_t		*h;
+	unlang_switch_case_t	*sc;
+	fr_type_t		type;
+	int			num = 0;
+
+	/*
+	 *	compile_switch() refuses more than one default case,
+	 *	but take the first one anyway, as it's the one which
+	 *	would be found by walking the cases in order.
+	 */
+	for (this = g->children; this; this = this->next) {
+		h = unlang_generic_to_group(this);
+		if (!h->vpt) {
+			g->default_case = this;
+			break;
+		}
+	}
+
+	if (g->vpt->type != TMPL_TYPE_ATTR) return 0;
+
+	type = g->vpt->tmpl_da->type;
+	if (!switch_case_hashable(type)) return 0;
+
+	/*
+	 *	Static case values should all have been cast to
+	 *	the type of the attribute.  If not, don't index
+	 *	anything, and match the slow way.
+	 */
+	for (this = g->children; this; this = this->next) {
+		h = unlang_generic_to_group(this);
+		if (h->vpt && (h->vpt->type == TMPL_TYPE_DATA) && (h->vpt->tmpl_value_type != type)) return 0;
+	}
+
+	g->cases = fr_hash_table_create(g, _switch_case_hash, _switch_case_cmp, NULL);
+	if (!g->cases) return -1;
+
+	for (this = g->children; this; this = this->next, num++) {
+		h = unlang_generic_to_group(this);
+		if (!h->vpt) continue;
+
+		if (h->vpt->type != TMPL_TYPE_DATA) {
+			g->dynamic_cases = true;
+			continue;
+		}
+
+		MEM(sc = talloc_zero(g->cases, unlang_switch_case_t));
+		sc->value = &h->vpt->tmpl_value;
+		sc->instruction = this;
+		sc->num = num;
+
+		if (fr_hash_table_finddata(g->cases, sc)) {
+			cf_log_warn(h->cs, "Ignoring duplicate 'case' %s, it can never match", this->name);
+			talloc_free(sc);
+			continue;
+		}
+
+		if (!fr_hash_table_insert(g->cases, sc)) {
+			talloc_free(sc);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
 				   unlang_group_type_t group_type, unlang_group_type_t parentgroup_type, unlang_type_t mod_type)
 {
@@ -1928,7 +2114,16 @@ static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx,
 		return NULL;
 	}
 
-	return compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
+	c = compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
+	if (!c) return NULL;
+
+	if (compile_switch_cases(g) < 0) {
+		cf_log_err(cs, "Failed indexing 'case' statements");
+		talloc_free(c);
+		return NULL;
+	}
+
+	return c;
 }
 
 static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
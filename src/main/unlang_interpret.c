@@ -767,12 +767,39 @@ static unlang_action_t unlang_xlat_inline(REQUEST *request, unlang_stack_t *stac
 	return UNLANG_ACTION_CONTINUE;
 }
 
+/** Find the first static 'case' matching any instance of the attribute being switched over
+ *
+ * @param[in] request	The current request.
+ * @param[in] g		The 'switch' statement.
+ * @return
+ *	- The matching 'case'.
+ *	- NULL if no static case matched.
+ */
+static unlang_t *unlang_switch_case_find(REQUEST *request, unlang_group_t *g)
+{
+	VALUE_PAIR		*vp;
+	vp_cursor_t		cursor;
+	unlang_switch_case_t	find, *sc, *best = NULL;
+	int			err;
+
+	for (vp = tmpl_cursor_init(&err, &cursor, request, g->vpt);
+	     vp;
+	     vp = tmpl_cursor_next(&cursor, g->vpt)) {
+		find.value = &vp->data;
+
+		sc = fr_hash_table_finddata(g->cases, &find);
+		if (sc && (!best || (sc->num < best->num))) best = sc;
+	}
+
+	return best ? best->instruction : NULL;
+}
+
 static unlang_action_t unlang_switch(REQUEST *request, unlang_stack_t *stack,
 				       UNUSED rlm_rcode_t *presult, UNUSED int *priority)
 {
 	unlang_stack_frame_t	*frame = &stack->frame[stack->depth];
 	unlang_t		*instruction = frame->instruction;
-	unlang_t		*this, *found, *null_case;
+	unlang_t		*this, *found;
 	unlang_group_t		*g, *h;
 	fr_cond_t		cond;
 	fr_value_box_t		data;
@@ -792,7 +819,7 @@ static unlang_action_t unlang_switch(REQUEST *request, unlang_stack_t *stack,
 
 	rad_assert(g->vpt != NULL);
 
-	null_case = found = NULL;
+	found = NULL;
 	data.datum.ptr = NULL;
 
 	/*
@@ -801,17 +828,21 @@ static unlang_action_t unlang_switch(REQUEST *request, unlang_stack_t *stack,
 	 */
 	if ((g->vpt->type == TMPL_TYPE_ATTR) && (tmpl_find_vp(NULL, request, g->vpt) < 0)) {
 	find_null_case:
-		for (this = g->children; this; this = this->next) {
-			rad_assert(this->type == UNLANG_TYPE_CASE);
-
-			h = unlang_generic_to_group(this);
-			if (h->vpt) continue;
+		found = g->default_case;
+		goto do_null_case;
+	}
 
-			found = this;
-			break;
+	/*
+	 *	Static 'case' values are indexed by value.  Only
+	 *	the dynamic cases appearing before the matching
+	 *	static case need to be evaluated.
+	 */
+	if (g->cases) {
+		found = unlang_switch_case_find(request, g);
+		if (!g->dynamic_cases) {
+			if (!found) found = g->default_case;
+			goto do_null_case;
 		}
-
-		goto do_null_case;
 	}
 
 	/*
@@ -835,18 +866,17 @@ static unlang_action_t unlang_switch(REQUEST *request, unlang_stack_t *stack,
 	 *	Find either the exact matching name, or the
 	 *	"case {...}" statement.
 	 */
-	for (this = g->children; this; this = this->next) {
+	for (this = g->children; this && (this != found); this = this->next) {
 		rad_assert(this->type == UNLANG_TYPE_CASE);
 
 		h = unlang_generic_to_group(this);
 
 		/*
-		 *	Remember the default case
+		 *	Skip the default case, and any static
+		 *	cases we've already checked.
 		 */
-		if (!h->vpt) {
-			if (!null_case) null_case = this;
-			continue;
-		}
+		if (!h->vpt) continue;
+		if (g->cases && (h->vpt->type == TMPL_TYPE_DATA)) continue;
 
 		/*
 		 *	If we're switching over an attribute
@@ -894,7 +924,7 @@ static unlang_action_t unlang_switch(REQUEST *request, unlang_stack_t *stack,
 		}
 	}
 
-	if (!found) found = null_case;
+	if (!found) found = g->default_case;
 
 do_null_case:
 	talloc_free(data.datum.ptr);
@@ -998,7 +1028,7 @@ static unlang_action_t unlang_module_call(REQUEST *request, unlang_stack_t *stac
 	 *	Lock is noop unless instance->mutex is set.
 	 */
 	safe_lock(sp->module_instance);
-	*presult = request->rcode = sp->method(sp->module_instance->dl_inst->data, modcall_state->thread->data, request);
+	*presult = request->rcode = sp->method(modcall_state->thread->inst_data, modcall_state->thread->data, request);
 	safe_unlock(sp->module_instance);
 
 	request->module = NULL;
@@ -1072,12 +1102,9 @@ static unlang_action_t unlang_if(REQUEST *request, unlang_stack_t *stack,
 	/*
 	 *	Tell the main interpreter to skip over the else /
 	 *	elsif blocks, as this "if" condition was taken.
+	 *	The end of the chain is resolved at compile time.
 	 */
-	while (frame->next &&
-	       ((frame->next->type == UNLANG_TYPE_ELSE) ||
-		(frame->next->type == UNLANG_TYPE_ELSIF))) {
-		frame->next = frame->next->next;
-	}
+	if (frame->next) frame->next = g->chain_end;
 
 	/*
 	 *	We took the "if".  Go recurse into its' children.
@@ -1110,7 +1137,7 @@ static unlang_action_t unlang_module_resumption(REQUEST *request, unlang_stack_t
 	 *	Lock is noop unless instance->mutex is set.
 	 */
 	safe_lock(sp->module_instance);
-	*presult = request->rcode = mr->callback(request, mr->module.module_instance->dl_inst->data, mr->thread->data, mutable);
+	*presult = request->rcode = mr->callback(request, mr->thread->inst_data, mr->thread->data, mutable);
 	safe_unlock(sp->module_instance);
 
 	request->module = NULL;
@@ -1812,25 +1839,24 @@ static void unlang_event_fd_error_handler(UNUSED fr_event_list_t *el, int fd,
  * param[in] request		the current request.
  * param[in] callback		to call.
  * param[in] ctx		for the callback.
- * param[in] timeout		when to call the timeout (i.e. now + timeout).
+ * param[in] when		when to call the timeout (i.e. now + timeout), on the
+ *				same clock as #fr_time.
  * @return
  *	- 0 on success.
  *	- <0 on error.
  */
 int unlang_event_timeout_add(REQUEST *request, fr_unlang_timeout_callback_t callback,
-			     void const *ctx, struct timeval *when)
+			     void const *ctx, fr_time_t when)
 {
 	unlang_stack_t			*stack = request->stack;
 	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
 	unlang_event_t			*ev;
-	unlang_module_call_t		*sp;
 	unlang_stack_state_modcall_t	*modcall_state = talloc_get_type_abort(frame->state,
 									       unlang_stack_state_modcall_t);
 
 	rad_assert(stack->depth > 0);
 	rad_assert((frame->instruction->type == UNLANG_TYPE_MODULE_CALL) ||
 		   (frame->instruction->type == UNLANG_TYPE_MODULE_RESUME));
-	sp = unlang_generic_to_module_call(frame->instruction);
 
 	ev = talloc_zero(request, unlang_event_t);
 	if (!ev) return -1;
@@ -1838,12 +1864,12 @@ int unlang_event_timeout_add(REQUEST *request, fr_unlang_timeout_callback_t call
 	ev->request = request;
 	ev->fd = -1;
 	ev->timeout = callback;
-	ev->inst = sp->module_instance->dl_inst->data;
-	ev->thread = modcall_state->thread;
+	ev->inst = modcall_state->thread->inst_data;
+	ev->thread = modcall_state->thread->data;
 	ev->ctx = ctx;
 
-	if (fr_event_timer_insert(request, request->el, &ev->ev,
-				  when, unlang_event_timeout_handler, ev) < 0) {
+	if (fr_event_timer_at(request, request->el, &ev->ev,
+			      when, unlang_event_timeout_handler, ev) < 0) {
 		RPEDEBUG("Failed inserting event");
 		talloc_free(ev);
 		return -1;
@@ -1905,7 +1931,6 @@ int unlang_event_fd_add(REQUEST *request,
 	unlang_stack_t			*stack = request->stack;
 	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
 	unlang_event_t			*ev;
-	unlang_module_call_t		*sp;
 	unlang_stack_state_modcall_t	*modcall_state = talloc_get_type_abort(frame->state,
 									       unlang_stack_state_modcall_t);
 
@@ -1913,7 +1938,6 @@ int unlang_event_fd_add(REQUEST *request,
 
 	rad_assert((frame->instruction->type == UNLANG_TYPE_MODULE_CALL) ||
 		   (frame->instruction->type == UNLANG_TYPE_MODULE_RESUME));
-	sp = unlang_generic_to_module_call(frame->instruction);
 
 	ev = talloc_zero(request, unlang_event_t);
 	if (!ev) return -1;
@@ -1923,8 +1947,8 @@ int unlang_event_fd_add(REQUEST *request,
 	ev->fd_read = read;
 	ev->fd_write = write;
 	ev->fd_error = error;
-	ev->inst = sp->module_instance->dl_inst->data;
-	ev->thread = modcall_state->thread;
+	ev->inst = modcall_state->thread->inst_data;
+	ev->thread = modcall_state->thread->data;
 	ev->ctx = ctx;
 
 	/*
@@ -2007,7 +2031,7 @@ void unlang_signal(REQUEST *request, fr_state_action_t action)
 
 	memcpy(&mutable, &mr->ctx, sizeof(mutable));
 
-	mr->signal_callback(request, mr->module.module_instance->dl_inst->data, mr->thread, mutable, action);
+	mr->signal_callback(request, mr->thread->inst_data, mr->thread->data, mutable, action);
 }
 
 /** Yield a request back to the interpreter from within a module
@@ -33,6 +33,31 @@ RCSID("$Id$")
 #include <ctype.h>
 #include "xlat.h"
 
+/*
+ *	Format strings expanded at runtime are usually the same few
+ *	strings from the configuration, so the result of tokenizing
+ *	them is cached per thread.  The number of entries is bounded
+ *	in case a caller passes arbitrary strings, and the least
+ *	recently used entry is evicted to make room for new ones.
+ */
+#define XLAT_RUNTIME_CACHE_MAX	1024
+
+typedef struct {
+	char const	*fmt;		//!< The format string.
+	xlat_exp_t	*node;		//!< Result of tokenizing fmt.
+	ssize_t		slen;		//!< Returned by #xlat_tokenize_request.
+	unsigned int	in_use;		//!< Number of expansions using node.  Entries in use
+					//!< aren't evicted, as expansions may be nested.
+	fr_dlist_t	entry;		//!< Entry in the LRU list.
+} xlat_runtime_cache_entry_t;
+
+typedef struct {
+	fr_hash_table_t	*ht;		//!< Entries, by format string.
+	fr_dlist_t	lru;		//!< Entries, most recently used first.
+} xlat_runtime_cache_t;
+
+fr_thread_local_setup(xlat_runtime_cache_t *, xlat_runtime_cache)
+
 static size_t xlat_process(TALLOC_CTX *ctx, char **out, REQUEST *request, xlat_exp_t const * const head,
 			   xlat_escape_t escape, void  const *escape_ctx);
 
@@ -633,7 +658,7 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, REQUEST *request, xlat_e
 			   xlat_escape_t escape, void const *escape_ctx)
 {
 	int i, list;
-	size_t total;
+	size_t total, *lens;
 	char **array, *answer;
 	xlat_exp_t const *node;
 
@@ -673,16 +698,22 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, REQUEST *request, xlat_e
 		list++;
 	}
 
-	array = talloc_array(ctx, char *, list);
+	/*
+	 *	One allocation for the string pointers and their
+	 *	lengths, so each strlen() is only done once.
+	 */
+	array = talloc_zero_size(ctx, (sizeof(char *) + sizeof(size_t)) * list);
 	if (!array) return -1;
+	talloc_set_type(array, char *);
+	lens = (size_t *)(array + list);
 
+	total = 0;
 	for (node = head, i = 0; node != NULL; node = node->next, i++) {
 		array[i] = xlat_aprint(array, request, node, escape, escape_ctx, 0); /* may be NULL */
-	}
-
-	total = 0;
-	for (i = 0; i < list; i++) {
-		if (array[i]) total += strlen(array[i]); /* FIXME: calculate strlen once */
+		if (array[i]) {
+			lens[i] = strlen(array[i]);
+			total += lens[i];
+		}
 	}
 
 	if (!total) {
@@ -695,13 +726,10 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, REQUEST *request, xlat_e
 
 	total = 0;
 	for (i = 0; i < list; i++) {
-		size_t len;
+		if (!lens[i]) continue;
 
-		if (array[i]) {
-			len = strlen(array[i]);
-			memcpy(answer + total, array[i], len);
-			total += len;
-		}
+		memcpy(answer + total, array[i], lens[i]);
+		total += lens[i];
 	}
 	answer[total] = '\0';
 	talloc_free(array);	/* and child entries */
@@ -757,6 +785,142 @@ static ssize_t _xlat_eval_compiled(TALLOC_CTX *ctx, char **out, size_t outlen, R
 	return len;
 }
 
+static uint32_t _xlat_runtime_cache_hash(void const *data)
+{
+	xlat_runtime_cache_entry_t const *entry = data;
+
+	return fr_hash_string(entry->fmt);
+}
+
+static int _xlat_runtime_cache_cmp(void const *one, void const *two)
+{
+	xlat_runtime_cache_entry_t const *a = one, *b = two;
+
+	return strcmp(a->fmt, b->fmt);
+}
+
+static void _xlat_runtime_cache_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+static void _xlat_runtime_cache_free(void *to_free)
+{
+	xlat_runtime_cache_t *cache = to_free;
+
+	fr_hash_table_free(cache->ht);
+	talloc_free(cache);
+}
+
+/** Evict the least recently used entry which isn't being expanded
+ *
+ * @return
+ *	- true if an entry was evicted.
+ *	- false if every entry is in use.
+ */
+static bool xlat_runtime_cache_evict(xlat_runtime_cache_t *cache)
+{
+	fr_dlist_t			*p;
+	xlat_runtime_cache_entry_t	*entry;
+
+	for (p = cache->lru.prev; p != &cache->lru; p = p->prev) {
+		entry = fr_ptr_to_type(xlat_runtime_cache_entry_t, entry, p);
+		if (entry->in_use) continue;
+
+		fr_dlist_remove(&entry->entry);
+		fr_hash_table_delete(cache->ht, entry);
+		return true;
+	}
+
+	return false;
+}
+
+/** Tokenize a format string, re-using the result of previous calls with the same string
+ *
+ * @param[out] head	Where to write the tokenized expansion.  If *cached is NULL,
+ *			must be freed by the caller.
+ * @param[out] cached	The cache entry head belongs to, or NULL.  Must be passed to
+ *			#xlat_runtime_cache_release once head is no longer needed.
+ * @param[in] ctx	to allocate head in, if it isn't cached.
+ * @param[in] request	The current request.
+ * @param[in] fmt	string to tokenize.
+ * @return the same values as #xlat_tokenize_request.
+ */
+static ssize_t xlat_tokenize_cached(xlat_exp_t **head, xlat_runtime_cache_entry_t **cached,
+				    TALLOC_CTX *ctx, REQUEST *request, char const *fmt)
+{
+	xlat_runtime_cache_t		*cache = xlat_runtime_cache;
+	xlat_runtime_cache_entry_t	find, *entry;
+	ssize_t				slen;
+
+	*cached = NULL;
+
+	if (!cache) {
+		MEM(cache = talloc_zero(NULL, xlat_runtime_cache_t));
+		cache->ht = fr_hash_table_create(cache, _xlat_runtime_cache_hash, _xlat_runtime_cache_cmp,
+						 _xlat_runtime_cache_entry_free);
+		if (!cache->ht) {
+			talloc_free(cache);
+			return xlat_tokenize_request(ctx, request, fmt, head);
+		}
+		FR_DLIST_INIT(cache->lru);
+		fr_thread_local_set_destructor(xlat_runtime_cache, _xlat_runtime_cache_free, cache);
+	}
+
+	find.fmt = fmt;
+	entry = fr_hash_table_finddata(cache->ht, &find);
+	if (entry) {
+		fr_dlist_remove(&entry->entry);
+		fr_dlist_insert_head(&cache->lru, &entry->entry);
+		goto found;
+	}
+
+	/*
+	 *	Cache is full of entries which are being expanded.
+	 *	Tokenize it just for this call.
+	 */
+	if ((fr_hash_table_num_elements(cache->ht) >= XLAT_RUNTIME_CACHE_MAX) &&
+	    !xlat_runtime_cache_evict(cache)) {
+		return xlat_tokenize_request(ctx, request, fmt, head);
+	}
+
+	/*
+	 *	Format strings which fail to tokenize aren't cached,
+	 *	so that the error is reported every time.
+	 */
+	MEM(entry = talloc_zero(NULL, xlat_runtime_cache_entry_t));
+	slen = xlat_tokenize_request(entry, request, fmt, &entry->node);
+	if (slen < 0) {
+		talloc_free(entry);
+		return slen;
+	}
+	if (entry->node) talloc_steal(entry, entry->node);	/* Nodes may be parented by the request */
+	entry->fmt = talloc_typed_strdup(entry, fmt);
+	entry->slen = slen;
+
+	if (!fr_hash_table_insert(cache->ht, entry)) {
+		talloc_free(entry);
+		return xlat_tokenize_request(ctx, request, fmt, head);
+	}
+	fr_dlist_insert_head(&cache->lru, &entry->entry);
+
+found:
+	entry->in_use++;
+	*head = entry->node;
+	*cached = entry;
+
+	return entry->slen;
+}
+
+/** Release a cache entry returned by #xlat_tokenize_cached
+ *
+ */
+static inline void xlat_runtime_cache_release(xlat_runtime_cache_entry_t *cached)
+{
+	rad_assert(cached->in_use > 0);
+	cached->in_use--;
+}
+
 static ssize_t _xlat_eval(TALLOC_CTX *ctx, char **out, size_t outlen, REQUEST *request, char const *fmt,
 			  xlat_escape_t escape, void const *escape_ctx) CC_HINT(nonnull (2, 4, 5));
 
@@ -778,6 +942,7 @@ static ssize_t _xlat_eval(TALLOC_CTX *ctx, char **out, size_t outlen, REQUEST *r
 {
 	ssize_t len;
 	xlat_exp_t *node;
+	xlat_runtime_cache_entry_t *cached;
 
 	RDEBUG2("EXPAND %s", fmt);
 	RINDENT();
@@ -785,8 +950,13 @@ static ssize_t _xlat_eval(TALLOC_CTX *ctx, char **out, size_t outlen, REQUEST *r
 	/*
 	 *	Give better errors than the old code.
 	 */
-	len = xlat_tokenize_request(ctx, request, fmt, &node);
+	len = xlat_tokenize_cached(&node, &cached, ctx, request, fmt);
 	if (len == 0) {
+		if (cached) {
+			xlat_runtime_cache_release(cached);
+		} else {
+			talloc_free(node);
+		}
 		if (*out) {
 			**out = '\0';
 		} else {
@@ -803,7 +973,11 @@ static ssize_t _xlat_eval(TALLOC_CTX *ctx, char **out, size_t outlen, REQUEST *r
 	}
 
 	len = _xlat_eval_compiled(ctx, out, outlen, request, node, escape, escape_ctx);
-	talloc_free(node);
+	if (cached) {
+		xlat_runtime_cache_release(cached);
+	} else {
+		talloc_free(node);
+	}
 
 	REXDENT();
 	RDEBUG2("--> %s", *out);
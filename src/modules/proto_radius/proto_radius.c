@@ -168,6 +168,7 @@ static int mod_decode(void const *instance, REQUEST *request, uint8_t *const dat
 {
 	proto_radius_t const *inst = talloc_get_type_abort(instance, proto_radius_t);
 	RADCLIENT *client;
+	size_t packet_len;
 
 	rad_assert(data[0] < FR_MAX_PACKET_CODE);
 
@@ -182,10 +183,22 @@ static int mod_decode(void const *instance, REQUEST *request, uint8_t *const dat
 	request->reply->id = data[1];
 	memcpy(request->packet->vector, data + 4, sizeof(request->packet->vector));
 
+	/*
+	 *	Transports which read several packets at once may
+	 *	leave padding after the packet.  The read routine
+	 *	has already checked the length.
+	 */
+	packet_len = (data[2] << 8) | data[3];
+	if (packet_len < data_len) data_len = packet_len;
+
 	request->packet->data = talloc_memdup(request->packet, data, data_len);
 	request->packet->data_len = data_len;
 
-	if (fr_radius_packet_decode(request->packet, NULL, client->secret) < 0) {
+	/*
+	 *	Octets attributes point into request->packet->data,
+	 *	which lives as long as the request does.
+	 */
+	if (fr_radius_packet_decode_borrow(request->packet, NULL, client->secret) < 0) {
 		RDEBUG("Failed decoding packet: %s", fr_strerror());
 		return -1;
 	}
@@ -211,7 +224,21 @@ static ssize_t mod_encode(void const *instance, REQUEST *request, uint8_t *buffe
 		return -1;
 	}
 
-	if (fr_radius_packet_sign(request->reply, request->packet, client->secret) < 0) {
+	/*
+	 *	The transport may calculate the Response
+	 *	Authenticators of many replies at once.  So leave
+	 *	that part of the signing to it.
+	 */
+	if (inst->app_io_private->reply_sign &&
+	    inst->app_io_private->reply_sign(inst->app_io_instance)) {
+		if (fr_radius_sign_start(request->reply->data, request->packet->data,
+					 (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1,
+					 client->hmac_key) < 0) {
+			RDEBUG("Failed signing RADIUS reply: %s", fr_strerror());
+			return -1;
+		}
+
+	} else if (fr_radius_packet_sign(request->reply, request->packet, client->secret, client->hmac_key) < 0) {
 		RDEBUG("Failed signing RADIUS reply: %s", fr_strerror());
 		return -1;
 	}
@@ -254,46 +281,87 @@ static void mod_process_set(void const *instance, REQUEST *request)
  */
 static int mod_open(void *instance, fr_schedule_t *sc, CONF_SECTION *conf)
 {
+	int		i, num_listen;
 	fr_listen_t	*listen;
+	void		**app_io_instance;
 	proto_radius_t 	*inst = talloc_get_type_abort(instance, proto_radius_t);
 
+	if (!inst->app_io) return 0;
+
 	/*
-	 *	Build the #fr_listen_t.  This describes the complete
-	 *	path, data takes from the socket to the decoder and
-	 *	back again.
+	 *	If the transport can be cloned, open one copy for
+	 *	each network thread.  The kernel then spreads the
+	 *	incoming packets across the sockets, and each
+	 *	network thread reads from its own socket.
 	 */
-	listen = talloc_zero(inst, fr_listen_t);
-
-	listen->app_io = inst->app_io;
-	listen->app_io_instance = inst->app_io_instance;
+	num_listen = 1;
+	if (inst->app_io->clone) num_listen = fr_schedule_num_networks(sc);
 
-	listen->app = &proto_radius;
-	listen->app_instance = instance;
-	listen->server_cs = inst->server_cs;
+	app_io_instance = talloc_zero_array(inst, void *, num_listen);
+	if (!app_io_instance) {
+		cf_log_err(conf, "Failed allocating memory");
+		return -1;
+	}
 
 	/*
-	 *	Set configurable parameters for message ring buffer.
+	 *	The clones MUST be created before the original is
+	 *	opened, as the original may need to be told that it
+	 *	will be sharing its address.
 	 */
-	listen->default_message_size = inst->default_message_size;
-	listen->num_messages = inst->default_message_size;
+	app_io_instance[0] = inst->app_io_instance;
+	for (i = 1; i < num_listen; i++) {
+		app_io_instance[i] = inst->app_io->clone(inst, inst->app_io_instance);
+		if (!app_io_instance[i]) {
+			cf_log_err(conf, "Failed cloning %s interface", inst->app_io->name);
+			talloc_free(app_io_instance);
+			return -1;
+		}
+	}
 
-	/*
-	 *	Open the socket, and add it to the scheduler.
-	 */
-	if (inst->app_io) {
-		if (inst->app_io->open(inst->app_io_instance) < 0) {
+	for (i = 0; i < num_listen; i++) {
+		/*
+		 *	Build the #fr_listen_t.  This describes the complete
+		 *	path, data takes from the socket to the decoder and
+		 *	back again.
+		 */
+		listen = talloc_zero(inst, fr_listen_t);
+
+		listen->app_io = inst->app_io;
+		listen->app_io_instance = app_io_instance[i];
+
+		listen->app = &proto_radius;
+		listen->app_instance = instance;
+		listen->server_cs = inst->server_cs;
+
+		/*
+		 *	Set configurable parameters for message ring buffer.
+		 */
+		listen->default_message_size = inst->default_message_size;
+		listen->num_messages = inst->num_messages;
+		if (inst->app_io_private->read_size) {
+			listen->read_size = inst->app_io_private->read_size(listen->app_io_instance);
+		}
+
+		/*
+		 *	Open the socket, and add it to the scheduler.
+		 */
+		if (inst->app_io->open(listen->app_io_instance) < 0) {
 			cf_log_err(conf, "Failed opening %s interface", inst->app_io->name);
 			talloc_free(listen);
+			talloc_free(app_io_instance);
 			return -1;
 		}
 
 		if (!fr_schedule_socket_add(sc, listen)) {
 			talloc_free(listen);
+			talloc_free(app_io_instance);
 			return -1;
 		}
+
+		if (i == 0) inst->listen = listen;	/* Probably won't need it, but doesn't hurt */
 	}
 
-	inst->listen = listen;	/* Probably won't need it, but doesn't hurt */
+	talloc_free(app_io_instance);
 
 	return 0;
 }
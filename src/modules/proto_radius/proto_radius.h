@@ -43,6 +43,24 @@ typedef RADCLIENT *(*proto_radius_client_get_t)(void const *instance, void const
 typedef int (*proto_radius_addr_get_t)(fr_socket_addr_t *sockaddr,
 				       void const *instance, void const *packet_ctx);
 
+/** Get how much buffer the #fr_app_io_t module wants for each read
+ *
+ * @param[in] instance		#fr_app_io_t instance.
+ * @return the size of the buffer.
+ */
+typedef size_t (*proto_radius_read_size_t)(void const *instance);
+
+/** Ask the #fr_app_io_t module whether it calculates the Response Authenticator
+ *
+ * If so, replies are passed to the #fr_app_io_t write() function with
+ * the Message-Authenticator done, and the original Request Authenticator
+ * where the Response Authenticator goes.  See #fr_radius_sign_start.
+ *
+ * @param[in] instance		#fr_app_io_t instance.
+ * @return whether the #fr_app_io_t module signs the replies.
+ */
+typedef bool (*proto_radius_reply_sign_t)(void const *instance);
+
 /** Semi-private functions exported by proto_radius #fr_app_io_t modules
  *
  * Should only be used by the proto_radius module, and submodules.
@@ -53,6 +71,12 @@ typedef struct {
 
 	proto_radius_addr_get_t		src;				//!< Retrieve the src address of the packet.
 	proto_radius_addr_get_t		dst;				//!< Retrieve the dst address of the packet.
+
+	proto_radius_read_size_t	read_size;			//!< How much buffer to give each read.
+									///< May be NULL.
+
+	proto_radius_reply_sign_t	reply_sign;			//!< Whether the transport calculates the
+									///< Response Authenticator.  May be NULL.
 } proto_radius_app_io_t;
 
 /** An instance of a proto_radius listen section
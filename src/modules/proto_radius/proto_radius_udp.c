@@ -26,6 +26,8 @@
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/protocol.h>
 #include <freeradius-devel/udp.h>
+#include <freeradius-devel/net.h>
+#include <freeradius-devel/md5.h>
 #include <freeradius-devel/radius/radius.h>
 #include <freeradius-devel/io/io.h>
 #include <freeradius-devel/io/application.h>
@@ -34,6 +36,13 @@
 #include <freeradius-devel/rad_assert.h>
 #include "proto_radius.h"
 
+/*
+ *	Extra space after each packet of a batch, so that the shared
+ *	secret can be appended to the packet when verifying or signing
+ *	the batch.  Longer secrets are handled one packet at a time.
+ */
+#define UDP_RECV_SECRET_ROOM	(64)
+
 typedef struct {
 	int				if_index;
 
@@ -47,6 +56,28 @@ typedef struct {
 	RADCLIENT			*client;
 } proto_radius_udp_address_t;
 
+/** State for batched reads and writes
+ *
+ */
+typedef struct {
+	udp_batch_entry_t		*recv;			//!< Packets read by one call to udp_recv_batch().
+	int				recv_num;		//!< Number of packets in the recv array.
+	int				recv_next;		//!< Next packet to give to the network.
+	size_t				stride;			//!< Distance between packets in the network's buffer.
+	bool				*verified;		//!< Per packet, whether mod_verify_batch() has
+								//!< checked the Request Authenticator.
+	RADCLIENT			**client;		//!< Per packet, the client it came from, so
+								//!< mod_read() doesn't look it up again.
+
+	udp_batch_entry_t		*send;			//!< Replies waiting for udp_send_batch().
+	int				send_num;		//!< Number of replies in the send array.
+	size_t				*secret_len;		//!< Per reply, the length of the secret
+								//!< after it.
+	uint8_t				**reply;		//!< Per reply, the copy in the tracking table
+								//!< (if any), which needs the same Response
+								//!< Authenticator.
+} proto_radius_udp_batch_t;
+
 typedef struct {
 	proto_radius_t	const		*parent;		//!< The module that spawned us!
 
@@ -68,8 +99,14 @@ typedef struct {
 	bool				recv_buff_is_set;	//!< Whether we were provided with a receive
 								//!< buffer value.
 
+	bool				reuse_port;		//!< Set SO_REUSEPORT, as other instances
+								//!< are listening on the same address.
+
 	fr_tracking_t			*ft;			//!< tracking table
 	uint32_t			cleanup_delay;		//!< cleanup delay for Access-Request packets
+
+	uint32_t			batch_size;		//!< How many packets to read / write per system call.
+	proto_radius_udp_batch_t	*batch;			//!< Batched read / write state.
 } proto_radius_udp_t;
 
 static const CONF_PARSER udp_listen_config[] = {
@@ -84,6 +121,7 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_IS_SET_OFFSET("recv_buff", FR_TYPE_UINT32, proto_radius_udp_t, recv_buff) },
 
 	{ FR_CONF_OFFSET("cleanup_delay", FR_TYPE_UINT32, proto_radius_udp_t, cleanup_delay), .dflt = "5" },
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, proto_radius_udp_t, batch_size), .dflt = "1" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -172,6 +210,223 @@ static int mod_decode(UNUSED void const *instance, REQUEST *request, UNUSED uint
 	return 0;
 }
 
+/** Check the Request Authenticators of a batch of packets together
+ *
+ * Accounting-Request, CoA-Request and Disconnect-Request packets are signed
+ * with the MD5 hash of the packet and the shared secret.  When a batch holds
+ * several of them, hashing them with fr_md5_calc_multi() is much cheaper
+ * than calling fr_radius_verify() for each one.
+ *
+ * Only packets which pass are marked as verified.  Everything else,
+ * including packets with a Message-Authenticator, is left to
+ * fr_radius_verify(), so the usual checks are done and the usual errors
+ * are produced.
+ *
+ * The client of every packet is looked up here, and saved for mod_read().
+ *
+ * @param[in] inst		of the RADIUS UDP I/O path.
+ */
+static void mod_verify_batch(proto_radius_udp_t const *inst)
+{
+	proto_radius_udp_batch_t	*batch = inst->batch;
+	uint8_t const			*in[FR_MD5_LANES];
+	size_t				inlen[FR_MD5_LANES];
+	uint8_t				*out[FR_MD5_LANES];
+	uint8_t				digest[FR_MD5_LANES][MD5_DIGEST_LENGTH];
+	uint8_t				vector[FR_MD5_LANES][AUTH_VECTOR_LEN];
+	int				index[FR_MD5_LANES];
+	int				i = 0, j, num;
+
+	while (i < batch->recv_num) {
+		for (num = 0; (i < batch->recv_num) && (num < FR_MD5_LANES); i++) {
+			udp_batch_entry_t	*entry = &batch->recv[i];
+			uint8_t			*attr, *end;
+			size_t			packet_len, secret_len;
+			RADCLIENT		*client;
+
+			batch->verified[i] = false;
+			batch->client[i] = NULL;
+
+			if (entry->data_len < RADIUS_HDR_LEN) continue;
+
+			client = batch->client[i] = client_find(NULL, &entry->src_ipaddr, IPPROTO_UDP);
+			if (!client) continue;
+
+			switch (entry->data[0]) {
+			case FR_CODE_ACCOUNTING_REQUEST:
+			case FR_CODE_COA_REQUEST:
+			case FR_CODE_DISCONNECT_REQUEST:
+				break;
+
+			default:
+				continue;
+			}
+
+			packet_len = (entry->data[2] << 8) | entry->data[3];
+			if ((packet_len < RADIUS_HDR_LEN) || (packet_len > entry->data_len)) continue;
+
+			/*
+			 *	Message-Authenticator has to be checked
+			 *	before the Request Authenticator, so
+			 *	leave those packets (and malformed ones)
+			 *	to fr_radius_verify().
+			 */
+			end = entry->data + packet_len;
+			for (attr = entry->data + RADIUS_HDR_LEN; attr < end; attr += attr[1]) {
+				if (((end - attr) < 2) || (attr[1] < 2) || (attr[0] == FR_MESSAGE_AUTHENTICATOR)) break;
+			}
+			if (attr != end) continue;
+
+			secret_len = talloc_array_length(client->secret) - 1;
+			if ((packet_len + secret_len) > batch->stride) continue;
+
+			/*
+			 *	Hash the packet in place, with a zero
+			 *	Request Authenticator and the secret
+			 *	appended.  The authenticator is put back
+			 *	afterwards.
+			 */
+			memcpy(vector[num], entry->data + 4, AUTH_VECTOR_LEN);
+			memset(entry->data + 4, 0, AUTH_VECTOR_LEN);
+			memcpy(entry->data + packet_len, client->secret, secret_len);
+
+			in[num] = entry->data;
+			inlen[num] = packet_len + secret_len;
+			out[num] = digest[num];
+			index[num] = i;
+			num++;
+		}
+
+		if (!num) break;
+
+		fr_md5_calc_multi(out, in, inlen, num);
+
+		/*
+		 *	The padding after the packet goes to the
+		 *	worker, so don't leave the secret in it.
+		 */
+		for (j = 0; j < num; j++) {
+			size_t secret_len = talloc_array_length(batch->client[index[j]]->secret) - 1;
+
+			memcpy(batch->recv[index[j]].data + 4, vector[j], AUTH_VECTOR_LEN);
+			memset(batch->recv[index[j]].data + inlen[j] - secret_len, 0, secret_len);
+			batch->verified[index[j]] = (fr_digest_cmp(digest[j], vector[j], AUTH_VECTOR_LEN) == 0);
+		}
+	}
+}
+
+/** Drop the packet at the start of the buffer, and move the last packet of the batch into its place
+ *
+ * This is the only time packets from a batch are copied.
+ *
+ * @param[in] batch		the current batch.
+ * @param[in] buffer		holding the rest of the batch.
+ * @return
+ *	- true if there are more packets in the batch.
+ *	- false if the batch is finished.
+ */
+static bool mod_batch_drop(proto_radius_udp_batch_t *batch, uint8_t *buffer)
+{
+	int last = batch->recv_num - 1;
+
+	if (batch->recv_next >= last) {
+		batch->recv_num = batch->recv_next = 0;
+		return false;
+	}
+
+	memcpy(buffer, buffer + ((last - batch->recv_next) * batch->stride), batch->recv[last].data_len);
+
+	batch->recv[batch->recv_next] = batch->recv[last];
+	batch->recv[batch->recv_next].data = buffer;
+	batch->verified[batch->recv_next] = batch->verified[last];
+	batch->client[batch->recv_next] = batch->client[last];
+	batch->recv_num = last;
+
+	return true;
+}
+
+/** Get the next packet from the current batch, reading a new batch if necessary
+ *
+ * A batch is read straight into the network's buffer, with a packet
+ * every batch->stride bytes.  The next packet to give to the network
+ * is always at the start of the buffer, as mod_read() tells the network
+ * to keep the rest of the batch as leftover data.
+ *
+ * @param[in] inst		of the RADIUS UDP I/O path.
+ * @param[in] buffer		the network's buffer.
+ * @param[in] buffer_len	the length of the buffer.
+ * @param[out] address		the src/dst ip/port and client of the packet.
+ * @param[out] verified		whether mod_verify_batch() has already checked the packet.
+ * @return
+ *	- <0 on error
+ *	- 0 no more packets
+ *	- >0 the length of the packet.
+ */
+static ssize_t mod_read_batch(proto_radius_udp_t const *inst, uint8_t *buffer, size_t buffer_len,
+			      proto_radius_udp_address_t *address, bool *verified)
+{
+	proto_radius_udp_batch_t	*batch = inst->batch;
+	udp_batch_entry_t		*entry;
+	int				i, num;
+
+	if (!batch->recv_num) {
+		num = buffer_len / batch->stride;
+		if (num > (int) inst->batch_size) num = inst->batch_size;
+
+		/*
+		 *	Not enough room for a batch.  Read one
+		 *	packet, which mod_verify_batch() doesn't
+		 *	look at.
+		 */
+		if (num < 1) {
+			num = 1;
+			batch->recv[0].data = buffer;
+			batch->recv[0].data_len = buffer_len;
+		} else {
+			for (i = 0; i < num; i++) {
+				batch->recv[i].data = buffer + (i * batch->stride);
+				batch->recv[i].data_len = inst->parent->default_message_size;
+			}
+		}
+
+		num = udp_recv_batch(inst->sockfd, batch->recv, num);
+		if (num <= 0) return num;
+
+		batch->recv_num = num;
+		batch->recv_next = 0;
+
+		if (num > 1) {
+			mod_verify_batch(inst);
+		} else {
+			batch->verified[0] = false;
+			batch->client[0] = NULL;
+			if (batch->recv[0].data_len >= RADIUS_HDR_LEN) {
+				batch->client[0] = client_find(NULL, &batch->recv[0].src_ipaddr, IPPROTO_UDP);
+			}
+		}
+	}
+
+	/*
+	 *	Bad address family.  Skip it.
+	 */
+	while (!batch->recv[batch->recv_next].data_len) {
+		if (!mod_batch_drop(batch, buffer)) return 0;
+	}
+
+	entry = &batch->recv[batch->recv_next];
+
+	address->src_ipaddr = entry->src_ipaddr;
+	address->src_port = entry->src_port;
+	address->dst_ipaddr = entry->dst_ipaddr;
+	address->dst_port = entry->dst_port;
+	address->if_index = entry->if_index;
+	address->client = batch->client[batch->recv_next];
+
+	*verified = batch->verified[batch->recv_next];
+
+	return entry->data_len;
+}
+
 static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover)
 {
 	proto_radius_udp_t const	*inst = talloc_get_type_abort(instance, proto_radius_udp_t);
@@ -184,13 +439,26 @@ static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **rec
 	fr_tracking_status_t		tracking_status;
 	fr_tracking_entry_t		*track;
 	proto_radius_udp_address_t	address;
+	bool				verified = false;
+
+	/*
+	 *	The rest of a batch is at the start of the buffer,
+	 *	unless the network couldn't keep it.
+	 */
+	if (inst->batch && !*leftover) inst->batch->recv_num = inst->batch->recv_next = 0;
 
 	*leftover = 0;
 
-	data_size = udp_recv(inst->sockfd, buffer, buffer_len, 0,
-			     &address.src_ipaddr, &address.src_port,
-			     &address.dst_ipaddr, &address.dst_port,
-			     &address.if_index, &timestamp);
+redo:
+	if (inst->batch) {
+		data_size = mod_read_batch(inst, buffer, buffer_len, &address, &verified);
+	} else {
+		data_size = udp_recv(inst->sockfd, buffer, buffer_len, 0,
+				     &address.src_ipaddr, &address.src_port,
+				     &address.dst_ipaddr, &address.dst_port,
+				     &address.if_index, &timestamp);
+		if ((data_size < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) return 0;
+	}
 	if (data_size <= 0) return data_size;
 
 	packet_len = data_size;
@@ -198,28 +466,32 @@ static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **rec
 	/*
 	 *	If it's not a RADIUS packet, ignore it.
 	 */
-	if (!fr_radius_ok(buffer, &packet_len, false, &reason)) return 0;
+	if (!fr_radius_ok(buffer, &packet_len, false, &reason)) goto ignore;
 
 	address.timestamp = fr_time();
 
 	/*
-	 *	Lookup the client - Must exist to continue.
+	 *	Lookup the client - Must exist to continue.  Packets
+	 *	from a batch have already been looked up.
 	 */
-	address.client = client_find(NULL, &address.src_ipaddr, IPPROTO_UDP);
+	if (!inst->batch) address.client = client_find(NULL, &address.src_ipaddr, IPPROTO_UDP);
 	if (!address.client) {
 		ERROR("Unknown client at address %pV:%u.  Ignoring...",
 		      fr_box_ipaddr(address.src_ipaddr), address.src_port);
 
-		return 0;
+		goto ignore;
 	}
 
 	/*
-	 *	If the signature fails validation, ignore it.
+	 *	If the signature fails validation, ignore it.  Packets
+	 *	from a batch may already have been checked.
 	 */
-	if (fr_radius_verify(buffer, NULL,
-			     (uint8_t const *)address.client->secret,
-			     talloc_array_length(address.client->secret)) < 0) {
-		return 0;
+	if (!verified &&
+	    (fr_radius_verify(buffer, NULL,
+			      (uint8_t const *)address.client->secret,
+			      talloc_array_length(address.client->secret) - 1,
+			      address.client->hmac_key) < 0)) {
+		goto ignore;
 	}
 
 	tracking_status = fr_radius_tracking_entry_insert(&track, inst->ft, buffer, address.timestamp, &address);
@@ -236,13 +508,9 @@ static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **rec
 		 */
 	case FR_TRACKING_SAME:
 		if (track->ev) {
-			struct timeval tv;
-
-			gettimeofday(&tv, NULL);
-			tv.tv_sec += inst->cleanup_delay;
-
-			(void) fr_event_timer_insert(NULL, inst->el, &track->ev,
-						     &tv, mod_cleanup_delay, track);
+			(void) fr_event_timer_at(NULL, inst->el, &track->ev,
+						 address.timestamp + ((fr_time_t) inst->cleanup_delay * NANOSEC),
+						 mod_cleanup_delay, track);
 		}
 
 		/*
@@ -254,7 +522,7 @@ static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **rec
 		 *	is very hard, so we might as well just ignore
 		 *	it.
 		 */
-		return 0;
+		goto ignore;
 
 	/*
 	 *	Delete any pre-existing cleanup_delay timers.
@@ -270,7 +538,175 @@ static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **rec
 	*packet_ctx = track;
 	*recv_time = &track->timestamp;
 
+	/*
+	 *	Give the network this packet and the padding after
+	 *	it, and tell it to keep the rest of the batch.
+	 *	mod_decode() trims the padding.
+	 */
+	if (inst->batch) {
+		proto_radius_udp_batch_t *batch = inst->batch;
+
+		if (++batch->recv_next < batch->recv_num) {
+			*leftover = (batch->recv_num - batch->recv_next) * batch->stride;
+			return batch->stride;
+		}
+
+		batch->recv_num = batch->recv_next = 0;
+	}
+
 	return packet_len;
+
+ignore:
+	/*
+	 *	Returning 0 tells the network to stop reading.  So
+	 *	if there are more packets in the batch, go get them.
+	 */
+	if (inst->batch && mod_batch_drop(inst->batch, buffer)) goto redo;
+
+	return 0;
+}
+
+/** Calculate the Response Authenticator of a reply which can't be batched
+ *
+ * @param[in] buffer		the reply packet.
+ * @param[in] buffer_len	the length of the reply packet.
+ * @param[in] client		the reply is going to.
+ * @param[in] reply		the copy in the tracking table, or NULL.
+ */
+static void mod_reply_sign_one(uint8_t *buffer, size_t buffer_len, RADCLIENT const *client, uint8_t *reply)
+{
+	FR_MD5_CTX	context;
+
+	fr_md5_init(&context);
+	fr_md5_update(&context, buffer, buffer_len);
+	fr_md5_update(&context, (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1);
+	fr_md5_final(buffer + 4, &context);
+
+	if (reply) memcpy(reply + 4, buffer + 4, AUTH_VECTOR_LEN);
+}
+
+/** Sign and send all of the queued replies
+ *
+ * The Response Authenticators of the replies are calculated together,
+ * with fr_md5_calc_multi().
+ *
+ * @param[in] instance of the RADIUS UDP I/O path.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int mod_flush(void const *instance)
+{
+	proto_radius_udp_t const	*inst = talloc_get_type_abort(instance, proto_radius_udp_t);
+	proto_radius_udp_batch_t	*batch = inst->batch;
+	uint8_t const			*in[FR_MD5_LANES];
+	size_t				inlen[FR_MD5_LANES];
+	uint8_t				*out[FR_MD5_LANES];
+	uint8_t				digest[FR_MD5_LANES][MD5_DIGEST_LENGTH];
+	int				i, j, num, sent;
+
+	if (!batch || !batch->send_num) return 0;
+
+	/*
+	 *	Each reply has the shared secret after it, see
+	 *	mod_write_batch().
+	 */
+	for (i = 0; i < batch->send_num; i += num) {
+		num = batch->send_num - i;
+		if (num > FR_MD5_LANES) num = FR_MD5_LANES;
+
+		for (j = 0; j < num; j++) {
+			in[j] = batch->send[i + j].data;
+			inlen[j] = batch->send[i + j].data_len + batch->secret_len[i + j];
+			out[j] = digest[j];
+		}
+
+		fr_md5_calc_multi(out, in, inlen, num);
+
+		for (j = 0; j < num; j++) {
+			udp_batch_entry_t *entry = &batch->send[i + j];
+
+			memcpy(entry->data + 4, digest[j], AUTH_VECTOR_LEN);
+			memset(entry->data + entry->data_len, 0, batch->secret_len[i + j]);
+
+			if (batch->reply[i + j]) memcpy(batch->reply[i + j] + 4, digest[j], AUTH_VECTOR_LEN);
+		}
+	}
+
+	sent = udp_send_batch(inst->sockfd, batch->send, batch->send_num);
+	if (sent < batch->send_num) {
+		/*
+		 *	UDP is lossy.  The client will retransmit,
+		 *	and we'll reply from the tracking table.
+		 */
+		DEBUG("Failed sending %d of %d replies: %s",
+		      batch->send_num - ((sent < 0) ? 0 : sent), batch->send_num, fr_strerror());
+	}
+	batch->send_num = 0;
+
+	return 0;
+}
+
+/** Queue a reply, to be sent by mod_flush()
+ *
+ *  The network calls mod_flush() after it has written all of the
+ *  pending replies, so the replies are signed together, and sent
+ *  with one system call.
+ *
+ *  The worker has left the Response Authenticator to us, see
+ *  mod_reply_sign().
+ *
+ * @param[in] inst		of the RADIUS UDP I/O path.
+ * @param[in] buffer		the reply packet.
+ * @param[in] buffer_len	the length of the reply packet.
+ * @param[in] address		the src/dst ip/port and client of the original request.
+ * @param[in] reply		the copy of the reply in the tracking table, or NULL.
+ * @return the amount of data we've taken.
+ */
+static ssize_t mod_write_batch(proto_radius_udp_t const *inst, uint8_t *buffer, size_t buffer_len,
+			       proto_radius_udp_address_t *address, uint8_t *reply)
+{
+	proto_radius_udp_batch_t	*batch = inst->batch;
+	udp_batch_entry_t		*entry;
+	size_t				secret_len = talloc_array_length(address->client->secret) - 1;
+
+	/*
+	 *	Too large to queue, or the secret doesn't fit after
+	 *	it.  Sign it and send it now.
+	 */
+	if ((buffer_len > inst->parent->default_message_size) || (secret_len > UDP_RECV_SECRET_ROOM)) {
+		mod_reply_sign_one(buffer, buffer_len, address->client, reply);
+
+		return udp_send(inst->sockfd, buffer, buffer_len, 0,
+				&address->dst_ipaddr, address->dst_port,
+				address->if_index,
+				&address->src_ipaddr, address->src_port);
+	}
+
+	if (batch->send_num >= (int) inst->batch_size) (void) mod_flush(inst);
+
+	/*
+	 *	The reply is sent from the original dst address, to
+	 *	the original src address.  The caller frees the buffer
+	 *	(and maybe the tracking entry) as soon as we return, so
+	 *	we have to copy everything.
+	 */
+	batch->secret_len[batch->send_num] = secret_len;
+	batch->reply[batch->send_num] = reply;
+
+	entry = &batch->send[batch->send_num++];
+	memcpy(entry->data, buffer, buffer_len);
+	memcpy(entry->data + buffer_len, address->client->secret, secret_len);
+	entry->data_len = buffer_len;
+	entry->src_ipaddr = address->dst_ipaddr;
+	entry->src_port = address->dst_port;
+	entry->dst_ipaddr = address->src_ipaddr;
+	entry->dst_port = address->src_port;
+	entry->if_index = address->if_index;
+
+	if (batch->send_num >= (int) inst->batch_size) (void) mod_flush(inst);
+
+	return buffer_len;
 }
 
 static ssize_t mod_write(void const *instance, void *packet_ctx,
@@ -282,7 +718,7 @@ static ssize_t mod_write(void const *instance, void *packet_ctx,
 
 	ssize_t				data_size;
 	fr_time_t			reply_time;
-	struct timeval			tv;
+	bool				keep;
 
 	/*
 	 *	The original packet has changed.  Suppress the write,
@@ -295,11 +731,37 @@ static ssize_t mod_write(void const *instance, void *packet_ctx,
 	 */
 	 reply_time = fr_time();
 
+	/*
+	 *	Most packets are cleaned up immediately.  Also, if
+	 *	cleanup_delay = 0, then we even clean up
+	 *	Access-Request packets immediately.
+	 *
+	 *	Otherwise, add the reply to the tracking entry, and
+	 *	clean up after a while.  This is done before sending
+	 *	the reply, as batched replies are only signed when
+	 *	they're flushed, and the copy has to be signed, too.
+	 */
+	keep = (track->data[0] == FR_CODE_ACCESS_REQUEST) && inst->el;
+	if (keep &&
+	    ((fr_radius_tracking_entry_reply(inst->ft, track, reply_time, buffer, buffer_len) < 0) ||
+	     (fr_event_timer_at(NULL, inst->el, &track->ev,
+				reply_time + ((fr_time_t) inst->cleanup_delay * NANOSEC),
+				mod_cleanup_delay, track) < 0))) {
+		keep = false;
+	}
+
 	/*
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
 	 */
-	if (buffer_len >= 20) {
+	if ((buffer_len >= 20) && inst->batch) {
+		uint8_t *reply = NULL;
+
+		if (keep) memcpy(&reply, &track->reply, sizeof(reply)); /* const issues */
+
+		data_size = mod_write_batch(inst, buffer, buffer_len, address, reply);
+
+	} else if (buffer_len >= 20) {
 		data_size = udp_send(inst->sockfd, buffer, buffer_len, 0,
 				     &address->dst_ipaddr, address->dst_port,
 				     address->if_index,
@@ -311,40 +773,7 @@ static ssize_t mod_write(void const *instance, void *packet_ctx,
 		data_size = buffer_len;
 	}
 
-	/*
-	 *	Most packets are cleaned up immediately.  Also, if
-	 *	cleanup_delay = 0, then we even clean up
-	 *	Access-Request packets immediately.
-	 */
-	 if ((track->data[0] != FR_CODE_ACCESS_REQUEST) || !inst->el) {
-		(void) fr_radius_tracking_entry_delete(inst->ft, track);
-		return data_size;
-	}
-
-	 /*
-	  *	Add the reply to the tracking entry.
-	  */
-	 if (fr_radius_tracking_entry_reply(inst->ft, track, reply_time,
-					    buffer, buffer_len) < 0) {
-		(void) fr_radius_tracking_entry_delete(inst->ft, track);
-		return data_size;
-	 }
-
-	 /*
-	  *	@todo - Move event timers to fr_time_t
-	  */
-	 gettimeofday(&tv, NULL);
-
-	 tv.tv_sec += inst->cleanup_delay;
-
-	 /*
-	  *	Clean up after a while.
-	  */
-	 if (fr_event_timer_insert(NULL, inst->el, &track->ev,
-	 			   &tv, mod_cleanup_delay, track) < 0) {
-		(void) fr_radius_tracking_entry_delete(inst->ft, track);
-		return data_size;
-	 }
+	if (!keep) (void) fr_radius_tracking_entry_delete(inst->ft, track);
 
 	return data_size;
 }
@@ -370,6 +799,25 @@ static int mod_open(void *instance)
 		return -1;
 	}
 
+#ifdef SO_REUSEPORT
+	/*
+	 *	Multiple network threads each have their own socket
+	 *	bound to the same address.  The kernel hashes the
+	 *	src/dst ip/port, so all packets from one client port
+	 *	go to the same socket, and therefore hit the same
+	 *	tracking table.
+	 */
+	if (inst->reuse_port) {
+		int on = 1;
+
+		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			ERROR("Failed setting SO_REUSEPORT: %s", fr_syserror(errno));
+			close(sockfd);
+			goto error;
+		}
+	}
+#endif
+
 	if (fr_socket_bind(sockfd, &inst->ipaddr, &port, inst->interface) < 0) {
 		ERROR("Failed binding socket: %s", fr_strerror());
 		goto error;
@@ -377,9 +825,96 @@ static int mod_open(void *instance)
 
 	inst->sockfd = sockfd;
 
+	/*
+	 *	Allocate buffers for batched reads and writes.
+	 */
+	if (inst->batch_size > 1) {
+		uint32_t i;
+		proto_radius_udp_batch_t *batch;
+
+		batch = talloc_zero(inst, proto_radius_udp_batch_t);
+		if (!batch) {
+		nomem:
+			ERROR("Failed allocating memory");
+			close(sockfd);
+			inst->sockfd = -1;
+			goto error;
+		}
+
+		batch->recv = talloc_zero_array(batch, udp_batch_entry_t, inst->batch_size);
+		batch->send = talloc_zero_array(batch, udp_batch_entry_t, inst->batch_size);
+		batch->verified = talloc_zero_array(batch, bool, inst->batch_size);
+		batch->client = talloc_zero_array(batch, RADCLIENT *, inst->batch_size);
+		batch->secret_len = talloc_zero_array(batch, size_t, inst->batch_size);
+		batch->reply = talloc_zero_array(batch, uint8_t *, inst->batch_size);
+		if (!batch->recv || !batch->send || !batch->verified || !batch->client ||
+		    !batch->secret_len || !batch->reply) {
+			talloc_free(batch);
+			goto nomem;
+		}
+
+		/*
+		 *	Packets are read into the network's buffer,
+		 *	see mod_read_size().  Replies are copied into
+		 *	our own buffers, with room for the secret.
+		 */
+		batch->stride = inst->parent->default_message_size + UDP_RECV_SECRET_ROOM;
+
+		for (i = 0; i < inst->batch_size; i++) {
+			batch->send[i].data = talloc_array(batch, uint8_t, batch->stride);
+			if (!batch->send[i].data) {
+				talloc_free(batch);
+				goto nomem;
+			}
+		}
+
+		inst->batch = batch;
+	}
+
 	return 0;
 }
 
+#ifdef SO_REUSEPORT
+/** Clone a UDP listener for use by another network thread
+ *
+ *  The clone shares the configuration of the original, but has its
+ *  own socket and tracking table.
+ *
+ * @param[in] ctx to allocate the clone in.
+ * @param[in] instance of the RADIUS UDP I/O path.
+ * @return
+ *	- NULL on error
+ *	- the new instance
+ */
+static void *mod_clone(TALLOC_CTX *ctx, void *instance)
+{
+	proto_radius_udp_t *inst = talloc_get_type_abort(instance, proto_radius_udp_t);
+	proto_radius_udp_t *clone;
+
+	clone = talloc_memdup(ctx, inst, sizeof(*inst));
+	if (!clone) return NULL;
+	talloc_set_type(clone, proto_radius_udp_t);
+
+	clone->sockfd = -1;
+	clone->el = NULL;
+	clone->batch = NULL;
+
+	clone->ft = fr_radius_tracking_create(clone, sizeof(proto_radius_udp_address_t), inst->parent->code_allowed);
+	if (!clone->ft) {
+		talloc_free(clone);
+		return NULL;
+	}
+
+	/*
+	 *	Both sockets have to set SO_REUSEPORT before binding.
+	 */
+	inst->reuse_port = true;
+	clone->reuse_port = true;
+
+	return clone;
+}
+#endif
+
 /** Get the file descriptor for this socket.
  *
  * @param[in] instance of the RADIUS UDP I/O path.
@@ -457,6 +992,13 @@ static int mod_instantiate(void *instance, CONF_SECTION *cs)
 
 	FR_INTEGER_BOUND_CHECK("cleanup_delay", inst->cleanup_delay, <=, 30);
 
+	/*
+	 *	The network reads at most 128 packets per event, and
+	 *	we need to tell it when each batch is done.
+	 */
+	FR_INTEGER_BOUND_CHECK("batch_size", inst->batch_size, >=, 1);
+	FR_INTEGER_BOUND_CHECK("batch_size", inst->batch_size, <=, 64);
+
 	inst->ft = fr_radius_tracking_create(inst, sizeof(proto_radius_udp_address_t), inst->parent->code_allowed);
 	if (!inst->ft) {
 		cf_log_err(cs, "Failed to create tracking table: %s", fr_strerror());
@@ -498,6 +1040,30 @@ static int mod_detach(void *instance)
 }
 
 
+/** Ask the network for enough buffer to read a whole batch
+ *
+ */
+static size_t mod_read_size(void const *instance)
+{
+	proto_radius_udp_t const *inst = talloc_get_type_abort(instance, proto_radius_udp_t);
+
+	if (inst->batch_size <= 1) return inst->parent->default_message_size;
+
+	return inst->batch_size * (inst->parent->default_message_size + UDP_RECV_SECRET_ROOM);
+}
+
+/** Replies are signed by mod_flush(), when we're batching them
+ *
+ * This is called from the worker, so it only looks at the
+ * configuration.
+ */
+static bool mod_reply_sign(void const *instance)
+{
+	proto_radius_udp_t const *inst = talloc_get_type_abort(instance, proto_radius_udp_t);
+
+	return (inst->batch_size > 1);
+}
+
 /** Private interface for use by proto_radius
  *
  */
@@ -505,7 +1071,9 @@ extern proto_radius_app_io_t proto_radius_app_io_private;
 proto_radius_app_io_t proto_radius_app_io_private = {
 	.client			= mod_client,
 	.src			= mod_src_address,
-	.dst			= mod_dst_address
+	.dst			= mod_dst_address,
+	.read_size		= mod_read_size,
+	.reply_sign		= mod_reply_sign
 };
 
 extern fr_app_io_t proto_radius_udp;
@@ -520,9 +1088,13 @@ fr_app_io_t proto_radius_udp = {
 
 	.default_message_size	= 4096,
 	.open			= mod_open,
+#ifdef SO_REUSEPORT
+	.clone			= mod_clone,
+#endif
 	.read			= mod_read,
 	.decode			= mod_decode,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd			= mod_fd,
 	.event_list_set		= mod_event_list_set,
 };
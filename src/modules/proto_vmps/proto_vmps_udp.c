@@ -162,6 +162,7 @@ static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **rec
 			     &ip->src_ipaddr, &ip->src_port,
 			     &ip->dst_ipaddr, &ip->dst_port,
 			     &ip->if_index, &timestamp);
+	if ((data_size < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) return 0;
 	if (data_size <= 0) return data_size;
 
 	packet_len = data_size;
@@ -0,0 +1,577 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_sharded.c
+ * @brief In memory cache, split into independently locked shards.
+ *
+ * Entries are distributed across shards by a hash of their key.  Each shard
+ * has its own mutex, hash table, timer wheel for expiry, and CLOCK list for
+ * evicting entries when the shard exceeds its share of max_memory.
+ *
+ * The cache API only gives us a key once a handle has been acquired, so the
+ * handle records which shard (if any) is locked, and the lock is taken by
+ * the first operation that provides a key.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/io/time.h>
+#include "../../rlm_cache.h"
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+/*
+ *	Number of slots in each shard's timer wheel.  Entries expiring
+ *	more than this many seconds in the future share slots, and are
+ *	skipped over until their expiry time comes around.
+ */
+#define CACHE_WHEEL_SLOTS	(256)
+
+#define CACHE_MAX_SHARDS	(256)
+
+typedef struct rlm_cache_sharded_entry {
+	rlm_cache_entry_t	fields;		//!< Entry data.  Must be first.
+	size_t			size;		//!< Memory used by the entry when it was inserted.
+	bool			referenced;	//!< Set when the entry is found, cleared by the CLOCK hand.
+	fr_dlist_t		wheel_entry;	//!< Entry in a timer wheel slot.
+	fr_dlist_t		clock_entry;	//!< Entry in the CLOCK list.
+} rlm_cache_sharded_entry_t;
+
+typedef struct cache_shard {
+	pthread_mutex_t		mutex;		//!< Protects everything in the shard.
+
+	fr_hash_table_t		*cache;		//!< Hash table for looking up cache keys.
+
+	fr_dlist_t		wheel[CACHE_WHEEL_SLOTS];	//!< Entries, by expiry time.
+	time_t			wheel_time;	//!< Slots for times before this have been processed.
+
+	fr_dlist_t		clock;		//!< Entries in eviction order.  The head is the CLOCK hand.
+	size_t			memory;		//!< Memory used by entries in this shard.
+} cache_shard_t;
+
+typedef struct rlm_cache_sharded {
+	uint32_t		num_shards;	//!< Number of shards.  Must be a power of 2.
+	size_t			max_memory;	//!< Maximum memory used by all entries.  0 is unlimited.
+
+	size_t			shard_max_memory;	//!< Maximum memory used by each shard.
+
+	cache_shard_t		*shards;	//!< Array of num_shards shards.
+	atomic_uint_fast32_t	*num_entries;	//!< Entries across all shards.
+} rlm_cache_sharded_t;
+
+/** Handle for a single cache operation
+ *
+ */
+typedef struct rlm_cache_sharded_handle {
+	rlm_cache_sharded_t	*driver;	//!< Instance we were acquired from.
+	cache_shard_t		*shard;		//!< Shard which is locked, or NULL if none.
+} rlm_cache_sharded_handle_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_cache_sharded_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("max_memory", FR_TYPE_SIZE, rlm_cache_sharded_t, max_memory), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Hash an entry by key
+ *
+ */
+static uint32_t cache_entry_hash(void const *data)
+{
+	rlm_cache_entry_t const *c = data;
+
+	return fr_hash(c->key, c->key_len);
+}
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Remove an entry from its shard
+ *
+ * @note Called with the shard mutex held.  The caller must free the entry.
+ */
+static void cache_shard_remove(rlm_cache_sharded_t *driver, cache_shard_t *shard, rlm_cache_sharded_entry_t *c)
+{
+	fr_hash_table_yank(shard->cache, c);
+	fr_dlist_remove(&c->wheel_entry);
+	fr_dlist_remove(&c->clock_entry);
+
+	shard->memory -= c->size;
+	atomic_fetch_sub_explicit(driver->num_entries, 1, memory_order_relaxed);
+}
+
+/** Expire entries from a shard
+ *
+ * Processes the timer wheel slots for every second between the last time
+ * the shard was processed and now.  Each slot is only visited once per
+ * revolution, so the amount of work done is bounded by #CACHE_WHEEL_SLOTS,
+ * no matter how many entries are in the shard.
+ *
+ * @note Called with the shard mutex held.
+ */
+static void cache_shard_expire(rlm_cache_sharded_t *driver, cache_shard_t *shard, time_t now)
+{
+	time_t t;
+
+	if (shard->wheel_time >= now) return;
+
+	t = shard->wheel_time;
+	if ((now - t) > CACHE_WHEEL_SLOTS) t = now - CACHE_WHEEL_SLOTS;
+
+	for (; t < now; t++) {
+		fr_dlist_t *slot = &shard->wheel[t % CACHE_WHEEL_SLOTS];
+		fr_dlist_t *entry, *next;
+
+		for (entry = slot->next; entry != slot; entry = next) {
+			rlm_cache_sharded_entry_t *c = fr_ptr_to_type(rlm_cache_sharded_entry_t, wheel_entry, entry);
+
+			next = entry->next;
+
+			if (c->fields.expires >= now) continue;
+
+			cache_shard_remove(driver, shard, c);
+			talloc_free(c);
+		}
+	}
+
+	shard->wheel_time = now;
+}
+
+/** Evict entries from a shard until there's room for a new one
+ *
+ * Uses the CLOCK algorithm.  Entries which have been found since the hand
+ * last passed them get a second chance, and are moved to the back of the
+ * list.  Other entries are evicted.
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @return the number of entries evicted.
+ */
+static int cache_shard_evict(rlm_cache_sharded_t *driver, cache_shard_t *shard, size_t needed)
+{
+	int evicted = 0;
+
+	while ((shard->memory + needed) > driver->shard_max_memory) {
+		rlm_cache_sharded_entry_t	*c;
+		fr_dlist_t			*hand;
+
+		hand = FR_DLIST_FIRST(shard->clock);
+		if (!hand) break;
+
+		c = fr_ptr_to_type(rlm_cache_sharded_entry_t, clock_entry, hand);
+		if (c->referenced) {
+			c->referenced = false;
+			fr_dlist_remove(hand);
+			fr_dlist_insert_tail(&shard->clock, hand);
+			continue;
+		}
+
+		cache_shard_remove(driver, shard, c);
+		talloc_free(c);
+		evicted++;
+	}
+
+	return evicted;
+}
+
+/** Lock the shard a key belongs to
+ *
+ * If the handle already holds the lock for a different shard, that
+ * lock is released first, so a handle never holds more than one lock.
+ *
+ * Expired entries are removed from the shard after it's locked.
+ */
+static cache_shard_t *cache_shard_lock(rlm_cache_sharded_handle_t *handle, REQUEST *request,
+				       uint8_t const *key, size_t key_len)
+{
+	rlm_cache_sharded_t	*driver = handle->driver;
+	cache_shard_t		*shard;
+
+	/*
+	 *	The hash table uses the low bits of the hash to
+	 *	pick a bucket, so we use the high ones to pick a
+	 *	shard.  Otherwise each shard would only ever use
+	 *	a fraction of its buckets.
+	 */
+	shard = &driver->shards[(fr_hash(key, key_len) >> 24) & (driver->num_shards - 1)];
+	if (handle->shard == shard) return shard;
+
+	if (handle->shard) pthread_mutex_unlock(&handle->shard->mutex);
+
+	pthread_mutex_lock(&shard->mutex);
+	handle->shard = shard;
+
+	cache_shard_expire(driver, shard, request->packet->timestamp.tv_sec);
+
+	return shard;
+}
+
+/** Cleanup a cache_sharded instance
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	uint32_t		i;
+
+	if (!driver->shards) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		cache_shard_t	*shard = &driver->shards[i];
+		fr_dlist_t	*entry;
+
+		if (!shard->cache) continue;
+
+		while ((entry = FR_DLIST_FIRST(shard->clock))) {
+			rlm_cache_sharded_entry_t *c = fr_ptr_to_type(rlm_cache_sharded_entry_t, clock_entry, entry);
+
+			cache_shard_remove(driver, shard, c);
+			talloc_free(c);
+		}
+
+		fr_hash_table_free(shard->cache);
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	return 0;
+}
+
+/** Create a new cache_sharded instance
+ *
+ * @copydetails cache_instantiate_t
+ */
+static int mod_instantiate(UNUSED rlm_cache_config_t const *config, void *instance, CONF_SECTION *conf)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	time_t			now = time(NULL);
+	uint32_t		i, j;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, CACHE_MAX_SHARDS);
+
+	if ((driver->num_shards & (driver->num_shards - 1)) != 0) {
+		cf_log_err(conf, "'shards' must be a power of 2");
+		return -1;
+	}
+
+	if (driver->max_memory) {
+		driver->shard_max_memory = driver->max_memory / driver->num_shards;
+	} else {
+		driver->shard_max_memory = SIZE_MAX;
+	}
+
+	driver->num_entries = talloc_zero(driver, atomic_uint_fast32_t);
+	if (!driver->num_entries) return -1;
+	atomic_init(driver->num_entries, 0);
+
+	driver->shards = talloc_zero_array(driver, cache_shard_t, driver->num_shards);
+	if (!driver->shards) return -1;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		cache_shard_t *shard = &driver->shards[i];
+
+		/*
+		 *	The hash tables grow after the instance is
+		 *	made read only, so they can't be parented by it.
+		 */
+		shard->cache = fr_hash_table_create(NULL, cache_entry_hash, cache_entry_cmp, NULL);
+		if (!shard->cache) {
+			ERROR("Failed to create cache");
+			return -1;
+		}
+
+		if (pthread_mutex_init(&shard->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			fr_hash_table_free(shard->cache);
+			shard->cache = NULL;
+			return -1;
+		}
+
+		for (j = 0; j < CACHE_WHEEL_SLOTS; j++) FR_DLIST_INIT(shard->wheel[j]);
+		FR_DLIST_INIT(shard->clock);
+		shard->wheel_time = now;
+	}
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    REQUEST *request)
+{
+	rlm_cache_sharded_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_sharded_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+	c->wheel_entry.prev = c->wheel_entry.next = &c->wheel_entry;
+	c->clock_entry.prev = c->clock_entry.next = &c->clock_entry;
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+				       REQUEST *request, void *handle, uint8_t const *key, size_t key_len)
+{
+	cache_shard_t			*shard;
+	rlm_cache_sharded_entry_t	*c;
+	rlm_cache_entry_t		my_c;
+
+	shard = cache_shard_lock(handle, request, key, key_len);
+
+	my_c.key = key;
+	my_c.key_len = key_len;
+	c = fr_hash_table_finddata(shard->cache, &my_c);
+	if (!c) {
+		*out = NULL;
+		return CACHE_MISS;
+	}
+	c->referenced = true;
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	cache_shard_t			*shard;
+	rlm_cache_sharded_entry_t	*c;
+	rlm_cache_entry_t		my_c;
+
+	if (!request) return CACHE_ERROR;
+
+	shard = cache_shard_lock(handle, request, key, key_len);
+
+	my_c.key = key;
+	my_c.key_len = key_len;
+	c = fr_hash_table_finddata(shard->cache, &my_c);
+	if (!c) return CACHE_MISS;
+
+	cache_shard_remove(driver, shard, c);
+	talloc_free(c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, void *handle,
+					 rlm_cache_entry_t const *entry)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	cache_shard_t			*shard;
+	rlm_cache_sharded_entry_t	*c, *old;
+	int				evicted;
+
+	if (!request) return CACHE_ERROR;
+
+	memcpy(&c, &entry, sizeof(c));
+
+	shard = cache_shard_lock(handle, request, c->fields.key, c->fields.key_len);
+
+	/*
+	 *	Re-inserting an existing entry, which is how TTLs are
+	 *	updated without set_ttl.  The entry stays where it is,
+	 *	and only moves to the wheel slot for its new expiry
+	 *	time.  Removing it first would leave it detached if
+	 *	anything below failed.
+	 */
+	old = fr_hash_table_finddata(shard->cache, c);
+	if (old == c) {
+		shard->memory -= c->size;
+		c->size = talloc_total_size(c);
+		shard->memory += c->size;
+
+		fr_dlist_remove(&c->wheel_entry);
+		fr_dlist_insert_tail(&shard->wheel[c->fields.expires % CACHE_WHEEL_SLOTS], &c->wheel_entry);
+
+		return CACHE_OK;
+	}
+
+	/*
+	 *	Allow overwriting
+	 */
+	if (old) {
+		cache_shard_remove(driver, shard, old);
+		talloc_free(old);
+	}
+
+	c->size = talloc_total_size(c);
+	if (c->size > driver->shard_max_memory) {
+		RERROR("Entry size %zu exceeds the per-shard memory limit of %zu", c->size, driver->shard_max_memory);
+		return CACHE_ERROR;
+	}
+
+	evicted = cache_shard_evict(driver, shard, c->size);
+	if (evicted) RDEBUG2("Evicted %i entries to make room for new entry", evicted);
+
+	if (!fr_hash_table_insert(shard->cache, c)) {
+		RERROR("Failed adding entry");
+		return CACHE_ERROR;
+	}
+
+	fr_dlist_insert_tail(&shard->wheel[c->fields.expires % CACHE_WHEEL_SLOTS], &c->wheel_entry);
+	fr_dlist_insert_tail(&shard->clock, &c->clock_entry);
+	c->referenced = false;
+
+	shard->memory += c->size;
+	atomic_fetch_add_explicit(driver->num_entries, 1, memory_order_relaxed);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * Moves the entry to the timer wheel slot for its new expiry time.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					  REQUEST *request, void *handle,
+					  rlm_cache_entry_t *entry)
+{
+	rlm_cache_sharded_entry_t	*c = (rlm_cache_sharded_entry_t *)entry;
+	cache_shard_t			*shard;
+
+#ifdef NDEBUG
+	if (!request) return CACHE_ERROR;
+#endif
+
+	shard = cache_shard_lock(handle, request, c->fields.key, c->fields.key_len);
+
+	if (!rad_cond_assert(fr_hash_table_finddata(shard->cache, c) == c)) {
+		RERROR("Entry not in cache");
+		return CACHE_ERROR;
+	}
+
+	fr_dlist_remove(&c->wheel_entry);
+	fr_dlist_insert_tail(&shard->wheel[c->fields.expires % CACHE_WHEEL_SLOTS], &c->wheel_entry);
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  REQUEST *request, UNUSED void *handle)
+{
+	rlm_cache_sharded_t *driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+
+	if (!request) return 0;
+
+	return atomic_load_explicit(driver->num_entries, memory_order_relaxed);
+}
+
+/** Allocate a handle
+ *
+ * No locks are taken until we know which shard the key belongs to.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+			 REQUEST *request)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_handle_t	*h;
+
+	h = talloc_zero(request, rlm_cache_sharded_handle_t);
+	if (!h) return -1;
+	h->driver = driver;
+
+	*handle = h;
+
+	return 0;
+}
+
+/** Release the handle, unlocking any shard it holds
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, REQUEST *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_sharded_handle_t *h = talloc_get_type_abort(handle, rlm_cache_sharded_handle_t);
+
+	if (h->shard) {
+		pthread_mutex_unlock(&h->shard->mutex);
+		RDEBUG3("Mutex released");
+	}
+
+	talloc_free(h);
+}
+
+extern cache_driver_t rlm_cache_sharded;
+cache_driver_t rlm_cache_sharded = {
+	.name		= "rlm_cache_sharded",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_sharded_t),
+	.config		= driver_config,
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
@@ -95,6 +95,7 @@ static rlm_rcode_t delay_add(rlm_delay_t const *inst, REQUEST *request)
 	struct timeval	delay;
 	struct timeval	*now;
 	struct timeval	when;
+	fr_time_t	remaining = 0;
 	int cmp;
 
 	if (tmpl_aexpand(request, &delay, request, inst->delay, NULL, NULL) < 0) return RLM_MODULE_FAIL;
@@ -125,17 +126,23 @@ static rlm_rcode_t delay_add(rlm_delay_t const *inst, REQUEST *request)
 	cmp = fr_timeval_cmp(now, &when);
 	if (!inst->force_reschedule && (cmp >= 0)) return RLM_MODULE_NOOP;
 
+	/*
+	 *	Timers run on the monotonic clock, so schedule the
+	 *	event the remaining delay from now.
+	 */
 	if (cmp < 0) {
 		struct timeval actual;
 		fr_timeval_subtract(&actual, &when, now);
 
 		RDEBUG2("Delaying request by ~%"PRIu64".%06"PRIu64"s",
 			(uint64_t)actual.tv_sec, (uint64_t)actual.tv_usec);
+
+		remaining = fr_time_delta_from_timeval(&actual);
 	} else {
 		RDEBUG2("Rescheduling request");
 	}
 
-	if (unlang_event_timeout_add(request, delay_done, now, &when) < 0) return RLM_MODULE_FAIL;
+	if (unlang_event_timeout_add(request, delay_done, now, fr_time() + remaining) < 0) return RLM_MODULE_FAIL;
 
 	return RLM_MODULE_YIELD;
 }
@@ -32,6 +32,11 @@ RCSID("$Id$")
 
 #include "rlm_ldap.h"
 
+/*
+ *	Seconds between attempts to reopen a failed multiplexed connection.
+ */
+#define LDAP_MUX_RETRY_DELAY	1
+
 /** Gets an LDAP socket from the connection pool
  *
  * Retrieve a socket from the connection pool, or NULL on error (of if no sockets are available).
@@ -148,3 +153,877 @@ void *mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *tim
 
 	return conn;
 }
+
+/** How far a multiplexed connection has got towards being usable
+ *
+ */
+typedef enum {
+	LDAP_MUX_CONNECTING = 0,			//!< Waiting for the TCP connection.
+	LDAP_MUX_START_TLS,				//!< Waiting for the result of StartTLS.
+	LDAP_MUX_TLS_HANDSHAKE,				//!< Waiting for the TLS handshake to finish.
+	LDAP_MUX_BINDING,				//!< Waiting for the result of the admin bind.
+	LDAP_MUX_BOUND					//!< Searches can be sent.
+} rlm_ldap_mux_state_t;
+
+/** A connection searches from many requests are multiplexed over
+ *
+ * Each thread has one of these.  It's bound as the admin user, and is never rebound, so the
+ * results of searches can be matched back to the request which sent them using the msgid.
+ */
+struct rlm_ldap_mux_s {
+	rlm_ldap_thread_t	*t;			//!< Thread the connection belongs to.
+	fr_ldap_conn_t		*conn;			//!< Admin bound connection.
+	int			fd;			//!< Socket of the connection, or -1 if it failed.
+	rbtree_t		*queries;		//!< Outstanding searches, by msgid.
+	uint32_t		refs;			//!< Number of queries which reference the connection.
+
+	rlm_ldap_mux_state_t	state;			//!< Whether the connection is ready for searches.
+	int			msgid;			//!< Message ID of the StartTLS or bind request.
+	fr_event_timer_t const	*timeout;		//!< Give up on connecting and binding.
+};
+
+/** Compare two queries on msgid
+ *
+ */
+static int _query_cmp(void const *one, void const *two)
+{
+	rlm_ldap_query_t const *a = one, *b = two;
+
+	return (a->msgid > b->msgid) - (a->msgid < b->msgid);
+}
+
+/** Stop watching for events on behalf of a query
+ *
+ */
+static void query_unwatch(rlm_ldap_query_t *query)
+{
+	if (query->fd >= 0) {
+		unlang_event_fd_delete(query->request, query, query->fd);
+		query->fd = -1;
+	}
+
+	if (query->timer) {
+		unlang_event_timeout_delete(query->request, query);
+		query->timer = false;
+	}
+}
+
+/** Tell the server we're no longer interested in the result of a query
+ *
+ * A connection from the pool with a query in progress is in an unknown state,
+ * so it's closed.
+ */
+static void query_abandon(rlm_ldap_query_t *query)
+{
+	if (!query->pending) return;
+	query->pending = false;
+
+	ldap_abandon_ext(query->conn->handle, query->msgid, NULL, NULL);
+
+	if (query->mux) {
+		rbtree_deletebydata(query->mux->queries, query);
+		return;
+	}
+
+	fr_pool_connection_close(query->t->inst->pool, query->request, query->conn);
+	query->conn = NULL;
+}
+
+/** Record the status of a query, and mark the request as resumable
+ *
+ */
+static void query_done(rlm_ldap_query_t *query, fr_ldap_rcode_t status)
+{
+	query->pending = false;
+	query->status = status;
+
+	query_unwatch(query);
+	unlang_resumable(query->request);
+}
+
+/** Release a reference to a multiplexed connection
+ *
+ * The connection is freed when it's been replaced, and the last query using it goes away.
+ */
+static void mux_unref(rlm_ldap_mux_t *mux)
+{
+	rad_assert(mux->refs > 0);
+
+	if (--mux->refs > 0) return;
+	if (mux->t->mux == mux) return;
+
+	talloc_free(mux);
+}
+
+static int _query_free(rlm_ldap_query_t *query)
+{
+	query_unwatch(query);
+	query_abandon(query);
+
+	if (query->result) ldap_msgfree(query->result);
+
+	if (query->mux) {
+		mux_unref(query->mux);
+		return 0;
+	}
+
+	if (!query->conn) return 0;
+
+	if (query->status == LDAP_PROC_BAD_CONN) {
+		fr_pool_connection_close(query->t->inst->pool, query->request, query->conn);
+	} else {
+		mod_conn_release(query->t->inst, query->request, query->conn);
+	}
+
+	return 0;
+}
+
+static rlm_ldap_query_t *query_alloc(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request, char const *dn)
+{
+	fr_ldap_handle_config_t const	*handle_config = &t->inst->handle_config;
+	rlm_ldap_query_t		*query;
+
+	MEM(query = talloc_zero(ctx, rlm_ldap_query_t));
+	query->t = t;
+	query->request = request;
+	query->msgid = -1;
+	query->fd = -1;
+	query->status = LDAP_PROC_ERROR;
+	query->dn = talloc_strdup(query, dn);
+	talloc_set_destructor(query, _query_free);
+
+	return query;
+}
+
+static void _query_timeout(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx,
+			   UNUSED struct timeval *fired)
+{
+	rlm_ldap_query_t *query = talloc_get_type_abort(uctx, rlm_ldap_query_t);
+
+	REDEBUG("Timed out waiting for result from \"%s\"", query->conn->config->server);
+
+	/*
+	 *	The timeout event is freed after we return.
+	 */
+	query->timer = false;
+	query_abandon(query);
+	query_done(query, LDAP_PROC_TIMEOUT);
+}
+
+/** Limit how long we wait for the result of a query
+ *
+ */
+static int query_timeout_add(rlm_ldap_query_t *query)
+{
+	REQUEST		*request = query->request;
+
+	if (unlang_event_timeout_add(request, _query_timeout, query,
+				     fr_time() + fr_time_delta_from_timeval(&query->conn->config->res_timeout)) < 0) {
+		REDEBUG("Failed adding result timeout");
+		return -1;
+	}
+	query->timer = true;
+
+	return 0;
+}
+
+/** Check the result of a search, and resume the request which sent it
+ *
+ */
+static void query_search_result(rlm_ldap_query_t *query, LDAPMessage *result)
+{
+	REQUEST		*request = query->request;
+	LDAP		*handle = query->conn->handle;
+	LDAPMessage	*msg;
+	fr_ldap_rcode_t	status = LDAP_PROC_SUCCESS;
+	int		count;
+
+	for (msg = ldap_first_message(handle, result);
+	     msg;
+	     msg = ldap_next_message(handle, msg)) {
+		status = fr_ldap_error_check(NULL, query->conn, msg, query->dn);
+		if (status != LDAP_PROC_SUCCESS) break;
+	}
+
+	if (status != LDAP_PROC_SUCCESS) {
+		RPEDEBUG("Failed performing search");
+		ldap_msgfree(result);
+		query_done(query, status);
+		return;
+	}
+
+	count = ldap_count_entries(handle, result);
+	if (count < 0) {
+		REDEBUG("Error counting results: %s", fr_ldap_error_str(query->conn));
+		ldap_msgfree(result);
+		query_done(query, LDAP_PROC_ERROR);
+		return;
+	}
+
+	if (count == 0) {
+		RDEBUG("Search returned no results");
+		ldap_msgfree(result);
+		query_done(query, LDAP_PROC_NO_RESULT);
+		return;
+	}
+
+	query->result = result;
+	query_done(query, LDAP_PROC_SUCCESS);
+}
+
+/** Resume all the requests waiting on a multiplexed connection, and stop using it
+ *
+ */
+static int _query_fail(void *ctx, void *data)
+{
+	rlm_ldap_query_t	*query = talloc_get_type_abort(data, rlm_ldap_query_t);
+	fr_ldap_rcode_t		*status = ctx;
+
+	query_done(query, *status);
+
+	return 2;	/* Delete the node, and continue */
+}
+
+static void mux_retry_add(rlm_ldap_thread_t *t);
+
+static void mux_fail(rlm_ldap_mux_t *mux, fr_ldap_rcode_t status)
+{
+	if (mux->timeout) fr_event_timer_delete(mux->t->el, &mux->timeout);
+
+	/*
+	 *	The connection is freed when it's replaced, or when
+	 *	the last query using it is freed, not here, as we
+	 *	may be running in the handler for its socket.
+	 */
+	if (mux->fd >= 0) {
+		fr_event_fd_delete(mux->t->el, mux->fd);
+		mux->fd = -1;
+
+		if (mux->t->mux == mux) mux_retry_add(mux->t);
+	}
+
+	rbtree_walk(mux->queries, RBTREE_DELETE_ORDER, _query_fail, &status);
+}
+
+/** Service a multiplexed connection's socket
+ *
+ * libldap buffers data it has read from the socket, so we read every complete result
+ * available, not just one.
+ */
+static void _mux_read(UNUSED fr_event_list_t *el, UNUSED int sock, UNUSED int flags, void *uctx)
+{
+	rlm_ldap_mux_t			*mux = talloc_get_type_abort(uctx, rlm_ldap_mux_t);
+	fr_ldap_handle_config_t const	*handle_config = mux->conn->config;
+	struct timeval			poll = { 0, 0 };
+	LDAPMessage			*result;
+	rlm_ldap_query_t		find, *query;
+	int				ret;
+
+	for (;;) {
+		ret = ldap_result(mux->conn->handle, LDAP_RES_ANY, LDAP_MSG_ALL, &poll, &result);
+		if (ret == 0) return;
+
+		if (ret < 0) {
+			fr_ldap_rcode_t status;
+
+			status = fr_ldap_error_check(NULL, mux->conn, NULL, NULL);
+			PERROR("Multiplexed connection failed");
+			mux_fail(mux, status);
+			return;
+		}
+
+		find.msgid = ldap_msgid(result);
+		query = rbtree_finddata(mux->queries, &find);
+		if (!query) {
+			DEBUG3("Ignoring result for msgid %i, doesn't match any outstanding searches", find.msgid);
+			ldap_msgfree(result);
+			continue;
+		}
+
+		rbtree_deletebydata(mux->queries, query);
+		query_search_result(query, result);
+	}
+}
+
+static void _mux_error(UNUSED fr_event_list_t *el, UNUSED int sock, UNUSED int flags, int fd_errno, void *uctx)
+{
+	rlm_ldap_mux_t			*mux = talloc_get_type_abort(uctx, rlm_ldap_mux_t);
+	fr_ldap_handle_config_t const	*handle_config = mux->conn->config;
+
+	ERROR("Multiplexed connection failed: %s", fr_syserror(fd_errno));
+	mux_fail(mux, LDAP_PROC_BAD_CONN);
+}
+
+static void _mux_timeout(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	rlm_ldap_mux_t			*mux = talloc_get_type_abort(uctx, rlm_ldap_mux_t);
+	fr_ldap_handle_config_t const	*handle_config = mux->conn->config;
+
+	ERROR("Timed out opening multiplexed connection to \"%s\"", handle_config->server);
+	mux_fail(mux, LDAP_PROC_TIMEOUT);
+}
+
+/** Send the admin bind on a multiplexed connection
+ *
+ * @return an LDAP error code.
+ */
+static int mux_bind_send(rlm_ldap_mux_t *mux)
+{
+	fr_ldap_handle_config_t const	*handle_config = mux->conn->config;
+	char const			*password = handle_config->admin_password;
+	struct berval			cred;
+
+	memcpy(&cred.bv_val, &password, sizeof(cred.bv_val));
+	cred.bv_len = password ? strlen(password) : 0;
+
+	mux->state = LDAP_MUX_BINDING;
+
+	return ldap_sasl_bind(mux->conn->handle, handle_config->admin_identity, LDAP_SASL_SIMPLE, &cred,
+			      NULL, NULL, &mux->msgid);
+}
+
+/** Send the first request on a multiplexed connection
+ *
+ * With an asynchronous connect, libldap returns LDAP_X_CONNECTING until the
+ * TCP connection is up, and the request has to be sent again.
+ *
+ * @return an LDAP error code.
+ */
+static int mux_start(rlm_ldap_mux_t *mux)
+{
+#ifdef HAVE_LDAP_START_TLS_S
+	if (mux->conn->config->start_tls) {
+		mux->state = LDAP_MUX_START_TLS;
+
+		return ldap_start_tls(mux->conn->handle, NULL, NULL, &mux->msgid);
+	}
+#endif
+
+	return mux_bind_send(mux);
+}
+
+/** Move a multiplexed connection along, until it's bound
+ *
+ * Called when the socket is readable, or, whilst connecting, writable.
+ */
+static void _mux_setup(fr_event_list_t *el, UNUSED int sock, UNUSED int flags, void *uctx)
+{
+	rlm_ldap_mux_t			*mux = talloc_get_type_abort(uctx, rlm_ldap_mux_t);
+	fr_ldap_handle_config_t const	*handle_config = mux->conn->config;
+	struct timeval			poll = { 0, 0 };
+	LDAPMessage			*result = NULL;
+	fr_ldap_rcode_t			status;
+	int				ret;
+
+	switch (mux->state) {
+	case LDAP_MUX_CONNECTING:
+		ret = mux_start(mux);
+		if (ret == LDAP_SUCCESS) break;
+#ifdef LDAP_X_CONNECTING
+		if (ret == LDAP_X_CONNECTING) {
+			mux->state = LDAP_MUX_CONNECTING;
+			return;
+		}
+#endif
+		ERROR("Failed sending request: %s", ldap_err2string(ret));
+		goto error;
+
+#ifdef HAVE_LDAP_START_TLS_S
+	case LDAP_MUX_START_TLS:
+		ret = ldap_result(mux->conn->handle, mux->msgid, LDAP_MSG_ALL, &poll, &result);
+		if (ret == 0) return;
+		if ((ret < 0) ||
+		    (ldap_parse_result(mux->conn->handle, result, &ret, NULL, NULL, NULL, NULL, 1) != LDAP_SUCCESS) ||
+		    (ret != LDAP_SUCCESS)) {
+			ERROR("Could not start TLS: %s", fr_ldap_error_str(mux->conn));
+			goto error;
+		}
+		mux->state = LDAP_MUX_TLS_HANDSHAKE;
+		/* FALL-THROUGH */
+
+	case LDAP_MUX_TLS_HANDSHAKE:
+		ret = ldap_install_tls(mux->conn->handle);
+#  ifdef LDAP_X_CONNECTING
+		if (ret == LDAP_X_CONNECTING) return;
+#  endif
+		if (ret != LDAP_SUCCESS) {
+			ERROR("Could not start TLS: %s", ldap_err2string(ret));
+			goto error;
+		}
+
+		ret = mux_bind_send(mux);
+		if (ret != LDAP_SUCCESS) {
+			ERROR("Failed sending bind: %s", ldap_err2string(ret));
+			goto error;
+		}
+		break;
+#else
+	case LDAP_MUX_START_TLS:
+	case LDAP_MUX_TLS_HANDSHAKE:
+		rad_assert(0);
+		goto error;
+#endif
+
+	case LDAP_MUX_BINDING:
+		ret = ldap_result(mux->conn->handle, mux->msgid, LDAP_MSG_ALL, &poll, &result);
+		if (ret == 0) return;
+
+		status = fr_ldap_error_check(NULL, mux->conn, (ret < 0) ? NULL : result,
+					     handle_config->admin_identity);
+		if (result) ldap_msgfree(result);
+		if (status != LDAP_PROC_SUCCESS) {
+			PERROR("Bind as \"%s\" to \"%s\" failed",
+			       handle_config->admin_identity ? handle_config->admin_identity : "(anonymous)",
+			       handle_config->server);
+			goto error;
+		}
+
+		if (mux->timeout) fr_event_timer_delete(el, &mux->timeout);
+
+		if (fr_event_fd_insert(mux, el, mux->fd, _mux_read, NULL, _mux_error, mux) < 0) {
+			PERROR("Failed adding LDAP socket to event loop");
+			goto error;
+		}
+		mux->state = LDAP_MUX_BOUND;
+
+		DEBUG2("Multiplexed connection to \"%s\" is bound", handle_config->server);
+		return;
+
+	case LDAP_MUX_BOUND:
+		rad_assert(0);
+		return;
+	}
+
+	/*
+	 *	A request has been sent.  Wait for its result.
+	 */
+	if (fr_event_fd_insert(mux, el, mux->fd, _mux_setup, NULL, _mux_error, mux) < 0) {
+		PERROR("Failed adding LDAP socket to event loop");
+		goto error;
+	}
+	return;
+
+error:
+	mux_fail(mux, LDAP_PROC_BAD_CONN);
+}
+
+/** Open this thread's multiplexed connection
+ *
+ * Nothing here waits for the directory.  The connect, StartTLS and admin bind
+ * are done by #_mux_setup as the socket becomes ready, and searches go to the
+ * connection pool until the connection is bound.
+ *
+ * @param[in] t	Thread specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mux_open(rlm_ldap_thread_t *t)
+{
+	fr_ldap_handle_config_t const	*handle_config = &t->inst->handle_config;
+	rlm_ldap_mux_t			*mux = t->mux;
+	int				ret;
+
+	/*
+	 *	Queries still using the old connection free it.
+	 */
+	if (mux) {
+		t->mux = NULL;
+		if (mux->refs == 0) talloc_free(mux);
+	}
+
+	/*
+	 *	SASL binds take several round trips, which libldap
+	 *	only does synchronously.
+	 */
+	if (handle_config->admin_sasl.mech) {
+		DEBUG2("Not multiplexing searches, as the admin user binds with SASL");
+		return 0;
+	}
+
+	MEM(mux = talloc_zero(t, rlm_ldap_mux_t));
+	mux->t = t;
+	mux->fd = -1;
+	mux->msgid = -1;
+	MEM(mux->queries = rbtree_create(mux, _query_cmp, NULL, RBTREE_FLAG_NONE));
+
+	DEBUG2("Opening multiplexed connection to \"%s\"", handle_config->server);
+
+	mux->conn = fr_ldap_conn_alloc(mux, handle_config);
+	if (!mux->conn) {
+	error:
+		talloc_free(mux);
+		return -1;
+	}
+
+	/*
+	 *	Searches on the connection never look at this.
+	 */
+	MEM(mux->conn->directory = talloc_zero(mux->conn, fr_ldap_directory_t));
+	mux->conn->directory->type = FR_LDAP_DIRECTORY_UNKNOWN;
+
+#ifdef LDAP_OPT_CONNECT_ASYNC
+	if (ldap_set_option(mux->conn->handle, LDAP_OPT_CONNECT_ASYNC, LDAP_OPT_ON) != LDAP_OPT_SUCCESS) {
+		ERROR("Failed setting connection option async: %s", fr_ldap_error_str(mux->conn));
+		goto error;
+	}
+#endif
+
+	mux->state = LDAP_MUX_CONNECTING;
+	ret = mux_start(mux);
+	if (ret == LDAP_SUCCESS) {
+		/* Connected straight away */
+#ifdef LDAP_X_CONNECTING
+	} else if (ret == LDAP_X_CONNECTING) {
+		mux->state = LDAP_MUX_CONNECTING;
+#endif
+	} else {
+		ERROR("Failed connecting to \"%s\": %s", handle_config->server, ldap_err2string(ret));
+		goto error;
+	}
+
+	if (ldap_get_option(mux->conn->handle, LDAP_OPT_DESC, &mux->fd) != LDAP_OPT_SUCCESS) {
+		ERROR("Failed retrieving file descriptor from LDAP handle: %s", fr_ldap_error_str(mux->conn));
+		mux->fd = -1;
+		goto error;
+	}
+
+	/*
+	 *	The socket becomes writable when the connect finishes.
+	 *	Once a request has been sent, we only want results.
+	 */
+	if (fr_event_fd_insert(mux, t->el, mux->fd, _mux_setup,
+			       (mux->state == LDAP_MUX_CONNECTING) ? _mux_setup : NULL, _mux_error, mux) < 0) {
+		PERROR("Failed adding LDAP socket to event loop");
+		mux->fd = -1;
+		goto error;
+	}
+
+	if (fr_event_timer_at(mux, t->el, &mux->timeout,
+			      fr_time() + fr_time_delta_from_timeval(&handle_config->net_timeout) +
+			      fr_time_delta_from_timeval(&handle_config->res_timeout),
+			      _mux_timeout, mux) < 0) {
+		PERROR("Failed adding timer for multiplexed connection");
+		fr_event_fd_delete(t->el, mux->fd);
+		mux->fd = -1;
+		goto error;
+	}
+
+	t->mux = mux;
+
+	return 0;
+}
+
+static void _mux_retry(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	rlm_ldap_thread_t *t = uctx;
+
+	if (mux_open(t) < 0) mux_retry_add(t);
+}
+
+/** Try to reopen this thread's multiplexed connection later
+ *
+ */
+static void mux_retry_add(rlm_ldap_thread_t *t)
+{
+	fr_ldap_handle_config_t const	*handle_config = &t->inst->handle_config;
+
+	if (fr_event_timer_at(t, t->el, &t->mux_retry,
+			      fr_time() + ((fr_time_t) LDAP_MUX_RETRY_DELAY * NANOSEC), _mux_retry, t) < 0) {
+		PERROR("Failed adding timer to reopen multiplexed connection");
+		return;
+	}
+
+	WARN("Multiplexed connection to \"%s\" is down, retrying in %i seconds",
+	     handle_config->server, LDAP_MUX_RETRY_DELAY);
+}
+
+/** Get this thread's multiplexed connection
+ *
+ * @return the connection, or NULL if it isn't bound yet, or is down.
+ */
+static rlm_ldap_mux_t *mux_get(rlm_ldap_thread_t *t)
+{
+	rlm_ldap_mux_t *mux = t->mux;
+
+	if (!mux || (mux->fd < 0) || (mux->state != LDAP_MUX_BOUND)) return NULL;
+
+	return mux;
+}
+
+/** Open this thread's multiplexed connection
+ *
+ * If the connection can't be opened now, the thread still starts, and the
+ * connection is retried in the background.
+ *
+ * @param[in] t	Thread specific data.
+ */
+void rlm_ldap_thread_mux_open(rlm_ldap_thread_t *t)
+{
+	if (mux_open(t) < 0) mux_retry_add(t);
+}
+
+/** Free this thread's multiplexed connection
+ *
+ * @param[in] t	Thread specific data.
+ */
+void rlm_ldap_thread_mux_free(rlm_ldap_thread_t *t)
+{
+	if (t->mux_retry) fr_event_timer_delete(t->el, &t->mux_retry);
+
+	if (!t->mux) return;
+
+	if (t->mux->fd >= 0) fr_event_fd_delete(t->el, t->mux->fd);
+	TALLOC_FREE(t->mux);
+}
+
+static void _query_error(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx, UNUSED int fd)
+{
+	rlm_ldap_query_t *query = talloc_get_type_abort(uctx, rlm_ldap_query_t);
+
+	REDEBUG("Connection failed whilst waiting for result");
+
+	query_abandon(query);
+	query_done(query, LDAP_PROC_BAD_CONN);
+}
+
+static void _search_read(UNUSED REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx,
+			 UNUSED int fd)
+{
+	rlm_ldap_query_t	*query = talloc_get_type_abort(uctx, rlm_ldap_query_t);
+	struct timeval		poll = { 0, 0 };
+	LDAPMessage		*result = NULL;
+
+	switch (ldap_result(query->conn->handle, query->msgid, LDAP_MSG_ALL, &poll, &result)) {
+	case 0:
+		return;
+
+	case -1:
+		query_done(query, fr_ldap_error_check(NULL, query->conn, NULL, query->dn));
+		return;
+
+	default:
+		query_search_result(query, result);
+		return;
+	}
+}
+
+/** Send a search on an exclusive connection from the pool
+ *
+ * Used whilst this thread's multiplexed connection is being opened.
+ */
+static int query_search_pool(TALLOC_CTX *ctx, rlm_ldap_query_t **out, rlm_ldap_thread_t *t, REQUEST *request,
+			     char const *dn, int scope, char const *filter, char const * const *attrs,
+			     LDAPControl **serverctrls)
+{
+	rlm_ldap_query_t	*query;
+	int			fd = -1;
+
+	query = query_alloc(ctx, t, request, dn);
+	query->conn = mod_conn_get(t->inst, request);
+	if (!query->conn) {
+	error:
+		talloc_free(query);
+		return -1;
+	}
+
+	if (fr_ldap_search_async(&query->msgid, request, &query->conn,
+				 dn, scope, filter, attrs, serverctrls, NULL) != LDAP_PROC_SUCCESS) {
+		query->status = fr_ldap_error_check(NULL, query->conn, NULL, dn);
+		goto error;
+	}
+	query->pending = true;
+
+	if (ldap_get_option(query->conn->handle, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS) {
+		REDEBUG("Failed retrieving file descriptor from LDAP handle: %s", fr_ldap_error_str(query->conn));
+		goto error;
+	}
+
+	if (unlang_event_fd_add(request, _search_read, NULL, _query_error, query, fd) < 0) {
+		REDEBUG("Failed adding LDAP socket to event loop");
+		goto error;
+	}
+	query->fd = fd;
+
+	if (query_timeout_add(query) < 0) goto error;
+
+	RDEBUG("Waiting for search result...");
+
+	*out = query;
+
+	return 0;
+}
+
+/** Send a search on this thread's multiplexed connection, or on a connection from the pool
+ *
+ * The caller should yield, and will be marked as resumable once the result is available.
+ * query->status then holds the result of the search, and query->result any entries.
+ *
+ * @param[in] ctx		to allocate the query in.  Freeing the query abandons the search.
+ * @param[out] out		Where to write the query.
+ * @param[in] t			Thread specific data.
+ * @param[in] request		Current request.
+ * @param[in] dn		to use as base for the search.
+ * @param[in] scope		to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
+ * @param[in] filter		to use, should be pre-escaped.
+ * @param[in] attrs		to retrieve.
+ * @param[in] serverctrls	Search controls to pass to the server.  May be NULL.
+ * @return
+ *	- 0 if the search was sent.
+ *	- -1 on error.
+ */
+int rlm_ldap_query_search(TALLOC_CTX *ctx, rlm_ldap_query_t **out, rlm_ldap_thread_t *t, REQUEST *request,
+			  char const *dn, int scope, char const *filter, char const * const *attrs,
+			  LDAPControl **serverctrls)
+{
+	rlm_ldap_mux_t		*mux;
+	rlm_ldap_query_t	*query;
+
+	*out = NULL;
+
+	mux = mux_get(t);
+	if (!mux) {
+		RDEBUG3("Multiplexed connection isn't bound, using a connection from the pool");
+		return query_search_pool(ctx, out, t, request, dn, scope, filter, attrs, serverctrls);
+	}
+
+	query = query_alloc(ctx, t, request, dn);
+	query->mux = mux;
+	query->conn = mux->conn;
+	mux->refs++;
+
+	if (fr_ldap_search_async(&query->msgid, request, &mux->conn,
+				 dn, scope, filter, attrs, serverctrls, NULL) != LDAP_PROC_SUCCESS) {
+		if (fr_ldap_error_check(NULL, mux->conn, NULL, dn) == LDAP_PROC_BAD_CONN) {
+			mux_fail(mux, LDAP_PROC_BAD_CONN);
+		}
+		talloc_free(query);
+		return -1;
+	}
+
+	query->pending = true;
+	if (!rbtree_insert(mux->queries, query)) {
+		REDEBUG("Failed tracking search with msgid %i", query->msgid);
+	error:
+		talloc_free(query);
+		return -1;
+	}
+
+	if (query_timeout_add(query) < 0) goto error;
+
+	RDEBUG("Waiting for search result...");
+
+	*out = query;
+
+	return 0;
+}
+
+static void _bind_read(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx, UNUSED int fd)
+{
+	rlm_ldap_query_t	*query = talloc_get_type_abort(uctx, rlm_ldap_query_t);
+	struct timeval		poll = { 0, 0 };
+	LDAPMessage		*result = NULL;
+	fr_ldap_rcode_t		status;
+
+	switch (ldap_result(query->conn->handle, query->msgid, LDAP_MSG_ALL, &poll, &result)) {
+	case 0:
+		return;
+
+	case -1:
+		status = fr_ldap_error_check(NULL, query->conn, NULL, query->dn);
+		break;
+
+	default:
+		status = fr_ldap_error_check(NULL, query->conn, result, query->dn);
+		ldap_msgfree(result);
+		break;
+	}
+
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		RDEBUG("Bind successful");
+		break;
+
+	case LDAP_PROC_NOT_PERMITTED:
+		RPEDEBUG("Bind as \"%s\" to \"%s\" not permitted", query->dn, query->conn->config->server);
+		break;
+
+	default:
+		RPEDEBUG("Bind as \"%s\" to \"%s\" failed", query->dn, query->conn->config->server);
+		break;
+	}
+
+	query_done(query, status);
+}
+
+/** Send a simple bind on an exclusive connection from the pool
+ *
+ * Binds change the identity of the connection, so they can't be multiplexed with searches.
+ * The caller should yield, and will be marked as resumable once the result is available in
+ * query->status.
+ *
+ * @param[in] ctx		to allocate the query in.  Freeing the query releases the connection.
+ * @param[out] out		Where to write the query.
+ * @param[in] t			Thread specific data.
+ * @param[in] request		Current request.
+ * @param[in] dn		of the user.
+ * @param[in] password		of the user.
+ * @return
+ *	- 0 if the bind was sent.
+ *	- -1 on error.
+ */
+int rlm_ldap_query_bind(TALLOC_CTX *ctx, rlm_ldap_query_t **out, rlm_ldap_thread_t *t, REQUEST *request,
+			char const *dn, char const *password)
+{
+	rlm_ldap_query_t	*query;
+	struct berval		cred;
+	int			fd = -1;
+
+	*out = NULL;
+
+	query = query_alloc(ctx, t, request, dn);
+	query->conn = mod_conn_get(t->inst, request);
+	if (!query->conn) {
+		talloc_free(query);
+		return -1;
+	}
+
+	/*
+	 *	Let the next user of the connection know it has
+	 *	to rebind as the admin user.
+	 */
+	query->conn->rebound = true;
+
+	memcpy(&cred.bv_val, &password, sizeof(cred.bv_val));
+	cred.bv_len = talloc_array_length(password) - 1;
+
+	if (ldap_sasl_bind(query->conn->handle, dn, LDAP_SASL_SIMPLE, &cred,
+			   NULL, NULL, &query->msgid) != LDAP_SUCCESS) {
+		query->status = fr_ldap_error_check(NULL, query->conn, NULL, dn);
+		RPEDEBUG("Bind as \"%s\" to \"%s\" failed", dn, query->conn->config->server);
+		talloc_free(query);
+		return -1;
+	}
+	query->pending = true;
+
+	if (ldap_get_option(query->conn->handle, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS) {
+		REDEBUG("Failed retrieving file descriptor from LDAP handle: %s", fr_ldap_error_str(query->conn));
+	error:
+		talloc_free(query);
+		return -1;
+	}
+
+	if (unlang_event_fd_add(request, _bind_read, NULL, _query_error, query, fd) < 0) {
+		REDEBUG("Failed adding LDAP socket to event loop");
+		goto error;
+	}
+	query->fd = fd;
+
+	if (query_timeout_add(query) < 0) goto error;
+
+	RDEBUG2("Waiting for bind result...");
+
+	*out = query;
+
+	return 0;
+}
@@ -254,154 +254,102 @@ finish:
 	return rcode;
 }
 
-/** Convert group membership information into attributes
+/** Expand the filter and base DN used to find group objects the user is a member of
  *
- * @param[in] inst rlm_ldap configuration.
- * @param[in] request Current request.
- * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
- * @param[in] entry retrieved by rlm_ldap_find_user or fr_ldap_search.
- * @param[in] attr membership attribute to look for in the entry.
- * @return One of the RLM_MODULE_* values.
+ * @param[out] filter		Buffer of LDAP_MAX_FILTER_STR_LEN + 1 bytes to write the filter to.
+ * @param[out] base_dn		Where to write a pointer to the base DN.
+ * @param[in] base_dn_buff	Buffer of LDAP_MAX_DN_STR_LEN bytes to expand the base DN into.
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @return
+ *	- #RLM_MODULE_OK on success.
+ *	- #RLM_MODULE_INVALID if either could not be expanded.
  */
-rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn,
-				       LDAPMessage *entry, char const *attr)
+static rlm_rcode_t groupobj_search_expand(char *filter, char const **base_dn, char *base_dn_buff,
+					  rlm_ldap_t const *inst, REQUEST *request)
 {
-	rlm_rcode_t rcode = RLM_MODULE_OK;
-
-	struct berval **values;
-
-	char *group_name[LDAP_MAX_CACHEABLE + 1];
-	char **name_p = group_name;
+	char const *filters[] = { inst->groupobj_filter, inst->groupobj_membership_filter };
 
-	char *group_dn[LDAP_MAX_CACHEABLE + 1];
-	char **dn_p;
+	if (fr_ldap_xlat_filter(request,
+				 filters, sizeof(filters) / sizeof(*filters),
+				 filter, LDAP_MAX_FILTER_STR_LEN + 1) < 0) {
+		return RLM_MODULE_INVALID;
+	}
 
-	char *name;
+	if (tmpl_expand(base_dn, base_dn_buff, LDAP_MAX_DN_STR_LEN, request,
+			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Failed creating base_dn");
 
-	VALUE_PAIR *vp, **list, *groups = NULL;
-	TALLOC_CTX *list_ctx, *value_ctx;
-	vp_cursor_t list_cursor, groups_cursor;
+		return RLM_MODULE_INVALID;
+	}
 
-	int is_dn, i, count;
+	return RLM_MODULE_OK;
+}
 
-	rad_assert(entry);
-	rad_assert(attr);
+/** Convert the group objects returned by a membership search into attributes
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn the search was performed on.
+ * @param[in] result of the search.
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t groupobj_search_result(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t const *conn,
+					  LDAPMessage *result)
+{
+	int		ldap_errno;
+	LDAPMessage	*entry;
+	VALUE_PAIR	*vp;
+	char		*dn;
 
-	/*
-	 *	Parse the membership information we got in the initial user query.
-	 */
-	values = ldap_get_values_len((*pconn)->handle, entry, attr);
-	if (!values) {
-		RDEBUG2("No cacheable group memberships found in user object");
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
 
 		return RLM_MODULE_OK;
 	}
-	count = ldap_count_values_len(values);
-
-	list = radius_list(request, PAIR_LIST_CONTROL);
-	list_ctx = radius_list_ctx(request, PAIR_LIST_CONTROL);
-
-	/*
-	 *	Simplifies freeing temporary values
-	 */
-	value_ctx = talloc_new(request);
-
-	/*
-	 *	Temporary list to hold new group VPs, will be merged
-	 *	once all group info has been gathered/resolved
-	 *	successfully.
-	 */
-	fr_pair_cursor_init(&groups_cursor, &groups);
-
-	for (i = 0; (i < LDAP_MAX_CACHEABLE) && (i < count); i++) {
-		is_dn = fr_ldap_util_is_dn(values[i]->bv_val, values[i]->bv_len);
 
+	RDEBUG("Adding cacheable group object memberships");
+	do {
 		if (inst->cacheable_group_dn) {
-			/*
-			 *	The easy case, we're caching DNs and we got a DN.
-			 */
-			if (is_dn) {
-				MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
-				fr_pair_value_bstrncpy(vp, values[i]->bv_val, values[i]->bv_len);
-				fr_pair_cursor_append(&groups_cursor, vp);
-			/*
-			 *	We were told to cache DNs but we got a name, we now need to resolve
-			 *	this to a DN. Store all the group names in an array so we can do one query.
-			 */
-			} else {
-				*name_p++ = fr_ldap_berval_to_string(value_ctx, values[i]);
+			dn = ldap_get_dn(conn->handle, entry);
+			if (!dn) {
+				ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+				REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+				return RLM_MODULE_OK;
 			}
-		}
+			fr_ldap_util_normalise_dn(dn, dn);
 
-		if (inst->cacheable_group_name) {
-			/*
-			 *	The easy case, we're caching names and we got a name.
-			 */
-			if (!is_dn) {
-				MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
-				fr_pair_value_bstrncpy(vp, values[i]->bv_val, values[i]->bv_len);
-				fr_pair_cursor_append(&groups_cursor, vp);
-			/*
-			 *	We were told to cache names but we got a DN, we now need to resolve
-			 *	this to a name.
-			 *	Only Active Directory supports filtering on DN, so we have to search
-			 *	for each individual group.
-			 */
-			} else {
-				char *dn;
-
-				dn = fr_ldap_berval_to_string(value_ctx, values[i]);
-				rcode = rlm_ldap_group_dn2name(inst, request, pconn, dn, &name);
-				talloc_free(dn);
-				if (rcode != RLM_MODULE_OK) {
-					ldap_value_free_len(values);
-					talloc_free(value_ctx);
-					fr_pair_list_free(&groups);
-
-					return rcode;
-				}
+			MEM(vp = pair_make_config(inst->cache_da->name, NULL, T_OP_ADD));
+			fr_pair_value_strcpy(vp, dn);
 
-				MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
-				fr_pair_value_bstrncpy(vp, name, talloc_array_length(name) - 1);
-				fr_pair_cursor_append(&groups_cursor, vp);
-				talloc_free(name);
-			}
+			RINDENT();
+			RDEBUG("&control:%s += \"%s\"", inst->cache_da->name, dn);
+			REXDENT();
+			ldap_memfree(dn);
 		}
-	}
-	*name_p = NULL;
 
-	rcode = rlm_ldap_group_name2dn(inst, request, pconn, group_name, group_dn, sizeof(group_dn));
+		if (inst->cacheable_group_name) {
+			struct berval **values;
 
-	ldap_value_free_len(values);
-	talloc_free(value_ctx);
+			values = ldap_get_values_len(conn->handle, entry, inst->groupobj_name_attr);
+			if (!values) continue;
 
-	if (rcode != RLM_MODULE_OK) return rcode;
+			MEM(vp = pair_make_config(inst->cache_da->name, NULL, T_OP_ADD));
+			fr_pair_value_bstrncpy(vp, values[0]->bv_val, values[0]->bv_len);
 
-	fr_pair_cursor_init(&list_cursor, list);
+			RINDENT();
+			RDEBUG("&control:%s += \"%.*s\"", inst->cache_da->name,
+			       (int)values[0]->bv_len, values[0]->bv_val);
+			REXDENT();
 
-	RDEBUG("Adding cacheable user object memberships");
-	RINDENT();
-	if (RDEBUG_ENABLED) {
-		for (vp = fr_pair_cursor_first(&groups_cursor);
-		     vp;
-		     vp = fr_pair_cursor_next(&groups_cursor)) {
-			RDEBUG("&control:%s += \"%s\"", inst->cache_da->name, vp->vp_strvalue);
+			ldap_value_free_len(values);
 		}
-	}
-
-	fr_pair_cursor_merge(&list_cursor, groups);
-
-	for (dn_p = group_dn; *dn_p; dn_p++) {
-		MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
-		fr_pair_value_strcpy(vp, *dn_p);
-		fr_pair_cursor_append(&list_cursor, vp);
-
-		RDEBUG("&control:%s += \"%s\"", inst->cache_da->name, vp->vp_strvalue);
-		ldap_memfree(*dn_p);
-	}
-	REXDENT();
+	} while ((entry = ldap_next_entry(conn->handle, entry)));
 
-	return rcode;
+	return RLM_MODULE_OK;
 }
 
 /** Convert group membership information into attributes
@@ -415,22 +363,16 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 {
 	rlm_rcode_t rcode = RLM_MODULE_OK;
 	fr_ldap_rcode_t status;
-	int ldap_errno;
 
 	LDAPMessage *result = NULL;
-	LDAPMessage *entry;
 
 	char const *base_dn;
 	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
 
-	char const *filters[] = { inst->groupobj_filter, inst->groupobj_membership_filter };
 	char filter[LDAP_MAX_FILTER_STR_LEN + 1];
 
 	char const *attrs[] = { inst->groupobj_name_attr, NULL };
 
-	VALUE_PAIR *vp;
-	char *dn;
-
 	rad_assert(inst->groupobj_base_dn);
 
 	if (!inst->groupobj_membership_filter) {
@@ -439,18 +381,8 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 		return RLM_MODULE_OK;
 	}
 
-	if (fr_ldap_xlat_filter(request,
-				 filters, sizeof(filters) / sizeof(*filters),
-				 filter, sizeof(filter)) < 0) {
-		return RLM_MODULE_INVALID;
-	}
-
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Failed creating base_dn");
-
-		return RLM_MODULE_INVALID;
-	}
+	rcode = groupobj_search_expand(filter, &base_dn, base_dn_buff, inst, request);
+	if (rcode != RLM_MODULE_OK) return rcode;
 
 	status = fr_ldap_search(&result, request, pconn, base_dn,
 				inst->groupobj_scope, filter, attrs, NULL, NULL);
@@ -467,57 +399,80 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 		goto finish;
 	}
 
-	entry = ldap_first_entry((*pconn)->handle, result);
-	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+	rcode = groupobj_search_result(inst, request, *pconn, result);
 
-		goto finish;
-	}
+finish:
+	if (result) ldap_msgfree(result);
 
-	RDEBUG("Adding cacheable group object memberships");
-	do {
-		if (inst->cacheable_group_dn) {
-			dn = ldap_get_dn((*pconn)->handle, entry);
-			if (!dn) {
-				ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-				REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+	return rcode;
+}
 
-				goto finish;
-			}
-			fr_ldap_util_normalise_dn(dn, dn);
+/** Send a search for group objects the user is a member of, without waiting for the result
+ *
+ * The caller should yield, and pass the query to #rlm_ldap_cacheable_groupobj_resume once
+ * the request is resumed.
+ *
+ * @param[in] ctx to allocate the query in.
+ * @param[out] out Where to write the query.  Will be NULL if there's nothing to search for.
+ * @param[in] t Thread specific data.
+ * @param[in] request Current request.
+ * @return One of the RLM_MODULE_* values.
+ */
+rlm_rcode_t rlm_ldap_cacheable_groupobj_async(TALLOC_CTX *ctx, rlm_ldap_query_t **out, rlm_ldap_thread_t *t,
+					      REQUEST *request)
+{
+	rlm_ldap_t const	*inst = t->inst;
+	rlm_rcode_t		rcode;
 
-			MEM(vp = pair_make_config(inst->cache_da->name, NULL, T_OP_ADD));
-			fr_pair_value_strcpy(vp, dn);
+	char const		*base_dn;
+	char			base_dn_buff[LDAP_MAX_DN_STR_LEN];
 
-			RINDENT();
-			RDEBUG("&control:%s += \"%s\"", inst->cache_da->name, dn);
-			REXDENT();
-			ldap_memfree(dn);
-		}
+	char			filter[LDAP_MAX_FILTER_STR_LEN + 1];
 
-		if (inst->cacheable_group_name) {
-			struct berval **values;
+	char const		*attrs[] = { inst->groupobj_name_attr, NULL };
 
-			values = ldap_get_values_len((*pconn)->handle, entry, inst->groupobj_name_attr);
-			if (!values) continue;
+	rad_assert(inst->groupobj_base_dn);
 
-			MEM(vp = pair_make_config(inst->cache_da->name, NULL, T_OP_ADD));
-			fr_pair_value_bstrncpy(vp, values[0]->bv_val, values[0]->bv_len);
+	*out = NULL;
 
-			RINDENT();
-			RDEBUG("&control:%s += \"%.*s\"", inst->cache_da->name,
-			       (int)values[0]->bv_len, values[0]->bv_val);
-			REXDENT();
+	if (!inst->groupobj_membership_filter) {
+		RDEBUG2("Skipping caching group objects as directive 'group.membership_filter' is not set");
 
-			ldap_value_free_len(values);
-		}
-	} while ((entry = ldap_next_entry((*pconn)->handle, entry)));
+		return RLM_MODULE_OK;
+	}
 
-finish:
-	if (result) ldap_msgfree(result);
+	rcode = groupobj_search_expand(filter, &base_dn, base_dn_buff, inst, request);
+	if (rcode != RLM_MODULE_OK) return rcode;
 
-	return rcode;
+	if (rlm_ldap_query_search(ctx, out, t, request, base_dn,
+				  inst->groupobj_scope, filter, attrs, NULL) < 0) return RLM_MODULE_FAIL;
+
+	return RLM_MODULE_OK;
+}
+
+/** Convert group membership information into attributes, once the search sent by
+ * #rlm_ldap_cacheable_groupobj_async completes
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] query the search was sent with.
+ * @return One of the RLM_MODULE_* values.
+ */
+rlm_rcode_t rlm_ldap_cacheable_groupobj_resume(rlm_ldap_t const *inst, REQUEST *request, rlm_ldap_query_t *query)
+{
+	switch (query->status) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_NO_RESULT:
+		RDEBUG2("No cacheable group memberships found in group objects");
+		return RLM_MODULE_OK;
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+
+	return groupobj_search_result(inst, request, query->conn, query->result);
 }
 
 /** Query the LDAP directory to check if a group object includes a user object as a member
@@ -658,8 +658,145 @@ finish:
 	return 0;
 }
 
-static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+/** Whether requests can be processed without blocking the worker
+ *
+ * Session tracking controls are set per connection, so can't be used with searches
+ * multiplexed over a shared connection.
+ */
+static inline bool ldap_async(UNUSED rlm_ldap_t const *inst)
+{
+#ifdef LDAP_CONTROL_X_SESSION_TRACKING
+	if (inst->session_tracking) return false;
+#endif
+
+	return true;
+}
+
+/** Convert the result of binding as the user to a module return code
+ *
+ */
+static rlm_rcode_t ldap_bind_rcode(fr_ldap_rcode_t status)
+{
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		return RLM_MODULE_OK;
+
+	case LDAP_PROC_NOT_PERMITTED:
+		return RLM_MODULE_USERLOCK;
+
+	case LDAP_PROC_REJECT:
+		return RLM_MODULE_REJECT;
+
+	case LDAP_PROC_BAD_DN:
+		return RLM_MODULE_INVALID;
+
+	case LDAP_PROC_NO_RESULT:
+		return RLM_MODULE_NOTFOUND;
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+}
+
+/** State for an authentication which yields whilst waiting for the directory
+ *
+ */
+typedef struct {
+	rlm_ldap_t const	*inst;			//!< Instance of rlm_ldap.
+	rlm_ldap_thread_t	*t;			//!< Thread specific data.
+	char const		*dn;			//!< DN of the user.
+	rlm_ldap_query_t	*query;			//!< User object search, or bind, in progress.
+} ldap_auth_ctx_t;
+
+static void auth_async_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx,
+			      fr_state_action_t action)
+{
+	ldap_auth_ctx_t *ctx = talloc_get_type_abort(uctx, ldap_auth_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending LDAP operation");
+
+	talloc_free(ctx);	/* Abandons the search or bind */
+}
+
+static rlm_rcode_t auth_async_bind_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread,
+					  void *uctx)
+{
+	ldap_auth_ctx_t	*ctx = talloc_get_type_abort(uctx, ldap_auth_ctx_t);
+	rlm_rcode_t	rcode;
+
+	rcode = ldap_bind_rcode(ctx->query->status);
+	if (rcode == RLM_MODULE_OK) RDEBUG("Bind as user \"%s\" was successful", ctx->dn);
+
+	talloc_free(ctx);
+
+	return rcode;
+}
+
+static rlm_rcode_t auth_async_bind(REQUEST *request, ldap_auth_ctx_t *ctx)
+{
+	if (rlm_ldap_query_bind(ctx, &ctx->query, ctx->t, request,
+				ctx->dn, request->password->vp_strvalue) < 0) {
+		talloc_free(ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, auth_async_bind_resume, auth_async_signal, ctx);
+}
+
+static rlm_rcode_t auth_async_search_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread,
+					    void *uctx)
+{
+	ldap_auth_ctx_t	*ctx = talloc_get_type_abort(uctx, ldap_auth_ctx_t);
+	rlm_rcode_t	rcode;
+
+	ctx->dn = rlm_ldap_find_user_resume(ctx->inst, request, ctx->query, NULL, &rcode);
+	TALLOC_FREE(ctx->query);
+	if (!ctx->dn) {
+		talloc_free(ctx);
+		return rcode;
+	}
+
+	return auth_async_bind(request, ctx);
+}
+
+/** Authenticate a user, yielding whilst waiting for the directory
+ *
+ * The user object search is multiplexed over the thread's connection.  The bind is sent on
+ * a connection from the pool, as binding changes the identity of the connection.
+ */
+static rlm_rcode_t auth_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request)
+{
+	ldap_auth_ctx_t	*ctx;
+	VALUE_PAIR	*vp;
+	rlm_rcode_t	rcode;
+
+	RDEBUG("Login attempt by \"%s\"", request->username->vp_strvalue);
+
+	MEM(ctx = talloc_zero(request, ldap_auth_ctx_t));
+	ctx->inst = inst;
+	ctx->t = t;
+
+	vp = fr_pair_find_by_num(request->control, 0, FR_LDAP_USERDN, TAG_ANY);
+	if (vp) {
+		RDEBUG("Using user DN from request \"%s\"", vp->vp_strvalue);
+		ctx->dn = vp->vp_strvalue;
+
+		return auth_async_bind(request, ctx);
+	}
+
+	rcode = rlm_ldap_find_user_async(ctx, &ctx->query, t, request, NULL);
+	if (rcode != RLM_MODULE_OK) {
+		talloc_free(ctx);
+		return rcode;
+	}
+
+	return unlang_module_yield(request, auth_async_search_resume, auth_async_signal, ctx);
+}
+
+static rlm_rcode_t mod_authenticate(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rcode_t		rcode;
 	fr_ldap_rcode_t		status;
@@ -702,6 +839,11 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 		return RLM_MODULE_INVALID;
 	}
 
+	/*
+	 *	SASL binds are multi-step, so are still done synchronously.
+	 */
+	if (!inst->user_sasl.mech && ldap_async(inst)) return auth_async(inst, thread, request);
+
 	conn = mod_conn_get(inst, request);
 	if (!conn) return RLM_MODULE_FAIL;
 
@@ -755,32 +897,8 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 			      inst->user_sasl.mech ? &sasl : NULL,
 			      NULL,
 			      NULL, NULL);
-	switch (status) {
-	case LDAP_PROC_SUCCESS:
-		rcode = RLM_MODULE_OK;
-		RDEBUG("Bind as user \"%s\" was successful", dn);
-		break;
-
-	case LDAP_PROC_NOT_PERMITTED:
-		rcode = RLM_MODULE_USERLOCK;
-		break;
-
-	case LDAP_PROC_REJECT:
-		rcode = RLM_MODULE_REJECT;
-		break;
-
-	case LDAP_PROC_BAD_DN:
-		rcode = RLM_MODULE_INVALID;
-		break;
-
-	case LDAP_PROC_NO_RESULT:
-		rcode = RLM_MODULE_NOTFOUND;
-		break;
-
-	default:
-		rcode = RLM_MODULE_FAIL;
-		break;
-	};
+	rcode = ldap_bind_rcode(status);
+	if (rcode == RLM_MODULE_OK) RDEBUG("Bind as user \"%s\" was successful", dn);
 
 finish:
 	mod_conn_release(inst, request, conn);
@@ -862,94 +980,64 @@ free_result:
 	return rcode;
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+/** Check the user is allowed access, and cache group memberships listed in the user object
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn the user object was retrieved with, or NULL if it was retrieved with *pconn.
+ * @param[in,out] pconn to use for further searches. May change as this function calls functions
+ *	which auto re-connect.
+ * @param[in] entry the user object.
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t autz_user_entry(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t *conn,
+				   fr_ldap_conn_t **pconn, LDAPMessage *entry)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-	fr_ldap_rcode_t		status;
-	int			ldap_errno;
-	int			i;
-	rlm_ldap_t const	*inst = instance;
-	struct berval		**values;
-	VALUE_PAIR		*vp;
-	fr_ldap_conn_t		*conn;
-	LDAPMessage		*result, *entry;
-	char const 		*dn = NULL;
-	fr_ldap_map_exp_t	expanded; /* faster than allocing every time */
-
-	/*
-	 *	Don't be tempted to add a check for request->username
-	 *	or request->password here. rlm_ldap.authorize can be used for
-	 *	many things besides searching for users.
-	 */
-
-	if (fr_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
-
-	conn = mod_conn_get(inst, request);
-	if (!conn) return RLM_MODULE_FAIL;
-
-	/*
-	 *	Add any additional attributes we need for checking access, memberships, and profiles
-	 */
-	if (inst->userobj_access_attr) {
-		expanded.attrs[expanded.count++] = inst->userobj_access_attr;
-	}
-
-	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
-		expanded.attrs[expanded.count++] = inst->userobj_membership_attr;
-	}
-
-	if (inst->profile_attr) {
-		expanded.attrs[expanded.count++] = inst->profile_attr;
-	}
-
-	if (inst->valuepair_attr) {
-		expanded.attrs[expanded.count++] = inst->valuepair_attr;
-	}
-
-	expanded.attrs[expanded.count] = NULL;
-
-	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
-	if (!dn) {
-		goto finish;
-	}
-
-	entry = ldap_first_entry(conn->handle, result);
-	if (!entry) {
-		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
-
-		goto finish;
-	}
+	rlm_rcode_t rcode;
 
 	/*
 	 *	Check for access.
 	 */
 	if (inst->userobj_access_attr) {
-		rcode = rlm_ldap_check_access(inst, request, conn, entry);
-		if (rcode != RLM_MODULE_OK) {
-			goto finish;
-		}
+		rcode = rlm_ldap_check_access(inst, request, conn ? conn : *pconn, entry);
+		if (rcode != RLM_MODULE_OK) return rcode;
 	}
 
 	/*
 	 *	Check if we need to cache group memberships
 	 */
-	if (inst->cacheable_group_dn || inst->cacheable_group_name) {
-		if (inst->userobj_membership_attr) {
-			rcode = rlm_ldap_cacheable_userobj(inst, request, &conn, entry, inst->userobj_membership_attr);
-			if (rcode != RLM_MODULE_OK) {
-				goto finish;
-			}
-		}
-
-		rcode = rlm_ldap_cacheable_groupobj(inst, request, &conn);
-		if (rcode != RLM_MODULE_OK) {
-			goto finish;
-		}
+	if ((inst->cacheable_group_dn || inst->cacheable_group_name) && inst->userobj_membership_attr) {
+		rcode = rlm_ldap_cacheable_userobj(inst, request, pconn, entry, inst->userobj_membership_attr);
+		if (rcode != RLM_MODULE_OK) return rcode;
 	}
 
+	return RLM_MODULE_OK;
+}
+
+/** Retrieve the eDirectory password, apply profiles, and map attributes from the user object
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn the user object was retrieved with, or NULL if it was retrieved with *pconn.
+ * @param[in,out] pconn to use for further searches and binds. May change as this function calls
+ *	functions which auto re-connect.
+ * @param[in] dn of the user object.
+ * @param[in] entry the user object.
+ * @param[in] expanded Structure containing a list of xlat expanded attribute names and mapping
+ *	information.
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t autz_user_map(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t *conn,
+				 fr_ldap_conn_t **pconn, char const *dn, LDAPMessage *entry,
+				 fr_ldap_map_exp_t const *expanded)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	int			i;
+	struct berval		**values;
 #ifdef WITH_EDIR
+	fr_ldap_rcode_t		status;
+	VALUE_PAIR		*vp;
+
 	/*
 	 *	We already have a Cleartext-Password.  Skip edir.
 	 */
@@ -968,12 +1056,11 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 		/*
 		 *	Retrive universal password
 		 */
-		res = fr_ldap_edir_get_password(conn->handle, dn, password, &pass_size);
+		res = fr_ldap_edir_get_password((*pconn)->handle, dn, password, &pass_size);
 		if (res != 0) {
 			REDEBUG("Failed to retrieve eDirectory password: (%i) %s", res, fr_ldap_edir_errstr(res));
-			rcode = RLM_MODULE_FAIL;
 
-			goto finish;
+			return RLM_MODULE_FAIL;
 		}
 
 		/*
@@ -993,8 +1080,8 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 			/*
 			 *	Bind as the user
 			 */
-			conn->rebound = true;
-			status = fr_ldap_bind(request, &conn, dn, vp->vp_strvalue, NULL, NULL, NULL, NULL);
+			(*pconn)->rebound = true;
+			status = fr_ldap_bind(request, pconn, dn, vp->vp_strvalue, NULL, NULL, NULL, NULL);
 			switch (status) {
 			case LDAP_PROC_SUCCESS:
 				rcode = RLM_MODULE_OK;
@@ -1002,29 +1089,26 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 				break;
 
 			case LDAP_PROC_NOT_PERMITTED:
-				rcode = RLM_MODULE_USERLOCK;
-				goto finish;
+				return RLM_MODULE_USERLOCK;
 
 			case LDAP_PROC_REJECT:
-				rcode = RLM_MODULE_REJECT;
-				goto finish;
+				return RLM_MODULE_REJECT;
 
 			case LDAP_PROC_BAD_DN:
-				rcode = RLM_MODULE_INVALID;
-				goto finish;
+				return RLM_MODULE_INVALID;
 
 			case LDAP_PROC_NO_RESULT:
-				rcode = RLM_MODULE_NOTFOUND;
-				goto finish;
+				return RLM_MODULE_NOTFOUND;
 
 			default:
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
+				return RLM_MODULE_FAIL;
 			};
 		}
 	}
 
 skip_edir:
+#else
+	(void) dn;
 #endif
 
 	/*
@@ -1038,18 +1122,15 @@ skip_edir:
 				request, inst->default_profile, NULL, NULL) < 0) {
 			REDEBUG("Failed creating default profile string");
 
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
+			return RLM_MODULE_INVALID;
 		}
 
-		switch (rlm_ldap_map_profile(inst, request, &conn, profile, &expanded)) {
+		switch (rlm_ldap_map_profile(inst, request, pconn, profile, expanded)) {
 		case RLM_MODULE_INVALID:
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
+			return RLM_MODULE_INVALID;
 
 		case RLM_MODULE_FAIL:
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
+			return RLM_MODULE_FAIL;
 
 		case RLM_MODULE_UPDATED:
 			rcode = RLM_MODULE_UPDATED;
@@ -1063,19 +1144,18 @@ skip_edir:
 	 *	Apply a SET of user profiles.
 	 */
 	if (inst->profile_attr) {
-		values = ldap_get_values_len(conn->handle, entry, inst->profile_attr);
+		values = ldap_get_values_len((conn ? conn : *pconn)->handle, entry, inst->profile_attr);
 		if (values != NULL) {
 			for (i = 0; values[i] != NULL; i++) {
 				rlm_rcode_t ret;
 				char *value;
 
 				value = fr_ldap_berval_to_string(request, values[i]);
-				ret = rlm_ldap_map_profile(inst, request, &conn, value, &expanded);
+				ret = rlm_ldap_map_profile(inst, request, pconn, value, expanded);
 				talloc_free(value);
 				if (ret == RLM_MODULE_FAIL) {
 					ldap_value_free_len(values);
-					rcode = ret;
-					goto finish;
+					return ret;
 				}
 
 			}
@@ -1084,14 +1164,247 @@ skip_edir:
 	}
 
 	if (inst->user_map || inst->valuepair_attr) {
+		if (!conn) conn = *pconn;
+
 		RDEBUG("Processing user attributes");
 		RINDENT();
 		if (fr_ldap_map_do(request, conn, inst->valuepair_attr,
-				   &expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
+				   expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
 		REXDENT();
 		rlm_ldap_check_reply(inst, request, conn);
 	}
 
+	return rcode;
+}
+
+/** State for an authorization which yields whilst waiting for the directory
+ *
+ */
+typedef struct {
+	rlm_ldap_t const	*inst;			//!< Instance of rlm_ldap.
+	rlm_ldap_thread_t	*t;			//!< Thread specific data.
+	REQUEST			*request;		//!< Current request.
+
+	fr_ldap_map_exp_t	expanded;		//!< Attributes to retrieve, and how to map them.
+
+	rlm_ldap_query_t	*user;			//!< User object search.  Kept until we're done, as
+							//!< the result has to be parsed with its connection.
+	rlm_ldap_query_t	*group;			//!< Group object membership search.
+
+	LDAPMessage		*result;		//!< Result of the user object search.
+	LDAPMessage		*entry;			//!< The user object.
+	char const		*dn;			//!< DN of the user object.
+
+	fr_ldap_conn_t		*conn;			//!< Connection from the pool, for operations which
+							//!< still block, or NULL.
+} ldap_autz_ctx_t;
+
+static int _autz_ctx_free(ldap_autz_ctx_t *ctx)
+{
+	talloc_free(ctx->expanded.ctx);
+	if (ctx->result) ldap_msgfree(ctx->result);
+	if (ctx->conn) mod_conn_release(ctx->inst, ctx->request, ctx->conn);
+
+	return 0;
+}
+
+/** Whether authorization needs a connection from the pool, for operations which block
+ *
+ */
+static bool autz_needs_conn(rlm_ldap_t const *inst)
+{
+	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) return true;
+#ifdef WITH_EDIR
+	if (inst->edir) return true;
+#endif
+	if (inst->default_profile || inst->profile_attr) return true;
+
+	return false;
+}
+
+static void autz_async_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx,
+			      fr_state_action_t action)
+{
+	ldap_autz_ctx_t *ctx = talloc_get_type_abort(uctx, ldap_autz_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending LDAP search");
+
+	talloc_free(ctx);	/* Abandons the search */
+}
+
+static rlm_rcode_t autz_async_map(REQUEST *request, ldap_autz_ctx_t *ctx)
+{
+	rlm_rcode_t rcode;
+
+	rcode = autz_user_map(ctx->inst, request, ctx->user->conn, &ctx->conn, ctx->dn, ctx->entry, &ctx->expanded);
+	talloc_free(ctx);
+
+	return rcode;
+}
+
+static rlm_rcode_t autz_async_group_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread,
+					   void *uctx)
+{
+	ldap_autz_ctx_t	*ctx = talloc_get_type_abort(uctx, ldap_autz_ctx_t);
+	rlm_rcode_t	rcode;
+
+	rcode = rlm_ldap_cacheable_groupobj_resume(ctx->inst, request, ctx->group);
+	TALLOC_FREE(ctx->group);
+	if (rcode != RLM_MODULE_OK) {
+		talloc_free(ctx);
+		return rcode;
+	}
+
+	return autz_async_map(request, ctx);
+}
+
+static rlm_rcode_t autz_async_user_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread,
+					  void *uctx)
+{
+	ldap_autz_ctx_t		*ctx = talloc_get_type_abort(uctx, ldap_autz_ctx_t);
+	rlm_ldap_t const	*inst = ctx->inst;
+	rlm_rcode_t		rcode;
+	int			ldap_errno;
+
+	ctx->dn = rlm_ldap_find_user_resume(inst, request, ctx->user, &ctx->result, &rcode);
+	if (!ctx->dn) goto finish;
+
+	ctx->entry = ldap_first_entry(ctx->user->conn->handle, ctx->result);
+	if (!ctx->entry) {
+		ldap_get_option(ctx->user->conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+
+		goto finish;
+	}
+
+	if (autz_needs_conn(inst)) {
+		ctx->conn = mod_conn_get(inst, request);
+		if (!ctx->conn) {
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+	}
+
+	rcode = autz_user_entry(inst, request, ctx->user->conn, &ctx->conn, ctx->entry);
+	if (rcode != RLM_MODULE_OK) goto finish;
+
+	if (inst->cacheable_group_dn || inst->cacheable_group_name) {
+		rcode = rlm_ldap_cacheable_groupobj_async(ctx, &ctx->group, ctx->t, request);
+		if (rcode != RLM_MODULE_OK) goto finish;
+
+		if (ctx->group) return unlang_module_yield(request, autz_async_group_resume, autz_async_signal, ctx);
+	}
+
+	return autz_async_map(request, ctx);
+
+finish:
+	talloc_free(ctx);
+
+	return rcode;
+}
+
+/** Authorize a user, yielding whilst waiting for the directory
+ *
+ * Searches are multiplexed over the thread's connection.  Operations which can't be, such as
+ * profile lookups and eDirectory binds, are performed on a connection from the pool.
+ */
+static rlm_rcode_t autz_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request,
+			      fr_ldap_map_exp_t const *expanded)
+{
+	ldap_autz_ctx_t	*ctx;
+	rlm_rcode_t	rcode;
+
+	MEM(ctx = talloc_zero(request, ldap_autz_ctx_t));
+	ctx->inst = inst;
+	ctx->t = t;
+	ctx->request = request;
+	ctx->expanded = *expanded;
+	talloc_set_destructor(ctx, _autz_ctx_free);
+
+	rcode = rlm_ldap_find_user_async(ctx, &ctx->user, t, request, ctx->expanded.attrs);
+	if (rcode != RLM_MODULE_OK) {
+		talloc_free(ctx);
+		return rcode;
+	}
+
+	return unlang_module_yield(request, autz_async_user_resume, autz_async_signal, ctx);
+}
+
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	int			ldap_errno;
+	rlm_ldap_t const	*inst = instance;
+	fr_ldap_conn_t		*conn;
+	LDAPMessage		*result, *entry;
+	char const 		*dn = NULL;
+	fr_ldap_map_exp_t	expanded; /* faster than allocing every time */
+
+	/*
+	 *	Don't be tempted to add a check for request->username
+	 *	or request->password here. rlm_ldap.authorize can be used for
+	 *	many things besides searching for users.
+	 */
+
+	if (fr_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
+
+	/*
+	 *	Add any additional attributes we need for checking access, memberships, and profiles
+	 */
+	if (inst->userobj_access_attr) {
+		expanded.attrs[expanded.count++] = inst->userobj_access_attr;
+	}
+
+	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
+		expanded.attrs[expanded.count++] = inst->userobj_membership_attr;
+	}
+
+	if (inst->profile_attr) {
+		expanded.attrs[expanded.count++] = inst->profile_attr;
+	}
+
+	if (inst->valuepair_attr) {
+		expanded.attrs[expanded.count++] = inst->valuepair_attr;
+	}
+
+	expanded.attrs[expanded.count] = NULL;
+
+	if (ldap_async(inst)) return autz_async(inst, thread, request, &expanded);
+
+	conn = mod_conn_get(inst, request);
+	if (!conn) {
+		talloc_free(expanded.ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
+	if (!dn) {
+		goto finish;
+	}
+
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+
+		goto finish;
+	}
+
+	rcode = autz_user_entry(inst, request, NULL, &conn, entry);
+	if (rcode != RLM_MODULE_OK) goto finish;
+
+	if (inst->cacheable_group_dn || inst->cacheable_group_name) {
+		rcode = rlm_ldap_cacheable_groupobj(inst, request, &conn);
+		if (rcode != RLM_MODULE_OK) {
+			goto finish;
+		}
+	}
+
+	rcode = autz_user_map(inst, request, NULL, &conn, dn, entry, &expanded);
+
 finish:
 	talloc_free(expanded.ctx);
 	if (result) ldap_msgfree(result);
@@ -1370,6 +1683,42 @@ static int mod_detach(void *instance)
 	return 0;
 }
 
+/** Initialise thread specific data
+ *
+ * Opens the connection searches are multiplexed over, so requests never wait
+ * for it to connect.  If it can't be opened, it's retried in the background.
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_ldap_t.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return 0
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el,
+				  void *thread)
+{
+	rlm_ldap_thread_t *t = thread;
+
+	t->inst = instance;
+	t->el = el;
+
+	rlm_ldap_thread_mux_open(t);
+
+	return 0;
+}
+
+/** Close the connection searches are multiplexed over
+ *
+ * @param[in] thread	specific data to destroy.
+ * @return 0
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_ldap_thread_mux_free(thread);
+
+	return 0;
+}
+
 /** Parse an accounting sub section.
  *
  * Allocate a new ldap_acct_section_t and write the config data into it.
@@ -1980,16 +2329,19 @@ static void mod_unload(void)
 /* globally exported name */
 extern rad_module_t rlm_ldap;
 rad_module_t rlm_ldap = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "ldap",
-	.type		= 0,
-	.inst_size	= sizeof(rlm_ldap_t),
-	.config		= module_config,
-	.load		= mod_load,
-	.unload		= mod_unload,
-	.bootstrap	= mod_bootstrap,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "ldap",
+	.type			= 0,
+	.inst_size		= sizeof(rlm_ldap_t),
+	.thread_inst_size	= sizeof(rlm_ldap_thread_t),
+	.config			= module_config,
+	.load			= mod_load,
+	.unload			= mod_unload,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.detach			= mod_detach,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize,
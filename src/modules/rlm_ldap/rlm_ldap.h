@@ -160,12 +160,56 @@ struct ldap_inst_s {
 	uint32_t	ldap_debug;			//!< Debug flag for the SDK.
 };
 
+typedef struct rlm_ldap_mux_s rlm_ldap_mux_t;
+
+/** Per-thread instance data
+ *
+ */
+typedef struct {
+	rlm_ldap_t const	*inst;			//!< Instance of rlm_ldap.
+	fr_event_list_t		*el;			//!< This thread's event list.
+	rlm_ldap_mux_t		*mux;			//!< Connection searches are multiplexed over,
+							//!< or NULL if we're not currently connected.
+	fr_event_timer_t const	*mux_retry;		//!< Timer to reopen the multiplexed connection.
+} rlm_ldap_thread_t;
+
+/** A search or bind which is waiting for a response from the directory
+ *
+ * The request which sent the query yields, and is marked resumable
+ * once the result arrives, the query times out, or the connection fails.
+ */
+typedef struct {
+	rlm_ldap_thread_t	*t;			//!< Thread the query was sent from.
+	REQUEST			*request;		//!< Request to resume.
+
+	rlm_ldap_mux_t		*mux;			//!< Multiplexed connection the search was sent on,
+							//!< NULL if the query has a connection from the pool.
+	fr_ldap_conn_t		*conn;			//!< Connection the query was sent on.
+
+	int			msgid;			//!< Message ID of the query.
+	char const		*dn;			//!< Base DN of the search, or DN we're binding as.
+
+	bool			pending;		//!< Whether we're still waiting for the result.
+	bool			timer;			//!< Whether a timeout event is set.
+	int			fd;			//!< Socket we're watching on behalf of the request,
+							//!< or -1.  Only used for connections from the pool.
+
+	fr_ldap_rcode_t		status;			//!< Status of the query.
+	LDAPMessage		*result;		//!< Result of a search.
+} rlm_ldap_query_t;
+
 /*
  *	user.c - User lookup functions
  */
 char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn,
 			       char const *attrs[], bool force, LDAPMessage **result, rlm_rcode_t *rcode);
 
+rlm_rcode_t rlm_ldap_find_user_async(TALLOC_CTX *ctx, rlm_ldap_query_t **out, rlm_ldap_thread_t *t,
+				     REQUEST *request, char const *attrs[]);
+
+char const *rlm_ldap_find_user_resume(rlm_ldap_t const *inst, REQUEST *request, rlm_ldap_query_t *query,
+				      LDAPMessage **result, rlm_rcode_t *rcode);
+
 rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, REQUEST *request,
 				  fr_ldap_conn_t const *conn, LDAPMessage *entry);
 
@@ -179,6 +223,11 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 
 rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn);
 
+rlm_rcode_t rlm_ldap_cacheable_groupobj_async(TALLOC_CTX *ctx, rlm_ldap_query_t **out, rlm_ldap_thread_t *t,
+					      REQUEST *request);
+
+rlm_rcode_t rlm_ldap_cacheable_groupobj_resume(rlm_ldap_t const *inst, REQUEST *request, rlm_ldap_query_t *query);
+
 rlm_rcode_t rlm_ldap_check_groupobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn,
 					    VALUE_PAIR *check);
 
@@ -196,6 +245,16 @@ void		mod_conn_release(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t
 
 void		*mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *timeout);
 
+int		rlm_ldap_query_search(TALLOC_CTX *ctx, rlm_ldap_query_t **out, rlm_ldap_thread_t *t,
+				      REQUEST *request, char const *dn, int scope, char const *filter,
+				      char const * const *attrs, LDAPControl **serverctrls);
+
+int		rlm_ldap_query_bind(TALLOC_CTX *ctx, rlm_ldap_query_t **out, rlm_ldap_thread_t *t,
+				    REQUEST *request, char const *dn, char const *password);
+
+void		rlm_ldap_thread_mux_open(rlm_ldap_thread_t *t);
+void		rlm_ldap_thread_mux_free(rlm_ldap_thread_t *t);
+
 /*
  *	clients.c - Dynamic clients (bulk load).
  */
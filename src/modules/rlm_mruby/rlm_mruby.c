@@ -521,7 +521,7 @@ extern rad_module_t rlm_mruby;
 rad_module_t rlm_mruby = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "mruby",
-	.type		= RLM_TYPE_THREAD_UNSAFE, /* Not sure */
+	.type		= RLM_TYPE_THREAD_UNSAFE | RLM_TYPE_THREAD_INSTANCE,	/* One mrb_state per thread */
 	.inst_size	= sizeof(rlm_mruby_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
@@ -144,12 +144,37 @@
  *   should attempt the operation again.  The cluster spec says we should attempt the operation
  *   after some time.  This time is configurable.
  *
+ *
+ * Asynchronous interface
+ * ----------------------
+ *
+ *   Modules which can yield should use #fr_redis_command_alloc and #fr_redis_command_send
+ *   instead of the state functions above.
+ *
+ *   Each thread allocates a #fr_redis_cluster_thread_t with #fr_redis_cluster_thread_alloc.
+ *   It opens at most one non-blocking connection per node, on demand.  Commands from all
+ *   of the thread's requests are written to that connection without waiting for earlier
+ *   replies.  Replies are matched to their commands in the order the commands were written.
+ *
+ *   Redirects, '-TRYAGAIN' and connection failures are handled as described above, except:
+ *     - '-TRYAGAIN' waits for retry_delay with a timer, instead of sleeping.
+ *     - If the node a '-MOVE' redirected us to is already known, the master for the key
+ *       slot is updated.  Otherwise remap_needed is set, and 'cluster slots' is written to
+ *       the node on the thread's connection.  Connection failures do the same, asking any
+ *       other active node.  The reply is applied under the mutex, with the same one per
+ *       second limit as other remaps, but only if every node in it is already known.
+ *       Maps with new nodes are left to the blocking remap, as allocating their pools
+ *       would block.
+ *     - Redirects to nodes not in the cluster map are followed by opening a connection to
+ *       the node directly.  No pool is allocated.
+ *
  */
 #include "redis.h"
 #include "cluster.h"
 #include "crc16.h"
 #include <freeradius-devel/rad_assert.h>
 #include <freeradius-devel/cf_parse.h>
+#include <freeradius-devel/io/time.h>
 
 #define KEY_SLOTS		16384			//!< Maximum number of keyslots (should not change).
 
@@ -810,49 +835,21 @@ static int cluster_map_node_validate(redisReply *node, int map_idx, int node_idx
 	return CLUSTER_OP_SUCCESS;
 }
 
-/** Learn a new cluster layout by querying the node that issued the -MOVE
+/** Validate the response to 'cluster slots'
  *
- * Also validates the response from the Redis cluster, so we can be sure that
- * it's well formed, before doing more expensive operations.
+ * Checks the complete map set, so we can be sure that it's well formed, before
+ * doing more expensive operations.
  *
  * @note Errors may be retrieved with fr_strerror().
  *
- * @param[out] out Where to write cluster map.
- * @param[in] conn to use for learning the new cluster map.
+ * @param[in] reply to 'cluster slots'.
  * @return
- *	- CLUSTER_OP_IGNORED if 'cluster slots' returned an error (indicating clustering not supported).
  *	- CLUSTER_OP_SUCCESS on success.
- *	- CLUSTER_OP_FAILED if issuing the command resulted in an error.
- *	- CLUSTER_OP_NO_CONNECTION connection failure.
  *	- CLUSTER_OP_BAD_INPUT on validation failure (bad data returned from Redis).
  */
-static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
+static cluster_rcode_t cluster_map_validate(redisReply *reply)
 {
-	redisReply	*reply;
-	size_t		i = 0;
-
-	*out = NULL;
-
-	reply = redisCommand(conn->handle, "cluster slots");
-	switch (fr_redis_command_status(conn, reply)) {
-	case REDIS_RCODE_RECONNECT:
-		fr_redis_reply_free(reply);
-		fr_strerror_printf("No connections available");
-		return CLUSTER_OP_NO_CONNECTION;
-
-	case REDIS_RCODE_ERROR:
-	default:
-		if (reply && reply->type == REDIS_REPLY_ERROR) {
-			fr_redis_reply_free(reply);
-			fr_strerror_printf("%.*s", (int)reply->len, reply->str);
-			return CLUSTER_OP_IGNORED;
-		}
-		fr_strerror_printf("Unknown client error");
-		return CLUSTER_OP_FAILED;
-
-	case REDIS_RCODE_SUCCESS:
-		break;
-	}
+	size_t i;
 
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		fr_strerror_printf("Bad response to \"cluster slots\" command, expected array got %s",
@@ -880,7 +877,6 @@ static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
 			fr_strerror_printf("Cluster map %zu is wrong type, expected array got %s",
 				   	   i, fr_int2str(redis_reply_types, map->type, "<UNKNOWN>"));
 		error:
-			fr_redis_reply_free(reply);
 			return CLUSTER_OP_BAD_INPUT;
 		}
 
@@ -951,6 +947,56 @@ static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
 			if (cluster_map_node_validate(map->element[j], i, j - 2) < 0) goto error;
 		}
 	}
+	return CLUSTER_OP_SUCCESS;
+}
+
+/** Learn a new cluster layout by querying the node that issued the -MOVE
+ *
+ * Also validates the response from the Redis cluster, so we can be sure that
+ * it's well formed, before doing more expensive operations.
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ *
+ * @param[out] out Where to write cluster map.
+ * @param[in] conn to use for learning the new cluster map.
+ * @return
+ *	- CLUSTER_OP_IGNORED if 'cluster slots' returned an error (indicating clustering not supported).
+ *	- CLUSTER_OP_SUCCESS on success.
+ *	- CLUSTER_OP_FAILED if issuing the command resulted in an error.
+ *	- CLUSTER_OP_NO_CONNECTION connection failure.
+ *	- CLUSTER_OP_BAD_INPUT on validation failure (bad data returned from Redis).
+ */
+static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
+{
+	redisReply	*reply;
+
+	*out = NULL;
+
+	reply = redisCommand(conn->handle, "cluster slots");
+	switch (fr_redis_command_status(conn, reply)) {
+	case REDIS_RCODE_RECONNECT:
+		fr_redis_reply_free(reply);
+		fr_strerror_printf("No connections available");
+		return CLUSTER_OP_NO_CONNECTION;
+
+	case REDIS_RCODE_ERROR:
+	default:
+		if (reply && reply->type == REDIS_REPLY_ERROR) {
+			fr_redis_reply_free(reply);
+			fr_strerror_printf("%.*s", (int)reply->len, reply->str);
+			return CLUSTER_OP_IGNORED;
+		}
+		fr_strerror_printf("Unknown client error");
+		return CLUSTER_OP_FAILED;
+
+	case REDIS_RCODE_SUCCESS:
+		break;
+	}
+
+	if (cluster_map_validate(reply) < 0) {
+		fr_redis_reply_free(reply);
+		return CLUSTER_OP_BAD_INPUT;
+	}
 	*out = reply;
 
 	return CLUSTER_OP_SUCCESS;
@@ -1938,6 +1984,1045 @@ try_again:
 	return REDIS_RCODE_TRY_AGAIN;
 }
 
+/** An asynchronous connection to a cluster node
+ *
+ * Owned by a single thread.  Commands from all of the thread's requests are written
+ * to the same connection back to back, and their replies are matched to them in the
+ * order they were written.
+ */
+typedef struct cluster_async_conn {
+	fr_socket_addr_t		addr;		//!< Address of the node.  Must be first, the
+							//!< connection tree uses #_cluster_node_cmp.
+	char				name[INET6_ADDRSTRLEN];	//!< Node address as a string.
+
+	fr_redis_cluster_thread_t	*thread;	//!< Thread this connection belongs to.
+	redisContext			*handle;	//!< Non-blocking hiredis context.
+
+	bool				connected;	//!< Whether the TCP connection has been established.
+	bool				want_write;	//!< Whether we're waiting for the socket to
+							//!< become writable.
+	bool				dead;		//!< Connection failed, and is waiting to be freed.
+	bool				in_tree;	//!< Whether the connection is in the thread's tree.
+
+	fr_event_timer_t const		*ev;		//!< Connection timeout, or deferred free.
+
+	fr_dlist_t			sent;		//!< Batches of commands awaiting replies, in the
+							//!< order they were written.
+} cluster_async_conn_t;
+
+/** A batch of commands written to a connection
+ */
+typedef struct cluster_async_sent {
+	fr_dlist_t			entry;		//!< Entry in the connection's sent list.
+	fr_redis_command_t		*cmd;		//!< Command the replies belong to.  NULL if the
+							//!< command was freed before its replies arrived,
+							//!< or if this is the connection setup batch.
+	unsigned int			outstanding;	//!< How many replies we're still waiting for.
+	bool				setup;		//!< AUTH and SELECT sent when the connection was opened.
+	bool				remap;		//!< 'cluster slots' sent to remap the cluster.
+} cluster_async_sent_t;
+
+/** Per-thread state for the asynchronous cluster client
+ */
+struct fr_redis_cluster_thread {
+	fr_redis_cluster_t		*cluster;	//!< Cluster shared by all threads.
+	fr_event_list_t			*el;		//!< Event list of the thread.
+	struct timeval			connect_timeout;	//!< How long we wait for new connections.
+	rbtree_t			*conns;		//!< Node connections, by node address.
+
+	bool				remap_sent;	//!< Whether we're waiting for a 'cluster slots' reply.
+	time_t				remap_last;	//!< When we last sent 'cluster slots'.
+};
+
+/** One or more pipelined commands, which must be executed on the same node
+ */
+struct fr_redis_command {
+	fr_redis_cluster_thread_t	*thread;	//!< Thread the command was allocated in.
+	REQUEST				*request;	//!< The current request.
+
+	fr_redis_command_cb_t		callback;	//!< Called when all replies have been received.
+	void				*uctx;		//!< Passed to the callback.
+
+	uint8_t const			*key;		//!< Key used to find the node.
+	size_t				key_len;	//!< Length of the key.
+
+	char				*cmds[FR_REDIS_PIPELINE_MAX];		//!< Formatted commands.
+	size_t				cmds_len[FR_REDIS_PIPELINE_MAX];	//!< Lengths of the formatted commands.
+	unsigned int			num_cmds;	//!< Number of commands in the batch.
+
+	fr_socket_addr_t		addr;		//!< Node the commands were last written to.
+	char				name[INET6_ADDRSTRLEN];	//!< Node address as a string.
+	cluster_async_sent_t		*sent;		//!< Replies we're waiting for.  NULL if the commands
+							//!< aren't in flight.
+	bool				asking;		//!< Prefix the batch with ASKING.
+
+	redisReply			*replies[FR_REDIS_PIPELINE_MAX + 1];	//!< Replies received so far.
+	unsigned int			num_replies;	//!< Number of replies received.
+
+	uint32_t			redirects;	//!< How many redirects we've followed.
+	uint32_t			retries;	//!< How many times we've received TRYAGAIN.
+	uint32_t			reconnects;	//!< How many times our connection failed.
+
+	fr_event_timer_t const		*ev;		//!< Delay before retrying after TRYAGAIN.
+};
+
+static int cluster_async_write(fr_redis_command_t *cmd, fr_socket_addr_t const *addr);
+static void cluster_async_reconnect(fr_redis_command_t *cmd);
+static void cluster_async_remap(fr_redis_cluster_thread_t *thread,
+				fr_socket_addr_t const *ask, fr_socket_addr_t const *failed);
+
+/** Free the replies a command has received
+ *
+ */
+static void cluster_async_replies_free(fr_redis_command_t *cmd)
+{
+	fr_redis_pipeline_free(cmd->replies, cmd->num_replies);
+	cmd->num_replies = 0;
+}
+
+/** Pass the result of a command back to its caller
+ *
+ * On error only the reply that caused the error is kept, in the first element of the
+ * reply array, mirroring #fr_redis_pipeline_result.
+ */
+static void cluster_async_finish(fr_redis_command_t *cmd, fr_redis_rcode_t status, unsigned int err_idx)
+{
+	REQUEST	*request = cmd->request;
+
+	if ((status != REDIS_RCODE_SUCCESS) && (err_idx < cmd->num_replies)) {
+		redisReply *err = cmd->replies[err_idx];
+
+		cmd->replies[err_idx] = NULL;
+		cluster_async_replies_free(cmd);
+		cmd->replies[0] = err;
+		cmd->num_replies = 1;
+	} else if ((status != REDIS_RCODE_SUCCESS) && (status != REDIS_RCODE_NO_SCRIPT)) {
+		cluster_async_replies_free(cmd);
+	}
+
+	if (status != REDIS_RCODE_SUCCESS) REDEBUG("Command failed: %s", fr_strerror());
+
+	cmd->callback(request, status, cmd->replies, cmd->num_replies, cmd->uctx);
+}
+
+/** Retry a command after -TRYAGAIN
+ *
+ */
+static void _cluster_async_retry(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	fr_redis_command_t	*cmd = talloc_get_type_abort(uctx, fr_redis_command_t);
+
+	if (cluster_async_write(cmd, &cmd->addr) < 0) cluster_async_finish(cmd, REDIS_RCODE_RECONNECT, 0);
+}
+
+/** Process the replies to a command
+ *
+ * Follows redirects, and retries commands on -TRYAGAIN.  Everything else is passed
+ * back to the caller.
+ */
+static void cluster_async_process(fr_redis_command_t *cmd)
+{
+	fr_redis_cluster_t	*cluster = cmd->thread->cluster;
+	REQUEST			*request = cmd->request;
+	fr_redis_rcode_t	status = REDIS_RCODE_SUCCESS;
+	unsigned int		i;
+	fr_socket_addr_t	addr;
+	uint16_t		slot;
+
+	/*
+	 *	The reply to ASKING is always +OK.
+	 */
+	if (cmd->asking) {
+		fr_redis_reply_free(cmd->replies[0]);
+		memmove(&cmd->replies[0], &cmd->replies[1], sizeof(cmd->replies[0]) * (cmd->num_replies - 1));
+		cmd->replies[--cmd->num_replies] = NULL;
+		cmd->asking = false;
+	}
+
+	fr_strerror();	/* Clear any outstanding errors */
+
+	for (i = 0; i < cmd->num_replies; i++) {
+		status = fr_redis_command_status(NULL, cmd->replies[i]);
+		if (status != REDIS_RCODE_SUCCESS) break;
+	}
+
+	RDEBUG2("[%s:%i] <<< Returned: %s", cmd->name, cmd->addr.port, fr_int2str(redis_rcodes, status, "<UNKNOWN>"));
+
+	switch (status) {
+	case REDIS_RCODE_SUCCESS:
+	case REDIS_RCODE_NO_SCRIPT:
+	case REDIS_RCODE_ERROR:
+	default:
+		cluster_async_finish(cmd, status, i);
+		return;
+
+	/*
+	 *	Cluster's unstable, try again after retry_delay.
+	 */
+	case REDIS_RCODE_TRY_AGAIN:
+		if (cmd->retries++ >= cluster->conf->max_retries) {
+			fr_strerror_printf("Hit maximum retry attempts");
+			cluster_async_finish(cmd, REDIS_RCODE_ERROR, i);
+			return;
+		}
+		cluster_async_replies_free(cmd);
+
+		if (fr_event_timer_at(cmd, cmd->thread->el, &cmd->ev,
+				      fr_event_list_now(cmd->thread->el) +
+				      fr_time_delta_from_timeval(&cluster->conf->retry_delay),
+				      _cluster_async_retry, cmd) < 0) {
+			cluster_async_finish(cmd, REDIS_RCODE_ERROR, 0);
+		}
+		return;
+
+	/*
+	 *	-MOVED is treated identically to -ASK, except the key slot's
+	 *	master is updated so the next command for the slot goes
+	 *	straight to the right node.
+	 */
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		RDEBUG("Processing redirect \"%s\"", cmd->replies[i]->str);
+		if (cmd->redirects++ >= cluster->conf->max_redirects) {
+			fr_strerror_printf("Reached max_redirects (%i)", cmd->redirects);
+			cluster_async_finish(cmd, REDIS_RCODE_ERROR, i);
+			return;
+		}
+
+		if ((cluster_node_conf_from_redirect(&slot, &addr, cmd->replies[i]) != CLUSTER_OP_SUCCESS) ||
+		    (slot >= KEY_SLOTS)) {
+			fr_strerror_printf("Invalid redirect \"%s\"", cmd->replies[i]->str);
+			cluster_async_finish(cmd, REDIS_RCODE_ERROR, i);
+			return;
+		}
+
+		if ((fr_ipaddr_cmp(&addr.ipaddr, &cmd->addr.ipaddr) == 0) && (addr.port == cmd->addr.port)) {
+			fr_strerror_printf("Node issued redirect to itself");
+			cluster_async_finish(cmd, REDIS_RCODE_ERROR, i);
+			return;
+		}
+
+		if (status == REDIS_RCODE_MOVE) {
+			cluster_node_t	find, *found;
+			bool		remap = false;
+
+			memset(&find, 0, sizeof(find));
+			find.addr = addr;
+
+			pthread_mutex_lock(&cluster->mutex);
+			found = rbtree_finddata(cluster->used_nodes, &find);
+			if (found) {
+				cluster->key_slot[slot].master = found->id;
+			} else {
+				cluster->remap_needed = remap = true;
+			}
+			pthread_mutex_unlock(&cluster->mutex);
+
+			if (remap) cluster_async_remap(cmd->thread, &addr, NULL);
+		} else {
+			cmd->asking = true;
+		}
+
+		cluster_async_replies_free(cmd);
+		cmd->reconnects = 0;
+		cmd->retries = 0;
+		if (cluster_async_write(cmd, &addr) < 0) cluster_async_finish(cmd, REDIS_RCODE_RECONNECT, 0);
+		return;
+	}
+}
+
+/** Free a connection that failed
+ *
+ * Deferred, so we don't free the connection from inside its own I/O handlers.
+ */
+static void _cluster_async_conn_reap(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	talloc_free(uctx);
+}
+
+/** Mark a connection as failed, and retry any commands which were waiting on it
+ *
+ * Errors should be set with fr_strerror_printf before calling this function.
+ */
+static void cluster_async_conn_fail(cluster_async_conn_t *conn)
+{
+	fr_redis_cluster_thread_t	*thread = conn->thread;
+	fr_dlist_t			*entry;
+
+	if (conn->dead) return;
+
+	ERROR("%s [%s:%i]: Connection failed: %s", thread->cluster->log_prefix,
+	      conn->name, conn->addr.port, fr_strerror());
+
+	conn->dead = true;
+	if (conn->in_tree) {
+		rbtree_deletebydata(thread->conns, conn);
+		conn->in_tree = false;
+	}
+	fr_event_fd_delete(thread->el, conn->handle->fd);
+
+	pthread_mutex_lock(&thread->cluster->mutex);
+	thread->cluster->remap_needed = true;
+	pthread_mutex_unlock(&thread->cluster->mutex);
+
+	/*
+	 *	The socket stays open until the connection is freed,
+	 *	so its file descriptor can't be reused by a new
+	 *	connection whilst the event loop still knows about it.
+	 */
+	if (fr_event_timer_at(conn, thread->el, &conn->ev, fr_event_list_now(thread->el),
+			      _cluster_async_conn_reap, conn) < 0) {
+		rad_assert(0);
+	}
+
+	while ((entry = FR_DLIST_FIRST(conn->sent))) {
+		cluster_async_sent_t	*sent = fr_ptr_to_type(cluster_async_sent_t, entry, entry);
+		fr_redis_command_t	*cmd = sent->cmd;
+
+		if (sent->remap) thread->remap_sent = false;
+		fr_dlist_remove(&sent->entry);
+		talloc_free(sent);
+
+		if (!cmd) continue;
+
+		cmd->sent = NULL;
+		cluster_async_replies_free(cmd);
+		cluster_async_reconnect(cmd);
+	}
+
+	cluster_async_remap(thread, NULL, &conn->addr);
+}
+
+/** Apply the reply to a 'cluster slots' command written by #cluster_async_remap
+ *
+ * Maps which contain nodes we don't know about yet are ignored, as allocating
+ * pools for new nodes would block.  remap_needed stays set, and the next blocking
+ * operation remaps the cluster.
+ */
+static void cluster_async_remap_apply(fr_redis_cluster_thread_t *thread, redisReply *reply)
+{
+	fr_redis_cluster_t	*cluster = thread->cluster;
+	cluster_node_t		find;
+	time_t			now;
+	size_t			i, j;
+
+	thread->remap_sent = false;
+
+	/*
+	 *	Clustering not enabled, or not supported
+	 */
+	if (reply->type == REDIS_REPLY_ERROR) {
+		DEBUG2("%s: Ignoring cluster map: %s", cluster->log_prefix, reply->str);
+		pthread_mutex_lock(&cluster->mutex);
+		cluster->remap_needed = false;
+		pthread_mutex_unlock(&cluster->mutex);
+		return;
+	}
+
+	if (cluster_map_validate(reply) < 0) {
+		PERROR("%s: Failed remapping cluster", cluster->log_prefix);
+		return;
+	}
+
+	now = time(NULL);
+	memset(&find, 0, sizeof(find));
+
+	pthread_mutex_lock(&cluster->mutex);
+	if (cluster->remapping || (now == cluster->last_updated)) {
+		pthread_mutex_unlock(&cluster->mutex);
+		DEBUG2("%s: Cluster was remapped less than a second ago, ignoring cluster map",
+		       cluster->log_prefix);
+		return;
+	}
+
+	for (i = 0; i < reply->elements; i++) {
+		redisReply *map = reply->element[i];
+
+		for (j = 2; j < map->elements; j++) {
+			SET_ADDR(find.addr, map->element[j]);
+			if (rbtree_finddata(cluster->used_nodes, &find)) continue;
+
+			pthread_mutex_unlock(&cluster->mutex);
+			DEBUG2("%s: Cluster map contains new nodes, leaving remap to a blocking operation",
+			       cluster->log_prefix);
+			return;
+		}
+	}
+
+	if (cluster_map_apply(cluster, reply) < 0) {
+		pthread_mutex_unlock(&cluster->mutex);
+		PERROR("%s: Failed remapping cluster", cluster->log_prefix);
+		return;
+	}
+	cluster->remap_needed = false;
+	pthread_mutex_unlock(&cluster->mutex);
+
+	INFO("%s: Cluster remapped, map consists of %zu key ranges", cluster->log_prefix, reply->elements);
+}
+
+/** Start or stop watching for the connection becoming writable
+ *
+ */
+static int cluster_async_conn_write_watch(cluster_async_conn_t *conn, bool want_write);
+
+/** Read as many replies as are available, and pass them to their commands
+ *
+ */
+static void _cluster_async_conn_read(UNUSED fr_event_list_t *el, UNUSED int sock, UNUSED int flags, void *uctx)
+{
+	cluster_async_conn_t	*conn = talloc_get_type_abort(uctx, cluster_async_conn_t);
+
+	if (redisBufferRead(conn->handle) != REDIS_OK) {
+		fr_strerror_printf("%s", conn->handle->errstr);
+		cluster_async_conn_fail(conn);
+		return;
+	}
+
+	while (!conn->dead) {
+		redisReply		*reply = NULL;
+		fr_dlist_t		*entry;
+		cluster_async_sent_t	*sent;
+		fr_redis_command_t	*cmd;
+
+		if (redisGetReplyFromReader(conn->handle, (void **)&reply) != REDIS_OK) {
+			fr_strerror_printf("%s", conn->handle->errstr);
+			cluster_async_conn_fail(conn);
+			return;
+		}
+		if (!reply) return;	/* Need more data */
+
+		entry = FR_DLIST_FIRST(conn->sent);
+		if (!entry) {
+			fr_redis_reply_free(reply);
+			fr_strerror_printf("Received reply with no outstanding commands");
+			cluster_async_conn_fail(conn);
+			return;
+		}
+		sent = fr_ptr_to_type(cluster_async_sent_t, entry, entry);
+		cmd = sent->cmd;
+
+		if (sent->setup) {
+			if (reply->type == REDIS_REPLY_ERROR) {
+				fr_strerror_printf("Failed setting up connection: %s", reply->str);
+				fr_redis_reply_free(reply);
+				cluster_async_conn_fail(conn);
+				return;
+			}
+			fr_redis_reply_free(reply);
+		} else if (sent->remap) {
+			cluster_async_remap_apply(conn->thread, reply);
+			fr_redis_reply_free(reply);
+		} else if (!cmd) {
+			fr_redis_reply_free(reply);	/* Command was cancelled */
+		} else {
+			if (!rad_cond_assert(cmd->num_replies < (sizeof(cmd->replies) / sizeof(*cmd->replies)))) {
+				fr_redis_reply_free(reply);
+				fr_strerror_printf("Too many replies");
+				cluster_async_conn_fail(conn);
+				return;
+			}
+			cmd->replies[cmd->num_replies++] = reply;
+		}
+
+		if (--sent->outstanding > 0) continue;
+
+		fr_dlist_remove(&sent->entry);
+		talloc_free(sent);
+
+		if (cmd) {
+			cmd->sent = NULL;
+			cluster_async_process(cmd);
+		}
+	}
+}
+
+/** Complete the connection, and write out as much of the output buffer as the socket will take
+ *
+ */
+static void _cluster_async_conn_write(UNUSED fr_event_list_t *el, int sock, UNUSED int flags, void *uctx)
+{
+	cluster_async_conn_t	*conn = talloc_get_type_abort(uctx, cluster_async_conn_t);
+	int			done = 0;
+
+	if (!conn->connected) {
+		int		err = 0;
+		socklen_t	len = sizeof(err);
+
+		if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+		if (err) {
+			fr_strerror_printf("%s", fr_syserror(err));
+			cluster_async_conn_fail(conn);
+			return;
+		}
+
+		DEBUG2("%s [%s:%i]: Connected", conn->thread->cluster->log_prefix, conn->name, conn->addr.port);
+		conn->connected = true;
+		if (conn->ev) fr_event_timer_delete(conn->thread->el, &conn->ev);
+	}
+
+	if (redisBufferWrite(conn->handle, &done) != REDIS_OK) {
+		fr_strerror_printf("%s", conn->handle->errstr);
+		cluster_async_conn_fail(conn);
+		return;
+	}
+
+	if (done) cluster_async_conn_write_watch(conn, false);
+}
+
+static void _cluster_async_conn_error(UNUSED fr_event_list_t *el, UNUSED int sock, UNUSED int flags,
+				      int fd_errno, void *uctx)
+{
+	cluster_async_conn_t	*conn = talloc_get_type_abort(uctx, cluster_async_conn_t);
+
+	fr_strerror_printf("%s", fd_errno ? fr_syserror(fd_errno) : "Connection closed by peer");
+	cluster_async_conn_fail(conn);
+}
+
+static int cluster_async_conn_write_watch(cluster_async_conn_t *conn, bool want_write)
+{
+	if (conn->want_write == want_write) return 0;
+
+	if (fr_event_fd_insert(conn, conn->thread->el, conn->handle->fd,
+			       _cluster_async_conn_read,
+			       want_write ? _cluster_async_conn_write : NULL,
+			       _cluster_async_conn_error, conn) < 0) {
+		cluster_async_conn_fail(conn);
+		return -1;
+	}
+	conn->want_write = want_write;
+
+	return 0;
+}
+
+static void _cluster_async_conn_timeout(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	cluster_async_conn_t	*conn = talloc_get_type_abort(uctx, cluster_async_conn_t);
+
+	fr_strerror_printf("Timed out connecting");
+	cluster_async_conn_fail(conn);
+}
+
+/** Close a node connection
+ *
+ * Commands still waiting on the connection are left for their owners to free.
+ */
+static int _cluster_async_conn_free(cluster_async_conn_t *conn)
+{
+	fr_dlist_t	*entry;
+
+	for (entry = FR_DLIST_FIRST(conn->sent); entry; entry = FR_DLIST_NEXT(conn->sent, entry)) {
+		cluster_async_sent_t *sent = fr_ptr_to_type(cluster_async_sent_t, entry, entry);
+
+		if (sent->cmd) sent->cmd->sent = NULL;
+		if (sent->remap) conn->thread->remap_sent = false;
+	}
+
+	if (conn->in_tree) rbtree_deletebydata(conn->thread->conns, conn);
+	if (!conn->dead) fr_event_fd_delete(conn->thread->el, conn->handle->fd);
+	redisFree(conn->handle);
+
+	return 0;
+}
+
+/** Open a non-blocking connection to a node
+ *
+ * AUTH and SELECT are queued ahead of any commands, so the connection can be
+ * used straight away.
+ */
+static cluster_async_conn_t *cluster_async_conn_alloc(fr_redis_cluster_thread_t *thread, fr_socket_addr_t const *addr)
+{
+	fr_redis_cluster_t	*cluster = thread->cluster;
+	cluster_async_conn_t	*conn;
+	unsigned int		setup = 0;
+
+	MEM(conn = talloc_zero(thread, cluster_async_conn_t));
+	conn->addr = *addr;
+	conn->thread = thread;
+	FR_DLIST_INIT(conn->sent);
+
+	if (!inet_ntop(addr->ipaddr.af, &addr->ipaddr.addr, conn->name, sizeof(conn->name))) {
+		fr_strerror_printf("Invalid node address");
+	error:
+		talloc_free(conn);
+		return NULL;
+	}
+
+	DEBUG2("%s [%s:%i]: Connecting", cluster->log_prefix, conn->name, conn->addr.port);
+
+	conn->handle = redisConnectNonBlock(conn->name, conn->addr.port);
+	if (!conn->handle) {
+		fr_strerror_printf("Failed allocating connection");
+		goto error;
+	}
+	if (conn->handle->err) {
+		fr_strerror_printf("%s", conn->handle->errstr);
+		redisFree(conn->handle);
+		goto error;
+	}
+	talloc_set_destructor(conn, _cluster_async_conn_free);
+
+	if (cluster->conf->password) {
+		redisAppendCommand(conn->handle, "AUTH %s", cluster->conf->password);
+		setup++;
+	}
+	if (cluster->conf->database) {
+		redisAppendCommand(conn->handle, "SELECT %i", cluster->conf->database);
+		setup++;
+	}
+	if (setup) {
+		cluster_async_sent_t *sent;
+
+		MEM(sent = talloc_zero(conn, cluster_async_sent_t));
+		sent->setup = true;
+		sent->outstanding = setup;
+		fr_dlist_insert_tail(&conn->sent, &sent->entry);
+	}
+
+	/*
+	 *	The socket becomes writable when the connection
+	 *	completes (or fails).
+	 */
+	if (fr_event_fd_insert(conn, thread->el, conn->handle->fd,
+			       _cluster_async_conn_read, _cluster_async_conn_write,
+			       _cluster_async_conn_error, conn) < 0) goto error;
+	conn->want_write = true;
+
+	if (fr_event_timer_at(conn, thread->el, &conn->ev,
+			      fr_event_list_now(thread->el) + fr_time_delta_from_timeval(&thread->connect_timeout),
+			      _cluster_async_conn_timeout, conn) < 0) {
+		goto error;
+	}
+
+	if (!rbtree_insert(thread->conns, conn)) {
+		fr_strerror_printf("Duplicate connection");
+		goto error;
+	}
+	conn->in_tree = true;
+
+	return conn;
+}
+
+/** Write a command's batch to the connection for a node
+ *
+ * The data is buffered, and written when the socket becomes writable, so commands
+ * from other requests are written out in the same system call.
+ *
+ * @param[in] cmd	to write.
+ * @param[in] addr	of the node to write it to.
+ * @return
+ *	- 0 on success.
+ *	- -1 if we couldn't get a connection to the node.
+ */
+static int cluster_async_write(fr_redis_command_t *cmd, fr_socket_addr_t const *addr)
+{
+	fr_redis_cluster_thread_t	*thread = cmd->thread;
+	REQUEST				*request = cmd->request;
+	cluster_async_conn_t		find, *conn;
+	cluster_async_sent_t		*sent;
+	unsigned int			i;
+
+	rad_assert(!cmd->sent);
+
+	memset(&find, 0, sizeof(find));
+	find.addr = *addr;
+
+	conn = rbtree_finddata(thread->conns, &find);
+	if (!conn) {
+		conn = cluster_async_conn_alloc(thread, addr);
+		if (!conn) return -1;
+	}
+	if (cluster_async_conn_write_watch(conn, true) < 0) return -1;
+
+	if (cmd->asking) redisAppendCommand(conn->handle, "ASKING");
+	for (i = 0; i < cmd->num_cmds; i++) {
+		if (redisAppendFormattedCommand(conn->handle, cmd->cmds[i], cmd->cmds_len[i]) != REDIS_OK) {
+			fr_strerror_printf("%s", conn->handle->errstr);
+			cluster_async_conn_fail(conn);
+			return -1;
+		}
+	}
+
+	MEM(sent = talloc_zero(conn, cluster_async_sent_t));
+	sent->cmd = cmd;
+	sent->outstanding = cmd->num_cmds + (cmd->asking ? 1 : 0);
+	fr_dlist_insert_tail(&conn->sent, &sent->entry);
+
+	cmd->sent = sent;
+	cmd->addr = *addr;
+	strlcpy(cmd->name, conn->name, sizeof(cmd->name));
+
+	RDEBUG2("[%s:%i] >>> Sending %u command(s)", conn->name, conn->addr.port, sent->outstanding);
+
+	return 0;
+}
+
+/** Write 'cluster slots' to a node, so the cluster can be remapped without blocking
+ *
+ * Limited to one in flight per thread, and one per second per thread.  Nothing is
+ * written if the cluster was remapped less than a second ago.
+ *
+ * @param[in] thread	to write the command with.
+ * @param[in] ask	node to ask.  If NULL, any other active node is asked.
+ * @param[in] failed	node to avoid asking, as its connection failed.  May be NULL.
+ */
+static void cluster_async_remap(fr_redis_cluster_thread_t *thread,
+				fr_socket_addr_t const *ask, fr_socket_addr_t const *failed)
+{
+	fr_redis_cluster_t	*cluster = thread->cluster;
+	cluster_async_conn_t	find, *conn;
+	cluster_async_sent_t	*sent;
+	fr_socket_addr_t	addr;
+	time_t			now;
+	uint8_t			i;
+
+	if (thread->remap_sent) return;
+
+	now = time(NULL);
+	if (now == thread->remap_last) return;
+
+	pthread_mutex_lock(&cluster->mutex);
+	if (cluster->remapping || (now == cluster->last_updated)) {
+		pthread_mutex_unlock(&cluster->mutex);
+		return;
+	}
+
+	if (ask) {
+		addr = *ask;
+	} else {
+		/*
+		 *	Node 0 is reserved.
+		 */
+		for (i = 1; i <= cluster->conf->max_nodes; i++) {
+			cluster_node_t *node = &cluster->node[i];
+
+			if (!node->is_active) continue;
+			if (failed && (fr_ipaddr_cmp(&node->addr.ipaddr, &failed->ipaddr) == 0) &&
+			    (node->addr.port == failed->port)) continue;
+
+			addr = node->addr;
+			break;
+		}
+		if (i > cluster->conf->max_nodes) {
+			pthread_mutex_unlock(&cluster->mutex);
+			return;
+		}
+	}
+	pthread_mutex_unlock(&cluster->mutex);
+
+	thread->remap_last = now;
+
+	memset(&find, 0, sizeof(find));
+	find.addr = addr;
+
+	conn = rbtree_finddata(thread->conns, &find);
+	if (!conn) {
+		conn = cluster_async_conn_alloc(thread, &addr);
+		if (!conn) {
+			PERROR("%s: Failed requesting cluster map", cluster->log_prefix);
+			return;
+		}
+	}
+	if (cluster_async_conn_write_watch(conn, true) < 0) return;
+
+	if (redisAppendCommand(conn->handle, "CLUSTER SLOTS") != REDIS_OK) {
+		fr_strerror_printf("%s", conn->handle->errstr);
+		cluster_async_conn_fail(conn);
+		return;
+	}
+
+	MEM(sent = talloc_zero(conn, cluster_async_sent_t));
+	sent->remap = true;
+	sent->outstanding = 1;
+	fr_dlist_insert_tail(&conn->sent, &sent->entry);
+
+	thread->remap_sent = true;
+
+	DEBUG2("%s [%s:%i]: Requesting cluster map", cluster->log_prefix, conn->name, conn->addr.port);
+}
+
+/** Determine which node a key's commands should be written to
+ *
+ */
+static int cluster_async_node_addr(fr_socket_addr_t *out, fr_redis_cluster_t *cluster, REQUEST *request,
+				   uint8_t const *key, size_t key_len)
+{
+	cluster_key_slot_t *key_slot;
+
+	pthread_mutex_lock(&cluster->mutex);
+	if (rbtree_num_elements(cluster->used_nodes) == 0) {
+		pthread_mutex_unlock(&cluster->mutex);
+		fr_strerror_printf("No nodes in cluster");
+		return -1;
+	}
+	key_slot = cluster_slot_by_key(cluster, request, key, key_len);
+	*out = cluster->node[key_slot->master].addr;
+	pthread_mutex_unlock(&cluster->mutex);
+
+	return 0;
+}
+
+/** Write a command to a new connection after its connection failed
+ *
+ */
+static void cluster_async_reconnect(fr_redis_command_t *cmd)
+{
+	fr_socket_addr_t addr;
+
+	if (cmd->reconnects++ > 0) {
+		cluster_async_finish(cmd, REDIS_RCODE_RECONNECT, 0);
+		return;
+	}
+
+	if ((cluster_async_node_addr(&addr, cmd->thread->cluster, cmd->request, cmd->key, cmd->key_len) < 0) ||
+	    (cluster_async_write(cmd, &addr) < 0)) {
+		cluster_async_finish(cmd, REDIS_RCODE_RECONNECT, 0);
+	}
+}
+
+static int _cluster_async_conn_free_walk(UNUSED void *ctx, void *data)
+{
+	cluster_async_conn_t *conn = talloc_get_type_abort(data, cluster_async_conn_t);
+
+	conn->in_tree = false;
+	talloc_free(conn);
+
+	return 2;	/* Delete the node and continue */
+}
+
+/** Close all of a thread's node connections
+ *
+ */
+static int _fr_redis_cluster_thread_free(fr_redis_cluster_thread_t *thread)
+{
+	rbtree_walk(thread->conns, RBTREE_DELETE_ORDER, _cluster_async_conn_free_walk, NULL);
+
+	return 0;
+}
+
+/** Allocate a thread's asynchronous cluster client
+ *
+ * Connections to cluster nodes are opened on demand, and are only used by the
+ * thread that owns el.
+ *
+ * @param[in] ctx	to allocate the client in.  Usually the module's thread instance data.
+ * @param[in] cluster	to issue commands against.
+ * @param[in] el	of the thread.
+ * @return
+ *	- New #fr_redis_cluster_thread_t on success.
+ *	- NULL on error.
+ */
+fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_redis_cluster_t *cluster,
+							 fr_event_list_t *el)
+{
+	fr_redis_cluster_thread_t	*thread;
+	uint8_t				i;
+
+	thread = talloc_zero(ctx, fr_redis_cluster_thread_t);
+	if (!thread) return NULL;
+
+	thread->cluster = cluster;
+	thread->el = el;
+	thread->conns = rbtree_create(thread, _cluster_node_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!thread->conns) {
+		talloc_free(thread);
+		return NULL;
+	}
+	talloc_set_destructor(thread, _fr_redis_cluster_thread_free);
+
+	/*
+	 *	All nodes share the same pool configuration.
+	 */
+	thread->connect_timeout = (struct timeval){ .tv_sec = 3 };
+	pthread_mutex_lock(&cluster->mutex);
+	for (i = 0; i < cluster->conf->max_nodes; i++) {
+		if (!cluster->node[i].pool) continue;
+
+		thread->connect_timeout = fr_pool_timeout(cluster->node[i].pool);
+		break;
+	}
+	pthread_mutex_unlock(&cluster->mutex);
+
+	return thread;
+}
+
+/** Free a command's formatted commands and replies, and stop waiting for its replies
+ *
+ */
+static int _fr_redis_command_free(fr_redis_command_t *cmd)
+{
+	if (cmd->sent) cmd->sent->cmd = NULL;	/* Replies are discarded when they arrive */
+	fr_redis_pipeline_free(cmd->replies, cmd->num_replies);
+
+	return 0;
+}
+
+/** Allocate a new pipelined command
+ *
+ * Append commands with #fr_redis_command_append, then write them with
+ * #fr_redis_command_send.  The callback is called when all of the replies have
+ * been received, or the command fails.
+ *
+ * Freeing the command cancels it.  Any replies still outstanding are discarded
+ * when they arrive.
+ *
+ * @param[in] ctx	to allocate the command in.
+ * @param[in] thread	client to write the command with.
+ * @param[in] request	The current request.
+ * @param[in] key	to resolve to a cluster node.  If key is NULL or key_len is 0 a
+ *			random slot will be chosen.
+ * @param[in] key_len	Length of the key.
+ * @param[in] callback	to call with the replies.
+ * @param[in] uctx	to pass to the callback.
+ * @return a new #fr_redis_command_t.
+ */
+fr_redis_command_t *fr_redis_command_alloc(TALLOC_CTX *ctx, fr_redis_cluster_thread_t *thread, REQUEST *request,
+					   uint8_t const *key, size_t key_len,
+					   fr_redis_command_cb_t callback, void *uctx)
+{
+	fr_redis_command_t *cmd;
+
+	MEM(cmd = talloc_zero(ctx, fr_redis_command_t));
+	talloc_set_destructor(cmd, _fr_redis_command_free);
+
+	cmd->thread = thread;
+	cmd->request = request;
+	cmd->callback = callback;
+	cmd->uctx = uctx;
+	if (key && key_len) {
+		MEM(cmd->key = talloc_memdup(cmd, key, key_len));
+		cmd->key_len = key_len;
+	}
+
+	return cmd;
+}
+
+/** Append a command which has already been formatted with redisFormatCommand
+ *
+ * @param[in] cmd	to append to.
+ * @param[in] in	formatted command.
+ * @param[in] inlen	length of the formatted command.
+ * @return
+ *	- 0 on success.
+ *	- -1 if there are too many commands in the batch.
+ */
+int fr_redis_command_append_formatted(fr_redis_command_t *cmd, char const *in, size_t inlen)
+{
+	if (cmd->num_cmds >= FR_REDIS_PIPELINE_MAX) {
+		fr_strerror_printf("Too many pipelined commands");
+		return -1;
+	}
+
+	MEM(cmd->cmds[cmd->num_cmds] = talloc_memdup(cmd, in, inlen));
+	cmd->cmds_len[cmd->num_cmds++] = inlen;
+
+	return 0;
+}
+
+/** Append a command to the batch
+ *
+ * @param[in] cmd	to append to.
+ * @param[in] fmt	hiredis format string.
+ * @param[in] ap	arguments for the format string.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_redis_command_vappend(fr_redis_command_t *cmd, char const *fmt, va_list ap)
+{
+	char	*buff;
+	int	len;
+	int	ret;
+
+	len = redisvFormatCommand(&buff, fmt, ap);
+	if (len < 0) {
+		fr_strerror_printf("Invalid command format");
+		return -1;
+	}
+	ret = fr_redis_command_append_formatted(cmd, buff, (size_t)len);
+	free(buff);
+
+	return ret;
+}
+
+/** Append a command to the batch
+ *
+ * @param[in] cmd	to append to.
+ * @param[in] fmt	hiredis format string.
+ * @param[in] ...	arguments for the format string.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_redis_command_append(fr_redis_command_t *cmd, char const *fmt, ...)
+{
+	va_list	ap;
+	int	ret;
+
+	va_start(ap, fmt);
+	ret = fr_redis_command_vappend(cmd, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/** Append a command to the batch from an argument vector
+ *
+ * @param[in] cmd	to append to.
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Arguments, the first being the command name.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_redis_command_append_argv(fr_redis_command_t *cmd, int argc, char const **argv)
+{
+	char	*buff;
+	int	len;
+	int	ret;
+
+	len = redisFormatCommandArgv(&buff, argc, argv, NULL);
+	if (len < 0) {
+		fr_strerror_printf("Invalid command");
+		return -1;
+	}
+	ret = fr_redis_command_append_formatted(cmd, buff, (size_t)len);
+	free(buff);
+
+	return ret;
+}
+
+/** Write a command to the node responsible for its key
+ *
+ * The callback is never called from within this function, so the caller can
+ * yield after it returns successfully.
+ *
+ * @param[in] cmd	to send.
+ * @return
+ *	- 0 on success.  The callback will be called with the result.
+ *	- -1 on failure.  The callback will not be called.
+ */
+int fr_redis_command_send(fr_redis_command_t *cmd)
+{
+	REQUEST			*request = cmd->request;
+	fr_socket_addr_t	addr;
+
+	if (!rad_cond_assert(cmd->num_cmds > 0) || !rad_cond_assert(!cmd->sent)) return -1;
+
+	cluster_async_replies_free(cmd);
+	cmd->redirects = 0;
+	cmd->retries = 0;
+	cmd->reconnects = 0;
+	cmd->asking = false;
+
+	if ((cluster_async_node_addr(&addr, cmd->thread->cluster, request, cmd->key, cmd->key_len) < 0) ||
+	    (cluster_async_write(cmd, &addr) < 0)) {
+		REDEBUG("Failed sending command: %s", fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Get the pool associated with a node in the cluster
  *
  * @note This is used for testing only.  It's not ifdef'd out because
@@ -32,8 +32,27 @@
 RCSIDH(cluster_h, "$Id$")
 
 #include <freeradius-devel/pool.h>
+#include <freeradius-devel/event.h>
+
+#define FR_REDIS_PIPELINE_MAX		8	//!< Maximum number of commands in a #fr_redis_command_t.
 
 typedef struct fr_redis_cluster fr_redis_cluster_t;
+typedef struct fr_redis_cluster_thread fr_redis_cluster_thread_t;
+typedef struct fr_redis_command fr_redis_command_t;
+
+/** Called when all the replies to a pipelined command have been received
+ *
+ * @param[in] request		The current request.
+ * @param[in] status		of the first reply that wasn't a success, or #REDIS_RCODE_SUCCESS.
+ * @param[in] replies		On success, one per command.  On error, the reply which caused
+ *				the error (if any).  Owned by the command, and freed with it.
+ *				Set elements to NULL to keep them.  The callback may free
+ *				the command.
+ * @param[in] num_replies	Number of elements in replies.
+ * @param[in] uctx		passed to #fr_redis_command_alloc.
+ */
+typedef void (*fr_redis_command_cb_t)(REQUEST *request, fr_redis_rcode_t status,
+				      redisReply *replies[], size_t num_replies, void *uctx);
 
 /** Redis connection sequence state
  *
@@ -75,6 +94,27 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 					     fr_redis_cluster_t *cluster, REQUEST *request,
 					     fr_redis_rcode_t status, redisReply **reply);
 
+/*
+ *	Pipeline commands from many requests over one non-blocking
+ *	connection per node, per thread.
+ */
+fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_redis_cluster_t *cluster,
+							 fr_event_list_t *el);
+
+fr_redis_command_t	*fr_redis_command_alloc(TALLOC_CTX *ctx, fr_redis_cluster_thread_t *thread, REQUEST *request,
+						uint8_t const *key, size_t key_len,
+						fr_redis_command_cb_t callback, void *uctx);
+
+int			fr_redis_command_append_formatted(fr_redis_command_t *cmd, char const *in, size_t inlen);
+
+int			fr_redis_command_vappend(fr_redis_command_t *cmd, char const *fmt, va_list ap);
+
+int			fr_redis_command_append(fr_redis_command_t *cmd, char const *fmt, ...);
+
+int			fr_redis_command_append_argv(fr_redis_command_t *cmd, int argc, char const **argv);
+
+int			fr_redis_command_send(fr_redis_command_t *cmd);
+
 /*
  *	Useful for running commands over every node, such as PING
  *	or KEYS.
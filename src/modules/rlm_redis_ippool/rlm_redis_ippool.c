@@ -402,165 +402,223 @@ static void ippool_action_print(REQUEST *request, ippool_action_t action,
 	talloc_free(gateway_str);
 }
 
-/** Execute a script against Redis cluster
- *
- * Handles uploading the script to the server if required.
+
+/** Per-thread instance data
  *
- * @note All replies will be freed on error.
+ */
+typedef struct rlm_redis_ippool_thread {
+	fr_redis_cluster_thread_t	*cluster;	//!< Pipelined connections to the cluster nodes.
+} rlm_redis_ippool_thread_t;
+
+/** State of a pool operation, whilst the request is yielded
  *
- * @param[out] out Where to write Redis reply object resulting from the command.
- * @param[in] request The current request.
- * @param[in] cluster configuration.
- * @param[in] key to use to determine the cluster node.
- * @param[in] key_len length of the key.
- * @param[in] wait_num If > 0 wait until this many slaves have replicated the data
- *	from the last command.
- * @param[in] wait_timeout How long to wait for slaves.
- * @param[in] digest of script.
- * @param[in] script to upload.
- * @param[in] cmd EVALSHA command to execute.
- * @param[in] ... Arguments for the eval command.
- * @return status of the command.
  */
-static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_redis_cluster_t *cluster,
-				      uint8_t const *key, size_t key_len,
-				      uint32_t wait_num, uint32_t wait_timeout,
-				      char const digest[], char const *script,
-				      char const *cmd, ...)
+typedef struct ippool_ctx {
+	rlm_redis_ippool_t const	*inst;
+	rlm_redis_ippool_thread_t	*t;
+	ippool_action_t			action;		//!< What we're doing to the pool.
+
+	uint8_t const			*key;		//!< Pool name, used to find the cluster node.
+	size_t				key_len;	//!< Length of the pool name.
+
+	char const			*digest;	//!< Of the script.
+	char const			*script;	//!< To upload if the node doesn't have it.
+	char				*evalsha;	//!< Formatted EVALSHA command.
+	size_t				evalsha_len;	//!< Length of the EVALSHA command.
+	bool				loading;	//!< Whether we're uploading the script.
+
+	char const			*ip_str;	//!< Requested address, for updates and releases.
+	uint32_t			expires;	//!< Lease time, for updates.
+
+	fr_redis_command_t		*cmd;		//!< Command in flight.
+	fr_redis_rcode_t		status;		//!< Of the script.
+	redisReply			*reply;		//!< Result of the script.
+} ippool_ctx_t;
+
+static int _ippool_ctx_free(ippool_ctx_t *ctx)
 {
-	fr_redis_conn_t			*conn;
-	redisReply			*replies[5];	/* Must be equal to the maximum number of pipelined commands */
-	size_t				reply_cnt = 0, i;
+	fr_redis_reply_free(ctx->reply);
 
-	fr_redis_cluster_state_t	state;
-	fr_redis_rcode_t		s_ret, status;
-	unsigned int			pipelined = 0;
+	return 0;
+}
 
-	va_list				ap;
+static int ippool_script_send(ippool_ctx_t *ctx, REQUEST *request, bool load);
 
-	*out = NULL;
+/** Process the replies to a script invocation
+ *
+ * Handles uploading the script to the server if required.
+ */
+static void _ippool_script_reply(REQUEST *request, fr_redis_rcode_t status,
+				 redisReply *replies[], size_t reply_cnt, void *uctx)
+{
+	ippool_ctx_t	*ctx = talloc_get_type_abort(uctx, ippool_ctx_t);
+	uint32_t	wait_num = ctx->inst->wait_num;
+	size_t		i;
 
-	va_start(ap, cmd);
+	/*
+	 *	Last command failed with NOSCRIPT, this means
+	 *	we have to send the Lua script up to the node
+	 *	so it can be cached.
+	 */
+	if ((status == REDIS_RCODE_NO_SCRIPT) && !ctx->loading) {
+		RDEBUG3("Loading script 0x%s", ctx->digest);
+		if (ippool_script_send(ctx, request, true) == 0) return;
+		status = REDIS_RCODE_ERROR;
+	}
+	ctx->status = status;
+	if (status != REDIS_RCODE_SUCCESS) goto finish;
 
-	for (s_ret = fr_redis_cluster_state_init(&state, &conn, cluster, request, key, key_len, false);
-	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
-	     s_ret = fr_redis_cluster_state_next(&state, &conn, cluster, request, status, &replies[0])) {
-	     	va_list	copy;
-
-	     	RDEBUG3("Calling script 0x%s", digest);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
-		pipelined = 1;
-		if (wait_num) {
-			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, wait_timeout);
-			pipelined++;
+	if (ctx->loading) {
+		if (RDEBUG_ENABLED3) for (i = 0; i < reply_cnt; i++) {
+			fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
 		}
-		reply_cnt = fr_redis_pipeline_result(&pipelined, &status,
-						     replies, sizeof(replies) / sizeof(*replies),
-						     conn);
-		if (status != REDIS_RCODE_NO_SCRIPT) continue;
 
-		/*
-		 *	Last command failed with NOSCRIPT, this means
-		 *	we have to send the Lua script up to the node
-		 *	so it can be cached.
-		 */
-	     	RDEBUG3("Loading script 0x%s", digest);
-		redisAppendCommand(conn->handle, "MULTI");
-		redisAppendCommand(conn->handle, "SCRIPT LOAD %s", script);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
-		redisAppendCommand(conn->handle, "EXEC");
-		pipelined = 4;
-		if (wait_num) {
-			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, wait_timeout);
-			pipelined++;
+		if (replies[3]->type != REDIS_REPLY_ARRAY) {
+			REDEBUG("Bad response to EXEC, expected array got %s",
+				fr_int2str(redis_reply_types, replies[3]->type, "<UNKNOWN>"));
+		error:
+			ctx->status = REDIS_RCODE_ERROR;
+			goto finish;
 		}
-
-		reply_cnt = fr_redis_pipeline_result(&pipelined, &status,
-						     replies, sizeof(replies) / sizeof(*replies),
-						     conn);
-		if (status == REDIS_RCODE_SUCCESS) {
-			if (RDEBUG_ENABLED3) for (i = 0; i < reply_cnt; i++) {
-				fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
-			}
-
-			if (replies[3]->type != REDIS_REPLY_ARRAY) {
-				REDEBUG("Bad response to EXEC, expected array got %s",
-					fr_int2str(redis_reply_types, replies[3]->type, "<UNKNOWN>"));
-			error:
-				fr_redis_pipeline_free(replies, reply_cnt);
-				status = REDIS_RCODE_ERROR;
-				goto finish;
-			}
-			if (replies[3]->elements != 2) {
-				REDEBUG("Bad response to EXEC, expected 2 result elements, got %zu",
-					replies[3]->elements);
-				goto error;
-			}
-			if (replies[3]->element[0]->type != REDIS_REPLY_STRING) {
-				REDEBUG("Bad response to SCRIPT LOAD, expected string got %s",
-					fr_int2str(redis_reply_types, replies[3]->element[0]->type, "<UNKNOWN>"));
-				goto error;
-			}
-			if (strcmp(replies[3]->element[0]->str, digest) != 0) {
-				RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s",
-					digest, replies[3]->element[0]->str);
-				goto error;
-			}
+		if (replies[3]->elements != 2) {
+			REDEBUG("Bad response to EXEC, expected 2 result elements, got %zu",
+				replies[3]->elements);
+			goto error;
+		}
+		if (replies[3]->element[0]->type != REDIS_REPLY_STRING) {
+			REDEBUG("Bad response to SCRIPT LOAD, expected string got %s",
+				fr_int2str(redis_reply_types, replies[3]->element[0]->type, "<UNKNOWN>"));
+			goto error;
+		}
+		if (strcmp(replies[3]->element[0]->str, ctx->digest) != 0) {
+			RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s",
+				ctx->digest, replies[3]->element[0]->str);
+			goto error;
 		}
 	}
-	if (s_ret != REDIS_RCODE_SUCCESS) goto error;
 
+	/*
+	 *	The remaining replies are freed with the command.
+	 */
 	switch (reply_cnt) {
 	case 2:	/* EVALSHA with wait */
 		if (ippool_wait_check(request, wait_num, replies[1]) < 0) goto error;
-		fr_redis_reply_free(replies[1]);	/* Free the wait response */
-		break;
+		/* FALL-THROUGH */
 
 	case 1:	/* EVALSHA */
-		*out = replies[0];
+		ctx->reply = replies[0];
+		replies[0] = NULL;
 		break;
 
 	case 5: /* LOADSCRIPT + EVALSHA + WAIT */
 		if (ippool_wait_check(request, wait_num, replies[4]) < 0) goto error;
-		fr_redis_reply_free(replies[4]);	/* Free the wait response */
 		/* FALL-THROUGH */
 
 	case 4: /* LOADSCRIPT + EVALSHA */
-		fr_redis_reply_free(replies[2]);	/* Free the queued cmd response*/
-		fr_redis_reply_free(replies[1]);	/* Free the queued script load response */
-		fr_redis_reply_free(replies[0]);	/* Free the queued multi response */
-		*out = replies[3]->element[1];
+		ctx->reply = replies[3]->element[1];
 		replies[3]->element[1] = NULL;		/* Prevent double free */
-		fr_redis_reply_free(replies[3]);	/* This works because hiredis checks for NULL elements */
 		break;
 
-	case 0:
+	default:
 		break;
 	}
 
 finish:
+	unlang_resumable(request);
+}
+
+/** Send a script invocation to the Redis cluster
+ *
+ * @param[in] ctx	holding the formatted EVALSHA command.
+ * @param[in] request	The current request.
+ * @param[in] load	If true, upload the script in the same transaction.
+ * @return
+ *	- 0 on success.  #_ippool_script_reply will be called with the result.
+ *	- -1 on failure.
+ */
+static int ippool_script_send(ippool_ctx_t *ctx, REQUEST *request, bool load)
+{
+	rlm_redis_ippool_t const	*inst = ctx->inst;
+
+	TALLOC_FREE(ctx->cmd);
+	ctx->loading = load;
+
+	ctx->cmd = fr_redis_command_alloc(ctx, ctx->t->cluster, request, ctx->key, ctx->key_len,
+					  _ippool_script_reply, ctx);
+
+	RDEBUG3("Calling script 0x%s", ctx->digest);
+	if (load) {
+		if ((fr_redis_command_append(ctx->cmd, "MULTI") < 0) ||
+		    (fr_redis_command_append(ctx->cmd, "SCRIPT LOAD %s", ctx->script) < 0)) goto error;
+	}
+	if (fr_redis_command_append_formatted(ctx->cmd, ctx->evalsha, ctx->evalsha_len) < 0) goto error;
+	if (load && (fr_redis_command_append(ctx->cmd, "EXEC") < 0)) goto error;
+	if (inst->wait_num && (fr_redis_command_append(ctx->cmd, "WAIT %i %i", inst->wait_num,
+						       FR_TIMEVAL_TO_MS(&inst->wait_timeout)) < 0)) {
+	error:
+		RPEDEBUG("Failed building command");
+		return -1;
+	}
+
+	return fr_redis_command_send(ctx->cmd);
+}
+
+/** Execute a script against Redis cluster
+ *
+ * The request should yield if this function succeeds.  The result of the script
+ * will be written to ctx->reply.
+ *
+ * @param[in] ctx	to write the result to.
+ * @param[in] request	The current request.
+ * @param[in] key	to use to determine the cluster node.
+ * @param[in] key_len	length of the key.
+ * @param[in] digest	of script.
+ * @param[in] script	to upload.
+ * @param[in] cmd	EVALSHA command to execute.
+ * @param[in] ...	Arguments for the eval command.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int ippool_script(ippool_ctx_t *ctx, REQUEST *request,
+			 uint8_t const *key, size_t key_len,
+			 char const digest[], char const *script,
+			 char const *cmd, ...)
+{
+	va_list	ap;
+	char	*buff;
+	int	len;
+
+	va_start(ap, cmd);
+	len = redisvFormatCommand(&buff, cmd, ap);
 	va_end(ap);
-	return s_ret;
+	if (len < 0) {
+		REDEBUG("Failed formatting command");
+		return -1;
+	}
+	MEM(ctx->evalsha = talloc_memdup(ctx, buff, len));
+	ctx->evalsha_len = len;
+	free(buff);
+
+	MEM(ctx->key = talloc_memdup(ctx, key, key_len));
+	ctx->key_len = key_len;
+	ctx->digest = digest;
+	ctx->script = script;
+
+	return ippool_script_send(ctx, request, false);
 }
 
 /** Allocate a new IP address from a pool
  *
  */
-static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQUEST *request,
-					    uint8_t const *key_prefix, size_t key_prefix_len,
-					    uint8_t const *device_id, size_t device_id_len,
-					    uint8_t const *gateway_id, size_t gateway_id_len,
-					    uint32_t expires)
+static int redis_ippool_allocate(ippool_ctx_t *ctx, REQUEST *request,
+				 uint8_t const *key_prefix, size_t key_prefix_len,
+				 uint8_t const *device_id, size_t device_id_len,
+				 uint8_t const *gateway_id, size_t gateway_id_len,
+				 uint32_t expires)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+	struct	timeval now;
+	int	ret;
 
 	rad_assert(key_prefix);
 	rad_assert(device_id);
@@ -572,16 +630,26 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQU
 	 */
 	if (!gateway_id) gateway_id = (uint8_t const *)"";
 
-	status = ippool_script(&reply, request, inst->cluster,
-			       key_prefix, key_prefix_len,
-			       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-			       lua_alloc_digest, lua_alloc_cmd,
-	 		       "EVALSHA %s 1 %b %u %u %b %b",
-	 		       lua_alloc_digest,
-			       key_prefix, key_prefix_len,
-			       (unsigned int)now.tv_sec, expires,
-			       device_id, device_id_len,
-			       gateway_id, gateway_id_len);
+	ret = ippool_script(ctx, request, key_prefix, key_prefix_len,
+			    lua_alloc_digest, lua_alloc_cmd,
+			    "EVALSHA %s 1 %b %u %u %b %b",
+			    lua_alloc_digest,
+			    key_prefix, key_prefix_len,
+			    (unsigned int)now.tv_sec, expires,
+			    device_id, device_id_len,
+			    gateway_id, gateway_id_len);
+
+	return ret;
+}
+
+/** Process the result of allocating a new IP address
+ *
+ */
+static ippool_rcode_t redis_ippool_allocate_result(rlm_redis_ippool_t const *inst, REQUEST *request,
+						   fr_redis_rcode_t status, redisReply *reply)
+{
+	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+
 	if (status != REDIS_RCODE_SUCCESS) {
 		ret = IPPOOL_RCODE_FAIL;
 		goto finish;
@@ -758,21 +826,16 @@ finish:
 /** Update an existing IP address in a pool
  *
  */
-static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUEST *request,
-					  uint8_t const *key_prefix, size_t key_prefix_len,
-					  fr_ipaddr_t *ip,
-					  uint8_t const *device_id, size_t device_id_len,
-					  uint8_t const *gateway_id, size_t gateway_id_len,
-					  uint32_t expires)
+static int redis_ippool_update(ippool_ctx_t *ctx, REQUEST *request,
+			       uint8_t const *key_prefix, size_t key_prefix_len,
+			       fr_ipaddr_t *ip,
+			       uint8_t const *device_id, size_t device_id_len,
+			       uint8_t const *gateway_id, size_t gateway_id_len,
+			       uint32_t expires)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
-
-	vp_tmpl_t		range_rhs = { .name = "", .type = TMPL_TYPE_DATA, .tmpl_value_type = FR_TYPE_STRING, .quote = T_DOUBLE_QUOTED_STRING };
-	vp_map_t		range_map = { .lhs = inst->range_attr, .op = T_OP_SET, .rhs = &range_rhs };
+	rlm_redis_ippool_t const	*inst = ctx->inst;
+	struct				timeval now;
+	int				ret;
 
 	gettimeofday(&now, NULL);
 
@@ -783,33 +846,44 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUES
 	if (!gateway_id) gateway_id = (uint8_t const *)"";
 
 	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %u %b %b",
-				       lua_update_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec, expires,
-				       htonl(ip->addr.v4.s_addr),
-				       device_id, device_id_len,
-				       gateway_id, gateway_id_len);
+		ret = ippool_script(ctx, request, key_prefix, key_prefix_len,
+				    lua_update_digest, lua_update_cmd,
+				    "EVALSHA %s 1 %b %u %u %u %b %b",
+				    lua_update_digest,
+				    key_prefix, key_prefix_len,
+				    (unsigned int)now.tv_sec, expires,
+				    htonl(ip->addr.v4.s_addr),
+				    device_id, device_id_len,
+				    gateway_id, gateway_id_len);
 	} else {
 		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
 
 		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %s %b %b",
-				       lua_update_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec, expires,
-				       ip_buff,
-				       device_id, device_id_len,
-				       gateway_id, gateway_id_len);
+		ret = ippool_script(ctx, request, key_prefix, key_prefix_len,
+				    lua_update_digest, lua_update_cmd,
+				    "EVALSHA %s 1 %b %u %u %s %b %b",
+				    lua_update_digest,
+				    key_prefix, key_prefix_len,
+				    (unsigned int)now.tv_sec, expires,
+				    ip_buff,
+				    device_id, device_id_len,
+				    gateway_id, gateway_id_len);
 	}
+
+	return ret;
+}
+
+/** Process the result of updating an existing IP address
+ *
+ */
+static ippool_rcode_t redis_ippool_update_result(rlm_redis_ippool_t const *inst, REQUEST *request,
+						 fr_redis_rcode_t status, redisReply *reply, uint32_t expires)
+{
+	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+
+	vp_tmpl_t		range_rhs = { .name = "", .type = TMPL_TYPE_DATA, .tmpl_value_type = FR_TYPE_STRING, .quote = T_DOUBLE_QUOTED_STRING };
+	vp_map_t		range_map = { .lhs = inst->range_attr, .op = T_OP_SET, .rhs = &range_rhs };
+
 	if (status != REDIS_RCODE_SUCCESS) {
 		ret = IPPOOL_RCODE_FAIL;
 		goto finish;
@@ -902,16 +976,14 @@ finish:
 /** Release an existing IP address in a pool
  *
  */
-static ippool_rcode_t redis_ippool_release(rlm_redis_ippool_t const *inst, REQUEST *request,
-					   uint8_t const *key_prefix, size_t key_prefix_len,
-					   fr_ipaddr_t *ip,
-					   uint8_t const *device_id, size_t device_id_len)
+static int redis_ippool_release(ippool_ctx_t *ctx, REQUEST *request,
+				uint8_t const *key_prefix, size_t key_prefix_len,
+				fr_ipaddr_t *ip,
+				uint8_t const *device_id, size_t device_id_len)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+	rlm_redis_ippool_t const	*inst = ctx->inst;
+	struct				timeval now;
+	int				ret;
 
 	gettimeofday(&now, NULL);
 
@@ -921,31 +993,38 @@ static ippool_rcode_t redis_ippool_release(rlm_redis_ippool_t const *inst, REQUE
 	if (!device_id) device_id = (uint8_t const *)"";
 
 	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %u %b",
-				       lua_release_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec,
-				       htonl(ip->addr.v4.s_addr),
-				       device_id, device_id_len);
+		ret = ippool_script(ctx, request, key_prefix, key_prefix_len,
+				    lua_release_digest, lua_release_cmd,
+				    "EVALSHA %s 1 %b %u %u %b",
+				    lua_release_digest,
+				    key_prefix, key_prefix_len,
+				    (unsigned int)now.tv_sec,
+				    htonl(ip->addr.v4.s_addr),
+				    device_id, device_id_len);
 	} else {
 		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
 
 		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %s %b",
-				       lua_release_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec,
-				       ip_buff,
-				       device_id, device_id_len);
+		ret = ippool_script(ctx, request, key_prefix, key_prefix_len,
+				    lua_release_digest, lua_release_cmd,
+				    "EVALSHA %s 1 %b %u %s %b",
+				    lua_release_digest,
+				    key_prefix, key_prefix_len,
+				    (unsigned int)now.tv_sec,
+				    ip_buff,
+				    device_id, device_id_len);
 	}
+
+	return ret;
+}
+
+/** Process the result of releasing an existing IP address
+ *
+ */
+static ippool_rcode_t redis_ippool_release_result(REQUEST *request, fr_redis_rcode_t status, redisReply *reply)
+{
+	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+
 	if (status != REDIS_RCODE_SUCCESS) {
 		ret = IPPOOL_RCODE_FAIL;
 		goto finish;
@@ -1021,7 +1100,150 @@ static inline ssize_t ippool_pool_name(uint8_t const **out, uint8_t buff[], size
 	return slen;
 }
 
-static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request, ippool_action_t action)
+
+static void mod_action_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx,
+			      fr_state_action_t action)
+{
+	ippool_ctx_t *ctx = talloc_get_type_abort(uctx, ippool_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending Redis command");
+
+	talloc_free(ctx);	/* Discards the replies when they arrive */
+}
+
+/** Process the result of the pool script, and write the lease attributes
+ *
+ */
+static rlm_rcode_t mod_action_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx)
+{
+	ippool_ctx_t			*ctx = talloc_get_type_abort(uctx, ippool_ctx_t);
+	rlm_redis_ippool_t const	*inst = ctx->inst;
+	redisReply			*reply = ctx->reply;
+	rlm_rcode_t			rcode;
+
+	ctx->reply = NULL;		/* Freed by the result functions */
+
+	switch (ctx->action) {
+	case POOL_ACTION_ALLOCATE:
+		switch (redis_ippool_allocate_result(inst, request, ctx->status, reply)) {
+		case IPPOOL_RCODE_SUCCESS:
+			RDEBUG2("IP address lease allocated");
+			rcode = RLM_MODULE_UPDATED;
+			break;
+
+		case IPPOOL_RCODE_POOL_EMPTY:
+			RWDEBUG("Pool contains no free addresses");
+			rcode = RLM_MODULE_NOTFOUND;
+			break;
+
+		default:
+			rcode = RLM_MODULE_FAIL;
+			break;
+		}
+		break;
+
+	case POOL_ACTION_UPDATE:
+		switch (redis_ippool_update_result(inst, request, ctx->status, reply, ctx->expires)) {
+		case IPPOOL_RCODE_SUCCESS:
+			RDEBUG2("Requested IP address' \"%s\" lease updated", ctx->ip_str);
+
+			/*
+			 *	Copy over the input IP address to the reply attribute
+			 */
+			if (inst->copy_on_update) {
+				vp_tmpl_t ip_rhs = {
+					.name = "",
+					.type = TMPL_TYPE_DATA,
+					.quote = T_BARE_WORD,
+				};
+				vp_map_t ip_map = {
+					.lhs = inst->allocated_address_attr,
+					.op = T_OP_SET,
+					.rhs = &ip_rhs
+				};
+
+				ip_rhs.tmpl_value_length = strlen(ctx->ip_str);
+				ip_rhs.tmpl_value.vb_strvalue = ctx->ip_str;
+				ip_rhs.tmpl_value_type = FR_TYPE_STRING;
+
+				if (map_to_request(request, &ip_map, map_to_vp, NULL) < 0) {
+					rcode = RLM_MODULE_FAIL;
+					break;
+				}
+			}
+			rcode = RLM_MODULE_UPDATED;
+			break;
+
+		/*
+		 *	It's useful to be able to identify the 'not found' case
+		 *	as we can relay to a server where the IP address might
+		 *	be found.  This extremely useful for migrations.
+		 */
+		case IPPOOL_RCODE_NOT_FOUND:
+			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ctx->ip_str);
+			rcode = RLM_MODULE_NOTFOUND;
+			break;
+
+		case IPPOOL_RCODE_EXPIRED:
+			REDEBUG("Requested IP address' \"%s\" lease already expired at time of renewal", ctx->ip_str);
+			rcode = RLM_MODULE_INVALID;
+			break;
+
+		case IPPOOL_RCODE_DEVICE_MISMATCH:
+			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ctx->ip_str);
+			rcode = RLM_MODULE_INVALID;
+			break;
+
+		default:
+			rcode = RLM_MODULE_FAIL;
+			break;
+		}
+		break;
+
+	case POOL_ACTION_RELEASE:
+		switch (redis_ippool_release_result(request, ctx->status, reply)) {
+		case IPPOOL_RCODE_SUCCESS:
+			RDEBUG2("IP address \"%s\" released", ctx->ip_str);
+			rcode = RLM_MODULE_UPDATED;
+			break;
+
+		/*
+		 *	It's useful to be able to identify the 'not found' case
+		 *	as we can relay to a server where the IP address might
+		 *	be found.  This extremely useful for migrations.
+		 */
+		case IPPOOL_RCODE_NOT_FOUND:
+			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ctx->ip_str);
+			rcode = RLM_MODULE_NOTFOUND;
+			break;
+
+		case IPPOOL_RCODE_DEVICE_MISMATCH:
+			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ctx->ip_str);
+			rcode = RLM_MODULE_INVALID;
+			break;
+
+		default:
+			rcode = RLM_MODULE_FAIL;
+			break;
+		}
+		break;
+
+	default:
+		rad_assert(0);
+		fr_redis_reply_free(reply);
+		rcode = RLM_MODULE_FAIL;
+		break;
+	}
+
+	talloc_free(ctx);
+
+	return rcode;
+}
+
+static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, rlm_redis_ippool_thread_t *t,
+			      REQUEST *request, ippool_action_t action)
 {
 	uint8_t		key_prefix_buff[IPPOOL_MAX_KEY_PREFIX_SIZE], device_id_buff[256], gateway_id_buff[256];
 	uint8_t const	*key_prefix, *device_id = NULL, *gateway_id = NULL;
@@ -1032,6 +1254,10 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 	char const	*expires_str;
 	unsigned long	expires = 0;
 	char		*q;
+	char		ip_buff[INET6_ADDRSTRLEN + 4];
+	char const	*ip_str;
+	ippool_ctx_t	*ctx;
+	int		ret;
 
 	slen = ippool_pool_name(&key_prefix, (uint8_t *)&key_prefix_buff, sizeof(key_prefix_len), inst, request);
 	if (slen < 0) return RLM_MODULE_FAIL;
@@ -1061,170 +1287,103 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 		gateway_id_len = (size_t)slen;
 	}
 
+	MEM(ctx = talloc_zero(request, ippool_ctx_t));
+	talloc_set_destructor(ctx, _ippool_ctx_free);
+	ctx->inst = inst;
+	ctx->t = t;
+	ctx->action = action;
+
 	switch (action) {
 	case POOL_ACTION_ALLOCATE:
 		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
 				request, inst->offer_time, NULL, NULL) < 0) {
 			REDEBUG("Failed expanding offer_time (%s)", inst->offer_time->name);
+		error:
+			talloc_free(ctx);
 			return RLM_MODULE_FAIL;
 		}
 
 		expires = strtoul(expires_str, &q, 10);
 		if (q != (expires_str + strlen(expires_str))) {
 			REDEBUG("Invalid offer_time.  Must be an integer value");
-			return RLM_MODULE_FAIL;
+			goto error;
 		}
 
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len, NULL,
 				    device_id, device_id_len, gateway_id, gateway_id_len, expires);
-		switch (redis_ippool_allocate(inst, request, key_prefix, key_prefix_len,
-					      device_id, device_id_len,
-					      gateway_id, gateway_id_len, (uint32_t)expires)) {
-		case IPPOOL_RCODE_SUCCESS:
-			RDEBUG2("IP address lease allocated");
-			return RLM_MODULE_UPDATED;
-
-		case IPPOOL_RCODE_POOL_EMPTY:
-			RWDEBUG("Pool contains no free addresses");
-			return RLM_MODULE_NOTFOUND;
-
-		default:
-			return RLM_MODULE_FAIL;
-		}
+		ret = redis_ippool_allocate(ctx, request, key_prefix, key_prefix_len,
+					    device_id, device_id_len,
+					    gateway_id, gateway_id_len, (uint32_t)expires);
+		break;
 
 	case POOL_ACTION_UPDATE:
-	{
-		char		ip_buff[INET6_ADDRSTRLEN + 4];
-		char const	*ip_str;
-
 		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
 				request, inst->lease_time, NULL, NULL) < 0) {
 			REDEBUG("Failed expanding lease_time (%s)", inst->lease_time->name);
-			return RLM_MODULE_FAIL;
+			goto error;
 		}
 
 		expires = strtoul(expires_str, &q, 10);
 		if (q != (expires_str + strlen(expires_str))) {
 			REDEBUG("Invalid expires.  Must be an integer value");
-			return RLM_MODULE_FAIL;
+			goto error;
 		}
 
 		if (tmpl_expand(&ip_str, ip_buff, sizeof(ip_buff), request, inst->requested_address, NULL, NULL) < 0) {
 			REDEBUG("Failed expanding requested_address (%s)", inst->requested_address->name);
-			return RLM_MODULE_FAIL;
+			goto error;
 		}
 
 		if (fr_inet_pton(&ip, ip_str, -1, AF_UNSPEC, false, true) < 0) {
 			REDEBUG("%s", fr_strerror());
-			return RLM_MODULE_FAIL;
+			goto error;
 		}
 
+		MEM(ctx->ip_str = talloc_typed_strdup(ctx, ip_str));
+		ctx->expires = (uint32_t)expires;
+
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len,
 				    ip_str, device_id, device_id_len, gateway_id, gateway_id_len, expires);
-		switch (redis_ippool_update(inst, request, key_prefix, key_prefix_len,
-					    &ip, device_id, device_id_len,
-					    gateway_id, gateway_id_len, (uint32_t)expires)) {
-		case IPPOOL_RCODE_SUCCESS:
-			RDEBUG2("Requested IP address' \"%s\" lease updated", ip_str);
-
-			/*
-			 *	Copy over the input IP address to the reply attribute
-			 */
-			if (inst->copy_on_update) {
-				vp_tmpl_t ip_rhs = {
-					.name = "",
-					.type = TMPL_TYPE_DATA,
-					.quote = T_BARE_WORD,
-				};
-				vp_map_t ip_map = {
-					.lhs = inst->allocated_address_attr,
-					.op = T_OP_SET,
-					.rhs = &ip_rhs
-				};
-
-				ip_rhs.tmpl_value_length = strlen(ip_str);
-				ip_rhs.tmpl_value.vb_strvalue = ip_str;
-				ip_rhs.tmpl_value_type = FR_TYPE_STRING;
-
-				if (map_to_request(request, &ip_map, map_to_vp, NULL) < 0) return RLM_MODULE_FAIL;
-			}
-			return RLM_MODULE_UPDATED;
-
-		/*
-		 *	It's useful to be able to identify the 'not found' case
-		 *	as we can relay to a server where the IP address might
-		 *	be found.  This extremely useful for migrations.
-		 */
-		case IPPOOL_RCODE_NOT_FOUND:
-			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ip_str);
-			return RLM_MODULE_NOTFOUND;
-
-		case IPPOOL_RCODE_EXPIRED:
-			REDEBUG("Requested IP address' \"%s\" lease already expired at time of renewal", ip_str);
-			return RLM_MODULE_INVALID;
-
-		case IPPOOL_RCODE_DEVICE_MISMATCH:
-			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ip_str);
-			return RLM_MODULE_INVALID;
-
-		default:
-			return RLM_MODULE_FAIL;
-		}
-	}
+		ret = redis_ippool_update(ctx, request, key_prefix, key_prefix_len,
+					  &ip, device_id, device_id_len,
+					  gateway_id, gateway_id_len, (uint32_t)expires);
+		break;
 
 	case POOL_ACTION_RELEASE:
-	{
-		char		ip_buff[INET6_ADDRSTRLEN + 4];
-		char const	*ip_str;
-
 		if (tmpl_expand(&ip_str, ip_buff, sizeof(ip_buff), request, inst->requested_address, NULL, NULL) < 0) {
 			REDEBUG("Failed expanding requested_address (%s)", inst->requested_address->name);
-			return RLM_MODULE_FAIL;
+			goto error;
 		}
 
 		if (fr_inet_pton(&ip, ip_str, -1, AF_UNSPEC, false, true) < 0) {
 			REDEBUG("%s", fr_strerror());
-			return RLM_MODULE_FAIL;
+			goto error;
 		}
 
+		MEM(ctx->ip_str = talloc_typed_strdup(ctx, ip_str));
+
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len,
 				    ip_str, device_id, device_id_len, gateway_id, gateway_id_len, 0);
-		switch (redis_ippool_release(inst, request, key_prefix, key_prefix_len,
-					     &ip, device_id, device_id_len)) {
-		case IPPOOL_RCODE_SUCCESS:
-			RDEBUG2("IP address \"%s\" released", ip_str);
-			return RLM_MODULE_UPDATED;
-
-		/*
-		 *	It's useful to be able to identify the 'not found' case
-		 *	as we can relay to a server where the IP address might
-		 *	be found.  This extremely useful for migrations.
-		 */
-		case IPPOOL_RCODE_NOT_FOUND:
-			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ip_str);
-			return RLM_MODULE_NOTFOUND;
-
-		case IPPOOL_RCODE_DEVICE_MISMATCH:
-			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ip_str);
-			return RLM_MODULE_INVALID;
-
-		default:
-			return RLM_MODULE_FAIL;
-		}
-	}
+		ret = redis_ippool_release(ctx, request, key_prefix, key_prefix_len,
+					   &ip, device_id, device_id_len);
+		break;
 
 	case POOL_ACTION_BULK_RELEASE:
 		RDEBUG2("Bulk release not yet implemented");
+		talloc_free(ctx);
 		return RLM_MODULE_NOOP;
 
 	default:
 		rad_assert(0);
-		return RLM_MODULE_FAIL;
+		goto error;
 	}
+	if (ret < 0) goto error;
+
+	return unlang_module_yield(request, mod_action_resume, mod_action_signal, ctx);
 }
 
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1233,7 +1392,7 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 	 *	Pool-Action override
 	 */
 	vp = fr_pair_find_by_num(request->control, 0, FR_POOL_ACTION, TAG_ANY);
-	if (vp) return mod_action(inst, request, vp->vp_uint32);
+	if (vp) return mod_action(inst, thread, request, vp->vp_uint32);
 
 	/*
 	 *	Otherwise, guess the action by Acct-Status-Type
@@ -1247,22 +1406,22 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 	switch (vp->vp_uint32) {
 	case FR_STATUS_START:
 	case FR_STATUS_ALIVE:
-		return mod_action(inst, request, POOL_ACTION_UPDATE);
+		return mod_action(inst, thread, request, POOL_ACTION_UPDATE);
 
 	case FR_STATUS_STOP:
-		return mod_action(inst, request, POOL_ACTION_RELEASE);
+		return mod_action(inst, thread, request, POOL_ACTION_RELEASE);
 
 	case FR_STATUS_ACCOUNTING_OFF:
 	case FR_STATUS_ACCOUNTING_ON:
-		return mod_action(inst, request, POOL_ACTION_BULK_RELEASE);
+		return mod_action(inst, thread, request, POOL_ACTION_BULK_RELEASE);
 
 	default:
 		return RLM_MODULE_NOOP;
 	}
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1272,11 +1431,11 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 	 *	when called in Post-Auth.
 	 */
 	vp = fr_pair_find_by_num(request->control, 0, FR_POOL_ACTION, TAG_ANY);
-	return mod_action(inst, request, vp ? vp->vp_uint32 : POOL_ACTION_ALLOCATE);
+	return mod_action(inst, thread, request, vp ? vp->vp_uint32 : POOL_ACTION_ALLOCATE);
 }
 
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1286,7 +1445,7 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
 	 *	when called in Post-Auth.
 	 */
 	vp = fr_pair_find_by_num(request->control, 0, FR_POOL_ACTION, TAG_ANY);
-	return mod_action(inst, request, vp ? vp->vp_uint32 : POOL_ACTION_ALLOCATE);
+	return mod_action(inst, thread, request, vp ? vp->vp_uint32 : POOL_ACTION_ALLOCATE);
 }
 
 static int mod_instantiate(void *instance, CONF_SECTION *conf)
@@ -1339,6 +1498,27 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el,
+				  void *thread)
+{
+	rlm_redis_ippool_t		*inst = instance;
+	rlm_redis_ippool_thread_t	*t = thread;
+
+	t->cluster = fr_redis_cluster_thread_alloc(t, inst->cluster, el);
+	if (!t->cluster) return -1;
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_redis_ippool_thread_t	*t = thread;
+
+	TALLOC_FREE(t->cluster);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -1348,13 +1528,16 @@ static int mod_load(void)
 
 extern rad_module_t rlm_redis_ippool;
 rad_module_t rlm_redis_ippool = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "redis",
-	.type		= RLM_TYPE_THREAD_SAFE,
-	.inst_size	= sizeof(rlm_redis_ippool_t),
-	.config		= module_config,
-	.load		= mod_load,
-	.instantiate	= mod_instantiate,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "redis",
+	.type			= RLM_TYPE_THREAD_SAFE,
+	.inst_size		= sizeof(rlm_redis_ippool_t),
+	.thread_inst_size	= sizeof(rlm_redis_ippool_thread_t),
+	.config			= module_config,
+	.load			= mod_load,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting,
 		[MOD_AUTHORIZE]		= mod_authorize,
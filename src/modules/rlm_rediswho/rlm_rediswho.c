@@ -76,20 +76,90 @@ static CONF_PARSER module_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
-/*
- *	Query the database executing a command with no result rows
+/** Per-thread instance data
+ *
+ */
+typedef struct rlm_rediswho_thread {
+	fr_redis_cluster_thread_t	*cluster;	//!< Pipelined connections to the cluster nodes.
+} rlm_rediswho_thread_t;
+
+/** Which command we're waiting for
+ *
+ */
+typedef enum {
+	REDISWHO_INSERT = 0,
+	REDISWHO_TRIM,
+	REDISWHO_EXPIRE
+} rediswho_stage_t;
+
+/** State of an accounting update, whilst the request is yielded
+ *
+ */
+typedef struct rediswho_ctx {
+	rlm_rediswho_t const	*inst;
+	rlm_rediswho_thread_t	*t;
+
+	char const		*insert;	//!< Command for inserting session data.
+	char const		*trim;		//!< Command for trimming the session list.
+	char const		*expire;	//!< Command for expiring entries.
+
+	rediswho_stage_t	stage;		//!< Command we're waiting for.
+	fr_redis_command_t	*cmd;		//!< Command in flight.
+	int			ret;		//!< Result of the last command.
+} rediswho_ctx_t;
+
+/** Process the reply to a command with no result rows
+ *
+ * @return
+ *	- -1 on failure.
+ *	- 0 on success.
+ *	- > 0 the integer returned by the server.
  */
-static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char const *fmt)
+static int rediswho_command_result(REQUEST *request, fr_redis_rcode_t status, redisReply *reply)
 {
-	fr_redis_conn_t		*conn;
+	int ret = 0;
+
+	if (status != REDIS_RCODE_SUCCESS) {
+		RERROR("Failed inserting accounting data");
+		return -1;
+	}
+	if (!rad_cond_assert(reply)) return -1;
+
+	switch (reply->type) {
+	case REDIS_REPLY_INTEGER:
+		RDEBUG2("Query response %lld", reply->integer);
+		if (reply->integer > 0) ret = reply->integer;
+		break;
+
+	case REDIS_REPLY_STRING:
+		REDEBUG2("Query response %s", reply->str);
+		break;
+
+	default:
+		break;
+	}
+
+	return ret;
+}
 
-	int 			ret = -1;
+static void _rediswho_command_reply(REQUEST *request, fr_redis_rcode_t status,
+				    redisReply *replies[], size_t num_replies, void *uctx)
+{
+	rediswho_ctx_t *ctx = talloc_get_type_abort(uctx, rediswho_ctx_t);
 
-	fr_redis_cluster_state_t	state;
-	fr_redis_rcode_t		status;
-	redisReply		*reply = NULL;
-	int			s_ret;
+	ctx->ret = rediswho_command_result(request, status, num_replies ? replies[0] : NULL);
+	unlang_resumable(request);
+}
 
+/** Send a command with no result rows
+ *
+ * @return
+ *	- -1 on failure.
+ *	- 0 if there's no command to send.
+ *	- 1 if the command was sent, and the request should yield.
+ */
+static int rediswho_command_send(REQUEST *request, rediswho_ctx_t *ctx, char const *fmt)
+{
 	uint8_t	const		*key = NULL;
 	size_t			key_len = 0;
 
@@ -97,10 +167,12 @@ static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char c
 	char const		*argv[MAX_REDIS_ARGS];
 	char			argv_buf[MAX_REDIS_COMMAND_LEN];
 
+	TALLOC_FREE(ctx->cmd);
+
 	if (!fmt || !*fmt) return 0;
 
 	argc = rad_expand_xlat(request, fmt, MAX_REDIS_ARGS, argv, false, sizeof(argv_buf), argv_buf);
- 	if (argc < 0) return -1;
+	if (argc < 0) return -1;
 
 	/*
 	 *	If we've got multiple arguments, the second one is usually the key.
@@ -114,58 +186,95 @@ static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char c
 	 	key_len = strlen((char const *)key);
 	}
 
-	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request, key, key_len, false);
-	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
-	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
-		reply = redisCommandArgv(conn->handle, argc, argv, NULL);
-		status = fr_redis_command_status(conn, reply);
-	}
-	if (s_ret != REDIS_RCODE_SUCCESS) {
-		RERROR("Failed inserting accounting data");
-	error:
-		fr_redis_reply_free(reply);
+	ctx->cmd = fr_redis_command_alloc(ctx, ctx->t->cluster, request, key, key_len, _rediswho_command_reply, ctx);
+	if ((fr_redis_command_append_argv(ctx->cmd, argc, argv) < 0) || (fr_redis_command_send(ctx->cmd) < 0)) {
+		RPERROR("Failed inserting accounting data");
 		return -1;
 	}
-	if (!rad_cond_assert(reply)) goto error;
 
-	switch (reply->type) {
-	case REDIS_REPLY_INTEGER:
-		RDEBUG2("Query response %lld", reply->integer);
-		if (reply->integer > 0) ret = reply->integer;
-		break;
+	return 1;
+}
 
-	case REDIS_REPLY_STRING:
-		REDEBUG2("Query response %s", reply->str);
-		break;
+static void mod_accounting_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx,
+				  fr_state_action_t action)
+{
+	rediswho_ctx_t *ctx = talloc_get_type_abort(uctx, rediswho_ctx_t);
 
-	default:
-		break;
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending Redis command");
+
+	talloc_free(ctx);	/* Discards the replies when they arrive */
+}
+
+/** Send the next command in the insert, trim, expire sequence
+ *
+ */
+static rlm_rcode_t mod_accounting_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx)
+{
+	rediswho_ctx_t		*ctx = talloc_get_type_abort(uctx, rediswho_ctx_t);
+	rlm_rediswho_t const	*inst = ctx->inst;
+	int			ret;
+
+	if (ctx->ret < 0) {
+	fail:
+		talloc_free(ctx);
+		return RLM_MODULE_FAIL;
 	}
-	fr_redis_reply_free(reply);
 
-	return ret;
+	switch (ctx->stage) {
+	case REDISWHO_INSERT:
+		/* Only trim if necessary */
+		if ((inst->trim_count >= 0) && (ctx->ret > inst->trim_count)) {
+			ctx->stage = REDISWHO_TRIM;
+			ret = rediswho_command_send(request, ctx, ctx->trim);
+			if (ret < 0) goto fail;
+			if (ret > 0) break;
+		}
+		/* FALL-THROUGH */
+
+	case REDISWHO_TRIM:
+		ctx->stage = REDISWHO_EXPIRE;
+		ret = rediswho_command_send(request, ctx, ctx->expire);
+		if (ret < 0) goto fail;
+		if (ret > 0) break;
+		/* FALL-THROUGH */
+
+	case REDISWHO_EXPIRE:
+		talloc_free(ctx);
+		return RLM_MODULE_OK;
+	}
+
+	return unlang_module_yield(request, mod_accounting_resume, mod_accounting_signal, ctx);
 }
 
-static rlm_rcode_t mod_accounting_all(rlm_rediswho_t const *inst, REQUEST *request,
+static rlm_rcode_t mod_accounting_all(rlm_rediswho_t const *inst, rlm_rediswho_thread_t *t, REQUEST *request,
 				      char const *insert,
 				      char const *trim,
 				      char const *expire)
 {
-	int ret;
-
-	ret = rediswho_command(inst, request, insert);
-	if (ret < 0) return RLM_MODULE_FAIL;
-
-	/* Only trim if necessary */
-	if ((inst->trim_count >= 0) && (ret > inst->trim_count)) {
-		if (rediswho_command(inst, request, trim) < 0) return RLM_MODULE_FAIL;
+	rediswho_ctx_t	*ctx;
+	int		ret;
+
+	MEM(ctx = talloc_zero(request, rediswho_ctx_t));
+	ctx->inst = inst;
+	ctx->t = t;
+	ctx->insert = insert;
+	ctx->trim = trim;
+	ctx->expire = expire;
+	ctx->stage = REDISWHO_INSERT;
+
+	ret = rediswho_command_send(request, ctx, insert);
+	if (ret < 0) {
+		talloc_free(ctx);
+		return RLM_MODULE_FAIL;
 	}
+	if (ret == 0) return mod_accounting_resume(request, NULL, NULL, ctx);
 
-	if (rediswho_command(inst, request, expire) < 0) return RLM_MODULE_FAIL;
-	return RLM_MODULE_OK;
+	return unlang_module_yield(request, mod_accounting_resume, mod_accounting_signal, ctx);
 }
 
-static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rediswho_t const	*inst = instance;
 	rlm_rcode_t		rcode;
@@ -196,7 +305,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *
 	trim = cf_pair_value(cf_pair_find(cs, "trim"));
 	expire = cf_pair_value(cf_pair_find(cs, "expire"));
 
-	rcode = mod_accounting_all(inst, request, insert, trim, expire);
+	rcode = mod_accounting_all(inst, thread, request, insert, trim, expire);
 
 	return rcode;
 }
@@ -222,6 +331,27 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el,
+				  void *thread)
+{
+	rlm_rediswho_t		*inst = instance;
+	rlm_rediswho_thread_t	*t = thread;
+
+	t->cluster = fr_redis_cluster_thread_alloc(t, inst->cluster, el);
+	if (!t->cluster) return -1;
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_rediswho_thread_t	*t = thread;
+
+	TALLOC_FREE(t->cluster);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -231,14 +361,17 @@ static int mod_load(void)
 
 extern rad_module_t rlm_rediswho;
 rad_module_t rlm_rediswho = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "rediswho",
-	.type		= RLM_TYPE_THREAD_SAFE,
-	.inst_size	= sizeof(rlm_rediswho_t),
-	.config		= module_config,
-	.load		= mod_load,
-	.instantiate	= mod_instantiate,
-	.bootstrap	= mod_bootstrap,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "rediswho",
+	.type			= RLM_TYPE_THREAD_SAFE,
+	.inst_size		= sizeof(rlm_rediswho_t),
+	.thread_inst_size	= sizeof(rlm_rediswho_thread_t),
+	.config			= module_config,
+	.load			= mod_load,
+	.instantiate		= mod_instantiate,
+	.bootstrap		= mod_bootstrap,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting
 	},
@@ -209,7 +209,6 @@ static int _rest_io_timer_modify(CURLM *mandle, long timeout_ms, void *ctx)
 	rlm_rest_thread_t	*t = talloc_get_type_abort(ctx, rlm_rest_thread_t);
 	CURLMcode		ret;
 	int			running = 0;
-	struct timeval		now, to_add, when;
 
 	if (timeout_ms == 0) {
 		ret = curl_multi_socket_action(mandle, CURL_SOCKET_TIMEOUT, 0, &running);
@@ -234,12 +233,9 @@ static int _rest_io_timer_modify(CURLM *mandle, long timeout_ms, void *ctx)
 
 	DEBUG3("multi-handle %p needs servicing in %li ms", mandle, timeout_ms);
 
-	gettimeofday(&now, NULL);
-	fr_timeval_from_ms(&to_add, (uint64_t)timeout_ms);
-	fr_timeval_add(&when, &now, &to_add);
-
-	(void) fr_event_timer_insert(NULL, t->el, &t->ev,
-				     &when, _rest_io_timer_expired, t);
+	(void) fr_event_timer_at(NULL, t->el, &t->ev,
+				 fr_time() + ((fr_time_t) timeout_ms * 1000000),
+				 _rest_io_timer_expired, t);
 
 	return 0;
 }
@@ -49,6 +49,14 @@ RCSID("$Id$")
 
 #include "rlm_sql.h"
 
+/*
+ *	MariaDB's client library has a non-blocking API, which
+ *	we use to run queries asynchronously.
+ */
+#ifdef MYSQL_WAIT_READ
+#  define HAVE_MYSQL_NONBLOCK
+#endif
+
 typedef enum {
 	SERVER_WARNINGS_AUTO = 0,
 	SERVER_WARNINGS_YES,
@@ -66,6 +74,9 @@ typedef struct rlm_sql_mysql_conn {
 	MYSQL		db;
 	MYSQL		*sock;
 	MYSQL_RES	*result;
+#ifdef HAVE_MYSQL_NONBLOCK
+	int		async_status;	//!< What the non-blocking API is waiting for.
+#endif
 } rlm_sql_mysql_conn_t;
 
 typedef struct rlm_sql_mysql_config {
@@ -226,6 +237,13 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *c
 #ifdef CLIENT_MULTI_STATEMENTS
 	sql_flags |= CLIENT_MULTI_STATEMENTS;
 #endif
+
+#ifdef HAVE_MYSQL_NONBLOCK
+	/*
+	 *	Blocking calls still work as normal on the connection.
+	 */
+	mysql_options(&(conn->db), MYSQL_OPT_NONBLOCK, 0);
+#endif
 	conn->sock = mysql_real_connect(&(conn->db),
 					config->sql_server,
 					config->sql_login,
@@ -344,6 +362,70 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 	return RLM_SQL_OK;
 }
 
+#ifdef HAVE_MYSQL_NONBLOCK
+/** Process the status of a non-blocking query
+ *
+ */
+static sql_rcode_t sql_query_status(rlm_sql_mysql_conn_t *conn, int err)
+{
+	char const *info;
+
+	/*
+	 *	Writes only block if the socket buffer is full,
+	 *	i.e. for very large queries.
+	 */
+	if (conn->async_status & MYSQL_WAIT_WRITE) return RLM_SQL_PENDING_WRITE;
+	if (conn->async_status) return RLM_SQL_PENDING;
+
+	if (err) return sql_check_error(conn->sock, 0);
+
+	info = mysql_info(conn->sock);
+	if (info) DEBUG2("%s", info);
+
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t sql_query_send(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+	int err = 0;
+
+	if (!conn->sock) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	conn->async_status = mysql_real_query_start(&err, conn->sock, query, strlen(query));
+
+	return sql_query_status(conn, err);
+}
+
+static sql_rcode_t sql_query_recv(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+	int err = 0;
+
+	/*
+	 *	rlm_sql waits for whichever of these we asked for,
+	 *	so that's what's now ready.
+	 */
+	conn->async_status = mysql_real_query_cont(&err, conn->sock,
+						   (conn->async_status & MYSQL_WAIT_WRITE) ?
+						   MYSQL_WAIT_WRITE : MYSQL_WAIT_READ);
+
+	return sql_query_status(conn, err);
+}
+
+static int sql_socket_fd(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+
+	if (!conn->sock) return -1;
+
+	return mysql_get_socket(conn->sock);
+}
+#endif
+
 static sql_rcode_t sql_store_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
@@ -767,5 +849,10 @@ rlm_sql_driver_t rlm_sql_mysql = {
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
 	.sql_finish_select_query	= sql_finish_query,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+#ifdef HAVE_MYSQL_NONBLOCK
+	.sql_query_send			= sql_query_send,
+	.sql_query_recv			= sql_query_recv,
+	.sql_socket_fd			= sql_socket_fd
+#endif
 };
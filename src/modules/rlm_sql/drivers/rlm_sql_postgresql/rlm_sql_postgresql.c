@@ -192,38 +192,14 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
-static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
-					      char const *query)
+/** Determine an action for rlm_sql to take from the result of a query
+ *
+ */
+static sql_rcode_t sql_result_status(rlm_sql_postgres_conn_t *conn)
 {
-	rlm_sql_postgres_conn_t *conn = handle->conn;
 	ExecStatusType status;
 	int numfields = 0;
 
-	if (!conn->db) {
-		ERROR("Socket not connected");
-		return RLM_SQL_RECONNECT;
-	}
-
-	/*
-	 *  Returns a PGresult pointer or possibly a null pointer.
-	 *  A non-null pointer will generally be returned except in
-	 *  out-of-memory conditions or serious errors such as inability
-	 *  to send the command to the server. If a null pointer is
-	 *  returned, it should be treated like a PGRES_FATAL_ERROR
-	 *  result.
-	 */
-	conn->result = PQexec(conn->db, query);
-
-	/*
-	 *  As this error COULD be a connection error OR an out-of-memory
-	 *  condition return value WILL be wrong SOME of the time
-	 *  regardless! Pick your poison...
-	 */
-	if (!conn->result) {
-		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
-	}
-
 	status = PQresultStatus(conn->result);
 	DEBUG("Status: %s", PQresStatus(status));
 
@@ -283,6 +259,144 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED r
 	return RLM_SQL_ERROR;
 }
 
+static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+					      char const *query)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	/*
+	 *  Returns a PGresult pointer or possibly a null pointer.
+	 *  A non-null pointer will generally be returned except in
+	 *  out-of-memory conditions or serious errors such as inability
+	 *  to send the command to the server. If a null pointer is
+	 *  returned, it should be treated like a PGRES_FATAL_ERROR
+	 *  result.
+	 */
+	conn->result = PQexec(conn->db, query);
+
+	/*
+	 *  As this error COULD be a connection error OR an out-of-memory
+	 *  condition return value WILL be wrong SOME of the time
+	 *  regardless! Pick your poison...
+	 */
+	if (!conn->result) {
+		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_result_status(conn);
+}
+
+/** Write as much of a pending query as the socket will take
+ *
+ */
+static sql_rcode_t sql_query_flush(rlm_sql_postgres_conn_t *conn)
+{
+	switch (PQflush(conn->db)) {
+	case 0:
+		return RLM_SQL_PENDING;
+
+	case 1:
+		return RLM_SQL_PENDING_WRITE;
+
+	default:
+		ERROR("Failed sending query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+}
+
+/** Send a query without waiting for the result
+ *
+ * The connection is put into non-blocking mode, so a large query
+ * may not be written in full.  PQexec() ignores the non-blocking
+ * mode, so the other queries still work as before.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_query_send(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+						   char const *query)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (!PQisnonblocking(conn->db) && (PQsetnonblocking(conn->db, 1) < 0)) {
+		ERROR("Failed setting connection to non-blocking: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (!PQsendQuery(conn->db, query)) {
+		ERROR("Failed sending query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_query_flush(conn);
+}
+
+/** Send the rest of a query, or read whatever is available of its result
+ *
+ * If the query string contained several statements, the result of the
+ * last one is used.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_query_recv(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+	PGresult *result;
+	sql_rcode_t rcode;
+
+	/*
+	 *  Finish sending the query first.  The input is read
+	 *  regardless, so the server is never stuck waiting for us.
+	 */
+	if (!PQconsumeInput(conn->db)) {
+		ERROR("Failed reading query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	rcode = sql_query_flush(conn);
+	if (rcode != RLM_SQL_PENDING) return rcode;
+
+	for (;;) {
+		if (!PQconsumeInput(conn->db)) {
+			ERROR("Failed reading query result: %s", PQerrorMessage(conn->db));
+			return RLM_SQL_RECONNECT;
+		}
+
+		if (PQisBusy(conn->db)) return RLM_SQL_PENDING;
+
+		/*
+		 *  NULL means there are no more results.
+		 */
+		result = PQgetResult(conn->db);
+		if (!result) break;
+
+		if (conn->result) PQclear(conn->result);
+		conn->result = result;
+	}
+
+	if (!conn->result) {
+		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_result_status(conn);
+}
+
+static int sql_socket_fd(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!conn->db) return -1;
+
+	return PQsocket(conn->db);
+}
+
 static sql_rcode_t sql_select_query(rlm_sql_handle_t * handle, rlm_sql_config_t *config, char const *query)
 {
 	return sql_query(handle, config, query);
@@ -542,5 +656,8 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
 	.sql_affected_rows		= sql_affected_rows,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+	.sql_query_send			= sql_query_send,
+	.sql_query_recv			= sql_query_recv,
+	.sql_socket_fd			= sql_socket_fd
 };
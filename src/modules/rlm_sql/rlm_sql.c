@@ -1493,32 +1493,23 @@ error:
 	return rcode;
 }
 
-/*
- *	Generic function for failing between a bunch of queries.
- *
- *	Uses the same principle as rlm_linelog, expanding the 'reference' config
- *	item using xlat to figure out what query it should execute.
+/** Find the first query for a section
  *
- *	If the reference matches multiple config items, and a query fails or
- *	doesn't update any rows, the next matching config item is used.
+ * Expands the section's reference, and looks it up in the section.
  *
+ * @param[out] out	The first query in the set of redundant queries.
+ * @param[in] request	The current request.
+ * @param[in] section	to find the query in.
+ * @return
+ *	- RLM_MODULE_OK if a query was found.
+ *	- RLM_MODULE_NOOP if there's no query matching the reference.
+ *	- RLM_MODULE_FAIL if the reference couldn't be expanded.
  */
-static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+static rlm_rcode_t acct_query_find(CONF_PAIR **out, REQUEST *request, sql_acct_section_t *section)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-
-	rlm_sql_handle_t	*handle = NULL;
-	int			sql_ret;
-	int			numaffected = 0;
-
 	CONF_ITEM		*item;
-	CONF_PAIR 		*pair;
-	char const		*attr = NULL;
-	char const		*value;
-
 	char			path[FR_MAX_STRING_LEN];
 	char			*p = path;
-	char			*expanded = NULL;
 
 	rad_assert(section);
 
@@ -1527,9 +1518,7 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	}
 
 	if (xlat_eval(p, sizeof(path) - (p - path), request, section->reference, NULL, NULL) < 0) {
-		rcode = RLM_MODULE_FAIL;
-
-		goto finish;
+		return RLM_MODULE_FAIL;
 	}
 
 	/*
@@ -1539,21 +1528,85 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	item = cf_reference_item(NULL, section->cs, path);
 	if (!item) {
 		RWDEBUG("No such configuration item %s", path);
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		return RLM_MODULE_NOOP;
 	}
 	if (cf_item_is_section(item)){
 		RWDEBUG("Sections are not supported as references");
-		rcode = RLM_MODULE_NOOP;
+		return RLM_MODULE_NOOP;
+	}
 
-		goto finish;
+	*out = cf_item_to_pair(item);
+
+	RDEBUG2("Using query template '%s'", cf_pair_attr(*out));
+
+	return RLM_MODULE_OK;
+}
+
+/** Expand a query, and write it to the query log
+ *
+ * @param[out] out	The expanded query.  Must be freed by the caller.
+ * @param[in] inst	rlm_sql instance.
+ * @param[in] request	The current request.
+ * @param[in] section	the query belongs to.
+ * @param[in] pair	containing the query.
+ * @param[in] handle	used to escape values.
+ * @return
+ *	- RLM_MODULE_OK if the query was expanded.
+ *	- RLM_MODULE_NOOP if the query is empty.
+ *	- RLM_MODULE_FAIL if the query couldn't be expanded.
+ */
+static rlm_rcode_t acct_query_expand(char **out, rlm_sql_t const *inst, REQUEST *request,
+				     sql_acct_section_t *section, CONF_PAIR *pair, rlm_sql_handle_t *handle)
+{
+	char const	*value;
+
+	value = cf_pair_value(pair);
+	if (!value) {
+		RDEBUG("Ignoring null query");
+		return RLM_MODULE_NOOP;
 	}
 
-	pair = cf_item_to_pair(item);
-	attr = cf_pair_attr(pair);
+	if (xlat_aeval(request, out, request, value, inst->sql_escape_func, handle) < 0) {
+		return RLM_MODULE_FAIL;
+	}
+
+	if (!**out) {
+		RDEBUG("Ignoring null query");
+		TALLOC_FREE(*out);
+		return RLM_MODULE_NOOP;
+	}
+
+	rlm_sql_query_log(inst, request, section, *out);
+
+	return RLM_MODULE_OK;
+}
+
+/*
+ *	Generic function for failing between a bunch of queries.
+ *
+ *	Uses the same principle as rlm_linelog, expanding the 'reference' config
+ *	item using xlat to figure out what query it should execute.
+ *
+ *	If the reference matches multiple config items, and a query fails or
+ *	doesn't update any rows, the next matching config item is used.
+ *
+ */
+static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
 
-	RDEBUG2("Using query template '%s'", attr);
+	rlm_sql_handle_t	*handle = NULL;
+	int			sql_ret;
+	int			numaffected = 0;
+
+	CONF_PAIR 		*pair;
+	char const		*attr = NULL;
+	char			*expanded = NULL;
+
+	rcode = acct_query_find(&pair, request, section);
+	if (rcode != RLM_MODULE_OK) return rcode;
+
+	attr = cf_pair_attr(pair);
 
 	handle = fr_pool_connection_get(inst->pool, request);
 	if (!handle) {
@@ -1565,29 +1618,8 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	sql_set_user(inst, request, NULL);
 
 	while (true) {
-		value = cf_pair_value(pair);
-		if (!value) {
-			RDEBUG("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
-
-			goto finish;
-		}
-
-		if (xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, handle) < 0) {
-			rcode = RLM_MODULE_FAIL;
-
-			goto finish;
-		}
-
-		if (!*expanded) {
-			RDEBUG("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
-			talloc_free(expanded);
-
-			goto finish;
-		}
-
-		rlm_sql_query_log(inst, request, section, expanded);
+		rcode = acct_query_expand(&expanded, inst, request, section, pair, handle);
+		if (rcode != RLM_MODULE_OK) goto finish;
 
 		sql_ret = rlm_sql_query(inst, request, &handle, expanded);
 		TALLOC_FREE(expanded);
@@ -1665,6 +1697,335 @@ finish:
 	return rcode;
 }
 
+/** State for running a set of redundant queries without blocking
+ *
+ */
+typedef struct sql_acct_ctx {
+	rlm_sql_t const		*inst;		//!< Module instance.
+	sql_acct_section_t	*section;	//!< Section the queries belong to.
+	rlm_sql_handle_t	*handle;	//!< Connection the query was sent on.
+
+	CONF_PAIR		*pair;		//!< Query currently being run.
+	char			*query;		//!< Expanded query.
+
+	int			fd;		//!< Socket we're waiting on, or -1.
+	bool			fd_write;	//!< Whether we're waiting for the socket to be writable.
+	bool			timer;		//!< Whether a timeout event is set.
+	bool			retried;	//!< Whether the query has been sent again
+						//!< after its connection failed.
+
+	sql_rcode_t		sql_ret;	//!< Result of the query.
+} sql_acct_ctx_t;
+
+/** Stop waiting for the result of a query
+ *
+ */
+static void acct_async_unwatch(REQUEST *request, sql_acct_ctx_t *ctx)
+{
+	if (ctx->fd >= 0) {
+		unlang_event_fd_delete(request, ctx, ctx->fd);
+		ctx->fd = -1;
+	}
+
+	if (ctx->timer) {
+		unlang_event_timeout_delete(request, ctx);
+		ctx->timer = false;
+	}
+}
+
+/** Close a connection with a query in progress
+ *
+ * The connection can't be reused, as the result of the query would
+ * be returned to whoever used it next.
+ */
+static void acct_async_close(REQUEST *request, sql_acct_ctx_t *ctx)
+{
+	if (!ctx->handle) return;
+
+	fr_pool_connection_close(ctx->inst->pool, request, ctx->handle);
+	ctx->handle = NULL;
+}
+
+/** Release resources and return the final result
+ *
+ */
+static rlm_rcode_t acct_async_finish(REQUEST *request, sql_acct_ctx_t *ctx, rlm_rcode_t rcode)
+{
+	if (ctx->handle) fr_pool_connection_release(ctx->inst->pool, request, ctx->handle);
+	sql_unset_user(ctx->inst, request);
+	talloc_free(ctx);
+
+	return rcode;
+}
+
+/** Decide what to do with the result of a query
+ *
+ * @return
+ *	- RLM_MODULE_UNKNOWN if the next query should be run.
+ *	- the final result of the module otherwise.
+ */
+static rlm_rcode_t acct_async_result(REQUEST *request, sql_acct_ctx_t *ctx)
+{
+	rlm_sql_t const	*inst = ctx->inst;
+	int		numaffected;
+
+	TALLOC_FREE(ctx->query);
+	RDEBUG("SQL query returned: %s", fr_int2str(sql_rcode_table, ctx->sql_ret, "<INVALID>"));
+
+	switch (ctx->sql_ret) {
+	case RLM_SQL_OK:
+		numaffected = (inst->driver->sql_affected_rows)(ctx->handle, inst->config);
+		(inst->driver->sql_finish_query)(ctx->handle, inst->config);
+		RDEBUG("%i record(s) updated", numaffected);
+
+		if (numaffected > 0) return RLM_MODULE_OK;
+		break;
+
+	case RLM_SQL_QUERY_INVALID:
+		return RLM_MODULE_INVALID;
+
+	case RLM_SQL_ALT_QUERY:
+		break;
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+
+	ctx->pair = cf_pair_find_next(ctx->section->cs, ctx->pair, cf_pair_attr(ctx->pair));
+	if (!ctx->pair) {
+		RDEBUG("No additional queries configured");
+		return RLM_MODULE_NOOP;
+	}
+
+	RDEBUG("Trying next query...");
+
+	return RLM_MODULE_UNKNOWN;
+}
+
+static void acct_async_ready(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx, UNUSED int fd)
+{
+	sql_acct_ctx_t *ctx = talloc_get_type_abort(uctx, sql_acct_ctx_t);
+
+	ctx->sql_ret = rlm_sql_query_recv(ctx->inst, request, ctx->handle);
+	switch (ctx->sql_ret) {
+	case RLM_SQL_PENDING:
+		if (!ctx->fd_write) return;
+		break;
+
+	case RLM_SQL_PENDING_WRITE:
+		if (ctx->fd_write) return;
+		break;
+
+	case RLM_SQL_RECONNECT:
+		acct_async_close(request, ctx);
+		/* FALL-THROUGH */
+
+	default:
+		acct_async_unwatch(request, ctx);
+		unlang_resumable(request);
+		return;
+	}
+
+	/*
+	 *	The driver wants to wait for something else.  The
+	 *	socket is re-registered when the module resumes,
+	 *	and the query timeout keeps running.
+	 */
+	unlang_event_fd_delete(request, ctx, ctx->fd);
+	ctx->fd = -1;
+	unlang_resumable(request);
+}
+
+static void acct_async_error(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx, UNUSED int fd)
+{
+	sql_acct_ctx_t *ctx = talloc_get_type_abort(uctx, sql_acct_ctx_t);
+
+	REDEBUG("Connection failed whilst waiting for query result");
+
+	acct_async_close(request, ctx);
+	ctx->sql_ret = RLM_SQL_RECONNECT;
+
+	acct_async_unwatch(request, ctx);
+	unlang_resumable(request);
+}
+
+static void acct_async_timeout(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx,
+			       UNUSED struct timeval *fired)
+{
+	sql_acct_ctx_t	*ctx = talloc_get_type_abort(uctx, sql_acct_ctx_t);
+	bool		waiting = (ctx->fd >= 0);
+
+	REDEBUG("Query timed out after %u seconds", ctx->inst->config->query_timeout);
+
+	acct_async_close(request, ctx);
+	ctx->sql_ret = RLM_SQL_ERROR;
+
+	/*
+	 *	The timeout event is freed after we return.
+	 */
+	ctx->timer = false;
+	acct_async_unwatch(request, ctx);
+
+	/*
+	 *	If we're not waiting on the socket, the request
+	 *	has already been marked resumable.
+	 */
+	if (waiting) unlang_resumable(request);
+}
+
+static void acct_async_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx,
+			      fr_state_action_t action)
+{
+	sql_acct_ctx_t *ctx = talloc_get_type_abort(uctx, sql_acct_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending SQL query");
+
+	acct_async_unwatch(request, ctx);
+	acct_async_close(request, ctx);
+	(void) acct_async_finish(request, ctx, RLM_MODULE_FAIL);
+}
+
+static rlm_rcode_t acct_async_resume(REQUEST *request, void *instance, void *thread, void *uctx);
+
+/** Wait for the socket to become readable or writable, as the driver asked
+ *
+ * The query timeout is only set the first time we wait for a query.
+ */
+static rlm_rcode_t acct_async_wait(REQUEST *request, sql_acct_ctx_t *ctx)
+{
+	rlm_sql_t const	*inst = ctx->inst;
+
+	ctx->fd_write = (ctx->sql_ret == RLM_SQL_PENDING_WRITE);
+
+	ctx->fd = (inst->driver->sql_socket_fd)(ctx->handle, inst->config);
+	if ((ctx->fd < 0) ||
+	    (unlang_event_fd_add(request,
+				 ctx->fd_write ? NULL : acct_async_ready,
+				 ctx->fd_write ? acct_async_ready : NULL,
+				 acct_async_error, ctx, ctx->fd) < 0)) {
+		REDEBUG("Failed adding socket to event loop");
+		ctx->fd = -1;
+	fail:
+		acct_async_unwatch(request, ctx);
+		acct_async_close(request, ctx);
+		return acct_async_finish(request, ctx, RLM_MODULE_FAIL);
+	}
+
+	if (!ctx->timer && inst->config->query_timeout) {
+		if (unlang_event_timeout_add(request, acct_async_timeout, ctx,
+					     fr_time() + ((fr_time_t) inst->config->query_timeout * NANOSEC)) < 0) {
+			REDEBUG("Failed adding query timeout");
+			goto fail;
+		}
+		ctx->timer = true;
+	}
+
+	return unlang_module_yield(request, acct_async_resume, acct_async_signal, ctx);
+}
+
+/** Run queries until one of them has to wait for the server
+ *
+ */
+static rlm_rcode_t acct_async_query(REQUEST *request, sql_acct_ctx_t *ctx)
+{
+	rlm_sql_t const	*inst = ctx->inst;
+	rlm_rcode_t	rcode;
+
+	for (;;) {
+		rcode = acct_query_expand(&ctx->query, inst, request, ctx->section, ctx->pair, ctx->handle);
+		if (rcode != RLM_MODULE_OK) return acct_async_finish(request, ctx, rcode);
+
+		ctx->sql_ret = rlm_sql_query_send(inst, request, &ctx->handle, ctx->query);
+		switch (ctx->sql_ret) {
+		case RLM_SQL_PENDING:
+		case RLM_SQL_PENDING_WRITE:
+			return acct_async_wait(request, ctx);
+
+		default:
+			break;
+		}
+
+		rcode = acct_async_result(request, ctx);
+		if (rcode != RLM_MODULE_UNKNOWN) return acct_async_finish(request, ctx, rcode);
+	}
+}
+
+static rlm_rcode_t acct_async_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *uctx)
+{
+	sql_acct_ctx_t	*ctx = talloc_get_type_abort(uctx, sql_acct_ctx_t);
+	rlm_rcode_t	rcode;
+
+	switch (ctx->sql_ret) {
+	case RLM_SQL_PENDING:
+	case RLM_SQL_PENDING_WRITE:
+		return acct_async_wait(request, ctx);
+
+	default:
+		break;
+	}
+
+	/*
+	 *	A new timeout is set for the next query.
+	 */
+	acct_async_unwatch(request, ctx);
+
+	/*
+	 *	The connection failed while we were waiting for the
+	 *	result.  Like rlm_sql_query(), send the query again
+	 *	on another connection, but only once.
+	 */
+	if ((ctx->sql_ret == RLM_SQL_RECONNECT) && !ctx->retried) {
+		rlm_sql_t const *inst = ctx->inst;
+
+		ctx->retried = true;
+
+		rad_assert(!ctx->handle);
+		ctx->handle = fr_pool_connection_get(inst->pool, request);
+		if (!ctx->handle) return acct_async_finish(request, ctx, RLM_MODULE_FAIL);
+
+		RDEBUG("Retrying query on a new connection");
+
+		return acct_async_query(request, ctx);
+	}
+
+	rcode = acct_async_result(request, ctx);
+	if (rcode != RLM_MODULE_UNKNOWN) return acct_async_finish(request, ctx, rcode);
+
+	return acct_async_query(request, ctx);
+}
+
+/** Run a set of redundant queries, yielding while waiting for the server
+ *
+ * Used instead of #acct_redundant if the driver supports non-blocking queries.
+ */
+static rlm_rcode_t acct_redundant_async(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+{
+	sql_acct_ctx_t	*ctx;
+	CONF_PAIR	*pair;
+	rlm_rcode_t	rcode;
+
+	rcode = acct_query_find(&pair, request, section);
+	if (rcode != RLM_MODULE_OK) return rcode;
+
+	MEM(ctx = talloc_zero(request, sql_acct_ctx_t));
+	ctx->inst = inst;
+	ctx->section = section;
+	ctx->pair = pair;
+	ctx->fd = -1;
+
+	ctx->handle = fr_pool_connection_get(inst->pool, request);
+	if (!ctx->handle) {
+		talloc_free(ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	sql_set_user(inst, request, NULL);
+
+	return acct_async_query(request, ctx);
+}
+
 #ifdef WITH_ACCOUNTING
 
 /*
@@ -1676,6 +2037,8 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 	rlm_sql_t const *inst = instance;
 
 	if (inst->config->accounting.reference_cp) {
+		if (inst->driver->sql_query_send) return acct_redundant_async(inst, request, &inst->config->accounting);
+
 		return acct_redundant(inst, request, &inst->config->accounting);
 	}
 
@@ -1693,6 +2056,8 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
 	rlm_sql_t const *inst = talloc_get_type_abort(instance, rlm_sql_t);
 
 	if (inst->config->postauth.reference_cp) {
+		if (inst->driver->sql_query_send) return acct_redundant_async(inst, request, &inst->config->postauth);
+
 		return acct_redundant(inst, request, &inst->config->postauth);
 	}
 
@@ -51,6 +51,8 @@ typedef enum {
 	RLM_SQL_RECONNECT = 1,		//!< Stale connection, should reconnect.
 	RLM_SQL_ALT_QUERY,		//!< Key constraint violation, use an alternative query.
 	RLM_SQL_NO_MORE_ROWS,		//!< No more rows available
+	RLM_SQL_PENDING,		//!< Query was sent, wait for the socket to become readable.
+	RLM_SQL_PENDING_WRITE,		//!< Query is being sent, wait for the socket to become writable.
 } sql_rcode_t;
 
 typedef enum {
@@ -210,6 +212,21 @@ typedef struct rlm_sql_driver_t {
 	sql_rcode_t (*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 
 	xlat_escape_t	sql_escape_func;
+
+	/*
+	 *	Optional.  Drivers which can run queries without blocking
+	 *	provide all three, and rlm_sql yields while the query runs.
+	 */
+	sql_rcode_t (*sql_query_send)(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+				      char const *query);		//!< Send a query.  Returns #RLM_SQL_PENDING
+									//!< if the result isn't available yet, or
+									//!< #RLM_SQL_PENDING_WRITE if the query
+									//!< couldn't all be sent.
+	sql_rcode_t (*sql_query_recv)(rlm_sql_handle_t *handle,
+				      rlm_sql_config_t *config);	//!< Continue a query when the socket is
+									//!< ready.  Returns #RLM_SQL_PENDING or
+									//!< #RLM_SQL_PENDING_WRITE if it's incomplete.
+	int (*sql_socket_fd)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);	//!< Socket to wait on.
 } rlm_sql_driver_t;
 
 struct sql_inst {
@@ -249,6 +266,8 @@ int		sql_dict_init(rlm_sql_handle_t *handle);
 void 		rlm_sql_query_log(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section, char const *query) CC_HINT(nonnull (1, 2, 4));
 sql_rcode_t	rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
 sql_rcode_t	rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
+sql_rcode_t	rlm_sql_query_send(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull);
+sql_rcode_t	rlm_sql_query_recv(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle) CC_HINT(nonnull);
 int		rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle);
 void		rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, bool force_debug);
 int		sql_set_user(rlm_sql_t const *inst, REQUEST *request, char const *username);
@@ -50,6 +50,8 @@ const FR_NAME_NUMBER sql_rcode_table[] = {
 	{ "query invalid",	RLM_SQL_QUERY_INVALID	},
 	{ "no connection",	RLM_SQL_RECONNECT	},
 	{ "no more rows",	RLM_SQL_NO_MORE_ROWS	},
+	{ "pending",		RLM_SQL_PENDING		},
+	{ "pending write",	RLM_SQL_PENDING_WRITE	},
 	{ NULL, 0 }
 };
 
@@ -308,6 +310,60 @@ void rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle
 	talloc_free_children(handle->log_ctx);
 }
 
+/** Log the errors from a failed query, and free its result
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request, may be NULL.
+ * @param handle the query was run on.
+ * @param ret from the driver.
+ * @return ret, or #RLM_SQL_ALT_QUERY if the driver can't distinguish between
+ *	constraints violations and other errors.
+ */
+static sql_rcode_t sql_query_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle,
+				   sql_rcode_t ret)
+{
+	switch (ret) {
+	/*
+	 *	These are bad and should make rlm_sql return invalid
+	 */
+	case RLM_SQL_QUERY_INVALID:
+		rlm_sql_print_error(inst, request, handle, false);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+		break;
+
+	/*
+	 *	Server or client errors.
+	 *
+	 *	If the driver claims to be able to distinguish between
+	 *	duplicate row errors and other errors, and we hit a
+	 *	general error treat it as a failure.
+	 *
+	 *	Otherwise rewrite it to RLM_SQL_ALT_QUERY.
+	 */
+	case RLM_SQL_ERROR:
+		if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
+			rlm_sql_print_error(inst, request, handle, false);
+			(inst->driver->sql_finish_query)(handle, inst->config);
+			break;
+		}
+		ret = RLM_SQL_ALT_QUERY;
+		/* FALL-THROUGH */
+
+	/*
+	 *	Driver suggested using an alternative query
+	 */
+	case RLM_SQL_ALT_QUERY:
+		rlm_sql_print_error(inst, request, handle, true);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+		break;
+
+	default:
+		break;
+	}
+
+	return ret;
+}
+
 /** Call the driver's sql_query method, reconnecting if necessary.
  *
  * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
@@ -366,50 +422,118 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 			/* Reconnection succeeded, try again with the new handle */
 			continue;
 
-		/*
-		 *	These are bad and should make rlm_sql return invalid
-		 */
-		case RLM_SQL_QUERY_INVALID:
-			rlm_sql_print_error(inst, request, *handle, false);
-			(inst->driver->sql_finish_query)(*handle, inst->config);
+		default:
+			ret = sql_query_error(inst, request, *handle, ret);
 			break;
+		}
 
-		/*
-		 *	Server or client errors.
-		 *
-		 *	If the driver claims to be able to distinguish between
-		 *	duplicate row errors and other errors, and we hit a
-		 *	general error treat it as a failure.
-		 *
-		 *	Otherwise rewrite it to RLM_SQL_ALT_QUERY.
-		 */
-		case RLM_SQL_ERROR:
-			if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
-				rlm_sql_print_error(inst, request, *handle, false);
-				(inst->driver->sql_finish_query)(*handle, inst->config);
-				break;
-			}
-			ret = RLM_SQL_ALT_QUERY;
-			/* FALL-THROUGH */
+		return ret;
+	}
 
-		/*
-		 *	Driver suggested using an alternative query
-		 */
-		case RLM_SQL_ALT_QUERY:
-			rlm_sql_print_error(inst, request, *handle, true);
-			(inst->driver->sql_finish_query)(*handle, inst->config);
+	ROPTIONAL(RERROR, ERROR, "Hit reconnection limit");
+
+	return RLM_SQL_ERROR;
+}
+
+/** Call the driver's sql_query_send method, reconnecting if necessary.
+ *
+ * The driver must support non-blocking queries.  If #RLM_SQL_PENDING is returned,
+ * the caller should wait for the handle's socket to become readable, and then call
+ * #rlm_sql_query_recv.  #RLM_SQL_PENDING_WRITE is the same, but the caller should
+ * wait for the socket to become writable.
+ *
+ * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
+ *	after they're done with the result.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle to query the database with. *handle should not be NULL, as this indicates
+ *	  previous reconnection attempt has failed.
+ * @param query to execute. Should not be zero length.
+ * @return
+ *	- #RLM_SQL_PENDING if the query was sent.
+ *	- #RLM_SQL_PENDING_WRITE if the rest of the query is waiting to be sent.
+ *	- other #sql_rcode_t values as for #rlm_sql_query, if the query has already completed,
+ *	  or couldn't be sent.
+ */
+sql_rcode_t rlm_sql_query_send(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query)
+{
+	int ret = RLM_SQL_ERROR;
+	int i, count;
+
+	rad_assert(*handle);
+	rad_assert(inst->driver->sql_query_send);
+
+	if (query[0] == '\0') {
+		REDEBUG("Zero length query");
+		return RLM_SQL_QUERY_INVALID;
+	}
+
+	count = fr_pool_state(inst->pool)->num;
+
+	for (i = 0; i < (count + 1); i++) {
+		RDEBUG2("Sending query: %s", query);
+
+		ret = (inst->driver->sql_query_send)(*handle, inst->config, query);
+		switch (ret) {
+		case RLM_SQL_OK:
+		case RLM_SQL_PENDING:
+		case RLM_SQL_PENDING_WRITE:
 			break;
 
+		case RLM_SQL_RECONNECT:
+			*handle = fr_pool_connection_reconnect(inst->pool, request, *handle);
+			if (!*handle) return RLM_SQL_RECONNECT;
+			continue;
+
+		default:
+			ret = sql_query_error(inst, request, *handle, ret);
+			break;
 		}
 
 		return ret;
 	}
 
-	ROPTIONAL(RERROR, ERROR, "Hit reconnection limit");
+	RERROR("Hit reconnection limit");
 
 	return RLM_SQL_ERROR;
 }
 
+/** Call the driver's sql_query_recv method
+ *
+ * Unlike #rlm_sql_query_send, this doesn't reconnect, as the handle has a
+ * query in progress.  The caller should close the handle, and may send the
+ * query again on a new one, as #rlm_sql_query does.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle the query was sent on.
+ * @return
+ *	- #RLM_SQL_PENDING if more data is needed.
+ *	- #RLM_SQL_PENDING_WRITE if the query still hasn't all been sent.
+ *	- #RLM_SQL_RECONNECT if the connection failed.  The caller should close it.
+ *	- other #sql_rcode_t values as for #rlm_sql_query.
+ */
+sql_rcode_t rlm_sql_query_recv(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle)
+{
+	sql_rcode_t ret;
+
+	ret = (inst->driver->sql_query_recv)(handle, inst->config);
+	switch (ret) {
+	case RLM_SQL_OK:
+	case RLM_SQL_PENDING:
+	case RLM_SQL_PENDING_WRITE:
+		return ret;
+
+	case RLM_SQL_RECONNECT:
+		rlm_sql_print_error(inst, request, handle, false);
+		return ret;
+
+	default:
+		return sql_query_error(inst, request, handle, ret);
+	}
+}
+
 /** Call the driver's sql_select_query method, reconnecting if necessary.
  *
  * @note Caller must call ``(inst->driver->sql_finish_select_query)(handle, inst->config);``
@@ -96,10 +96,14 @@ typedef struct rlm_test_t {
 
 	_timeval_t	timeval;
 	_timeval_t	*timeval_m;
+
+	uint32_t	instantiated;		//!< How many times mod_instantiate() has been called
+						//!< on this copy of the instance data.
 } rlm_test_t;
 
 typedef struct {
 	pthread_t	value;
+	rlm_test_t const *inst;			//!< This thread's copy of the instance data.
 } rlm_test_thread_t;
 
 /*
@@ -177,14 +181,21 @@ static int rlm_test_cmp(UNUSED void *instance, REQUEST *request, UNUSED VALUE_PA
 	return 1;
 }
 
-static int mod_thread_instantiate(UNUSED CONF_SECTION  const *cs, UNUSED void *instance, UNUSED fr_event_list_t *el,
+static int mod_thread_instantiate(UNUSED CONF_SECTION  const *cs, void *instance, UNUSED fr_event_list_t *el,
 				  void *thread)
 {
 	rlm_test_thread_t *t = thread;
 
 	t->value = pthread_self();
+	t->inst = instance;
 	INFO("Performing instantiation for thread %p (ctx %p)", (void *)t->value, t);
 
+	/*
+	 *	We should have been given a private copy of the
+	 *	instance data, which has been instantiated again.
+	 */
+	if (!rad_cond_assert(t->inst->instantiated == 2)) return -1;
+
 	return 0;
 }
 
@@ -213,6 +224,12 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
 {
 	rlm_test_t *inst = instance;
 
+	/*
+	 *	Called again for each thread's copy of the
+	 *	instance data.  Only register things once.
+	 */
+	if (inst->instantiated++ > 0) return 0;
+
 	paircompare_register_byname("test-Paircmp", fr_dict_attr_by_num(NULL, 0, FR_USER_NAME), false,
 				    rlm_test_cmp, inst);
 
@@ -239,7 +256,7 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
  *	from the database. The authentication code only needs to check
  *	the password, the rest is done here.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_authorize(UNUSED void *instance, void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, void *thread, REQUEST *request)
 {
 	rlm_test_thread_t *t = thread;
 
@@ -269,6 +286,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(UNUSED void *instance, void *t
 	REDEBUG4("RDEBUG4 error message");
 
 	if (!rad_cond_assert(t->value == pthread_self())) return RLM_MODULE_FAIL;
+	if (!rad_cond_assert(t->inst == instance)) return RLM_MODULE_FAIL;
 
 	return RLM_MODULE_OK;
 }
@@ -276,11 +294,12 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(UNUSED void *instance, void *t
 /*
  *	Authenticate the user with the given password.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(UNUSED void *instance, void *thread, UNUSED REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, UNUSED REQUEST *request)
 {
 	rlm_test_thread_t *t = thread;
 
 	if (!rad_cond_assert(t->value == pthread_self())) return RLM_MODULE_FAIL;
+	if (!rad_cond_assert(t->inst == instance)) return RLM_MODULE_FAIL;
 
 	return RLM_MODULE_OK;
 }
@@ -289,11 +308,12 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(UNUSED void *instance, void
 /*
  *	Massage the request before recording it or proxying it
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_preacct(UNUSED void *instance, void *thread, UNUSED REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_preacct(void *instance, void *thread, UNUSED REQUEST *request)
 {
 	rlm_test_thread_t *t = thread;
 
 	if (!rad_cond_assert(t->value == pthread_self())) return RLM_MODULE_FAIL;
+	if (!rad_cond_assert(t->inst == instance)) return RLM_MODULE_FAIL;
 
 	return RLM_MODULE_OK;
 }
@@ -301,11 +321,12 @@ static rlm_rcode_t CC_HINT(nonnull) mod_preacct(UNUSED void *instance, void *thr
 /*
  *	Write accounting information to this modules database.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_accounting(UNUSED void *instance, void *thread, UNUSED REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, void *thread, UNUSED REQUEST *request)
 {
 	rlm_test_thread_t *t = thread;
 
 	if (!rad_cond_assert(t->value == pthread_self())) return RLM_MODULE_FAIL;
+	if (!rad_cond_assert(t->inst == instance)) return RLM_MODULE_FAIL;
 
 	return RLM_MODULE_OK;
 }
@@ -325,12 +346,16 @@ static int mod_detach(UNUSED void *instance)
  *	data, the type should be changed to RLM_TYPE_THREAD_UNSAFE.
  *	The server will then take care of ensuring that the module
  *	is single-threaded.
+ *
+ *	This module uses RLM_TYPE_THREAD_INSTANCE instead, so each
+ *	thread gets its own copy of the instance data.  That's only
+ *	so the tests exercise it.
  */
 extern rad_module_t rlm_test;
 rad_module_t rlm_test = {
 	.magic			= RLM_MODULE_INIT,
 	.name			= "test",
-	.type			= RLM_TYPE_THREAD_SAFE,
+	.type			= RLM_TYPE_THREAD_UNSAFE | RLM_TYPE_THREAD_INSTANCE,
 	.inst_size		= sizeof(rlm_test_t),
 	.thread_inst_size	= sizeof(rlm_test_thread_t),
 	.config			= module_config,
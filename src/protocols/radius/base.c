@@ -292,22 +292,28 @@ invalid:
 	return packet_len;
 }
 
-/** Sign a previously encoded packet
+/** Sign a previously encoded packet, apart from the Request / Response Authenticator
+ *
+ * Calculates the Message-Authenticator (if any), and sets up the
+ * authenticator field for MD5(packet + secret).  The caller can then
+ * calculate that hash for many packets at once, with #fr_md5_calc_multi.
  *
  * @param packet the raw RADIUS packet (request or response)
  * @param original the raw original request (if this is a response)
  * @param secret the shared secret
  * @param secret_len the length of the secret
+ * @param hkey HMAC-MD5 key state for the secret, from #fr_hmac_md5_key_init.
+ *	May be NULL, in which case it's calculated from the secret.
  * @return
  *	- <0 on error
- *	- 0 on success
+ *	- 0 the packet is signed.
+ *	- 1 the caller has to write MD5(packet + secret) to packet + 4.
  */
-int fr_radius_sign(uint8_t *packet, uint8_t const *original,
-		   uint8_t const *secret, size_t secret_len)
+int fr_radius_sign_start(uint8_t *packet, uint8_t const *original,
+			 uint8_t const *secret, size_t secret_len, fr_hmac_md5_key_t const *hkey)
 {
 	uint8_t *msg, *end;
 	size_t packet_len = (packet[2] << 8) | packet[3];
-	FR_MD5_CTX	context;
 
 	if (packet_len < RADIUS_HDR_LEN) {
 		fr_strerror_printf("Packet must be encoded before calling fr_radius_sign()");
@@ -384,7 +390,11 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		 *	Message-Authenticator attribute.
 		 */
 		memset(msg + 2, 0, AUTH_VECTOR_LEN);
-		fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		if (hkey) {
+			fr_hmac_md5_keyed(msg + 2, packet, packet_len, hkey);
+		} else {
+			fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		}
 		break;
 	}
 
@@ -429,6 +439,33 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		return -1;
 	}
 
+	return 1;
+}
+
+/** Sign a previously encoded packet
+ *
+ * @param packet the raw RADIUS packet (request or response)
+ * @param original the raw original request (if this is a response)
+ * @param secret the shared secret
+ * @param secret_len the length of the secret
+ * @param hkey HMAC-MD5 key state for the secret, from #fr_hmac_md5_key_init.
+ *	May be NULL, in which case it's calculated from the secret.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_radius_sign(uint8_t *packet, uint8_t const *original,
+		   uint8_t const *secret, size_t secret_len, fr_hmac_md5_key_t const *hkey)
+{
+	int		rcode;
+	size_t		packet_len;
+	FR_MD5_CTX	context;
+
+	rcode = fr_radius_sign_start(packet, original, secret, secret_len, hkey);
+	if (rcode <= 0) return rcode;
+
+	packet_len = (packet[2] << 8) | packet[3];
+
 	/*
 	 *	Request / Response Authenticator = MD5(packet + secret)
 	 */
@@ -714,12 +751,13 @@ finish:
  * @param original the raw original request (if this is a response)
  * @param secret the shared secret
  * @param secret_len the length of the secret
+ * @param hkey HMAC-MD5 key state for the secret, or NULL.
  * @return
  *	- <0 on error
  *	- 0 on success
  */
 int fr_radius_verify(uint8_t *packet, uint8_t const *original,
-		     uint8_t const *secret, size_t secret_len)
+		     uint8_t const *secret, size_t secret_len, fr_hmac_md5_key_t const *hkey)
 {
 	int rcode;
 	uint8_t *msg, *end;
@@ -775,7 +813,7 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *original,
 	 *	slightly more CPU work than having verify-specific
 	 *	functions, but it ends up being cleaner in the code.
 	 */
-	rcode = fr_radius_sign(packet, original, secret, secret_len);
+	rcode = fr_radius_sign(packet, original, secret, secret_len, hkey);
 	if (rcode < 0) {
 		fr_strerror_printf("unknown packet code");
 		return -1;
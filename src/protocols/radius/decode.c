@@ -1286,8 +1286,24 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_dic
 	vp->tag = tag;
 
 	switch (parent->type) {
-	case FR_TYPE_STRING:
 	case FR_TYPE_OCTETS:
+		/*
+		 *	Reference the packet instead of copying the
+		 *	value, if the caller allows it.  "p" may point
+		 *	to a decrypted or reassembled copy, which we
+		 *	can't reference.
+		 *
+		 *	Strings are always copied, as they have to be
+		 *	NUL terminated.
+		 */
+		if (packet_ctx && packet_ctx->borrow_start &&
+		    (p >= packet_ctx->borrow_start) && ((p + data_len) <= packet_ctx->borrow_end)) {
+			fr_value_box_memborrow(&vp->data, vp->da, p, data_len, true);
+			break;
+		}
+		/* FALL-THROUGH */
+
+	case FR_TYPE_STRING:
 	case FR_TYPE_IPV4_ADDR:
 	case FR_TYPE_IPV6_ADDR:
 	case FR_TYPE_BOOL:
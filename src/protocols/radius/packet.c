@@ -101,13 +101,7 @@ int fr_radius_packet_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original
 }
 
 
-/** Calculate/check digest, and decode radius attributes
- *
- * @return
- *	- 0 on success
- *	- -1 on decoding error.
- */
-int fr_radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret)
+static int radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret, bool borrow)
 {
 	int			packet_length;
 	uint32_t		num_attributes;
@@ -119,6 +113,12 @@ int fr_radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char
 
 	packet_ctx.secret = secret;
 	packet_ctx.vector = packet->vector;
+	if (borrow) {
+		packet_ctx.borrow_start = packet->data;
+		packet_ctx.borrow_end = packet->data + packet->data_len;
+	} else {
+		packet_ctx.borrow_start = packet_ctx.borrow_end = NULL;
+	}
 
 	switch (packet->code) {
 	case FR_CODE_ACCESS_REQUEST:
@@ -234,6 +234,33 @@ int fr_radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char
 	return 0;
 }
 
+/** Calculate/check digest, and decode radius attributes
+ *
+ * @return
+ *	- 0 on success
+ *	- -1 on decoding error.
+ */
+int fr_radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret)
+{
+	return radius_packet_decode(packet, original, secret, false);
+}
+
+/** Calculate/check digest, and decode radius attributes, without copying octets values
+ *
+ * Octets attributes which aren't encrypted reference packet->data directly,
+ * instead of having their own copy.  packet->data must not be freed or
+ * modified while the decoded VALUE_PAIRs are in use.  The VALUE_PAIRs
+ * get their own copy if they're stolen by another ctx.
+ *
+ * @return
+ *	- 0 on success
+ *	- -1 on decoding error.
+ */
+int fr_radius_packet_decode_borrow(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret)
+{
+	return radius_packet_decode(packet, original, secret, true);
+}
+
 
 /** See if the data pointed to by PTR is a valid RADIUS packet.
  *
@@ -272,8 +299,13 @@ bool fr_radius_packet_ok(RADIUS_PACKET *packet, bool require_ma, decode_fail_t *
 
 /** Verify the Request/Response Authenticator (and Message-Authenticator if present) of a packet
  *
+ * @param packet	to verify.
+ * @param original	request, if packet is a response.
+ * @param secret	the shared secret.
+ * @param hkey		HMAC-MD5 key state for the secret, or NULL.
  */
-int fr_radius_packet_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret)
+int fr_radius_packet_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret,
+			    fr_hmac_md5_key_t const *hkey)
 {
 	uint8_t const	*original_data;
 	char		buffer[INET6_ADDRSTRLEN];
@@ -287,7 +319,7 @@ int fr_radius_packet_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char
 	}
 
 	if (fr_radius_verify(packet->data, original_data,
-			     (uint8_t const *) secret, talloc_array_length(secret) - 1) < 0) {
+			     (uint8_t const *) secret, talloc_array_length(secret) - 1, hkey) < 0) {
 		fr_strerror_printf("Received packet from %s with %s",
 				   inet_ntop(packet->src_ipaddr.af, &packet->src_ipaddr.addr,
 					     buffer, sizeof(buffer)),
@@ -301,9 +333,13 @@ int fr_radius_packet_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char
 
 /** Sign a previously encoded packet
  *
+ * @param packet	to sign.
+ * @param original	request, if packet is a response.
+ * @param secret	the shared secret.
+ * @param hkey		HMAC-MD5 key state for the secret, or NULL.
  */
 int fr_radius_packet_sign(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
-			  char const *secret)
+			  char const *secret, fr_hmac_md5_key_t const *hkey)
 {
 	int rcode;
 	uint8_t const *original_data;
@@ -325,7 +361,7 @@ int fr_radius_packet_sign(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
 	}
 
 	rcode = fr_radius_sign(packet->data, original_data,
-			       (uint8_t const *) secret, talloc_array_length(secret) - 1);
+			       (uint8_t const *) secret, talloc_array_length(secret) - 1, hkey);
 	if (rcode < 0) return rcode;
 
 	memcpy(packet->vector, packet->data + 4, AUTH_VECTOR_LEN);
@@ -483,7 +519,7 @@ int fr_radius_packet_send(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
 		 *	Re-sign it, including updating the
 		 *	Message-Authenticator.
 		 */
-		if (fr_radius_packet_sign(packet, original, secret) < 0) {
+		if (fr_radius_packet_sign(packet, original, secret, NULL) < 0) {
 			return -1;
 		}
 
@@ -27,6 +27,7 @@
 #include <freeradius-devel/cursor.h>
 #include <freeradius-devel/packet.h>
 #include <freeradius-devel/fr_log.h>
+#include <freeradius-devel/md5.h>
 
 #define AUTH_VECTOR_LEN		16
 #define CHAP_VALUE_LENGTH       16
@@ -71,10 +72,15 @@ typedef enum {
  */
 size_t		fr_radius_attr_len(VALUE_PAIR const *vp);
 
+int		fr_radius_sign_start(uint8_t *packet, uint8_t const *original,
+				     uint8_t const *secret, size_t secret_len,
+				     fr_hmac_md5_key_t const *hkey) CC_HINT(nonnull (1,3));
 int		fr_radius_sign(uint8_t *packet, uint8_t const *original,
-			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
+			       uint8_t const *secret, size_t secret_len,
+			       fr_hmac_md5_key_t const *hkey) CC_HINT(nonnull (1,3));
 int		fr_radius_verify(uint8_t *packet, uint8_t const *original,
-				 uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
+				 uint8_t const *secret, size_t secret_len,
+				 fr_hmac_md5_key_t const *hkey) CC_HINT(nonnull (1,3));
 bool		fr_radius_ok(uint8_t const *packet, size_t *packet_len_p, bool require_ma,
 			     decode_fail_t *reason) CC_HINT(nonnull (1,2));
 
@@ -99,14 +105,16 @@ int		fr_radius_packet_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *origina
 					char const *secret) CC_HINT(nonnull (1,3));
 int		fr_radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original,
 					char const *secret) CC_HINT(nonnull (1,3));
+int		fr_radius_packet_decode_borrow(RADIUS_PACKET *packet, RADIUS_PACKET *original,
+					       char const *secret) CC_HINT(nonnull (1,3));
 
 bool		fr_radius_packet_ok(RADIUS_PACKET *packet, bool require_ma,
 				    decode_fail_t *reason) CC_HINT(nonnull (1));
 
 int		fr_radius_packet_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original,
-					char const *secret) CC_HINT(nonnull (1,3));
+					char const *secret, fr_hmac_md5_key_t const *hkey) CC_HINT(nonnull (1,3));
 int		fr_radius_packet_sign(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
-				      char const *secret) CC_HINT(nonnull (1,3));
+				      char const *secret, fr_hmac_md5_key_t const *hkey) CC_HINT(nonnull (1,3));
 
 RADIUS_PACKET	*fr_radius_packet_recv(TALLOC_CTX *ctx, int fd, int flags, bool require_ma);
 int		fr_radius_packet_send(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
@@ -118,6 +126,9 @@ void		fr_radius_print_hex(RADIUS_PACKET const *packet) CC_HINT(nonnull);
 typedef struct fr_radius_ctx {
 	uint8_t const		*vector;		//!< vector for encryption / decryption of data
 	char const		*secret;		//!< shared secret.  MUST be talloc'd
+
+	uint8_t const		*borrow_start;		//!< octets values inside this buffer are referenced
+	uint8_t const		*borrow_end;		//!< instead of copied.  NULL to always copy.
 } fr_radius_ctx_t;
 
 /*
@@ -28,3 +28,32 @@ TESTS.DICT_FILES := $(addprefix $(BUILD_DIR)/tests/dict/,$(notdir $(FILES)))
 $(TESTS.DICT_FILES): | $(BUILD_DIR)/tests/dict
 
 tests.dict: $(TESTS.DICT_FILES)
+
+#
+#  Load the main dictionaries from the text files, and then from the
+#  snapshot which that wrote.  Both have to produce the same attributes
+#  and values.  The hash tables don't preserve the load order, so the
+#  output is sorted before comparing it.
+#
+$(BUILD_DIR)/tests/dict/snapshot: $(wildcard share/dictionary*) $(BUILD_DIR)/bin/raddict $(TESTBINDIR)/raddict | $(BUILD_DIR)/tests/dict
+	${Q}echo DICT-SNAPSHOT
+	${Q}rm -rf $@_dir
+	${Q}mkdir -p $@_dir
+	${Q}echo '$$INCLUDE $(abspath share/dictionary)' > $@_dir/dictionary
+	${Q}if ! $(TESTBIN)/raddict -D $@_dir -p > $@.text; then \
+		echo "$(TESTBIN)/raddict -D $@_dir -p"; \
+		exit 1; \
+	fi
+	${Q}if ! $(TESTBIN)/raddict -D $@_dir -p -s > $@.snapshot; then \
+		echo "$(TESTBIN)/raddict -D $@_dir -p -s"; \
+		exit 1; \
+	fi
+	${Q}sort -o $@.text $@.text
+	${Q}sort -o $@.snapshot $@.snapshot
+	${Q}if ! diff $@.text $@.snapshot; then \
+		echo "diff $@.text $@.snapshot"; \
+		exit 1; \
+	fi
+	${Q}touch $@
+
+tests.dict: $(BUILD_DIR)/tests/dict/snapshot
@@ -118,6 +118,22 @@ tests.keywords: $(TESTS.KEYWORDS_FILES)
 
 $(TESTS.KEYWORDS_FILES): $(TESTS.XLAT_FILES) $(TESTS.MAP_FILES)
 
+#
+#  Benchmark the interpreter, using the keyword tests as policies.
+#  Tests which are expected to fail to load are skipped.
+#
+#	make tests.keywords.bench BENCH_ITERATIONS=100000
+#
+BENCH_ITERATIONS ?= 10000
+
+.PHONY: tests.keywords.bench
+tests.keywords.bench: $(TESTS.KEYWORDS_FILES)
+	${Q}for x in $(KEYWORD_FILES); do \
+		if grep ERROR src/tests/keywords/$$x > /dev/null; then continue; fi; \
+		KEYWORD=$$x $(TESTBIN)/unit_test_module -D share -d src/tests/keywords/ -b $(BENCH_ITERATIONS) \
+			-i $(BUILD_DIR)/tests/keywords/$$x.attrs -f $(BUILD_DIR)/tests/keywords/$$x.attrs | grep ' ns/request' || exit 1; \
+	done
+
 .PHONY: clean.tests.keywords
 clean.tests.keywords:
 	${Q}rm -rf $(BUILD_DIR)/tests/keywords/
@@ -66,3 +66,17 @@ $(TESTS.UNIT_FILES): $(TESTS.DICT_FILES)
 #  Depend on the output files, and create the directory first.
 #
 tests.unit: $(TESTS.UNIT_FILES)
+
+#
+#  Benchmark the decoder, using the "decode" tests as input.
+#
+#	make tests.unit.bench BENCH_ITERATIONS=100000
+#
+BENCH_ITERATIONS ?= 10000
+TESTS.UNIT_BENCH_FILES := $(addprefix $(DIR)/,$(FILES))
+
+.PHONY: tests.unit.bench
+tests.unit.bench: $(BUILD_DIR)/bin/unit_test_attribute $(TESTBINDIR)/unit_test_attribute $(BUILD_DIR)/share/dictionary
+	${Q}for x in $(TESTS.UNIT_BENCH_FILES); do \
+		$(TESTBIN)/unit_test_attribute -b $(BENCH_ITERATIONS) -D $(BUILD_DIR)/share $$x || exit 1; \
+	done
@@ -1,4 +1,4 @@
-SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk 
+SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk trie_test.mk md5_multi_test.mk hmac_md5_test.mk state_test.mk pairmove_test.mk event_test.mk
 
 #
 #  These require pthread.
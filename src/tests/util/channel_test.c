@@ -24,6 +24,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/io/channel.h>
+#include <freeradius-devel/event.h>
 #include <freeradius-devel/rad_assert.h>
 
 #ifdef HAVE_GETOPT_H
@@ -34,17 +35,14 @@ RCSID("$Id$")
 #include <pthread.h>
 #endif
 
-#include <sys/event.h>
-
 #define MAX_MESSAGES		(2048)
 #define MAX_CONTROL_PLANE	(1024)
-#define MAX_KEVENTS		(10)
 
 #define MPRINT1 if (debug_lvl) printf
 #define MPRINT2 if (debug_lvl > 1) printf
 
 static int			debug_lvl = 0;
-static int			kq_master, kq_worker;
+static fr_event_list_t		*el_master, *el_worker;
 static fr_atomic_queue_t	*aq_master, *aq_worker;
 static fr_control_t		*control_master, *control_worker;
 static int			max_messages = 10;
@@ -86,6 +84,14 @@ static void NEVER_RETURNS usage(void)
 	exit(1);
 }
 
+/*
+ *	Each thread drains its control plane after servicing its event
+ *	list, so all the user event has to do is wake it up.
+ */
+static void channel_signal(UNUSED fr_event_list_t *el, UNUSED void *uctx)
+{
+}
+
 static void *channel_master(void *arg)
 {
 	bool			running, signaled_close;
@@ -97,7 +103,6 @@ static void *channel_master(void *arg)
 	fr_channel_t		*channel = arg;
 	fr_channel_t		*new_channel;
 	fr_channel_event_t	ce;
-	struct kevent		events[MAX_KEVENTS];
 
 	ctx = talloc_init("channel_master");
 	if (!ctx) _exit(1);
@@ -214,13 +219,11 @@ check_close:
 		MPRINT1("Master waiting on events.\n");
 		rad_assert(num_messages <= max_messages);
 
-		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, NULL);
-		MPRINT1("Master kevent returned %d\n", num_events);
+		num_events = fr_event_corral(el_master, true);
+		MPRINT1("Master event corral returned %d\n", num_events);
 
 		if (num_events < 0) {
-			if (num_events == EINTR) continue;
-
-			fprintf(stderr, "Failed waiting for kevent: %s\n", strerror(errno));
+			fprintf(stderr, "Failed waiting for events: %s\n", fr_strerror());
 			exit(1);
 		}
 
@@ -229,8 +232,10 @@ check_close:
 		/*
 		 *	Service the events.
 		 */
+		fr_event_service(el_master);
+
 		for (i = 0; i < num_events; i++) {
-			(void) fr_channel_service_kevent(channel, control_master, &events[i]);
+			(void) fr_channel_service_kevent(channel, control_master);
 		}
 
 		now = fr_time();
@@ -324,7 +329,6 @@ static void *channel_worker(void *arg)
 	TALLOC_CTX *ctx;
 	fr_channel_t *channel = arg;
 	fr_channel_event_t ce;
-	struct kevent events[MAX_KEVENTS];
 
 	ctx = talloc_init("channel_worker");
 	if (!ctx) _exit(1);
@@ -344,20 +348,20 @@ static void *channel_worker(void *arg)
 
 		MPRINT1("\tWorker waiting on events.\n");
 
-		num_events = kevent(kq_worker, NULL, 0, events, MAX_KEVENTS, NULL);
-		MPRINT1("\tWorker kevent returned %d events\n", num_events);
+		num_events = fr_event_corral(el_worker, true);
+		MPRINT1("\tWorker event corral returned %d events\n", num_events);
 
 		if (num_events < 0) {
-			if (errno == EINTR) continue;
-
-			fprintf(stderr, "Failed waiting for kevent: %s\n", strerror(errno));
+			fprintf(stderr, "Failed waiting for events: %s\n", fr_strerror());
 			exit(1);
 		}
 
 		if (num_events == 0) continue;
 
+		fr_event_service(el_worker);
+
 		for (i = 0; i < num_events; i++) {
-			(void) fr_channel_service_kevent(channel, control_worker, &events[i]);
+			(void) fr_channel_service_kevent(channel, control_worker);
 		}
 
 		MPRINT1("\tWorker servicing control-plane aq %p\n", aq_worker);
@@ -495,6 +499,7 @@ static void *channel_worker(void *arg)
 int main(int argc, char *argv[])
 {
 	int c;
+	uintptr_t	ident;
 	fr_channel_t	*channel;
 	TALLOC_CTX	*autofree = talloc_init("main");
 	pthread_attr_t	attr;
@@ -540,11 +545,11 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
-	kq_master = kqueue();
-	rad_assert(kq_master >= 0);
+	el_master = fr_event_list_alloc(autofree, NULL, NULL);
+	rad_assert(el_master != NULL);
 
-	kq_worker = kqueue();
-	rad_assert(kq_worker >= 0);
+	el_worker = fr_event_list_alloc(autofree, NULL, NULL);
+	rad_assert(el_worker != NULL);
 
 	aq_master = fr_atomic_queue_create(autofree, max_control_plane);
 	rad_assert(aq_master != NULL);
@@ -552,10 +557,16 @@ int main(int argc, char *argv[])
 	aq_worker = fr_atomic_queue_create(autofree, max_control_plane);
 	rad_assert(aq_worker != NULL);
 
-	control_master = fr_control_create(autofree, kq_master, aq_master, 1024);
+	ident = fr_event_user_insert(el_master, channel_signal, NULL);
+	rad_assert(ident != 0);
+
+	control_master = fr_control_create(autofree, fr_event_list_kq(el_master), aq_master, ident);
 	rad_assert(control_master != NULL);
 
-	control_worker = fr_control_create(autofree, kq_worker, aq_worker, 1025);
+	ident = fr_event_user_insert(el_worker, channel_signal, NULL);
+	rad_assert(ident != 0);
+
+	control_worker = fr_control_create(autofree, fr_event_list_kq(el_worker), aq_worker, ident);
 	rad_assert(control_worker != NULL);
 
 	channel = fr_channel_create(autofree, control_master, control_worker);
@@ -576,9 +587,6 @@ int main(int argc, char *argv[])
 	(void) pthread_join(master_id, NULL);
 	(void) pthread_join(worker_id, NULL);
 
-	close(kq_master);
-	close(kq_worker);
-
 	fr_channel_debug(channel, stdout);
 
 	talloc_free(autofree);
@@ -24,9 +24,10 @@ RCSID("$Id$")
 
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/io/time.h>
+#include <freeradius-devel/event.h>
+#include <freeradius-devel/fr_log.h>
 #include <freeradius-devel/rad_assert.h>
 
-#include <sys/event.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -42,7 +43,7 @@ RCSID("$Id$")
 #define CONTROL_MAGIC 0xabcd6809
 
 static int		debug_lvl = 0;
-static int		kq = -1;
+static fr_event_list_t	*el = NULL;
 static fr_atomic_queue_t *aq;
 static size_t		max_messages = 10;
 static int		aq_size = 16;
@@ -88,6 +89,14 @@ typedef struct my_message_t {
 	size_t			counter;
 } my_message_t;
 
+/*
+ *	The master drains the control plane itself, all the user event
+ *	has to do is wake it up.
+ */
+static void control_signal(UNUSED fr_event_list_t *event_list, UNUSED void *uctx)
+{
+}
+
 static void *control_master(UNUSED void *arg)
 {
 	TALLOC_CTX *ctx;
@@ -104,17 +113,18 @@ static void *control_master(UNUSED void *arg)
 		int num_events;
 		ssize_t data_size;
 		my_message_t m;
-		struct kevent kev;
 
 	wait_for_events:
 		MPRINT1("Master waiting for events.\n");
 
-		num_events = kevent(kq, NULL, 0, &kev, 1, NULL);
+		num_events = fr_event_corral(el, true);
 		if (num_events < 0) {
-			fprintf(stderr, "Failed reading kevent: %s\n", strerror(errno));
+			fprintf(stderr, "Failed waiting for events: %s\n", fr_strerror());
 			exit(1);
 		}
 
+		fr_event_service(el);
+
 		MPRINT1("Master draining the control plane.\n");
 
 		while (true) {
@@ -185,6 +195,7 @@ retry:
 int main(int argc, char *argv[])
 {
 	int c;
+	uintptr_t	ident;
 	TALLOC_CTX	*autofree = talloc_init("main");
 	pthread_attr_t	attr;
 	pthread_t	master_id, worker_id;
@@ -210,13 +221,16 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
-	kq = kqueue();
-	rad_assert(kq >= 0);
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	rad_assert(el != NULL);
+
+	ident = fr_event_user_insert(el, control_signal, NULL);
+	rad_assert(ident != 0);
 
 	aq = fr_atomic_queue_create(autofree, aq_size);
 	rad_assert(aq != NULL);
 
-	control = fr_control_create(autofree, kq, aq, 1024);
+	control = fr_control_create(autofree, fr_event_list_kq(el), aq, ident);
 	if (!control) {
 		fprintf(stderr, "control_test: Failed to create control plane\n");
 		exit(1);
@@ -237,8 +251,6 @@ int main(int argc, char *argv[])
 	(void) pthread_join(master_id, NULL);
 	(void) pthread_join(worker_id, NULL);
 
-	close(kq);
-
 	talloc_free(autofree);
 
 	return 0;
@@ -0,0 +1,393 @@
+/*
+ * event_test.c	Tests for the event list timer wheel, user events and files
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/event.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define USEC (1000000)
+
+/*
+ *	Nothing here sleeps.  The tests pass made-up times to
+ *	fr_event_timer_run(), which is how an idle event loop sees
+ *	the clock jump forwards.
+ */
+typedef struct event_test_timer_t {
+	int			id;
+	struct timeval		due;
+	fr_event_timer_t const	*ev;
+} event_test_timer_t;
+
+static int		debug_lvl = 0;
+static int		fired[8];
+static int		num_fired;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: event_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+static void tv_add(struct timeval *out, struct timeval const *base, uint64_t usec)
+{
+	out->tv_sec = base->tv_sec + (usec / USEC);
+	out->tv_usec = base->tv_usec + (usec % USEC);
+	if (out->tv_usec >= USEC) {
+		out->tv_sec++;
+		out->tv_usec -= USEC;
+	}
+}
+
+static int64_t tv_diff(struct timeval const *a, struct timeval const *b)
+{
+	return ((int64_t) (a->tv_sec - b->tv_sec) * USEC) + (a->tv_usec - b->tv_usec);
+}
+
+static void timer_fired(UNUSED fr_event_list_t *el, struct timeval *now, void *uctx)
+{
+	event_test_timer_t *timer = uctx;
+
+	if (debug_lvl) printf("timer %d fired %" PRId64 "us after it was due\n", timer->id, tv_diff(now, &timer->due));
+
+	if (tv_diff(now, &timer->due) < 0) {
+		fprintf(stderr, "Timer %d fired %" PRId64 "us early\n", timer->id, -tv_diff(now, &timer->due));
+		exit(1);
+	}
+
+	if (num_fired >= (int) (sizeof(fired) / sizeof(fired[0]))) {
+		fprintf(stderr, "Too many timers fired\n");
+		exit(1);
+	}
+
+	fired[num_fired++] = timer->id;
+}
+
+static void timer_add(fr_event_list_t *el, event_test_timer_t *timer, int id,
+		      struct timeval const *base, uint64_t usec)
+{
+	timer->id = id;
+	timer->ev = NULL;
+	tv_add(&timer->due, base, usec);
+
+	if (fr_event_timer_insert(NULL, el, &timer->ev, &timer->due, timer_fired, timer) < 0) {
+		fr_perror("event_test");
+		exit(1);
+	}
+}
+
+static void fired_check(char const *test, int const *expected, int num)
+{
+	int i;
+
+	if (num_fired != num) {
+		fprintf(stderr, "%s: %d timers fired, expected %d\n", test, num_fired, num);
+		exit(1);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (fired[i] != expected[i]) {
+			fprintf(stderr, "%s: timer %d fired in position %d, expected timer %d\n",
+				test, fired[i], i, expected[i]);
+			exit(1);
+		}
+	}
+
+	num_fired = 0;
+}
+
+/** Run an idle event loop, which sleeps until the next time it's told to wake up
+ *
+ * Timers more than a few ticks away live in the wheel, and the loop
+ * should only wake up when they're moved to the heap.  Waking up for
+ * every tick of the wheel would need thousands of wakeups here.
+ */
+static void wheel_promotion(fr_event_list_t *el)
+{
+	event_test_timer_t	timers[3];
+	struct timeval		base, now, when;
+	int			wakeups = 0;
+	int const		expected[] = { 0, 1, 2 };
+
+	gettimeofday(&base, NULL);
+
+	timer_add(el, &timers[0], 0, &base, 100000);		/* 100ms, goes straight into the heap */
+	timer_add(el, &timers[1], 1, &base, 10 * USEC);		/* in the wheel */
+	timer_add(el, &timers[2], 2, &base, 300 * USEC);	/* in the wheel, a few rotations out */
+
+	now = base;
+	while (true) {
+		when = now;
+		if (fr_event_timer_run(el, &when) == 1) {
+			/*
+			 *	The next timer after the first one is
+			 *	nearly ten seconds away.
+			 */
+			if (num_fired == 1) {
+				when = now;
+				if ((fr_event_timer_run(el, &when) == 0) && (tv_diff(&when, &base) < (9 * USEC))) {
+					fprintf(stderr, "wheel_promotion: woke up after %" PRId64 "us, "
+						"expected at least 9s\n", tv_diff(&when, &base));
+					exit(1);
+				}
+			}
+			continue;
+		}
+
+		if (!when.tv_sec && !when.tv_usec) break;
+
+		if (tv_diff(&when, &now) <= 0) {
+			fprintf(stderr, "wheel_promotion: asked to wake up at %" PRId64 "us, "
+				"which isn't after %" PRId64 "us\n", tv_diff(&when, &base), tv_diff(&now, &base));
+			exit(1);
+		}
+
+		now = when;
+		wakeups++;
+	}
+
+	fired_check("wheel_promotion", expected, 3);
+
+	/*
+	 *	One wakeup for each timer, one for each slot the
+	 *	wheel moves into the heap, and one for each rotation
+	 *	the last timer is away.
+	 */
+	if (wakeups > 10) {
+		fprintf(stderr, "wheel_promotion: woke up %d times, expected at most 10\n", wakeups);
+		exit(1);
+	}
+
+	if (debug_lvl) printf("OK - wheel_promotion, %d wakeups\n", wakeups);
+}
+
+/** Run an event loop which has been away for much longer than a rotation of the wheel
+ *
+ * Everything which is due fires, in order, and nothing which isn't
+ * due fires early.
+ */
+static void idle_catch_up(fr_event_list_t *el)
+{
+	event_test_timer_t	timers[3];
+	struct timeval		base, now, when;
+	int const		expected[] = { 0, 1 };
+	int const		expected_last[] = { 2 };
+
+	gettimeofday(&base, NULL);
+
+	timer_add(el, &timers[0], 0, &base, 10 * USEC);
+	timer_add(el, &timers[1], 1, &base, 300 * USEC);
+	timer_add(el, &timers[2], 2, &base, 2000 * USEC);
+
+	tv_add(&now, &base, 1000 * USEC);
+
+	while (true) {
+		when = now;
+		if (fr_event_timer_run(el, &when) == 0) break;
+	}
+
+	fired_check("idle_catch_up", expected, 2);
+
+	if ((!when.tv_sec && !when.tv_usec) || (tv_diff(&when, &timers[2].due) > 0)) {
+		fprintf(stderr, "idle_catch_up: asked to wake up at %" PRId64 "us, expected at most %" PRId64 "us\n",
+			tv_diff(&when, &base), tv_diff(&timers[2].due, &base));
+		exit(1);
+	}
+
+	/*
+	 *	And the last one fires when it's due.
+	 */
+	now = timers[2].due;
+	while (true) {
+		when = now;
+		if (fr_event_timer_run(el, &when) == 0) break;
+	}
+
+	fired_check("idle_catch_up", expected_last, 1);
+
+	if (when.tv_sec || when.tv_usec) {
+		fprintf(stderr, "idle_catch_up: timers left after the last one fired\n");
+		exit(1);
+	}
+
+	if (debug_lvl) printf("OK - idle_catch_up\n");
+}
+
+static void user_fired(UNUSED fr_event_list_t *el, void *uctx)
+{
+	int *count = uctx;
+
+	(*count)++;
+}
+
+/** Trigger a user event, and check it wakes the loop up exactly once
+ *
+ * Two triggers before the loop runs are one wakeup, and the event
+ * doesn't fire again until it's triggered again.
+ */
+static void user_event(fr_event_list_t *el)
+{
+	uintptr_t	ident;
+	int		count = 0;
+
+	ident = fr_event_user_insert(el, user_fired, &count);
+	if (!ident) {
+		fr_perror("event_test");
+		exit(1);
+	}
+
+	if ((fr_event_user_trigger(fr_event_list_kq(el), ident) < 0) ||
+	    (fr_event_user_trigger(fr_event_list_kq(el), ident) < 0)) {
+		fr_perror("event_test");
+		exit(1);
+	}
+
+	if (fr_event_corral(el, true) != 1) {
+		fprintf(stderr, "user_event: expected one event after the trigger\n");
+		exit(1);
+	}
+	fr_event_service(el);
+
+	if (count != 1) {
+		fprintf(stderr, "user_event: callback ran %d times, expected once\n", count);
+		exit(1);
+	}
+
+	if (fr_event_corral(el, false) != 0) {
+		fprintf(stderr, "user_event: event is still pending after it was serviced\n");
+		exit(1);
+	}
+
+	if (fr_event_user_delete(el, user_fired, &count) < 0) {
+		fprintf(stderr, "user_event: failed deleting the user event\n");
+		exit(1);
+	}
+
+	if (debug_lvl) printf("OK - user_event\n");
+}
+
+static void file_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	int *count = uctx;
+
+	(*count)++;
+}
+
+/** Regular files are always readable, so the loop mustn't sleep on them
+ *
+ */
+static void file_fd(fr_event_list_t *el)
+{
+	int	fd;
+	int	count = 0;
+	char	path[] = "/tmp/event_test.XXXXXX";
+
+	/*
+	 *	kqueue only says a file is readable if it's not at
+	 *	EOF, so give it something to read.
+	 */
+	fd = mkstemp(path);
+	if ((fd < 0) || (write(fd, "data", 4) != 4) || (lseek(fd, 0, SEEK_SET) != 0)) {
+		fprintf(stderr, "file_fd: failed creating %s: %s\n", path, fr_syserror(errno));
+		exit(1);
+	}
+	unlink(path);
+
+	if (fr_event_fd_insert(NULL, el, fd, file_read, NULL, NULL, &count) < 0) {
+		fr_perror("event_test");
+		exit(1);
+	}
+
+	if (fr_event_corral(el, true) < 1) {
+		fprintf(stderr, "file_fd: expected the file to be readable\n");
+		exit(1);
+	}
+	fr_event_service(el);
+
+	if (count != 1) {
+		fprintf(stderr, "file_fd: read callback ran %d times, expected once\n", count);
+		exit(1);
+	}
+
+	if (fr_event_fd_delete(el, fd) < 0) {
+		fr_perror("event_test");
+		exit(1);
+	}
+	close(fd);
+
+	if (debug_lvl) printf("OK - file_fd\n");
+}
+
+static fr_event_list_t *event_list_alloc(TALLOC_CTX *ctx)
+{
+	fr_event_list_t *el;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	if (!el) {
+		fprintf(stderr, "event_test: Failed creating event list\n");
+		exit(1);
+	}
+
+	return el;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	fr_event_list_t	*el;
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hx")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	/*
+	 *	Each test moves its event list's clock forwards, so
+	 *	each one gets a new list.
+	 */
+	el = event_list_alloc(autofree);
+	wheel_promotion(el);
+
+	el = event_list_alloc(autofree);
+	idle_catch_up(el);
+
+	el = event_list_alloc(autofree);
+	user_event(el);
+	file_fd(el);
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := event_test
+
+SOURCES		:= event_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
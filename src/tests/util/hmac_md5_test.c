@@ -0,0 +1,197 @@
+/*
+ * hmac_md5_test.c	Tests and benchmarks for HMAC-MD5
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_LENGTH	(4096)
+
+/*
+ *	The HMAC-MD5 test cases from RFC 2202, section 2.  Keys and
+ *	data are either a string, or one byte repeated.  Test case 4
+ *	has a key of 0x01 through 0x19, which is marked by a fill
+ *	byte of zero.
+ */
+typedef struct hmac_md5_vector_t {
+	char const	*key;
+	uint8_t		key_fill;
+	size_t		key_len;
+
+	char const	*data;
+	uint8_t		data_fill;
+	size_t		data_len;
+
+	char const	*digest;
+} hmac_md5_vector_t;
+
+static hmac_md5_vector_t const vectors[] = {
+	{ NULL, 0x0b, 16,	"Hi There", 0, 8,
+	  "9294727a3638bb1c13f48ef8158bfc9d" },
+	{ "Jefe", 0, 4,		"what do ya want for nothing?", 0, 28,
+	  "750c783e6ab0b503eaa86e310a5db738" },
+	{ NULL, 0xaa, 16,	NULL, 0xdd, 50,
+	  "56be34521d144c88dbb8c733f0e8b3f6" },
+	{ NULL, 0x00, 25,	NULL, 0xcd, 50,
+	  "697eaf0aca3a3aea3a75164746ffaa79" },
+	{ NULL, 0x0c, 16,	"Test With Truncation", 0, 20,
+	  "56461ef2342edc00f9bab995690efd4c" },
+	{ NULL, 0xaa, 80,	"Test Using Larger Than Block-Size Key - Hash Key First", 0, 54,
+	  "6b1ab7fe4bd7bf8f0b62e6ce61b9d0cd" },
+	{ NULL, 0xaa, 80,	"Test Using Larger Than Block-Size Key and Larger Than One Block-Size Data", 0, 73,
+	  "6f630fad67cda0ee1fb1f562db3aa53e" },
+};
+
+static int		debug_lvl = 0;
+
+static uint8_t		data[MAX_LENGTH];
+
+static double elapsed(struct timespec const *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + ((now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+static void vector_fill(uint8_t *out, char const *str, uint8_t fill, size_t len)
+{
+	size_t i;
+
+	if (str) {
+		memcpy(out, str, len);
+		return;
+	}
+
+	for (i = 0; i < len; i++) out[i] = fill ? fill : (i + 1);
+}
+
+static void digest_check(char const *function, int test, uint8_t const digest[MD5_DIGEST_LENGTH], char const *expected)
+{
+	char hex[(MD5_DIGEST_LENGTH * 2) + 1];
+
+	fr_bin2hex(hex, digest, MD5_DIGEST_LENGTH);
+
+	if (strcmp(hex, expected) != 0) {
+		fprintf(stderr, "%s: test case %d gave %s, expected %s\n", function, test, hex, expected);
+		exit(1);
+	}
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: hmac_md5_test [OPTS]\n");
+	fprintf(stderr, "  -l <length>            Length of each message (default: 64).\n");
+	fprintf(stderr, "  -i <iterations>        Benchmark with this many calls.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, n;
+	int			iterations = 0;
+	size_t			i, len = 64;
+	uint8_t			key[80];
+	uint8_t			digest[MD5_DIGEST_LENGTH];
+	fr_hmac_md5_key_t	hkey;
+
+	while ((c = getopt(argc, argv, "hi:l:x")) != EOF) switch (c) {
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+
+		case 'l':
+			len = atoi(optarg);
+			if (len > MAX_LENGTH) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	/*
+	 *	Both ways of calculating the HMAC must give the
+	 *	digests from the RFC.  Key state is reused, so check
+	 *	it twice.
+	 */
+	for (i = 0; i < (sizeof(vectors) / sizeof(vectors[0])); i++) {
+		hmac_md5_vector_t const *v = &vectors[i];
+
+		vector_fill(key, v->key, v->key_fill, v->key_len);
+		vector_fill(data, v->data, v->data_fill, v->data_len);
+
+		fr_hmac_md5(digest, data, v->data_len, key, v->key_len);
+		digest_check("fr_hmac_md5", i + 1, digest, v->digest);
+
+		fr_hmac_md5_key_init(&hkey, key, v->key_len);
+		for (n = 0; n < 2; n++) {
+			fr_hmac_md5_keyed(digest, data, v->data_len, &hkey);
+			digest_check("fr_hmac_md5_keyed", i + 1, digest, v->digest);
+		}
+
+		if (debug_lvl) printf("Checked RFC 2202 test case %zu\n", i + 1);
+	}
+
+	/*
+	 *	Compare setting the key up on every call, as
+	 *	fr_hmac_md5() does, with setting it up once.
+	 */
+	if (iterations > 0) {
+		struct timespec	start;
+		double		unkeyed, keyed;
+
+		for (i = 0; i < len; i++) data[i] = i;
+		for (i = 0; i < 16; i++) key[i] = 0xaa;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (n = 0; n < iterations; n++) fr_hmac_md5(digest, data, len, key, 16);
+		unkeyed = elapsed(&start);
+
+		fr_hmac_md5_key_init(&hkey, key, 16);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (n = 0; n < iterations; n++) fr_hmac_md5_keyed(digest, data, len, &hkey);
+		keyed = elapsed(&start);
+
+		printf("fr_hmac_md5:       %.0f ns/call (%zu bytes)\n", unkeyed * 1e9 / iterations, len);
+		printf("fr_hmac_md5_keyed: %.0f ns/call (%zu bytes)\n", keyed * 1e9 / iterations, len);
+	}
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := hmac_md5_test
+
+SOURCES		:= hmac_md5_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
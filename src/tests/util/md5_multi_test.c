@@ -0,0 +1,181 @@
+/*
+ * md5_multi_test.c	Tests and benchmarks for multi-buffer MD5
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_BUFFERS	(256)
+#define MAX_LENGTH	(4096)
+
+static int		debug_lvl = 0;
+
+static uint8_t		data[MAX_BUFFERS][MAX_LENGTH];
+static uint8_t const	*in[MAX_BUFFERS];
+static size_t		inlen[MAX_BUFFERS];
+static uint8_t		digest[MAX_BUFFERS][MD5_DIGEST_LENGTH];
+static uint8_t		*out[MAX_BUFFERS];
+
+static double elapsed(struct timespec const *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + ((now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+/** Fill the buffers with pseudo-random data, and pick their lengths
+ *
+ * Lengths are either fixed, or random up to max_len.  Random lengths
+ * exercise lanes finishing at different blocks, and the padding
+ * spilling into an extra block.
+ */
+static void fill_buffers(int num, size_t len, size_t max_len, uint32_t *seed)
+{
+	int	i;
+	size_t	j;
+
+	for (i = 0; i < num; i++) {
+		for (j = 0; j < max_len; j++) {
+			*seed = (*seed * 1103515245) + 12345;
+			data[i][j] = *seed >> 16;
+		}
+
+		if (len) {
+			inlen[i] = len;
+		} else {
+			*seed = (*seed * 1103515245) + 12345;
+			inlen[i] = (*seed >> 8) % (max_len + 1);
+		}
+
+		in[i] = data[i];
+		out[i] = digest[i];
+	}
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: md5_multi_test [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Hash num buffers per call.\n");
+	fprintf(stderr, "  -l <length>            Length of each buffer (default: random).\n");
+	fprintf(stderr, "  -i <iterations>        Benchmark with this many calls.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i, n;
+	int		num = 64, iterations = 0;
+	size_t		len = 0, max_len;
+	uint32_t	seed = 0xabcdef;
+	uint8_t		expected[MD5_DIGEST_LENGTH];
+
+	while ((c = getopt(argc, argv, "hi:l:n:x")) != EOF) switch (c) {
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+
+		case 'l':
+			len = atoi(optarg);
+			if (len > MAX_LENGTH) usage();
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			if ((num <= 0) || (num > MAX_BUFFERS)) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	/*
+	 *	Check every length up to a few blocks, with every
+	 *	number of buffers up to a few groups of lanes.  All
+	 *	of the digests must match the scalar implementation.
+	 */
+	for (n = 1; n <= (3 * FR_MD5_LANES); n++) {
+		for (max_len = 0; max_len <= (4 * 64); max_len++) {
+			fill_buffers(n, 0, max_len, &seed);
+			fr_md5_calc_multi(out, in, inlen, n);
+
+			for (i = 0; i < n; i++) {
+				fr_md5_calc(expected, in[i], inlen[i]);
+
+				if (memcmp(expected, digest[i], sizeof(expected)) != 0) {
+					fprintf(stderr, "Digest mismatch for buffer %d of %d, length %zu\n",
+						i, n, inlen[i]);
+					exit(1);
+				}
+			}
+		}
+
+		if (debug_lvl) printf("Checked %d buffers per call\n", n);
+	}
+
+	/*
+	 *	Compare throughput of hashing the buffers one at a
+	 *	time, and all together.
+	 */
+	if (iterations > 0) {
+		struct timespec	start;
+		double		scalar, multi, bytes = 0;
+
+		max_len = len ? len : MAX_LENGTH;
+		fill_buffers(num, len, max_len, &seed);
+		for (i = 0; i < num; i++) bytes += inlen[i];
+		bytes *= iterations;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (n = 0; n < iterations; n++) {
+			for (i = 0; i < num; i++) fr_md5_calc(out[i], in[i], inlen[i]);
+		}
+		scalar = elapsed(&start);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (n = 0; n < iterations; n++) fr_md5_calc_multi(out, in, inlen, num);
+		multi = elapsed(&start);
+
+		printf("scalar: %.1f MB/s\n", bytes / scalar / 1e6);
+		printf("multi:  %.1f MB/s (%d lanes)\n", bytes / multi / 1e6, FR_MD5_LANES);
+	}
+
+	return 0;
+}
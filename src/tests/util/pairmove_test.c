@@ -0,0 +1,352 @@
+/*
+ * pairmove_test.c	Tests and benchmarks for radius_pairmove()
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	The server core uses the main configuration.
+ */
+main_config_t		main_config;
+
+/*
+ *	Tmp-String-0..9 and Tmp-Integer-0..9
+ */
+#define NUM_TYPES	20
+
+static int		debug_lvl = 0;
+static char		attr_names[NUM_TYPES][32];
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: pairmove_test [OPTS]\n");
+	fprintf(stderr, "  -b <iterations>        Benchmark lookups, inserts and moves.\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <num>               Number of instances of each attribute.  Default is 16.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+static void pair_add(TALLOC_CTX *ctx, VALUE_PAIR **vps, char const *name, int value, FR_TOKEN op)
+{
+	char buffer[32];
+
+	snprintf(buffer, sizeof(buffer), "%d", value);
+	if (!fr_pair_make(ctx, vps, name, buffer, op)) {
+		fr_perror("pairmove_test");
+		exit(1);
+	}
+}
+
+/** Fill a list with num instances of every attribute, with values 0..num-1
+ *
+ */
+static void list_fill(TALLOC_CTX *ctx, VALUE_PAIR **vps, int num)
+{
+	int i, j;
+
+	for (i = 0; i < NUM_TYPES; i++) {
+		for (j = 0; j < num; j++) pair_add(ctx, vps, attr_names[i], j, T_OP_EQ);
+	}
+}
+
+/** Check the instances of one attribute in a list, in order
+ *
+ * @param[in] vps	to check.
+ * @param[in] name	of the attribute.
+ * @param[in] values	expected, in list order.
+ * @param[in] num	number of values.
+ */
+static void list_check(VALUE_PAIR *vps, char const *name, int const *values, int num)
+{
+	VALUE_PAIR	*vp;
+	int		i = 0;
+	char		buffer[32];
+
+	for (vp = vps; vp; vp = vp->next) {
+		if (strcmp(vp->da->name, name) != 0) continue;
+
+		if (i >= num) {
+			fprintf(stderr, "Too many instances of %s, expected %d\n", name, num);
+			exit(1);
+		}
+
+		fr_pair_value_snprint(buffer, sizeof(buffer), vp, '\0');
+		if (atoi(buffer) != values[i]) {
+			fprintf(stderr, "Instance %d of %s is %s, expected %d\n", i, name, buffer, values[i]);
+			exit(1);
+		}
+		i++;
+	}
+
+	if (i != num) {
+		fprintf(stderr, "Found %d instances of %s, expected %d\n", i, name, num);
+		exit(1);
+	}
+}
+
+/** Apply each operator to a list, and check the result against what the operator should do
+ *
+ */
+static void pairmove_check(TALLOC_CTX *ctx, int num)
+{
+	REQUEST		*request;
+	VALUE_PAIR	*from = NULL;
+	int		*values;
+	int		i;
+
+	request = request_alloc(ctx);
+	request->packet = fr_radius_alloc(request, false);
+	request->reply = fr_radius_alloc(request, false);
+	rad_assert(request->packet && request->reply);
+
+	/*
+	 *	Every attribute except Tmp-Integer-9 is in the "to" list.
+	 */
+	for (i = 0; i < (NUM_TYPES - 1); i++) {
+		int j;
+
+		for (j = 0; j < num; j++) pair_add(request->reply, &request->reply->vps, attr_names[i], j, T_OP_EQ);
+	}
+
+	pair_add(request, &from, "Tmp-Integer-0", 100, T_OP_SET);		/* replace the first */
+	pair_add(request, &from, "Tmp-Integer-1", 3, T_OP_SUB);		/* delete the matching one */
+	pair_add(request, &from, "Tmp-Integer-2", 5, T_OP_EQ);		/* exists, so do nothing */
+	pair_add(request, &from, "Tmp-Integer-3", 7, T_OP_ADD);		/* append */
+	pair_add(request, &from, "Tmp-Integer-4", 0, T_OP_CMP_FALSE);	/* delete all */
+	pair_add(request, &from, "Tmp-Integer-5", 4, T_OP_CMP_EQ);		/* delete all the others */
+	pair_add(request, &from, "Tmp-Integer-9", 9, T_OP_EQ);		/* doesn't exist, so append */
+
+	radius_pairmove(request, &request->reply->vps, from, false);
+
+	values = talloc_array(request, int, num + 1);
+	for (i = 0; i < num; i++) values[i] = i;
+
+	/*
+	 *	Untouched attributes keep their values, in order.
+	 */
+	for (i = 0; i < 10; i++) list_check(request->reply->vps, attr_names[i], values, num);
+	for (i = 16; i < 19; i++) list_check(request->reply->vps, attr_names[i], values, num);
+
+	values[0] = 100;
+	list_check(request->reply->vps, "Tmp-Integer-0", values, num);
+	values[0] = 0;
+
+	memmove(&values[3], &values[4], (num - 4) * sizeof(values[0]));
+	list_check(request->reply->vps, "Tmp-Integer-1", values, num - 1);
+	for (i = 0; i < num; i++) values[i] = i;
+
+	list_check(request->reply->vps, "Tmp-Integer-2", values, num);
+
+	values[num] = 7;
+	list_check(request->reply->vps, "Tmp-Integer-3", values, num + 1);
+
+	list_check(request->reply->vps, "Tmp-Integer-4", values, 0);
+
+	values[0] = 4;
+	list_check(request->reply->vps, "Tmp-Integer-5", values, 1);
+
+	values[0] = 9;
+	list_check(request->reply->vps, "Tmp-Integer-9", values, 1);
+
+	talloc_free(request);
+}
+
+/** Apply operators to a list too short to be indexed
+ *
+ */
+static void pairmove_check_short(TALLOC_CTX *ctx)
+{
+	REQUEST		*request;
+	VALUE_PAIR	*from = NULL;
+	int const	set[] = { 100, 1 };
+	int const	sub[] = { 0, 2 };
+	int const	add[] = { 9 };
+
+	request = request_alloc(ctx);
+	request->packet = fr_radius_alloc(request, false);
+	request->reply = fr_radius_alloc(request, false);
+	rad_assert(request->packet && request->reply);
+
+	pair_add(request->reply, &request->reply->vps, "Tmp-Integer-0", 0, T_OP_EQ);
+	pair_add(request->reply, &request->reply->vps, "Tmp-Integer-1", 0, T_OP_EQ);
+	pair_add(request->reply, &request->reply->vps, "Tmp-Integer-0", 1, T_OP_EQ);
+	pair_add(request->reply, &request->reply->vps, "Tmp-Integer-1", 1, T_OP_EQ);
+	pair_add(request->reply, &request->reply->vps, "Tmp-Integer-1", 2, T_OP_EQ);
+
+	pair_add(request, &from, "Tmp-Integer-0", 100, T_OP_SET);		/* replace the first */
+	pair_add(request, &from, "Tmp-Integer-1", 1, T_OP_SUB);		/* delete the matching one */
+	pair_add(request, &from, "Tmp-Integer-9", 9, T_OP_EQ);		/* doesn't exist, so append */
+
+	radius_pairmove(request, &request->reply->vps, from, false);
+
+	list_check(request->reply->vps, "Tmp-Integer-0", set, 2);
+	list_check(request->reply->vps, "Tmp-Integer-1", sub, 2);
+	list_check(request->reply->vps, "Tmp-Integer-9", add, 1);
+
+	talloc_free(request);
+}
+
+static uint64_t usec_since(struct timeval const *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+
+	return ((end.tv_sec - start->tv_sec) * 1000000) + (end.tv_usec - start->tv_usec);
+}
+
+/** Time lookups, inserts and moves on lists with num instances of every attribute
+ *
+ */
+static void pairmove_benchmark(TALLOC_CTX *ctx, int num, int iterations)
+{
+	REQUEST			*request;
+	VALUE_PAIR		*vps = NULL, *from;
+	fr_dict_attr_t const	*da[NUM_TYPES];
+	struct timeval		start;
+	uint64_t		usec;
+	int			i, j;
+
+	request = request_alloc(ctx);
+	request->packet = fr_radius_alloc(request, false);
+	request->reply = fr_radius_alloc(request, false);
+	rad_assert(request->packet && request->reply);
+
+	for (i = 0; i < NUM_TYPES; i++) {
+		da[i] = fr_dict_attr_by_name(NULL, attr_names[i]);
+		rad_assert(da[i] != NULL);
+	}
+
+	/*
+	 *	Inserts, one attribute at a time.
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		list_fill(request, &vps, num);
+		fr_pair_list_free(&vps);
+	}
+	usec = usec_since(&start);
+	printf("insert: %d pairs, %" PRIu64 " ns/insert\n",
+	       NUM_TYPES * num, (usec * 1000) / ((uint64_t) iterations * NUM_TYPES * num));
+
+	/*
+	 *	Lookups of the first instance of each attribute.
+	 *	Instances are grouped by type, so each type is
+	 *	further down the list than the one before it.
+	 */
+	list_fill(request, &vps, num);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < NUM_TYPES; j++) {
+			if (!fr_pair_find_by_da(vps, da[j], TAG_ANY)) {
+				fprintf(stderr, "Failed finding %s\n", attr_names[j]);
+				exit(1);
+			}
+		}
+	}
+	usec = usec_since(&start);
+	printf("lookup: %d pairs, %" PRIu64 " ns/lookup\n",
+	       NUM_TYPES * num, (usec * 1000) / ((uint64_t) iterations * NUM_TYPES));
+	fr_pair_list_free(&vps);
+
+	/*
+	 *	Moves of one of each attribute into a full list.
+	 */
+	list_fill(request->reply, &request->reply->vps, num);
+	usec = 0;
+	for (i = 0; i < iterations; i++) {
+		from = NULL;
+		for (j = 0; j < NUM_TYPES; j++) pair_add(request, &from, attr_names[j], j, T_OP_SET);
+
+		gettimeofday(&start, NULL);
+		radius_pairmove(request, &request->reply->vps, from, false);
+		usec += usec_since(&start);
+	}
+	printf("move:   %d pairs into %d, %" PRIu64 " ns/move\n",
+	       NUM_TYPES, NUM_TYPES * num, (usec * 1000) / iterations);
+
+	talloc_free(request);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i;
+	int		num = 16;
+	int		iterations = 0;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "b:D:hn:x")) != EOF) switch (c) {
+		case 'b':
+			iterations = atoi(optarg);
+			if (iterations <= 0) usage();
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			if (num < 8) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			fr_debug_lvl = rad_debug_lvl = debug_lvl;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("pairmove_test");
+		exit(1);
+	}
+
+	for (i = 0; i < 10; i++) {
+		snprintf(attr_names[i], sizeof(attr_names[i]), "Tmp-String-%d", i);
+		snprintf(attr_names[i + 10], sizeof(attr_names[i + 10]), "Tmp-Integer-%d", i);
+	}
+
+	pairmove_check(autofree, num);
+	pairmove_check_short(autofree);
+
+	if (debug_lvl) printf("OK - operators applied to %d instances of each attribute\n", num);
+
+	if (iterations) pairmove_benchmark(autofree, num, iterations);
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := pairmove_test
+
+SOURCES		:= pairmove_test.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-util.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
@@ -30,6 +30,7 @@ RCSID("$Id$")
 #include <freeradius-devel/radius.h>
 #include <freeradius-devel/md5.h>
 #include <freeradius-devel/libradius.h>
+#include <freeradius-devel/event.h>
 #include <freeradius-devel/rad_assert.h>
 
 #ifdef HAVE_GETOPT_H
@@ -39,11 +40,8 @@ RCSID("$Id$")
 #include <pthread.h>
 #include <signal.h>
 
-#include <sys/event.h>
-
 #define MAX_MESSAGES		(2048)
 #define MAX_CONTROL_PLANE	(1024)
-#define MAX_KEVENTS		(10)
 #define MAX_WORKERS		(1024)
 
 #define MPRINT1 if (debug_lvl) printf
@@ -204,18 +202,122 @@ static void send_reply(int sockfd, fr_channel_data_t *reply)
 }
 
 
+/** Read one packet, and send it to a worker
+ *
+ */
+static void master_read_packet(TALLOC_CTX *ctx, fr_message_set_t *ms, fr_listen_t *listen, int sockfd, int *which_worker)
+{
+	int			rcode;
+	uint8_t			*packet, *attr, *end;
+	size_t			total_len;
+	ssize_t			data_size;
+	fr_radius_packet_ctx_t	*packet_ctx;
+	fr_channel_data_t	*cd, *reply;
+
+	cd = (fr_channel_data_t *) fr_message_reserve(ms, 4096);
+	rad_assert(cd != NULL);
+
+	packet_ctx = talloc(ctx, fr_radius_packet_ctx_t);
+	rad_assert(packet_ctx != NULL);
+	packet_ctx->salen = sizeof(packet_ctx->src);
+
+	cd->priority = 0;
+	cd->packet_ctx = packet_ctx;
+	cd->listen = listen;
+
+	data_size = recvfrom(sockfd, cd->m.data, cd->m.rb_size, 0,
+			     (struct sockaddr *) &packet_ctx->src, &packet_ctx->salen);
+	MPRINT1("Master got packet size %zd\n", data_size);
+	if (data_size <= 20) {
+		MPRINT1("Master ignoring packet (data length %zd)\n", data_size);
+
+	discard:
+		fr_message_done(&cd->m); /* yeah, re-use it for the next packet... */
+		return;
+	}
+
+	/*
+	 *	Verify the packet before doing anything more with it.
+	 */
+	packet = cd->m.data;
+	if (packet[0] != FR_CODE_ACCESS_REQUEST) {
+		MPRINT1("Master ignoring packet code %u\n", packet[0]);
+		goto discard;
+	}
+
+	total_len = (packet[2] << 8) | packet[3];
+	if (total_len < 20) {
+		MPRINT1("Master ignoring packet (header length %zu)\n", total_len);
+		goto discard;
+	}
+	if (total_len > (size_t) data_size) {
+		MPRINT1("Master ignoring truncated packet (read %zd, says %zu)\n",
+			data_size, total_len);
+		goto discard;
+	}
+
+	attr = packet + 20;
+	end = packet + data_size;
+	while (attr < end) {
+		if ((end - attr) < 2) goto discard;
+		if (attr[0] == 0) goto discard;
+		if (attr[1] < 2) goto discard;
+		if ((attr + attr[1]) > end) goto discard;
+
+		attr += attr[1];
+	}
+
+	(void) fr_message_alloc(ms, &cd->m, total_len);
+
+	MPRINT1("Master sending packet size %zd to worker %d\n", cd->m.data_size, *which_worker);
+	cd->m.when = fr_time();
+
+	packet_ctx->id = packet[1];
+	memcpy(packet_ctx->vector, packet + 4, 16);
+
+	rcode = fr_channel_send_request(workers[*which_worker].ch, cd, &reply);
+	if (rcode < 0) {
+		fprintf(stderr, "Failed sending request: %s\n", strerror(errno));
+		exit(1);
+	}
+	(*which_worker)++;
+	if (*which_worker >= num_workers) *which_worker = 0;
+
+	rad_assert(rcode == 0);
+	if (reply) send_reply(sockfd, reply);
+}
+
+/*
+ *	The master reads the socket, and drains its control plane,
+ *	after servicing its event list.  The callbacks just say which
+ *	of those it needs to do.
+ */
+static void master_signal(UNUSED fr_event_list_t *el, void *uctx)
+{
+	bool *signaled = uctx;
+
+	*signaled = true;
+}
+
+static void master_socket_read(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUSED int flags, void *uctx)
+{
+	bool *readable = uctx;
+
+	*readable = true;
+}
+
 static void master_process(TALLOC_CTX *ctx)
 {
-	bool			running;
+	bool			running, control_plane_signal, socket_readable;
 	int			rcode, i, num_events, which_worker;
+	uintptr_t		ident;
 	int			num_outstanding;
 	fr_message_set_t	*ms;
 	fr_channel_t		*ch;
 	fr_channel_event_t	ce;
 	pthread_attr_t		pthread_attr;
 	fr_schedule_worker_t	*sw;
-	struct kevent		events[MAX_KEVENTS];
-	int			kq_master;
+	fr_event_list_t		*el_master;
 	fr_atomic_queue_t	*aq_master;
 	fr_control_t		*control_master;
 	fr_listen_t		listen = { .app_io = &app_io };
@@ -230,15 +332,18 @@ static void master_process(TALLOC_CTX *ctx)
 	}
 
 	/*
-	 *	Create the KQ and associated sockets.
+	 *	Create the event list and associated sockets.
 	 */
-	kq_master = kqueue();
-	rad_assert(kq_master >= 0);
+	el_master = fr_event_list_alloc(ctx, NULL, NULL);
+	rad_assert(el_master != NULL);
+
+	ident = fr_event_user_insert(el_master, master_signal, &control_plane_signal);
+	rad_assert(ident != 0);
 
 	aq_master = fr_atomic_queue_create(ctx, max_control_plane);
 	rad_assert(aq_master != NULL);
 
-	control_master = fr_control_create(ctx, kq_master, aq_master, 1024);
+	control_master = fr_control_create(ctx, fr_event_list_kq(el_master), aq_master, ident);
 	rad_assert(control_master != NULL);
 
 	sockfd = fr_socket_server_udp(&my_ipaddr, &my_port, NULL, true);
@@ -253,11 +358,10 @@ static void master_process(TALLOC_CTX *ctx)
 	}
 
 	/*
-	 *	Set up the KQ filter for reading.
+	 *	Listen for the socket becoming readable.
 	 */
-	EV_SET(&events[0], sockfd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
-	if (kevent(kq_master, events, 1, NULL, 0, NULL) < 0) {
-		fprintf(stderr, "Failed setting KQ for EVFILT_READ: %s\n", fr_strerror());
+	if (fr_event_fd_insert(ctx, el_master, sockfd, master_socket_read, NULL, NULL, &socket_readable) < 0) {
+		fprintf(stderr, "Failed listening on socket: %s\n", fr_strerror());
 		exit(1);
 	}
 
@@ -303,117 +407,34 @@ static void master_process(TALLOC_CTX *ctx)
 	running = true;
 
 	while (running) {
-		bool control_plane_signal;
 		fr_time_t now;
-		fr_channel_data_t *cd, *reply;
+		fr_channel_data_t *reply;
 
 		MPRINT1("Master waiting on events.\n");
 
-		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, NULL);
-		MPRINT1("Master kevent returned %d\n", num_events);
+		control_plane_signal = false;
+		socket_readable = false;
 
-		if (num_events < 0) {
-			if (errno == EINTR) continue;
+		num_events = fr_event_corral(el_master, true);
+		MPRINT1("Master event corral returned %d\n", num_events);
 
-			fprintf(stderr, "Failed waiting for kevent: %s\n", strerror(errno));
+		if (num_events < 0) {
+			fprintf(stderr, "Failed waiting for events: %s\n", fr_strerror());
 			exit(1);
 		}
 
 		if (num_events == 0) continue;
 
-		control_plane_signal = false;
-
 		/*
 		 *	Service the events.
 		 *
 		 *	@todo this should NOT take a channel pointer
 		 */
-		for (i = 0; i < num_events; i++) {
-			uint8_t			*packet, *attr, *end;
-			size_t			total_len;
-			ssize_t			data_size;
-			fr_radius_packet_ctx_t	*packet_ctx;
-
-			if (events[i].filter == EVFILT_USER) {
-				(void) fr_channel_service_kevent(workers[0].ch, control_master, &events[i]);
-				control_plane_signal = true;
-				break;
-			}
-
-			rad_assert(events[i].filter == EVFILT_READ);
-
-			cd = (fr_channel_data_t *) fr_message_reserve(ms, 4096);
-			rad_assert(cd != NULL);
-
-			packet_ctx = talloc(ctx, fr_radius_packet_ctx_t);
-			rad_assert(packet_ctx != NULL);
-			packet_ctx->salen = sizeof(packet_ctx->src);
+		fr_event_service(el_master);
 
-			cd->priority = 0;
-			cd->packet_ctx = packet_ctx;
-			cd->listen = &listen;
+		if (control_plane_signal) (void) fr_channel_service_kevent(workers[0].ch, control_master);
 
-			data_size = recvfrom(sockfd, cd->m.data, cd->m.rb_size, 0,
-					     (struct sockaddr *) &packet_ctx->src, &packet_ctx->salen);
-			MPRINT1("Master got packet size %zd\n", data_size);
-			if (data_size <= 20) {
-				MPRINT1("Master ignoring packet (data length %zd)\n", data_size);
-
-			discard:
-				fr_message_done(&cd->m); /* yeah, re-use it for the next packet... */
-				continue;
-			}
-
-			/*
-			 *	Verify the packet before doing anything more with it.
-			 */
-			packet = cd->m.data;
-			if (packet[0] != FR_CODE_ACCESS_REQUEST) {
-				MPRINT1("Master ignoring packet code %u\n", packet[0]);
-				goto discard;
-			}
-
-			total_len = (packet[2] << 8) | packet[3];
-			if (total_len < 20) {
-				MPRINT1("Master ignoring packet (header length %zu)\n", total_len);
-				goto discard;
-			}
-			if (total_len > (size_t) data_size) {
-				MPRINT1("Master ignoring truncated packet (read %zd, says %zu)\n",
-					data_size, total_len);
-				goto discard;
-			}
-
-			attr = packet + 20;
-			end = packet + data_size;
-			while (attr < end) {
-				if ((end - attr) < 2) goto discard;
-				if (attr[0] == 0) goto discard;
-				if (attr[1] < 2) goto discard;
-				if ((attr + attr[1]) > end) goto discard;
-
-				attr += attr[1];
-			}
-
-			(void) fr_message_alloc(ms, &cd->m, total_len);
-
-			MPRINT1("Master sending packet size %zd to worker %d\n", cd->m.data_size, which_worker);
-			cd->m.when = fr_time();
-
-			packet_ctx->id = packet[1];
-			memcpy(packet_ctx->vector, packet + 4, 16);
-
-			rcode = fr_channel_send_request(workers[which_worker].ch, cd, &reply);
-			if (rcode < 0) {
-				fprintf(stderr, "Failed sending request: %s\n", strerror(errno));
-				exit(1);
-			}
-			which_worker++;
-			if (which_worker >= num_workers) which_worker = 0;
-
-			rad_assert(rcode == 0);
-			if (reply) send_reply(sockfd, reply);
-		}
+		if (socket_readable) master_read_packet(ctx, ms, &listen, sockfd, &which_worker);
 
 		if (!control_plane_signal) continue;
 
@@ -31,7 +31,6 @@ RCSID("$Id$")
 #include <freeradius-devel/rad_assert.h>
 #include <freeradius-devel/debug.h>
 
-#include <sys/event.h>
 #include <stdio.h>
 #include <string.h>
 
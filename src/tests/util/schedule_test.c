@@ -29,7 +29,6 @@ RCSID("$Id$")
 #include <freeradius-devel/md5.h>
 #include <freeradius-devel/rad_assert.h>
 
-#include <sys/event.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -99,6 +98,8 @@ int main(int argc, char *argv[])
 
 	sleep(1);
 
+	if (debug_lvl) fr_schedule_debug(sched, stdout);
+
 	(void) fr_schedule_destroy(sched);
 
 	talloc_free(autofree);
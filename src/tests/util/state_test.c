@@ -0,0 +1,176 @@
+/*
+ * state_test.c	Tests for the session-state tree
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/state.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	state.c uses the main configuration.  Nothing here needs
+ *	threads, so the shards aren't locked.
+ */
+main_config_t		main_config;
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: state_test [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <num>               Maximum number of sessions.  Default is 64.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Save some session-state, as a module would at the end of a round
+ *
+ * @return whether the state tree accepted the entry.
+ */
+static bool state_save(TALLOC_CTX *ctx, fr_state_tree_t *state, CONF_SECTION *server_cs)
+{
+	bool		ret;
+	REQUEST		*request;
+	RADIUS_PACKET	*reply;
+
+	request = request_alloc(ctx);
+	rad_assert(request != NULL);
+	request->server_cs = server_cs;
+
+	reply = fr_radius_alloc(request, false);
+	rad_assert(reply != NULL);
+
+	if (!fr_pair_make(request->state_ctx, &request->state, "User-Name", "bob", T_OP_EQ)) {
+		fr_perror("state_test");
+		exit(1);
+	}
+
+	ret = fr_request_to_state(state, request, NULL, reply);
+
+	talloc_free(request);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i;
+	int		num = 64;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+	fr_state_tree_t	*state;
+	CONF_SECTION	*server_cs;
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "D:hn:x")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			if (num <= 0) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			fr_debug_lvl = rad_debug_lvl = debug_lvl;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("state_test");
+		exit(1);
+	}
+
+	server_cs = cf_section_alloc(autofree, NULL, "server", "state_test");
+	rad_assert(server_cs != NULL);
+
+	/*
+	 *	Entries live for one second.
+	 */
+	state = fr_state_tree_init(autofree, num, 1);
+	rad_assert(state != NULL);
+
+	/*
+	 *	Fill the tree.  Nobody ever comes back for these
+	 *	sessions, so they all go stale.
+	 */
+	for (i = 0; i < num; i++) {
+		if (!state_save(autofree, state, server_cs)) {
+			fprintf(stderr, "Failed saving state %d of %d\n", i, num);
+			exit(1);
+		}
+	}
+
+	if (fr_state_entries_tracked(state) != (uint32_t) num) {
+		fprintf(stderr, "Expected %d entries, got %u\n", num, fr_state_entries_tracked(state));
+		exit(1);
+	}
+
+	/*
+	 *	The tree is full, and nothing has expired yet.
+	 */
+	if (state_save(autofree, state, server_cs)) {
+		fprintf(stderr, "Saved state in a full tree\n");
+		exit(1);
+	}
+
+	/*
+	 *	Wait for the entries to time out.  The next entry
+	 *	MUST clean up all of the stale ones, no matter which
+	 *	shard they're in.
+	 */
+	sleep(3);
+
+	if (!state_save(autofree, state, server_cs)) {
+		fprintf(stderr, "Failed saving state after the old entries expired\n");
+		exit(1);
+	}
+
+	if (fr_state_entries_tracked(state) != 1) {
+		fprintf(stderr, "Expected 1 entry after expiry, got %u\n", fr_state_entries_tracked(state));
+		exit(1);
+	}
+
+	if (fr_state_entries_timeout(state) != (uint64_t) num) {
+		fprintf(stderr, "Expected %d timed out entries, got %" PRIu64 "\n",
+			num, fr_state_entries_timeout(state));
+		exit(1);
+	}
+
+	if (debug_lvl) printf("OK - %d stale entries expired\n", num);
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := state_test
+
+SOURCES		:= state_test.c ../../main/state.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-util.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,271 @@
+/*
+ * trie_test.c	Tests and benchmarks for path-compressed tries
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/trie.h>
+#include <freeradius-devel/rbtree.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	One IPv4 prefix.
+ */
+typedef struct trie_test_entry_t {
+	uint32_t	addr;		//!< network byte order, masked to "prefix"
+	uint32_t	prefix;
+	bool		deleted;	//!< not in the trie
+} trie_test_entry_t;
+
+static int		debug_lvl = 0;
+
+static int entry_cmp(void const *one, void const *two)
+{
+	trie_test_entry_t const *a = one, *b = two;
+
+	return (a->addr > b->addr) - (a->addr < b->addr);
+}
+
+static uint32_t mask_addr(uint32_t addr, uint32_t prefix)
+{
+	if (!prefix) return 0;
+
+	return htonl(ntohl(addr) & (0xffffffff << (32 - prefix)));
+}
+
+/** The old way of finding clients: one rbtree per prefix length
+ *
+ */
+static trie_test_entry_t *trees_lookup(rbtree_t **trees, uint32_t addr)
+{
+	int			i;
+	trie_test_entry_t	my_entry, *found;
+
+	for (i = 32; i >= 0; i--) {
+		if (!trees[i]) continue;
+
+		my_entry.addr = mask_addr(addr, i);
+		found = rbtree_finddata(trees[i], &my_entry);
+		if (found) return found;
+	}
+
+	return NULL;
+}
+
+static uint64_t usec_since(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return ((now.tv_sec - start->tv_sec) * 1000000) + (now.tv_usec - start->tv_usec);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: trie_test [OPTS]\n");
+	fprintf(stderr, "  -l <lookups>           Number of lookups to do.\n");
+	fprintf(stderr, "  -n <prefixes>          Number of prefixes to insert.\n");
+	fprintf(stderr, "  -s <seed>              Random number seed.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+static int check(fr_trie_t *ft, rbtree_t **trees, uint32_t *addrs, int num_lookups)
+{
+	int			i;
+	trie_test_entry_t	*a, *b;
+
+	for (i = 0; i < num_lookups; i++) {
+		a = fr_trie_lookup(ft, &addrs[i], 32);
+		b = trees_lookup(trees, addrs[i]);
+
+		if (a != b) {
+			fprintf(stderr, "Lookup %d mismatch: trie %p, trees %p\n", i, a, b);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i;
+	int			num_prefixes = 1000, num_lookups = 100000;
+	unsigned int		seed = 1;
+	uint32_t		num_inserted = 0;
+	trie_test_entry_t	*entries;
+	uint32_t		*addrs;
+	rbtree_t		*trees[33];
+	fr_trie_t		*ft;
+	struct timeval		start;
+	uint64_t		trie_usec, trees_usec;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hl:n:s:x")) != EOF) switch (c) {
+		case 'l':
+			num_lookups = atoi(optarg);
+			break;
+
+		case 'n':
+			num_prefixes = atoi(optarg);
+			break;
+
+		case 's':
+			seed = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if ((num_prefixes <= 0) || (num_lookups <= 0)) usage();
+
+	srandom(seed);
+
+	memset(trees, 0, sizeof(trees));
+
+	ft = fr_trie_alloc(autofree, 32);
+	if (!ft) {
+		fprintf(stderr, "Failed creating trie: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	entries = talloc_zero_array(autofree, trie_test_entry_t, num_prefixes);
+	addrs = talloc_array(autofree, uint32_t, num_lookups);
+
+	/*
+	 *	Insert random prefixes.  Most clients are single
+	 *	hosts, with a few networks.
+	 */
+	for (i = 0; i < num_prefixes; i++) {
+		trie_test_entry_t *entry = &entries[i];
+
+		entry->prefix = ((random() & 0x03) == 0) ? 8 + (random() % 24) : 32;
+		entry->addr = mask_addr(htonl(random()), entry->prefix);
+
+		if (!trees[entry->prefix]) {
+			trees[entry->prefix] = rbtree_create(autofree, entry_cmp, NULL, 0);
+		}
+
+		/*
+		 *	Skip duplicates.
+		 */
+		if (rbtree_finddata(trees[entry->prefix], entry)) {
+			entry->deleted = true;
+			continue;
+		}
+
+		if (!rbtree_insert(trees[entry->prefix], entry)) {
+			fprintf(stderr, "Failed inserting into tree\n");
+			exit(1);
+		}
+
+		if (fr_trie_insert(ft, &entry->addr, entry->prefix, entry) < 0) {
+			fprintf(stderr, "Failed inserting into trie: %s\n", fr_strerror());
+			exit(1);
+		}
+
+		if (fr_trie_find(ft, &entry->addr, entry->prefix) != entry) {
+			fprintf(stderr, "Failed finding prefix %d\n", i);
+			exit(1);
+		}
+
+		num_inserted++;
+	}
+
+	if (fr_trie_num_elements(ft) != num_inserted) {
+		fprintf(stderr, "Wrong number of elements\n");
+		exit(1);
+	}
+
+	/*
+	 *	Look up a mix of addresses which are known to match,
+	 *	and random ones.
+	 */
+	for (i = 0; i < num_lookups; i++) {
+		if (i & 0x01) {
+			trie_test_entry_t *entry = &entries[random() % num_prefixes];
+
+			addrs[i] = entry->addr | htonl(random() & ~ntohl(mask_addr(0xffffffff, entry->prefix)));
+		} else {
+			addrs[i] = htonl(random());
+		}
+	}
+
+	if (check(ft, trees, addrs, num_lookups) < 0) exit(1);
+
+	/*
+	 *	Benchmark the two methods.
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_lookups; i++) (void) fr_trie_lookup(ft, &addrs[i], 32);
+	trie_usec = usec_since(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_lookups; i++) (void) trees_lookup(trees, addrs[i]);
+	trees_usec = usec_since(&start);
+
+	printf("%u prefixes, %d lookups: trie %"PRIu64"us, trees %"PRIu64"us\n",
+	       fr_trie_num_elements(ft), num_lookups, trie_usec, trees_usec);
+
+	/*
+	 *	Delete every other prefix, and check again.
+	 */
+	for (i = 0; i < num_prefixes; i += 2) {
+		trie_test_entry_t *entry = &entries[i];
+
+		if (entry->deleted) continue;
+
+		if (fr_trie_remove(ft, &entry->addr, entry->prefix) != entry) {
+			fprintf(stderr, "Failed removing prefix %d\n", i);
+			exit(1);
+		}
+
+		rbtree_deletebydata(trees[entry->prefix], entry);
+		entry->deleted = true;
+
+		if (fr_trie_find(ft, &entry->addr, entry->prefix) != NULL) {
+			fprintf(stderr, "Found prefix %d after removing it\n", i);
+			exit(1);
+		}
+	}
+
+	if (debug_lvl) printf("%u prefixes after deleting\n", fr_trie_num_elements(ft));
+
+	if (check(ft, trees, addrs, num_lookups) < 0) exit(1);
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := trie_test
+
+SOURCES		:= trie_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
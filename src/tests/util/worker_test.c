@@ -25,6 +25,7 @@ RCSID("$Id$")
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/io/worker.h>
 #include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/event.h>
 #include <freeradius-devel/rad_assert.h>
 
 #ifdef HAVE_GETOPT_H
@@ -34,11 +35,8 @@ RCSID("$Id$")
 #include <pthread.h>
 #include <signal.h>
 
-#include <sys/event.h>
-
 #define MAX_MESSAGES		(2048)
 #define MAX_CONTROL_PLANE	(1024)
-#define MAX_KEVENTS		(10)
 #define MAX_WORKERS		(1024)
 
 #define MPRINT1 if (debug_lvl) printf
@@ -52,7 +50,7 @@ typedef struct fr_schedule_worker_t {
 } fr_schedule_worker_t;
 
 static int		debug_lvl = 0;
-static int		kq_master;
+static fr_event_list_t	*el_master;
 static fr_atomic_queue_t *aq_master;
 static fr_control_t	*control_master;
 static int		max_messages = 10;
@@ -61,16 +59,15 @@ static int		max_outstanding = 1;
 static bool		touch_memory = false;
 static int		num_workers = 1;
 static bool		quiet = false;
+static size_t		alloc_size = 0;
+static fr_time_t	latency_total = 0;
+static fr_time_t	latency_max = 0;
+static uint64_t		latency_count = 0;
 static fr_schedule_worker_t workers[MAX_WORKERS];
 
 /**********************************************************************/
 typedef struct rad_request REQUEST;
 
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx)
-{
-	return NULL;
-}
-
 void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request)
 {
 }
@@ -88,6 +85,7 @@ void talloc_const_free(void const *ptr)
 static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: worker_test [OPTS]\n");
+	fprintf(stderr, "  -a <bytes>             Allocate memory in each request, to size the pools from.\n");
 	fprintf(stderr, "  -c <control-plane>     Size of the control plane queue.\n");
 	fprintf(stderr, "  -m <messages>	  Send number of messages.\n");
 	fprintf(stderr, "  -o <outstanding>       Keep number of messages outstanding.\n");
@@ -99,9 +97,28 @@ static void NEVER_RETURNS usage(void)
 	exit(1);
 }
 
+/*
+ *	The master drains its control plane after servicing its event
+ *	list, so all the user event has to do is wake it up.
+ */
+static void master_signal(UNUSED fr_event_list_t *el, UNUSED void *uctx)
+{
+}
+
 static fr_io_final_t test_process(REQUEST *request, fr_io_action_t action)
 {
 	MPRINT1("\t\tPROCESS --- request %"PRIu64" action %d\n", request->number, action);
+
+	/*
+	 *	Use some memory, so that the worker has a footprint
+	 *	to size its pools from.  One request in two hundred
+	 *	uses much more than the others, which is less than
+	 *	the 1% the pools are allowed to overflow.
+	 */
+	if (alloc_size) {
+		(void) talloc_zero_size(request, (request->number % 200) ? alloc_size : (alloc_size * 16));
+	}
+
 	return FR_IO_REPLY;
 }
 
@@ -190,6 +207,23 @@ static void *worker_thread(void *arg)
 }
 
 
+/** Record how long a message took to go from the master, through a worker, and back
+ *
+ *  This is mostly the time taken to wake up the worker, and then the
+ *  master, so it can be used to compare event loop backends.
+ */
+static void reply_latency(fr_channel_data_t const *reply, fr_time_t now)
+{
+	fr_time_t latency;
+
+	if (now < reply->reply.request_time) return;
+
+	latency = now - reply->reply.request_time;
+	latency_total += latency;
+	if (latency > latency_max) latency_max = latency;
+	latency_count++;
+}
+
 static void master_process(void)
 {
 	bool			running, signaled_close;
@@ -203,7 +237,6 @@ static void master_process(void)
 	pthread_attr_t		attr;
 	fr_schedule_worker_t	*sw;
 	fr_listen_t		listen = { .app_io = &app_io };
-	struct kevent		events[MAX_KEVENTS];
 
 	ctx = talloc_init("master");
 	if (!ctx) _exit(1);
@@ -316,6 +349,7 @@ static void master_process(void)
 
 			rad_assert(rcode == 0);
 			if (reply) {
+				reply_latency(reply, fr_time());
 				num_replies++;
 				num_outstanding--;
 				MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
@@ -350,13 +384,11 @@ check_close:
 		MPRINT1("Master waiting on events.\n");
 		rad_assert(num_messages <= max_messages);
 
-		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, NULL);
-		MPRINT1("Master kevent returned %d\n", num_events);
+		num_events = fr_event_corral(el_master, true);
+		MPRINT1("Master event corral returned %d\n", num_events);
 
 		if (num_events < 0) {
-			if (errno == EINTR) continue;
-
-			fprintf(stderr, "Failed waiting for kevent: %s\n", strerror(errno));
+			fprintf(stderr, "Failed waiting for events: %s\n", fr_strerror());
 			exit(1);
 		}
 
@@ -367,8 +399,10 @@ check_close:
 		 *
 		 *	@todo this should NOT take a channel pointer
 		 */
+		fr_event_service(el_master);
+
 		for (i = 0; i < num_events; i++) {
-			(void) fr_channel_service_kevent(workers[0].ch, control_master, &events[i]);
+			(void) fr_channel_service_kevent(workers[0].ch, control_master);
 		}
 
 		now = fr_time();
@@ -399,6 +433,7 @@ check_close:
 				}
 
 				do {
+					reply_latency(reply, now);
 					num_replies++;
 					num_outstanding--;
 					MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
@@ -441,6 +476,11 @@ check_close:
 
 	MPRINT1("Master exiting.\n");
 
+	if (!quiet && latency_count) {
+		printf("Round trip latency mean %" PRIu64 "ns max %" PRIu64 "ns over %" PRIu64 " replies\n",
+		       latency_total / latency_count, latency_max, latency_count);
+	}
+
 	fr_time_t last_checked = fr_time();
 
 	/*
@@ -488,6 +528,7 @@ static void sig_ignore(int sig)
 int main(int argc, char *argv[])
 {
 	int c;
+	uintptr_t	ident;
 	TALLOC_CTX	*autofree = talloc_init("main");
 
 	if (fr_time_start() < 0) {
@@ -497,11 +538,15 @@ int main(int argc, char *argv[])
 
 	fr_log_init(&default_log, false);
 
-	while ((c = getopt(argc, argv, "c:hm:o:qtw:x")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "a:c:hm:o:qtw:x")) != EOF) switch (c) {
 		case 'x':
 			debug_lvl++;
 			break;
 
+		case 'a':
+			alloc_size = atoi(optarg);
+			break;
+
 		case 'c':
 			max_control_plane = atoi(optarg);
 			break;
@@ -545,13 +590,16 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
-	kq_master = kqueue();
-	rad_assert(kq_master >= 0);
+	el_master = fr_event_list_alloc(autofree, NULL, NULL);
+	rad_assert(el_master != NULL);
+
+	ident = fr_event_user_insert(el_master, master_signal, NULL);
+	rad_assert(ident != 0);
 
 	aq_master = fr_atomic_queue_create(autofree, max_control_plane);
 	rad_assert(aq_master != NULL);
 
-	control_master = fr_control_create(autofree, kq_master, aq_master, 1024);
+	control_master = fr_control_create(autofree, fr_event_list_kq(el_master), aq_master, ident);
 	rad_assert(control_master != NULL);
 
 	signal(SIGTERM, sig_ignore);
@@ -562,8 +610,6 @@ int main(int argc, char *argv[])
 
 	master_process();
 
-	close(kq_master);
-
 	talloc_free(autofree);
 
 	return 0;
@@ -53,6 +53,19 @@ tests.xlat: $(TESTS.XLAT_FILES)
 
 $(TESTS.XLAT_FILES): $(TESTS.UNIT_FILES)
 
+#
+#  Benchmark runtime expansions, using the xlat tests as input.
+#
+#	make tests.xlat.bench BENCH_ITERATIONS=100000
+#
+BENCH_ITERATIONS ?= 10000
+
+.PHONY: tests.xlat.bench
+tests.xlat.bench: $(TESTS.XLAT_FILES)
+	${Q}for x in $(XLAT_FILES); do \
+		$(TESTBIN)/unit_test_module -D share -d src/tests/xlat/ -i src/tests/xlat/$$x -O xlat_only -b $(BENCH_ITERATIONS) || exit 1; \
+	done
+
 .PHONY: clean.tests.xlat
 clean.tests.xlat:
 	${Q}rm -rf $(BUILD_DIR)/tests/xlat/